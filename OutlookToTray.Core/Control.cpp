@@ -0,0 +1,149 @@
+/*
+ * Outlook to Tray - Control
+ */
+
+#include "Control.h"
+#include "Targets.h"
+#include "TrayCore.h"
+#include "Os.h"
+#include <wchar.h>
+
+static BOOL IsSpace(wchar_t c) {
+    return c == L' ' || c == L'\t' || c == L'\r' || c == L'\n';
+}
+
+// Rule named by 'app' (its name or its process), or -1
+static int FindRuleByName(const RuleTable* pRules, const wchar_t* app) {
+    for (int i = 0; i < pRules->count; i++) {
+        if (NameEqualsNoCase(pRules->rules[i].name, app) || NameEqualsNoCase(pRules->rules[i].image, app)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Parse a request: the verb, then for hide and restore the rest of the line as the app
+BOOL ParseControlCommand(const wchar_t* request, const RuleTable* pRules, ControlCommand* pCommand,
+                         wchar_t* error, int errorSize) {
+    static const wchar_t* const VERBS[] = { L"hide", L"restore", L"status", L"stats" };
+    RuleTable defaultRules;
+    if (pRules->count == 0) {
+        DefaultRuleTable(&defaultRules);    // Nothing published yet
+        pRules = &defaultRules;
+    }
+
+    wchar_t verb[16];
+    wchar_t app[CONTROL_MAX_REQUEST];
+    const wchar_t* p = request;
+    while (IsSpace(*p)) p++;
+    int length = 0;
+    while (*p && !IsSpace(*p) && length < 15) verb[length++] = *p++;
+    verb[length] = L'\0';
+    while (IsSpace(*p)) p++;
+    length = 0;
+    while (*p && length < CONTROL_MAX_REQUEST - 1) app[length++] = *p++;
+    while (length > 0 && IsSpace(app[length - 1])) length--;
+    app[length] = L'\0';
+
+    pCommand->verb = -1;
+    for (int i = 0; i < (int)(sizeof(VERBS) / sizeof(VERBS[0])); i++) {
+        if (NameEqualsNoCase(verb, VERBS[i])) {
+            pCommand->verb = i;
+        }
+    }
+    pCommand->rule = -1;
+    if (pCommand->verb < 0) {
+        swprintf(error, errorSize, L"error unknown command '%ls'; try hide, restore, status or stats", verb);
+        return FALSE;
+    }
+    if (app[0] == L'\0') {
+        return TRUE;
+    }
+    if (pCommand->verb != CONTROL_HIDE && pCommand->verb != CONTROL_RESTORE) {
+        swprintf(error, errorSize, L"error %ls takes no app", VERBS[pCommand->verb]);
+        return FALSE;
+    }
+    pCommand->rule = FindRuleByName(pRules, app);
+    if (pCommand->rule < 0) {
+        swprintf(error, errorSize, L"error unknown app '%ls'", app);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// On screen, and not parked or cloaked by an earlier hide
+static BOOL IsShownWindow(HWND hwnd) {
+    RECT rect;
+    return OsGetWindowOwner(hwnd) == NULL && OsIsWindowVisible(hwnd) && OsGetWindowRect(hwnd, &rect) &&
+           rect.left > -30000 && !OsIsWindowCloaked(hwnd);
+}
+
+// Ask the app's on-screen windows on the given threads to hide; the hook does it
+// The rule of a thread is looked up from its first window's process, once
+int RequestHideWindows(const RuleTable* pRules, int rule, const DWORD* threadIds, int threadCount) {
+    int requested = 0;
+    for (int t = 0; t < threadCount; t++) {
+        HWND windows[MAX_THREAD_WINDOWS];
+        int count = OsGetThreadWindows(threadIds[t], windows, MAX_THREAD_WINDOWS);
+        const TargetRule* pRule = NULL;
+        for (int i = 0; i < count; i++) {
+            HWND hwnd = windows[i];
+            if (!pRule) {
+                wchar_t path[MAX_PATH];
+                int match = OsGetProcessImageName(OsGetWindowProcessId(hwnd), path, MAX_PATH)
+                                ? MatchRule(pRules, path) : -1;
+                if (match < 0 || (rule >= 0 && match != rule)) {
+                    break;
+                }
+                pRule = &pRules->rules[match];
+            }
+            wchar_t className[MAX_WINDOW_CLASS];
+            if (!IsShownWindow(hwnd) ||
+                (pRule->windowClass[0] && !(OsGetWindowClassName(hwnd, className, MAX_WINDOW_CLASS) &&
+                                            NameEqualsNoCase(className, pRule->windowClass)))) {
+                continue;
+            }
+            if (OsRequestHide(hwnd)) {
+                requested++;
+            }
+        }
+    }
+    return requested;
+}
+
+// App names may hold spaces; in a reply they become underscores
+static void AppendName(wchar_t* text, int size, int* pLength, const wchar_t* name) {
+    for (const wchar_t* p = name; *p; p++) {
+        AppendText(text, size, pLength, L"%lc", IsSpace(*p) ? L'_' : *p);
+    }
+}
+
+// Reply to status
+int FormatControlStatus(const ControlStatus* pStatus, const RuleTable* pRules, wchar_t* text, int size) {
+    int length = 0;
+    text[0] = L'\0';
+    AppendText(text, size, &length, L"ok outlook=%ls pid=%lu unread=%d hidden=%d",
+               pStatus->outlookRunning ? L"running" : L"stopped", (unsigned long)pStatus->outlookPid,
+               pStatus->unreadCount, pStatus->hiddenCount);
+    for (int i = 0; i < pRules->count; i++) {
+        AppendText(text, size, &length, L" hidden.");
+        AppendName(text, size, &length, pRules->rules[i].name);
+        AppendText(text, size, &length, L"=%d", pStatus->hiddenByRule[i]);
+    }
+    AppendText(text, size, &length, L" hook=%ls lean=%d",
+               pStatus->targetedHook ? L"targeted" : L"global", pStatus->lean ? 1 : 0);
+    return length;
+}
+
+// Reply to stats
+int FormatControlStats(const ControlStats* pStats, wchar_t* text, int size) {
+    int length = 0;
+    text[0] = L'\0';
+    AppendText(text, size, &length, L"ok processes=%d messages=%llu handled=%llu subclassed=%llu hides=%llu "
+               L"restores=%llu stalls=%llu maxstallus=%llu logwritten=%llu loglost=%llu wakeups=%ld logwakeups=%ld",
+               pStats->processes, pStats->hooks.messagesSeen, pStats->hooks.outlookMessages,
+               pStats->hooks.subclassInstalls, pStats->hooks.hides, pStats->hooks.restores, pStats->stalls,
+               pStats->maxStallUs, pStats->logWritten, pStats->logLost, (long)pStats->monitorWakeups,
+               (long)pStats->logWakeups);
+    return length;
+}
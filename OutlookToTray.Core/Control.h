@@ -0,0 +1,86 @@
+/*
+ * Outlook to Tray - Control
+ * The commands scripts send to the tray over its named pipe, one per pipe
+ * message, each answered by one message (UTF-16 text):
+ *   hide [app]      Hide the app's windows that are on screen
+ *   restore [app]   Restore the app's hidden windows
+ *   status          Outlook running, unread count, hidden windows per app
+ *   stats           Hook counters, message loop stalls, log records
+ * Without an app, hide and restore act on every app. A reply starts with
+ * "ok" or "error", followed by name=value pairs.
+ */
+
+#ifndef OUTLOOKTOTRAY_CONTROL_H
+#define OUTLOOKTOTRAY_CONTROL_H
+
+#include "Platform.h"
+#include "SharedState.h"
+#include "HookStats.h"
+#include <wchar.h>
+
+// Pipe of a session: the prefix and the session id
+// Pipes have no per-session namespace, so the id keeps users on a terminal server apart
+#define CONTROL_PIPE_PREFIX L"\\\\.\\pipe\\OutlookToTray.Control."
+#define CONTROL_MAX_REQUEST 128     // Characters, including the terminator
+#define CONTROL_MAX_REPLY   512
+
+enum ControlVerb {
+    CONTROL_HIDE,
+    CONTROL_RESTORE,
+    CONTROL_STATUS,
+    CONTROL_STATS
+};
+
+struct ControlCommand {
+    int verb;                   // ControlVerb
+    int rule;                   // Hide and restore: the app's rule, or -1 for every app
+};
+
+// The tray's state as the pipe server answers from it, published by the UI thread
+struct ControlStatus {
+    BOOL outlookRunning;
+    DWORD outlookPid;
+    int unreadCount;
+    int hiddenCount;
+    int hiddenByRule[MAX_TARGET_RULES];
+    BOOL targetedHook;
+    BOOL lean;
+    ULONGLONG stalls;           // Message loop stalls (see StallStats)
+    ULONGLONG maxStallUs;
+};
+
+// Counters for the stats command, gathered by the pipe server
+struct ControlStats {
+    HookStats hooks;            // Summed over every process
+    int processes;              // Processes with the DLL loaded now
+    ULONGLONG stalls;
+    ULONGLONG maxStallUs;
+    ULONGLONG logWritten;
+    ULONGLONG logLost;
+    LONG monitorWakeups;
+    LONG logWakeups;            // Log drains run
+};
+
+// Name of the control pipe of a session (inline: the client needs nothing else from here)
+inline void ControlPipeName(DWORD sessionId, wchar_t* name, int size) {
+    swprintf(name, size, L"%ls%lu", CONTROL_PIPE_PREFIX, (unsigned long)sessionId);
+}
+
+// Parse a request against the rules; an app is named by its rule name or process
+// FALSE (with the reason in 'error') for an unknown verb or app
+BOOL ParseControlCommand(const wchar_t* request, const RuleTable* pRules, ControlCommand* pCommand,
+                         wchar_t* error, int errorSize);
+
+// Send HIDE_WINDOW_MESSAGE to every on-screen window of the app ('rule', -1 for
+// every app) on the given UI threads, without waiting; the hook hides it as on a
+// close. Only windows the hook would hide are asked: unowned, of the rule's class
+// if it names one. The threads should be ones the hook is confirmed on; elsewhere
+// the message is ignored and the window stays. Returns the number of windows asked.
+int RequestHideWindows(const RuleTable* pRules, int rule, const DWORD* threadIds, int threadCount);
+
+// Replies; each returns the number of characters written (a reply that does
+// not fit is cut off at the end of the buffer, still terminated)
+int FormatControlStatus(const ControlStatus* pStatus, const RuleTable* pRules, wchar_t* text, int size);
+int FormatControlStats(const ControlStats* pStats, wchar_t* text, int size);
+
+#endif // OUTLOOKTOTRAY_CONTROL_H
@@ -0,0 +1,87 @@
+/*
+ * Outlook to Tray - Footprint
+ */
+
+#include "Footprint.h"
+#include <stdarg.h>
+#include <string.h>
+#include <wchar.h>
+
+// Add a process to its session's row, inserting the row in session order
+void AddFootprintSample(FootprintReport* pReport, const FootprintSample* pSample) {
+    int i = 0;
+    while (i < pReport->sessionCount && pReport->sessions[i].sessionId < pSample->sessionId) {
+        i++;
+    }
+    if (i == pReport->sessionCount || pReport->sessions[i].sessionId != pSample->sessionId) {
+        if (pReport->sessionCount == MAX_FOOTPRINT_SESSIONS) {
+            pReport->droppedSessions++;
+            return;
+        }
+        memmove(&pReport->sessions[i + 1], &pReport->sessions[i],
+                (pReport->sessionCount - i) * sizeof(SessionFootprint));
+        memset(&pReport->sessions[i], 0, sizeof(SessionFootprint));
+        pReport->sessions[i].sessionId = pSample->sessionId;
+        pReport->sessionCount++;
+    }
+
+    SessionFootprint* pSession = &pReport->sessions[i];
+    if (!pSample->tray) {
+        pSession->hooked++;
+        return;
+    }
+    pSession->trays++;
+    pSession->threads += pSample->threads;
+    pSession->privateBytes += pSample->privateBytes;
+    pSession->cpuTime += pSample->cpuTime;
+}
+
+static void Append(wchar_t* text, int size, int* pLength, const wchar_t* format, ...) {
+    if (*pLength < 0) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int written = vswprintf(text + *pLength, size - *pLength, format, args);
+    va_end(args);
+    *pLength = written < 0 ? -1 : *pLength + written;
+}
+
+// CPU time as a share of one core over the interval
+static double CpuPercent(const FootprintReport* pReport, ULONGLONG cpuTime) {
+    return pReport->interval ? 100.0 * (double)cpuTime / (double)pReport->interval : 0.0;
+}
+
+// One row per session and the totals per host and per session, as text
+// Per session is over the sessions running a tray, the figure to size a server by
+int FormatFootprint(const FootprintReport* pReport, wchar_t* text, int size) {
+    int length = 0;
+    Append(text, size, &length, L"%8ls %6ls %7ls %8ls %12ls %8ls\n",
+           L"Session", L"Trays", L"Hooked", L"Threads", L"Private KB", L"CPU %");
+    SessionFootprint total = {};
+    int traySessions = 0;
+    for (int i = 0; i < pReport->sessionCount; i++) {
+        const SessionFootprint* pSession = &pReport->sessions[i];
+        Append(text, size, &length, L"%8u %6d %7d %8u %12llu %8.3f\n", pSession->sessionId, pSession->trays,
+               pSession->hooked, pSession->threads, pSession->privateBytes / 1024,
+               CpuPercent(pReport, pSession->cpuTime));
+        total.trays += pSession->trays;
+        total.hooked += pSession->hooked;
+        total.threads += pSession->threads;
+        total.privateBytes += pSession->privateBytes;
+        total.cpuTime += pSession->cpuTime;
+        traySessions += pSession->trays > 0;
+    }
+    if (pReport->droppedSessions) {
+        Append(text, size, &length, L"%d more session(s) not counted\n", pReport->droppedSessions);
+    }
+    Append(text, size, &length, L"Host: %d tray(s) in %d session(s), %d hooked process(es), "
+           L"%llu KB private, %.3f%% of one core over %.1f s\n", total.trays, traySessions, total.hooked,
+           total.privateBytes / 1024, CpuPercent(pReport, total.cpuTime), pReport->interval / 1e7);
+    if (traySessions > 0) {
+        Append(text, size, &length, L"Per session: %llu KB private, %.1f thread(s), %.1f hooked process(es), "
+               L"%.3f%% of one core\n", total.privateBytes / 1024 / traySessions, (double)total.threads / traySessions,
+               (double)total.hooked / traySessions, CpuPercent(pReport, total.cpuTime) / traySessions);
+    }
+    return length < 0 ? 0 : length;
+}
@@ -0,0 +1,47 @@
+/*
+ * Outlook to Tray - Footprint
+ * Per-session totals of what the tray costs a terminal server: the tray
+ * processes' private bytes, threads and CPU, and how many processes have
+ * the hook DLL loaded. Sampled by OutlookToTray.Footprint.exe.
+ */
+
+#ifndef OUTLOOKTOTRAY_FOOTPRINT_H
+#define OUTLOOKTOTRAY_FOOTPRINT_H
+
+#include "Platform.h"
+
+#define MAX_FOOTPRINT_SESSIONS 1024     // Sessions beyond this are only counted
+
+// One process as sampled
+struct FootprintSample {
+    DWORD sessionId;
+    BOOL tray;                  // OutlookToTray.exe; otherwise a process with the DLL loaded
+    DWORD threads;              // Tray only, like the fields below
+    ULONGLONG privateBytes;
+    ULONGLONG cpuTime;          // Over the interval, 100 ns units
+};
+
+struct SessionFootprint {
+    DWORD sessionId;
+    int trays;
+    int hooked;                 // Other processes with the DLL loaded
+    DWORD threads;              // Of the trays
+    ULONGLONG privateBytes;
+    ULONGLONG cpuTime;
+};
+
+struct FootprintReport {
+    ULONGLONG interval;         // Of the CPU samples, 100 ns units
+    int sessionCount;
+    int droppedSessions;        // Beyond MAX_FOOTPRINT_SESSIONS
+    SessionFootprint sessions[MAX_FOOTPRINT_SESSIONS];     // By session id
+};
+
+// Add a process to its session's row
+void AddFootprintSample(FootprintReport* pReport, const FootprintSample* pSample);
+
+// One row per session and the totals per host and per session, as text;
+// returns the number of characters written
+int FormatFootprint(const FootprintReport* pReport, wchar_t* text, int size);
+
+#endif // OUTLOOKTOTRAY_FOOTPRINT_H
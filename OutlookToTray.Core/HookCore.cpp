@@ -0,0 +1,311 @@
+/*
+ * Outlook to Tray - Hook Logic
+ * Which windows to subclass, and how a subclassed window hides on close
+ */
+
+#include "HookCore.h"
+#include "Os.h"
+#include "Targets.h"
+
+// Decide once per process whether the hook has anything to do here
+// Hooked windows always belong to the process the DLL is loaded into, so the
+// matching rule is looked up here and never per message
+void HookInitProcess(HookState* pState, SharedData* pData) {
+    HookSettings settings = {};
+    if (pData) {
+        ReadHookSettings(pData, &settings);
+    }
+    if (settings.rules.count == 0) {
+        DefaultRuleTable(&settings.rules);     // Nothing published yet
+    }
+    wchar_t path[MAX_PATH];
+    pState->rule = OsGetModuleImageName(path, MAX_PATH) ? MatchRule(&settings.rules, path) : -1;
+    pState->isTargetProcess = pState->rule >= 0;
+    pState->ruleHideMode = HIDE_DEFAULT;
+    pState->windowClass[0] = L'\0';
+    if (pState->isTargetProcess) {
+        const TargetRule* pRule = &settings.rules.rules[pState->rule];
+        pState->ruleHideMode = pRule->hideMode;
+        for (int i = 0; i < MAX_WINDOW_CLASS; i++) {
+            pState->windowClass[i] = pRule->windowClass[i];
+        }
+        pState->windowClass[MAX_WINDOW_CLASS - 1] = L'\0';
+    }
+    pState->stats = ClaimHookStats(pData, OsGetCurrentProcessId(), OsGetCurrentProcessStartTime());
+    pState->log = pData ? &pData->log : NULL;
+    pState->traceControl = pData ? &pData->traceSession : NULL;
+    pState->traceSession = 0;
+    pState->trace = NULL;
+    pState->restoreMessage = pState->isTargetProcess ? OsRegisterMessage(RESTORE_WINDOW_MESSAGE) : 0;
+    pState->hideMessage = pState->isTargetProcess ? OsRegisterMessage(HIDE_WINDOW_MESSAGE) : 0;
+    pState->paintWindow = NULL;
+    if (pState->isTargetProcess) {
+        LOG_INFO(pState->log, LOG_HOOK_ATTACHED, pState->rule);
+    }
+}
+
+// The DLL is unloading: hand this process's counters over to the totals
+void HookExitProcess(HookState* pState, SharedData* pData) {
+    RetireHookStats(pData, pState->stats);
+    pState->stats = ClaimHookStats(NULL, 0, 0);
+    pState->traceControl = NULL;
+    pState->trace = NULL;
+    if (pState->traceView) {
+        OsUnmapSharedMemory(pState->traceView, pState->hTraceMapping);
+        pState->traceView = NULL;
+        pState->hTraceMapping = NULL;
+    }
+    if (pState->retiredView) {
+        OsUnmapSharedMemory(pState->retiredView, pState->hRetiredMapping);
+        pState->retiredView = NULL;
+        pState->hRetiredMapping = NULL;
+    }
+}
+
+// A message capture started or stopped: join it or stop recording
+// Several UI threads may get here at once; the compare-exchange lets one switch.
+// Other threads may still be writing to the old view, so it is unmapped at once
+// only when this process saw the old capture stop before the new one started (a
+// user's click apart). Otherwise it is retired, and unmapped a capture later.
+void HookFollowTrace(HookState* pState) {
+    LONG seen = pState->traceSession;
+    LONG session = *pState->traceControl;
+    if (session == seen || InterlockedCompareExchange(&pState->traceSession, session, seen) != seen) {
+        return;
+    }
+    BOOL sawStop = pState->trace == NULL;
+    pState->trace = NULL;
+    if (session == 0) {
+        return;
+    }
+    if (pState->retiredView) {
+        OsUnmapSharedMemory(pState->retiredView, pState->hRetiredMapping);
+        pState->retiredView = NULL;
+        pState->hRetiredMapping = NULL;
+    }
+    if (pState->traceView && sawStop) {
+        OsUnmapSharedMemory(pState->traceView, pState->hTraceMapping);
+    }
+    else if (pState->traceView) {
+        pState->retiredView = pState->traceView;
+        pState->hRetiredMapping = pState->hTraceMapping;
+    }
+    pState->traceView = NULL;
+    pState->hTraceMapping = NULL;
+
+    wchar_t name[64];
+    TraceMappingName(session, name, 64);
+    HANDLE hMapping;
+    TraceHeader* pTrace = (TraceHeader*)OsOpenSharedMemory(name, &hMapping);
+    if (!pTrace) {
+        return;     // Stopped again already
+    }
+    if (!IsTraceHeader(pTrace, sizeof(TraceHeader))) {
+        OsUnmapSharedMemory(pTrace, hMapping);
+        return;
+    }
+    wchar_t path[MAX_PATH];
+    pState->traceProcess = TraceAddProcess(pTrace, OsGetCurrentProcessId(),
+                                           OsGetModuleImageName(path, MAX_PATH) ? ImageBaseName(path) : L"?");
+    pState->traceView = pTrace;
+    pState->hTraceMapping = hMapping;
+    pState->trace = pTrace;
+}
+
+// Unowned top-level window, of the rule's class if it names one
+static BOOL IsSelectedWindow(const HookState* pState, HWND hwnd) {
+    if (OsGetWindowOwner(hwnd) != NULL) {
+        return FALSE;
+    }
+    if (pState->windowClass[0] == L'\0') {
+        return TRUE;
+    }
+    wchar_t className[MAX_WINDOW_CLASS];
+    return OsGetWindowClassName(hwnd, className, MAX_WINDOW_CLASS) &&
+           NameEqualsNoCase(className, pState->windowClass);
+}
+
+// Look up (or fill) the cached selection verdict for a window
+static WindowCacheEntry* GetWindowCacheEntry(HookState* pState, HWND hwnd) {
+    UINT_PTR slot = ((UINT_PTR)hwnd >> 4) & (WINDOW_CACHE_SIZE - 1);
+    WindowCacheEntry* pEntry = &pState->windowCache[slot];
+    if (pEntry->hwnd != hwnd) {
+        pEntry->hwnd = hwnd;
+        pEntry->selected = IsSelectedWindow(pState, hwnd);
+        pEntry->subclassed = FALSE;
+    }
+    return pEntry;
+}
+
+// Drop a destroyed window from the cache (handles can be reused)
+static void EvictWindowCacheEntry(HookState* pState, HWND hwnd) {
+    UINT_PTR slot = ((UINT_PTR)hwnd >> 4) & (WINDOW_CACHE_SIZE - 1);
+    if (pState->windowCache[slot].hwnd == hwnd) {
+        pState->windowCache[slot].hwnd = NULL;
+    }
+}
+
+// Target-process part of the hook
+HookDecision HookOnMessage(HookState* pState, HWND hwnd, UINT message, WPARAM wParam) {
+    if (message == WM_NCDESTROY) {
+        EvictWindowCacheEntry(pState, hwnd);
+        return HOOK_CACHE_EVICTED;
+    }
+
+    // Subclass on first WM_CLOSE or when window becomes visible, on a hide request,
+    // or on a restore request for a window hidden before this process had the hook
+    // (adopted by a restarted tray); the new subclass then handles the request itself
+    if (message != WM_CLOSE && message != pState->restoreMessage && message != pState->hideMessage &&
+        !(message == WM_SHOWWINDOW && wParam == TRUE)) {
+        return HOOK_IGNORED;
+    }
+    WindowCacheEntry* pEntry = GetWindowCacheEntry(pState, hwnd);
+    if (pEntry->subclassed || !pEntry->selected || !OsIsWindowVisible(hwnd)) {
+        return HOOK_CHECKED;
+    }
+    pEntry->subclassed = OsSubclassWindow(hwnd);
+    if (!pEntry->subclassed) {
+        LOG_WARNING(pState->log, LOG_SUBCLASS_FAILED, (UINT_PTR)hwnd);
+        return HOOK_SUBCLASS_FAILED;
+    }
+    pState->stats->subclassInstalls++;
+    LOG_DEBUG(pState->log, LOG_WINDOW_SUBCLASSED, (UINT_PTR)hwnd);
+    return HOOK_SUBCLASSED;
+}
+
+// Hide a window (off-screen or cloaked), saving how to bring it back
+// Only window calls: the caller records the result under the entry's seqlock
+static void HideWindow(HWND hwnd, LONG hideMode, RECT* pRect, LONG* pExStyle, BOOL* pCloaked) {
+    // Save original position
+    OsGetWindowRect(hwnd, pRect);
+
+    // Save original extended style and hide from taskbar
+    *pExStyle = OsGetWindowExStyle(hwnd);
+    OsSetWindowExStyle(hwnd, (*pExStyle | WS_EX_TOOLWINDOW) & ~WS_EX_APPWINDOW);
+
+    // Cloak or move off-screen instead of hiding it completely
+    // This allows notifications to still work (SW_HIDE suppresses them)
+    *pCloaked = hideMode == HIDE_CLOAK && OsCloakWindow(hwnd, TRUE);
+    if (!*pCloaked) {
+        OsMoveWindow(hwnd, -32000, -32000, FALSE);
+    }
+}
+
+// Hide a selected window and record it; FALSE (window untouched) if the table is full
+// A slot is claimed before the window is touched; the entry is not held across
+// the window calls, which send messages of their own. The claim already names
+// this process, so ReleaseProcessWindows frees the slot if it dies before publishing.
+static BOOL HideToTray(HookState* pState, SharedData* pData, HWND hwnd) {
+    WindowEntry* pEntry = LockWindowEntry(pData, hwnd, TRUE);
+    if (!pEntry) {
+        return FALSE;
+    }
+    BOOL hidden = (pEntry->flags & ENTRY_HIDDEN) != 0;
+    if (!hidden) {
+        pEntry->processId = OsGetCurrentProcessId();
+        pEntry->hiddenTick = OsGetTickCount64();
+    }
+    EndEntryWrite(pData, pEntry);
+    if (hidden) {
+        return TRUE;    // Already hidden: nothing to save, just keep blocking the close
+    }
+
+    LONG hideMode = pState->ruleHideMode != HIDE_DEFAULT ? pState->ruleHideMode : pData->settings.hideMode;
+    RECT rect;
+    LONG exStyle;
+    BOOL cloaked;
+    HideWindow(hwnd, hideMode, &rect, &exStyle, &cloaked);
+
+    // The tray may have freed the claimed slot meanwhile; if no other is left, undo
+    pEntry = LockWindowEntry(pData, hwnd, TRUE);
+    if (!pEntry) {
+        OsRestoreWindow(hwnd, exStyle, &rect, cloaked);
+        return FALSE;
+    }
+    pEntry->originalRect = rect;
+    pEntry->originalExStyle = exStyle;
+    pEntry->processId = OsGetCurrentProcessId();
+    pEntry->hiddenTick = OsGetTickCount64();
+    pEntry->rule = pState->rule;
+    pEntry->flags = ENTRY_HIDDEN | (cloaked ? ENTRY_CLOAKED : 0);
+    EndEntryWrite(pData, pEntry);
+
+    pState->stats->hides++;
+    LOG_INFO(pState->log, LOG_WINDOW_HIDDEN, (UINT_PTR)hwnd, pState->rule, cloaked);
+    NotifyTray(pData, TRAY_NOTIFY_WINDOW_HIDDEN, hwnd);
+    return TRUE;
+}
+
+// Restore requested by the tray: undo HideWindow on the window's own thread
+// and acknowledge through the usual restored notification
+static void RestoreInProcess(HookState* pState, SharedData* pData, HWND hwnd, BOOL prewarmed,
+                             LPARAM requestTicks) {
+    WindowEntry* pEntry = pData ? LockWindowEntry(pData, hwnd, FALSE) : NULL;
+    if (!pEntry) {
+        return;     // Not hidden (restored already, or never hidden)
+    }
+    RECT rect = pEntry->originalRect;
+    LONG exStyle = pEntry->originalExStyle;
+    BOOL cloaked = (pEntry->flags & ENTRY_CLOAKED) != 0;
+    ReleaseWindowEntry(pData, pEntry);
+
+    OsRestoreWindow(hwnd, exStyle, &rect, cloaked);
+
+    // The click time arrives truncated to pointer size; the difference is exact
+    UINT_PTR elapsed = 0;
+    if (requestTicks) {
+        elapsed = (UINT_PTR)OsQueryPerformanceCounter() - (UINT_PTR)requestTicks;
+        RecordRestoreTime(cloaked ? &pState->stats->cloakedRestore : &pState->stats->inProcessRestore,
+                          (LONGLONG)elapsed);
+        pState->paintWindow = hwnd;
+        pState->paintClickTicks = (UINT_PTR)requestTicks;
+        pState->paintPrewarmed = prewarmed;
+    }
+    LOG_INFO(pState->log, LOG_WINDOW_RESTORED, (UINT_PTR)hwnd, cloaked, elapsed);
+    pState->stats->restores++;
+    NotifyTray(pData, TRAY_NOTIFY_WINDOW_RESTORED, hwnd);
+}
+
+// Subclass procedure logic; TRUE means the message is swallowed
+BOOL SubclassOnMessage(HookState* pState, SharedData* pData, HWND hwnd, UINT message,
+                       WPARAM wParam, LPARAM lParam) {
+    if (message == pState->restoreMessage && message != 0) {
+        RestoreInProcess(pState, pData, hwnd, wParam != 0, lParam);
+        return TRUE;
+    }
+    if (message == WM_PAINT && hwnd == pState->paintWindow) {
+        // First frame after the restore: how long the user looked at a stale one
+        UINT_PTR elapsed = (UINT_PTR)OsQueryPerformanceCounter() - pState->paintClickTicks;
+        RecordRestoreTime(&pState->stats->firstPaint[pState->paintPrewarmed ? 1 : 0], (LONGLONG)elapsed);
+        pState->paintWindow = NULL;
+        return FALSE;
+    }
+    if (message == pState->hideMessage && message != 0) {
+        // Asked by the tray; never a close, so a full table leaves the window shown
+        if (pData && !HideToTray(pState, pData, hwnd)) {
+            LOG_WARNING(pState->log, LOG_TABLE_FULL, (UINT_PTR)hwnd);
+        }
+        return TRUE;
+    }
+    if (message == WM_CLOSE) {
+        if (pData && HideToTray(pState, pData, hwnd)) {
+            return TRUE;  // Block the close
+        }
+        // No room to remember the window: let it close rather than lose it
+        LOG_WARNING(pState->log, LOG_TABLE_FULL, (UINT_PTR)hwnd);
+    }
+    else if (message == WM_DESTROY) {
+        WindowEntry* pEntry = pData ? LockWindowEntry(pData, hwnd, FALSE) : NULL;
+        if (pEntry) {
+            ReleaseWindowEntry(pData, pEntry);
+            LOG_INFO(pState->log, LOG_WINDOW_DESTROYED, (UINT_PTR)hwnd);
+            NotifyTray(pData, TRAY_NOTIFY_WINDOW_DESTROYED, hwnd);
+        }
+        GetWindowCacheEntry(pState, hwnd)->subclassed = FALSE;
+        if (hwnd == pState->paintWindow) {
+            pState->paintWindow = NULL;
+        }
+        OsRemoveSubclass(hwnd);
+    }
+    return FALSE;
+}
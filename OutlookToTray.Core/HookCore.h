@@ -0,0 +1,94 @@
+/*
+ * Outlook to Tray - Hook Logic
+ * Decisions made by the hook DLL inside each process it is loaded into
+ */
+
+#ifndef OUTLOOKTOTRAY_HOOKCORE_H
+#define OUTLOOKTOTRAY_HOOKCORE_H
+
+#include "Platform.h"
+#include "SharedState.h"
+#include "HookStats.h"
+#include "Trace.h"
+#include "Os.h"
+
+// Per-HWND classification cache (only used inside target processes)
+#define WINDOW_CACHE_SIZE 64    // Power of two
+
+struct WindowCacheEntry {
+    HWND hwnd;
+    BOOL selected;          // Unowned top-level window of a class the rule accepts
+    BOOL subclassed;
+};
+
+// Hook state, one per process that loaded the DLL
+struct HookState {
+    BOOL isTargetProcess;   // Matches a target rule; decided once when the DLL is loaded
+    int rule;               // Index of that rule, -1 elsewhere
+    LONG ruleHideMode;      // The rule's HideMode, or HIDE_DEFAULT for the setting
+    wchar_t windowClass[MAX_WINDOW_CLASS];  // The rule's window class; empty means any
+    HookStats* stats;       // This process's counters (never NULL after init)
+    LogRing* log;           // In the shared mapping; NULL without it
+    UINT restoreMessage;    // RESTORE_WINDOW_MESSAGE inside target processes, 0 elsewhere
+    UINT hideMessage;       // HIDE_WINDOW_MESSAGE, likewise
+    HWND paintWindow;       // Restored in-process, first WM_PAINT not seen yet
+    UINT_PTR paintClickTicks;   // Its click time, as the restore request carried it
+    BOOL paintPrewarmed;
+    const volatile LONG* traceControl;  // SharedData::traceSession; NULL without the mapping
+    volatile LONG traceSession;         // Capture this process has followed, 0 for none
+    TraceHeader* trace;     // Its file while it runs; NULL when not capturing
+    int traceProcess;       // This process's slot in its header
+    TraceHeader* traceView; // Last capture's view, kept mapped until the next one or unload
+    HANDLE hTraceMapping;
+    TraceHeader* retiredView;   // The one before, if threads may still have been writing
+    HANDLE hRetiredMapping;     // to it; unmapped at the next switch or unload
+    WindowCacheEntry windowCache[WINDOW_CACHE_SIZE];
+};
+
+// Decide once per process whether the hook has anything to do here,
+// and claim this process's counter slot in the shared mapping
+void HookInitProcess(HookState* pState, SharedData* pData);
+
+// The DLL is unloading: hand this process's counters over to the totals
+void HookExitProcess(HookState* pState, SharedData* pData);
+
+// Target-process part of the hook
+HookDecision HookOnMessage(HookState* pState, HWND hwnd, UINT message, WPARAM wParam);
+
+// A message capture started or stopped: join it or stop recording
+void HookFollowTrace(HookState* pState);
+
+// Body of CallWndProc before CallNextHookEx
+// A call with nCode < 0 is passed on untouched: not counted, not captured.
+// Every process that matches no rule counts the message and leaves through
+// this single branch, however many rules there are; only the target path is timed.
+// While no capture runs, tracing costs one compare and one pointer test.
+inline void HookDispatch(HookState* pState, int nCode, HWND hwnd, UINT message, WPARAM wParam) {
+    if (nCode < 0) {
+        return;
+    }
+    HookStats* pStats = pState->stats;
+    pStats->messagesSeen++;
+    if (pState->traceControl && *pState->traceControl != pState->traceSession) {
+        HookFollowTrace(pState);
+    }
+    if (pState->isTargetProcess) {
+        LONGLONG start = OsQueryPerformanceCounter();
+        HookDecision decision = HookOnMessage(pState, hwnd, message, wParam);
+        LONGLONG cost = OsQueryPerformanceCounter() - start;
+        RecordHookTime(pStats, cost);
+        if (pState->trace) {
+            TraceMessage(pState->trace, pState->traceProcess, start, hwnd, message, decision, cost);
+        }
+    }
+    else if (pState->trace) {
+        TraceMessage(pState->trace, pState->traceProcess, OsQueryPerformanceCounter(), hwnd, message,
+                     HOOK_OTHER_PROCESS, 0);
+    }
+}
+
+// Subclass procedure logic; TRUE means the message is swallowed
+BOOL SubclassOnMessage(HookState* pState, SharedData* pData, HWND hwnd, UINT message,
+                       WPARAM wParam, LPARAM lParam);
+
+#endif // OUTLOOKTOTRAY_HOOKCORE_H
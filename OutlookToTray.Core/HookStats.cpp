@@ -0,0 +1,166 @@
+/*
+ * Outlook to Tray - Hook Statistics
+ * Slot ownership and aggregation of the per-process hook counters
+ */
+
+#include "HookStats.h"
+#include "SharedState.h"
+#include "Os.h"
+
+// Where processes without a slot (or without the mapping) count
+static HookStats g_uncountedStats;
+
+static void FoldIntoRetired(SharedData* pData, HookStats* pStats);
+
+// An owner that is gone, or whose process ID now belongs to a later process
+static BOOL IsStaleOwner(const HookStats* pStats, LONG owner) {
+    ULONGLONG start;
+    if (!OsGetProcessStartTime((DWORD)owner, &start)) {
+        return TRUE;
+    }
+    return start != 0 && pStats->processStart != 0 && start != pStats->processStart;
+}
+
+// Claim a slot for this process; never NULL (falls back to an uncounted sink)
+// A slot still naming this process ID was left by a killed process whose ID was
+// reused. Only a full table costs a liveness check per slot, so a DLL load
+// usually makes no system call here.
+HookStats* ClaimHookStats(SharedData* pData, DWORD processId, ULONGLONG processStart) {
+    if (!pData) {
+        return &g_uncountedStats;
+    }
+    HookStats* pClaimed = NULL;
+    for (int i = 0; i < MAX_STATS_SLOTS && !pClaimed; i++) {
+        HookStats* pStats = &pData->stats[i];
+        LONG owner = pStats->processId;
+        if ((owner == 0 || owner == (LONG)processId) &&
+            InterlockedCompareExchange(&pStats->processId, (LONG)processId, owner) == owner) {
+            pClaimed = pStats;
+        }
+    }
+    for (int i = 0; i < MAX_STATS_SLOTS && !pClaimed; i++) {
+        HookStats* pStats = &pData->stats[i];
+        LONG owner = pStats->processId;
+        if (owner != 0 && IsStaleOwner(pStats, owner) &&
+            InterlockedCompareExchange(&pStats->processId, (LONG)processId, owner) == owner) {
+            pClaimed = pStats;
+        }
+    }
+    if (!pClaimed) {
+        InterlockedIncrement(&pData->uncountedProcesses);
+        return &g_uncountedStats;
+    }
+    // What a killed owner counted still belongs in the totals
+    FoldIntoRetired(pData, pClaimed);
+    pClaimed->processStart = processStart;
+    return pClaimed;
+}
+
+static void AddRetired(ULONGLONG* pTotal, ULONGLONG value) {
+    if (value) {
+        InterlockedExchangeAdd64((volatile LONGLONG*)pTotal, (LONGLONG)value);
+    }
+}
+
+static void RaiseRetired(ULONGLONG* pMax, ULONGLONG value) {
+    LONGLONG current = (LONGLONG)*pMax;
+    while ((ULONGLONG)current < value) {
+        LONGLONG seen = InterlockedCompareExchange64((volatile LONGLONG*)pMax, (LONGLONG)value, current);
+        if (seen == current) break;
+        current = seen;
+    }
+}
+
+// Move a slot's counters into the retired totals, leaving them zero
+static void FoldIntoRetired(SharedData* pData, HookStats* pStats) {
+    HookStats* pRetired = &pData->retiredStats;
+    AddRetired(&pRetired->messagesSeen, pStats->messagesSeen);
+    AddRetired(&pRetired->outlookMessages, pStats->outlookMessages);
+    AddRetired(&pRetired->subclassInstalls, pStats->subclassInstalls);
+    AddRetired(&pRetired->hides, pStats->hides);
+    AddRetired(&pRetired->restores, pStats->restores);
+    AddRetired(&pRetired->hookTicks, pStats->hookTicks);
+    for (int b = 0; b < HOOK_HISTOGRAM_BUCKETS; b++) {
+        AddRetired(&pRetired->histogram[b], pStats->histogram[b]);
+    }
+    AddRetired(&pRetired->inProcessRestore.count, pStats->inProcessRestore.count);
+    AddRetired(&pRetired->inProcessRestore.totalTicks, pStats->inProcessRestore.totalTicks);
+    RaiseRetired(&pRetired->inProcessRestore.maxTicks, pStats->inProcessRestore.maxTicks);
+    AddRetired(&pRetired->cloakedRestore.count, pStats->cloakedRestore.count);
+    AddRetired(&pRetired->cloakedRestore.totalTicks, pStats->cloakedRestore.totalTicks);
+    RaiseRetired(&pRetired->cloakedRestore.maxTicks, pStats->cloakedRestore.maxTicks);
+    for (int i = 0; i < 2; i++) {
+        AddRetired(&pRetired->firstPaint[i].count, pStats->firstPaint[i].count);
+        AddRetired(&pRetired->firstPaint[i].totalTicks, pStats->firstPaint[i].totalTicks);
+        RaiseRetired(&pRetired->firstPaint[i].maxTicks, pStats->firstPaint[i].maxTicks);
+    }
+
+    pStats->messagesSeen = 0;
+    pStats->outlookMessages = 0;
+    pStats->subclassInstalls = 0;
+    pStats->hides = 0;
+    pStats->restores = 0;
+    pStats->hookTicks = 0;
+    for (int b = 0; b < HOOK_HISTOGRAM_BUCKETS; b++) {
+        pStats->histogram[b] = 0;
+    }
+    pStats->inProcessRestore = RestoreTiming();
+    pStats->cloakedRestore = RestoreTiming();
+    pStats->firstPaint[0] = RestoreTiming();
+    pStats->firstPaint[1] = RestoreTiming();
+}
+
+// Fold a process's counters into the retired totals and free its slot
+void RetireHookStats(SharedData* pData, HookStats* pStats) {
+    if (!pData || pStats == &g_uncountedStats) {
+        return;
+    }
+    FoldIntoRetired(pData, pStats);
+    pStats->processStart = 0;
+    MemoryBarrier();
+    pStats->processId = 0;
+}
+
+static void AddTiming(RestoreTiming* pTotal, const RestoreTiming* pTiming) {
+    pTotal->count += pTiming->count;
+    pTotal->totalTicks += pTiming->totalTicks;
+    if (pTiming->maxTicks > pTotal->maxTicks) {
+        pTotal->maxTicks = pTiming->maxTicks;
+    }
+}
+
+static void AddStats(HookStats* pTotal, const HookStats* pStats) {
+    pTotal->messagesSeen += pStats->messagesSeen;
+    pTotal->outlookMessages += pStats->outlookMessages;
+    pTotal->subclassInstalls += pStats->subclassInstalls;
+    pTotal->hides += pStats->hides;
+    pTotal->restores += pStats->restores;
+    pTotal->hookTicks += pStats->hookTicks;
+    for (int b = 0; b < HOOK_HISTOGRAM_BUCKETS; b++) {
+        pTotal->histogram[b] += pStats->histogram[b];
+    }
+    AddTiming(&pTotal->inProcessRestore, &pStats->inProcessRestore);
+    AddTiming(&pTotal->cloakedRestore, &pStats->cloakedRestore);
+    AddTiming(&pTotal->firstPaint[0], &pStats->firstPaint[0]);
+    AddTiming(&pTotal->firstPaint[1], &pStats->firstPaint[1]);
+}
+
+// Sum retired totals and every live slot; returns the number of live slots
+// Not a consistent snapshot: a process retiring meanwhile can be counted
+// twice or not at all for that one read, which diagnostics can live with.
+int AggregateHookStats(SharedData* pData, HookStats* pTotal) {
+    *pTotal = HookStats();
+    if (!pData) {
+        return 0;
+    }
+    AddStats(pTotal, &pData->retiredStats);
+    int live = 0;
+    for (int i = 0; i < MAX_STATS_SLOTS; i++) {
+        const HookStats* pStats = &pData->stats[i];
+        if (pStats->processId != 0) {
+            AddStats(pTotal, pStats);
+            live++;
+        }
+    }
+    return live;
+}
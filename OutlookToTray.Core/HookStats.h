@@ -0,0 +1,98 @@
+/*
+ * Outlook to Tray - Hook Statistics
+ * Per-process hook counters and a log-bucketed time histogram, kept in
+ * the shared mapping so the tray can show what the hook costs
+ */
+
+#ifndef OUTLOOKTOTRAY_HOOKSTATS_H
+#define OUTLOOKTOTRAY_HOOKSTATS_H
+
+#include "Platform.h"
+
+// Processes that can own a counter slot at once (the rest are not counted)
+#define MAX_STATS_SLOTS         64
+
+// Histogram bucket b holds calls that took 2^(b-1) to 2^b - 1 performance-
+// counter ticks; bucket 0 holds calls shorter than one tick
+#define HOOK_HISTOGRAM_BUCKETS  32
+
+// Click-to-visible latency of one restore path, in performance-counter ticks
+struct RestoreTiming {
+    ULONGLONG count;
+    ULONGLONG totalTicks;
+    ULONGLONG maxTicks;
+};
+
+// Counters for one process
+// Only the owning process writes its slot, with plain increments: two of its
+// threads hooking a message at the same instant can lose a count, which is
+// fine for diagnostics and keeps the hook free of locked instructions.
+struct alignas(64) HookStats {
+    volatile LONG processId;    // Owner; 0 while the slot is free
+    LONG reserved;
+    ULONGLONG processStart;     // Owner's start time, so a reused process ID is told apart
+    ULONGLONG messagesSeen;     // Every call into the hook
+    ULONGLONG outlookMessages;  // Calls that reached the Outlook-only path
+    ULONGLONG subclassInstalls;
+    ULONGLONG hides;
+    ULONGLONG restores;
+    ULONGLONG hookTicks;        // Performance-counter ticks spent on the Outlook path
+    ULONGLONG histogram[HOOK_HISTOGRAM_BUCKETS];
+    RestoreTiming inProcessRestore;     // Restores done by the subclass procedure (off-screen)
+    RestoreTiming cloakedRestore;       // The same, for windows hidden by cloaking
+    RestoreTiming firstPaint[2];        // Click to the window's first WM_PAINT after an
+                                        // in-process restore: [0] cold, [1] pre-warmed
+};
+
+struct SharedData;
+
+// Histogram bucket for a call that took 'ticks' (bit width, capped)
+inline int HookTimeBucket(LONGLONG ticks) {
+    if (ticks <= 0) {
+        return 0;
+    }
+#ifdef _MSC_VER
+    // _BitScanReverse64 is x64-only; two 32-bit scans work on every target
+    unsigned long index;
+    unsigned long long value = (unsigned long long)ticks;
+    if (value >> 32) {
+        _BitScanReverse(&index, (unsigned long)(value >> 32));
+        index += 32;
+    }
+    else {
+        _BitScanReverse(&index, (unsigned long)value);
+    }
+    int bucket = (int)index + 1;
+#else
+    int bucket = 64 - __builtin_clzll((unsigned long long)ticks);
+#endif
+    return bucket < HOOK_HISTOGRAM_BUCKETS ? bucket : HOOK_HISTOGRAM_BUCKETS - 1;
+}
+
+// Account one pass through the Outlook path of the hook
+inline void RecordHookTime(HookStats* pStats, LONGLONG ticks) {
+    pStats->outlookMessages++;
+    pStats->hookTicks += ticks;
+    pStats->histogram[HookTimeBucket(ticks)]++;
+}
+
+// Account one restore that became visible 'ticks' after the click
+inline void RecordRestoreTime(RestoreTiming* pTiming, LONGLONG ticks) {
+    pTiming->count++;
+    pTiming->totalTicks += ticks;
+    if ((ULONGLONG)ticks > pTiming->maxTicks) {
+        pTiming->maxTicks = ticks;
+    }
+}
+
+// Claim a slot for this process; never NULL (falls back to an uncounted sink)
+// With no free slot, one whose owner was killed without retiring it is taken over
+HookStats* ClaimHookStats(SharedData* pData, DWORD processId, ULONGLONG processStart);
+
+// Fold a process's counters into the retired totals and free its slot
+void RetireHookStats(SharedData* pData, HookStats* pStats);
+
+// Sum retired totals and every live slot; returns the number of live slots
+int AggregateHookStats(SharedData* pData, HookStats* pTotal);
+
+#endif // OUTLOOKTOTRAY_HOOKSTATS_H
@@ -0,0 +1,188 @@
+/*
+ * Outlook to Tray - Log
+ */
+
+#include "Log.h"
+#include "Os.h"
+#include <wchar.h>
+
+// Readers give a writer this many newer records' head start before they
+// assume it died mid-record and skip its slot
+#define LOG_STALL_DISTANCE  (LOG_RING_SIZE / 2)
+
+// How each event's arguments are named and printed ('x' hex, 'd' decimal)
+struct LogEventInfo {
+    const wchar_t* name;
+    const wchar_t* args[LOG_ARG_COUNT];
+    const char* formats;
+};
+
+static const LogEventInfo LOG_EVENTS[LOG_EVENT_COUNT] = {
+    { L"Unknown",          { NULL }, "" },
+    { L"HookAttached",     { L"rule" }, "d" },
+    { L"WindowSubclassed", { L"hwnd" }, "x" },
+    { L"SubclassFailed",   { L"hwnd" }, "x" },
+    { L"WindowHidden",     { L"hwnd", L"rule", L"cloaked" }, "xdd" },
+    { L"WindowRestored",   { L"hwnd", L"cloaked", L"latencyTicks" }, "xdd" },
+    { L"WindowDestroyed",  { L"hwnd" }, "x" },
+    { L"TableFull",        { L"hwnd" }, "x" },
+    { L"TrayStarted",      { L"targetedHook", L"inProcessRestore", L"rules" }, "ddd" },
+    { L"OutlookStarted",   { L"pid" }, "d" },
+    { L"OutlookExited",    { L"pid" }, "d" },
+    { L"ThreadsHooked",    { L"threads", L"otherApps", L"otherBitness" }, "ddd" },
+    { L"SettingsReloaded", { NULL }, "" },
+    { L"OutlookTrimmed",   { L"processes", L"bytes", L"skipped" }, "ddd" },
+    { L"IconAdded",        { L"attempts" }, "d" },
+    { L"WindowsRecovered", { L"windows", L"us" }, "dd" },
+    { L"UiStall",          { L"message", L"us" }, "xd" },
+    { L"ControlCommand",   { L"verb", L"windows" }, "dd" },
+    { L"HotkeyToggle",     { L"action", L"us" }, "dd" },
+    { L"AutoHide",         { L"reason", L"windows", L"idleSeconds" }, "ddd" },
+    { L"AutoHideEnded",    { L"reason", L"hiddenMs" }, "dd" },
+    { L"EntryAbandoned",   { L"hwnd", L"writerPid" }, "xd" },
+};
+
+static const wchar_t* const LEVEL_NAMES[LOG_LEVEL_COUNT] = { L"DEBUG", L"INFO", L"WARN", L"ERROR" };
+
+// Tickets wrap; these keep the arithmetic unsigned
+static LONG TicketDistance(LONG later, LONG earlier) {
+    return (LONG)((DWORD)later - (DWORD)earlier);
+}
+
+static LONG TicketSequence(LONG ticket) {
+    return (LONG)((DWORD)ticket + 1);
+}
+
+// Write one record; does nothing without a ring
+// Lock-free: one interlocked increment, then plain stores into the owned slot
+void LogWrite(LogRing* pRing, int level, LogEvent event, ULONGLONG arg0, ULONGLONG arg1,
+              ULONGLONG arg2, ULONGLONG arg3) {
+    if (!pRing) {
+        return;
+    }
+    LONG ticket = (LONG)((DWORD)InterlockedIncrement(&pRing->head) - 1);
+    LogRecord* pSlot = &pRing->records[ticket & (LOG_RING_SIZE - 1)];
+    pSlot->sequence = 0;
+    MemoryBarrier();
+    pSlot->event = (BYTE)event;
+    pSlot->level = (BYTE)level;
+    pSlot->processId = OsGetCurrentProcessId();
+    pSlot->threadId = OsGetCurrentThreadId();
+    pSlot->time = OsGetSystemTime();
+    pSlot->args[0] = arg0;
+    pSlot->args[1] = arg1;
+    pSlot->args[2] = arg2;
+    pSlot->args[3] = arg3;
+    MemoryBarrier();
+    pSlot->sequence = TicketSequence(ticket);
+}
+
+// Start reading at the current end of the ring
+void LogReaderStart(LogRing* pRing, LogReader* pReader) {
+    pReader->next = pRing->head;
+    pReader->read = 0;
+    pReader->lost = 0;
+}
+
+// Copy out the records written since the last call, oldest first
+// Tickets are compared by difference, so the counter may wrap
+int LogDrain(LogRing* pRing, LogReader* pReader, LogRecord* pRecords, int maxRecords) {
+    int count = 0;
+    while (count < maxRecords) {
+        LONG head = pRing->head;
+        LONG pending = TicketDistance(head, pReader->next);
+        if (pending <= 0) {
+            break;
+        }
+        if (pending > LOG_RING_SIZE) {
+            // Lapped: the oldest unread records are gone
+            pReader->lost += pending - LOG_RING_SIZE;
+            pReader->next = (LONG)((DWORD)head - LOG_RING_SIZE);
+        }
+        LONG ticket = pReader->next;
+        const LogRecord* pSlot = &pRing->records[ticket & (LOG_RING_SIZE - 1)];
+        LONG sequence = pSlot->sequence;
+        MemoryBarrier();
+        if (sequence == TicketSequence(ticket)) {
+            LogRecord* pCopy = &pRecords[count];
+            pCopy->event = pSlot->event;
+            pCopy->level = pSlot->level;
+            pCopy->processId = pSlot->processId;
+            pCopy->threadId = pSlot->threadId;
+            pCopy->time = pSlot->time;
+            for (int i = 0; i < LOG_ARG_COUNT; i++) {
+                pCopy->args[i] = pSlot->args[i];
+            }
+            MemoryBarrier();
+            if (pSlot->sequence == sequence) {
+                pCopy->sequence = sequence;
+                count++;
+                pReader->read++;
+            }
+            else {
+                pReader->lost++;    // Overwritten while being copied
+            }
+            pReader->next = TicketSequence(ticket);
+            continue;
+        }
+        if (sequence != 0 && TicketDistance(sequence, TicketSequence(ticket)) > 0) {
+            pReader->lost++;        // Already reused by a newer record
+            pReader->next = TicketSequence(ticket);
+            continue;
+        }
+        if (TicketDistance(head, ticket) <= LOG_STALL_DISTANCE) {
+            break;                  // Still being written: pick it up next time
+        }
+        pReader->lost++;            // Its writer never finished (process killed mid-record)
+        pReader->next = TicketSequence(ticket);
+    }
+    return count;
+}
+
+// FILETIME to calendar date and time, UTC
+// Days to civil date after H. Hinnant's algorithm, counted from 1970-01-01
+static void SplitFileTime(ULONGLONG time, int* pYear, int* pMonth, int* pDay, int* pSecondOfDay, int* pMilliseconds) {
+    const ULONGLONG UNIX_EPOCH = 116444736000000000ULL;     // 1970-01-01 as FILETIME
+    ULONGLONG ms = time > UNIX_EPOCH ? (time - UNIX_EPOCH) / 10000 : 0;
+    *pMilliseconds = (int)(ms % 1000);
+    ULONGLONG seconds = ms / 1000;
+    *pSecondOfDay = (int)(seconds % 86400);
+    long long days = (long long)(seconds / 86400) + 719468;
+    long long era = days / 146097;
+    long long dayOfEra = days - era * 146097;
+    long long yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    long long dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    long long monthIndex = (5 * dayOfYear + 2) / 153;
+    *pDay = (int)(dayOfYear - (153 * monthIndex + 2) / 5 + 1);
+    *pMonth = (int)(monthIndex < 10 ? monthIndex + 3 : monthIndex - 9);
+    *pYear = (int)(yearOfEra + era * 400 + (*pMonth <= 2));
+}
+
+// One record as a line of text, with a trailing newline
+// Returns the number of characters written
+int FormatLogRecord(const LogRecord* pRecord, wchar_t* text, int size) {
+    int year, month, day, secondOfDay, milliseconds;
+    SplitFileTime(pRecord->time, &year, &month, &day, &secondOfDay, &milliseconds);
+    const LogEventInfo* pInfo = &LOG_EVENTS[pRecord->event < LOG_EVENT_COUNT ? pRecord->event : 0];
+    const wchar_t* level = pRecord->level < LOG_LEVEL_COUNT ? LEVEL_NAMES[pRecord->level] : L"?";
+
+    int length = swprintf(text, size, L"%04d-%02d-%02d %02d:%02d:%02d.%03dZ %-5ls %u/%u %ls",
+                          year, month, day, secondOfDay / 3600, secondOfDay / 60 % 60, secondOfDay % 60,
+                          milliseconds, level, pRecord->processId, pRecord->threadId, pInfo->name);
+    for (int i = 0; i < LOG_ARG_COUNT && pInfo->args[i] && length >= 0; i++) {
+        int written = swprintf(text + length, size - length,
+                               pInfo->formats[i] == 'x' ? L" %ls=0x%llx" : L" %ls=%llu",
+                               pInfo->args[i], pRecord->args[i]);
+        length = written < 0 ? -1 : length + written;
+    }
+    if (length >= 0) {
+        int written = swprintf(text + length, size - length, L"\r\n");
+        length = written < 0 ? -1 : length + written;
+    }
+    if (length < 0) {
+        // Did not fit: keep what was written, terminated at the end of the buffer
+        text[size - 1] = L'\0';
+        return size - 1;
+    }
+    return length;
+}
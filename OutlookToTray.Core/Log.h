@@ -0,0 +1,121 @@
+/*
+ * Outlook to Tray - Log
+ * Structured binary log records in a lock-free ring inside the shared
+ * mapping: the hook writes from every process it is loaded into, the tray
+ * writes its own events and drains the ring to a file
+ */
+
+#ifndef OUTLOOKTOTRAY_LOG_H
+#define OUTLOOKTOTRAY_LOG_H
+
+#include "Platform.h"
+
+#define LOG_RING_SIZE       1024    // Records, power of two
+#define LOG_ARG_COUNT       4
+
+// Levels; numbers, so the preprocessor can compare them
+#define LOG_LEVEL_DEBUG     0
+#define LOG_LEVEL_INFO      1
+#define LOG_LEVEL_WARNING   2
+#define LOG_LEVEL_ERROR     3
+#define LOG_LEVEL_COUNT     4
+
+// Lowest level compiled in (build with -DLOG_COMPILE_LEVEL=0 for debug records)
+// Calls below it are removed by the preprocessor, arguments and all
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL   LOG_LEVEL_INFO
+#endif
+
+// What a record says; the arguments of each are listed in Log.cpp
+enum LogEvent {
+    LOG_HOOK_ATTACHED = 1,      // Hook loaded into a target process
+    LOG_WINDOW_SUBCLASSED,
+    LOG_SUBCLASS_FAILED,
+    LOG_WINDOW_HIDDEN,
+    LOG_WINDOW_RESTORED,
+    LOG_WINDOW_DESTROYED,       // While hidden
+    LOG_TABLE_FULL,             // No entry left; the window was allowed to close (or stayed shown)
+    LOG_TRAY_STARTED,
+    LOG_OUTLOOK_STARTED,
+    LOG_OUTLOOK_EXITED,
+    LOG_THREADS_HOOKED,
+    LOG_SETTINGS_RELOADED,
+    LOG_OUTLOOK_TRIMMED,
+    LOG_ICON_ADDED,
+    LOG_WINDOWS_RECOVERED,      // Found hidden by an earlier tray
+    LOG_UI_STALL,               // The tray's message loop was blocked
+    LOG_CONTROL_COMMAND,        // Hide or restore asked for over the control pipe
+    LOG_HOTKEY_TOGGLE,          // A hotkey hide or restore finished
+    LOG_AUTO_HIDE,              // Outlook hidden because the user is away
+    LOG_AUTO_HIDE_ENDED,        // Outlook restored or exited after an automatic hide
+    LOG_ENTRY_ABANDONED,        // A window entry's writer was killed holding it; freed
+    LOG_EVENT_COUNT
+};
+
+// One record, one cache line
+// 'sequence' is 0 while a writer fills the slot and ticket + 1 once it is done
+struct alignas(64) LogRecord {
+    volatile LONG sequence;
+    BYTE event;                 // LogEvent
+    BYTE level;
+    DWORD processId;
+    DWORD threadId;
+    ULONGLONG time;             // FILETIME (UTC)
+    ULONGLONG args[LOG_ARG_COUNT];
+};
+
+static_assert(sizeof(LogRecord) == 64, "LogRecord must fit one cache line");
+
+// Multi-producer ring: a writer takes a ticket with one interlocked increment
+// and owns slot ticket % LOG_RING_SIZE until it publishes the sequence
+// Writers never wait; when the reader falls behind, the oldest records are lost
+struct LogRing {
+    volatile LONG head;         // Next ticket
+    LogRecord records[LOG_RING_SIZE];
+};
+
+// The tray's position in the ring
+struct LogReader {
+    LONG next;                  // Ticket to read next
+    ULONGLONG read;
+    ULONGLONG lost;             // Overwritten before they were read, or abandoned mid-write
+};
+
+// Write one record; does nothing without a ring
+void LogWrite(LogRing* pRing, int level, LogEvent event, ULONGLONG arg0 = 0, ULONGLONG arg1 = 0,
+              ULONGLONG arg2 = 0, ULONGLONG arg3 = 0);
+
+// LOG_INFO(pRing, event, args...) and so on
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(pRing, ...)   LogWrite(pRing, LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(pRing, ...)   ((void)0)
+#endif
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(pRing, ...)    LogWrite(pRing, LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(pRing, ...)    ((void)0)
+#endif
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_WARNING
+#define LOG_WARNING(pRing, ...) LogWrite(pRing, LOG_LEVEL_WARNING, __VA_ARGS__)
+#else
+#define LOG_WARNING(pRing, ...) ((void)0)
+#endif
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(pRing, ...)   LogWrite(pRing, LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(pRing, ...)   ((void)0)
+#endif
+
+// Start reading at the current end of the ring
+void LogReaderStart(LogRing* pRing, LogReader* pReader);
+
+// Copy out the records written since the last call, oldest first
+// Stops at a record still being written; returns the number copied
+int LogDrain(LogRing* pRing, LogReader* pReader, LogRecord* pRecords, int maxRecords);
+
+// One record as a line of text, with a trailing newline
+// Returns the number of characters written
+int FormatLogRecord(const LogRecord* pRecord, wchar_t* text, int size);
+
+#endif // OUTLOOKTOTRAY_LOG_H
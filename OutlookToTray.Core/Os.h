@@ -0,0 +1,111 @@
+/*
+ * Outlook to Tray - OS Interface
+ * The few window, process and memory calls the core logic needs.
+ * OsWin32.cpp implements them for the real DLL and EXE; the test build
+ * links an in-memory fake instead.
+ */
+
+#ifndef OUTLOOKTOTRAY_OS_H
+#define OUTLOOKTOTRAY_OS_H
+
+#include "Platform.h"
+
+// Windows
+HWND OsGetWindowOwner(HWND hwnd);
+BOOL OsIsWindow(HWND hwnd);
+BOOL OsIsWindowVisible(HWND hwnd);
+BOOL OsIsTopLevelWindow(HWND hwnd);
+DWORD OsGetWindowProcessId(HWND hwnd);
+BOOL OsGetWindowClassName(HWND hwnd, wchar_t* name, int size);
+BOOL OsGetWindowRect(HWND hwnd, RECT* pRect);
+LONG OsGetWindowExStyle(HWND hwnd);
+void OsSetWindowExStyle(HWND hwnd, LONG exStyle);
+void OsMoveWindow(HWND hwnd, int x, int y, BOOL activate);
+void OsShowWindow(HWND hwnd);           // Show, restore and bring to the foreground
+// Style, position, show in one update; a cloaked window stays where it is and is uncloaked
+void OsRestoreWindow(HWND hwnd, LONG exStyle, const RECT* pRect, BOOL cloaked);
+BOOL OsCloakWindow(HWND hwnd, BOOL cloak);  // DWM cloak; only works on the caller's own windows
+BOOL OsIsWindowCloaked(HWND hwnd);          // Cloaked by its own process (not by the shell)
+void OsRepaintWindow(HWND hwnd);            // Invalidate it and its children; painted by its own thread
+BOOL OsPostTrayNotification(HWND trayWindow, UINT event, HWND hwnd);  // TRAY_NOTIFY_MESSAGE
+BOOL OsRequestHide(HWND hwnd);               // HIDE_WINDOW_MESSAGE, sent without waiting so the hook sees it
+UINT OsRegisterMessage(const wchar_t* name);
+
+// Subclassing (provided by the hook DLL, which owns the subclass procedure)
+BOOL OsSubclassWindow(HWND hwnd);
+void OsRemoveSubclass(HWND hwnd);
+
+// Processes and threads
+DWORD OsGetCurrentProcessId();
+DWORD OsGetCurrentThreadId();
+BOOL OsGetModuleImageName(wchar_t* path, DWORD size);     // Current process
+BOOL OsGetProcessImageName(DWORD processId, wchar_t* path, DWORD size);
+DWORD OsFindProcessId(const wchar_t* name);
+BOOL OsIsOtherBitness(DWORD processId);     // 32-bit under a 64-bit tray or the reverse: the DLL cannot load
+// FILETIME the process started; FALSE if no process of that ID runs (one that
+// runs but cannot be opened counts as running, with a start time of 0)
+BOOL OsGetProcessStartTime(DWORD processId, ULONGLONG* pStartTime);
+ULONGLONG OsGetCurrentProcessStartTime();   // Looked up once
+int OsFindUiThreads(DWORD processId, DWORD* threadIds, int maxThreads);
+BOOL OsIsThreadAlive(DWORD threadId);
+int OsGetThreadWindows(DWORD threadId, HWND* windows, int maxWindows);  // Its top-level windows
+BOOL OsHasOnScreenWindow(DWORD processId);  // Visible top-level window, not parked off-screen or cloaked
+
+// One row of the process list
+struct ProcessLink {
+    DWORD processId;
+    DWORD parentId;
+    BOOL webView;           // msedgewebview2.exe
+};
+int OsListProcesses(ProcessLink* links, int maxLinks);
+
+// Empty a process's working set; FALSE if the process cannot be opened for it
+BOOL OsTrimWorkingSet(DWORD processId, ULONGLONG* pBytesReleased);
+
+// Efficiency mode: EcoQoS, plus below-normal priority if the priority was normal
+// (*pLowered); leaving puts EcoQoS back under system control and, if 'raise',
+// the priority back to normal. FALSE if the process cannot be opened for it.
+BOOL OsEnterEfficiencyMode(DWORD processId, BOOL* pLowered);
+BOOL OsLeaveEfficiencyMode(DWORD processId, BOOL raise);
+
+// User plus kernel time in 100 ns units; FALSE if it cannot be read
+BOOL OsGetProcessCpuTime(DWORD processId, ULONGLONG* pCpuTime);
+
+// GPU engine running time of each process, in 100 ns units, all engines summed
+// FALSE if the GPU performance counters are not available
+// Collecting the counters walks every GPU engine instance: not for the UI thread
+BOOL OsGetProcessGpuTimes(const DWORD* processIds, int count, ULONGLONG* pGpuTimes);
+
+// Settings storage: registry values under HKCU or HKLM, and a UTF-8 text file
+// FALSE if the value or file does not exist (or has another type)
+enum RegistryHive {
+    HIVE_CURRENT_USER,
+    HIVE_LOCAL_MACHINE
+};
+BOOL OsReadRegistryDword(RegistryHive hive, const wchar_t* key, const wchar_t* name, DWORD* pValue);
+BOOL OsReadRegistryString(RegistryHive hive, const wchar_t* key, const wchar_t* name,
+                          wchar_t* value, DWORD size);
+BOOL OsReadTextFile(const wchar_t* path, wchar_t* text, DWORD size);
+
+// Time
+ULONGLONG OsGetTickCount64();
+ULONGLONG OsGetSystemTime();            // FILETIME (UTC, 100 ns units since 1601)
+LONGLONG OsQueryPerformanceCounter();
+LONGLONG OsQueryPerformanceFrequency();  // Ticks per second
+
+// Named objects this process creates are open to its user and SYSTEM only,
+// including the user's low-integrity processes (which the hook runs in too)
+HANDLE OsCreateMutex(const wchar_t* name, BOOL* pExisted);     // Owned; *pExisted if the name was taken
+// Server end of a local named pipe: overlapped, message mode, remote clients refused
+// NULL on failure; the first instance fails if any process already has a pipe of that name
+HANDLE OsCreatePipeInstance(const wchar_t* name, BOOL first, DWORD bufferSize);
+
+// Named shared memory (created zero-filled if it does not exist yet)
+void* OsMapSharedMemory(const wchar_t* name, size_t size, HANDLE* phMapping);
+void* OsOpenSharedMemory(const wchar_t* name, HANDLE* phMapping);   // Whole mapping; NULL if it does not exist
+void OsUnmapSharedMemory(void* pView, HANDLE hMapping);
+
+// Named mapping backed by a new file at 'path' (replaced if it exists), zero-filled
+void* OsMapFile(const wchar_t* path, const wchar_t* name, size_t size, HANDLE* phMapping);
+
+#endif // OUTLOOKTOTRAY_OS_H
@@ -0,0 +1,708 @@
+/*
+ * Outlook to Tray - OS Interface for Windows
+ * Thin wrappers over Win32, shared by the hook DLL and the tray app
+ */
+
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
+
+// GetProcessMemoryInfo from kernel32 (K32GetProcessMemoryInfo), no psapi.lib
+#ifndef PSAPI_VERSION
+#define PSAPI_VERSION 2
+#endif
+
+#include <windows.h>
+#include <tlhelp32.h>
+#include <psapi.h>
+#include <dwmapi.h>
+#include <pdh.h>
+#include <sddl.h>
+#include <stdlib.h>
+#include <wchar.h>
+#include "Os.h"
+#include "Targets.h"
+#include "SharedState.h"
+
+#pragma comment(lib, "Dwmapi.lib")
+#pragma comment(lib, "Advapi32.lib")
+
+// Not in older SDK headers
+#ifndef DWMWA_CLOAK
+#define DWMWA_CLOAK     13
+#define DWMWA_CLOAKED   14
+#endif
+#ifndef DWM_CLOAKED_APP
+#define DWM_CLOAKED_APP 0x1
+#endif
+
+// Windows
+
+HWND OsGetWindowOwner(HWND hwnd) {
+    return GetWindow(hwnd, GW_OWNER);
+}
+
+BOOL OsIsWindow(HWND hwnd) {
+    return IsWindow(hwnd);
+}
+
+BOOL OsIsWindowVisible(HWND hwnd) {
+    return IsWindowVisible(hwnd);
+}
+
+BOOL OsIsTopLevelWindow(HWND hwnd) {
+    return GetAncestor(hwnd, GA_PARENT) == GetDesktopWindow();
+}
+
+DWORD OsGetWindowProcessId(HWND hwnd) {
+    DWORD processId = 0;
+    GetWindowThreadProcessId(hwnd, &processId);
+    return processId;
+}
+
+BOOL OsGetWindowClassName(HWND hwnd, wchar_t* name, int size) {
+    return GetClassNameW(hwnd, name, size) > 0;
+}
+
+BOOL OsGetWindowRect(HWND hwnd, RECT* pRect) {
+    return GetWindowRect(hwnd, pRect);
+}
+
+LONG OsGetWindowExStyle(HWND hwnd) {
+    return GetWindowLong(hwnd, GWL_EXSTYLE);
+}
+
+void OsSetWindowExStyle(HWND hwnd, LONG exStyle) {
+    SetWindowLong(hwnd, GWL_EXSTYLE, exStyle);
+}
+
+void OsMoveWindow(HWND hwnd, int x, int y, BOOL activate) {
+    UINT flags = SWP_NOSIZE | SWP_NOZORDER | SWP_FRAMECHANGED;
+    if (!activate) {
+        flags |= SWP_NOACTIVATE;
+    }
+    SetWindowPos(hwnd, NULL, x, y, 0, 0, flags);
+}
+
+void OsShowWindow(HWND hwnd) {
+    ShowWindow(hwnd, SW_SHOW);
+    ShowWindow(hwnd, SW_RESTORE);
+    SetForegroundWindow(hwnd);
+    BringWindowToTop(hwnd);
+}
+
+// Runs on the window's own thread, so none of this crosses processes
+void OsRestoreWindow(HWND hwnd, LONG exStyle, const RECT* pRect, BOOL cloaked) {
+    if (exStyle != 0) {
+        SetWindowLong(hwnd, GWL_EXSTYLE, exStyle);
+    }
+    // Position, frame refresh for the new style, z-order and show in one call
+    // A cloaked window never moved; the frame is ready before it is uncloaked
+    UINT flags = SWP_NOSIZE | SWP_FRAMECHANGED | SWP_SHOWWINDOW;
+    if (cloaked) {
+        flags |= SWP_NOMOVE;
+    }
+    SetWindowPos(hwnd, HWND_TOP, pRect->left, pRect->top, 0, 0, flags);
+    if (cloaked) {
+        OsCloakWindow(hwnd, FALSE);
+    }
+    if (IsIconic(hwnd)) {
+        ShowWindow(hwnd, SW_RESTORE);
+    }
+    SetForegroundWindow(hwnd);
+}
+
+BOOL OsCloakWindow(HWND hwnd, BOOL cloak) {
+    BOOL value = cloak;
+    return SUCCEEDED(DwmSetWindowAttribute(hwnd, DWMWA_CLOAK, &value, sizeof(value)));
+}
+
+BOOL OsIsWindowCloaked(HWND hwnd) {
+    DWORD cloaked = 0;
+    return SUCCEEDED(DwmGetWindowAttribute(hwnd, DWMWA_CLOAKED, &cloaked, sizeof(cloaked))) &&
+           (cloaked & DWM_CLOAKED_APP) != 0;
+}
+
+void OsRepaintWindow(HWND hwnd) {
+    RedrawWindow(hwnd, NULL, NULL, RDW_INVALIDATE | RDW_ERASE | RDW_FRAME | RDW_ALLCHILDREN);
+}
+
+BOOL OsPostTrayNotification(HWND trayWindow, UINT event, HWND hwnd) {
+    // Registered once per process; a racing second registration returns the same id
+    static UINT s_notifyMessage = 0;
+    if (!s_notifyMessage) {
+        s_notifyMessage = RegisterWindowMessageW(TRAY_NOTIFY_MESSAGE);
+    }
+    return PostMessage(trayWindow, s_notifyMessage, (WPARAM)event, (LPARAM)hwnd);
+}
+
+// Sent, not posted: WH_CALLWNDPROC only sees sent messages
+// Registered on first use; racing threads get the same value
+static UINT g_hideMessage = 0;
+
+BOOL OsRequestHide(HWND hwnd) {
+    if (!g_hideMessage) {
+        g_hideMessage = RegisterWindowMessageW(HIDE_WINDOW_MESSAGE);
+    }
+    return g_hideMessage && SendNotifyMessageW(hwnd, g_hideMessage, 0, 0);
+}
+
+UINT OsRegisterMessage(const wchar_t* name) {
+    return RegisterWindowMessageW(name);
+}
+
+// Processes and threads
+
+DWORD OsGetCurrentProcessId() {
+    return GetCurrentProcessId();
+}
+
+DWORD OsGetCurrentThreadId() {
+    return GetCurrentThreadId();
+}
+
+BOOL OsGetModuleImageName(wchar_t* path, DWORD size) {
+    DWORD len = GetModuleFileNameW(NULL, path, size);
+    return len != 0 && len < size;
+}
+
+BOOL OsGetProcessImageName(DWORD processId, wchar_t* path, DWORD size) {
+    BOOL result = FALSE;
+    HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId);
+    if (hProcess) {
+        result = QueryFullProcessImageNameW(hProcess, 0, path, &size);
+        CloseHandle(hProcess);
+    }
+    return result;
+}
+
+BOOL OsIsOtherBitness(DWORD processId) {
+    BOOL otherWow64 = FALSE;
+    BOOL ownWow64 = FALSE;
+    HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId);
+    if (!hProcess) {
+        return FALSE;
+    }
+    BOOL known = IsWow64Process(hProcess, &otherWow64) && IsWow64Process(GetCurrentProcess(), &ownWow64);
+    CloseHandle(hProcess);
+    return known && otherWow64 != ownWow64;
+}
+
+// Creation time from GetProcessTimes, as FILETIME ticks
+static ULONGLONG ProcessStartTime(HANDLE hProcess) {
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(hProcess, &created, &exited, &kernel, &user)) {
+        return 0;
+    }
+    return ((ULONGLONG)created.dwHighDateTime << 32) | created.dwLowDateTime;
+}
+
+// An exited process stays openable while anyone holds a handle to it
+BOOL OsGetProcessStartTime(DWORD processId, ULONGLONG* pStartTime) {
+    *pStartTime = 0;
+    HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId);
+    if (!hProcess) {
+        return GetLastError() != ERROR_INVALID_PARAMETER;   // No such process
+    }
+    DWORD exitCode = 0;
+    BOOL running = !GetExitCodeProcess(hProcess, &exitCode) || exitCode == STILL_ACTIVE;
+    if (running) {
+        *pStartTime = ProcessStartTime(hProcess);
+    }
+    CloseHandle(hProcess);
+    return running;
+}
+
+// Filled on first use; racing threads store the same value
+static ULONGLONG g_currentProcessStartTime = 0;
+
+ULONGLONG OsGetCurrentProcessStartTime() {
+    if (!g_currentProcessStartTime) {
+        g_currentProcessStartTime = ProcessStartTime(GetCurrentProcess());
+    }
+    return g_currentProcessStartTime;
+}
+
+DWORD OsFindProcessId(const wchar_t* name) {
+    DWORD processId = 0;
+    HANDLE hSnap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (hSnap != INVALID_HANDLE_VALUE) {
+        PROCESSENTRY32W pe32 = {};
+        pe32.dwSize = sizeof(PROCESSENTRY32W);
+        if (Process32FirstW(hSnap, &pe32)) {
+            do {
+                if (NameEqualsNoCase(pe32.szExeFile, name)) {
+                    processId = pe32.th32ProcessID;
+                    break;
+                }
+            } while (Process32NextW(hSnap, &pe32));
+        }
+        CloseHandle(hSnap);
+    }
+    return processId;
+}
+
+// EnumThreadWindows callback: stop at the first window found
+static BOOL CALLBACK HasWindowProc(HWND hwnd, LPARAM lParam) {
+    *(bool*)lParam = true;
+    return FALSE;
+}
+
+int OsFindUiThreads(DWORD processId, DWORD* threadIds, int maxThreads) {
+    int count = 0;
+    HANDLE hSnap = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (hSnap != INVALID_HANDLE_VALUE) {
+        THREADENTRY32 te32 = {};
+        te32.dwSize = sizeof(THREADENTRY32);
+        if (Thread32First(hSnap, &te32)) {
+            do {
+                if (te32.th32OwnerProcessID != processId) {
+                    continue;
+                }
+                bool hasWindow = false;
+                EnumThreadWindows(te32.th32ThreadID, HasWindowProc, (LPARAM)&hasWindow);
+                if (hasWindow) {
+                    threadIds[count++] = te32.th32ThreadID;
+                }
+            } while (count < maxThreads && Thread32Next(hSnap, &te32));
+        }
+        CloseHandle(hSnap);
+    }
+    return count;
+}
+
+// EnumThreadWindows callback: collect the windows
+struct ThreadWindowList {
+    HWND* windows;
+    int count;
+    int maxWindows;
+};
+
+static BOOL CALLBACK ThreadWindowProc(HWND hwnd, LPARAM lParam) {
+    ThreadWindowList* pList = (ThreadWindowList*)lParam;
+    pList->windows[pList->count++] = hwnd;
+    return pList->count < pList->maxWindows;
+}
+
+int OsGetThreadWindows(DWORD threadId, HWND* windows, int maxWindows) {
+    ThreadWindowList list = { windows, 0, maxWindows };
+    if (maxWindows > 0) {
+        EnumThreadWindows(threadId, ThreadWindowProc, (LPARAM)&list);
+    }
+    return list.count;
+}
+
+BOOL OsIsThreadAlive(DWORD threadId) {
+    BOOL alive = FALSE;
+    HANDLE hThread = OpenThread(SYNCHRONIZE, FALSE, threadId);
+    if (hThread) {
+        alive = WaitForSingleObject(hThread, 0) == WAIT_TIMEOUT;
+        CloseHandle(hThread);
+    }
+    return alive;
+}
+
+// EnumWindows callback: stop at the first window of the process that is on screen
+// Hidden windows are parked at -32000 (where Windows also puts minimized ones)
+// or cloaked
+struct OnScreenSearch {
+    DWORD processId;
+    BOOL found;
+};
+
+static BOOL CALLBACK OnScreenWindowProc(HWND hwnd, LPARAM lParam) {
+    OnScreenSearch* pSearch = (OnScreenSearch*)lParam;
+    RECT rect;
+    if (OsGetWindowProcessId(hwnd) == pSearch->processId && IsWindowVisible(hwnd) &&
+        GetWindowRect(hwnd, &rect) && rect.left > -30000 &&
+        rect.right > rect.left && rect.bottom > rect.top) {
+        DWORD cloaked = 0;
+        DwmGetWindowAttribute(hwnd, DWMWA_CLOAKED, &cloaked, sizeof(cloaked));
+        if (cloaked) {
+            return TRUE;
+        }
+        pSearch->found = TRUE;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL OsHasOnScreenWindow(DWORD processId) {
+    OnScreenSearch search = { processId, FALSE };
+    EnumWindows(OnScreenWindowProc, (LPARAM)&search);
+    return search.found;
+}
+
+int OsListProcesses(ProcessLink* links, int maxLinks) {
+    int count = 0;
+    HANDLE hSnap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (hSnap != INVALID_HANDLE_VALUE) {
+        PROCESSENTRY32W pe32 = {};
+        pe32.dwSize = sizeof(PROCESSENTRY32W);
+        if (Process32FirstW(hSnap, &pe32)) {
+            do {
+                links[count].processId = pe32.th32ProcessID;
+                links[count].parentId = pe32.th32ParentProcessID;
+                links[count].webView = IsWebViewImage(pe32.szExeFile);
+                count++;
+            } while (count < maxLinks && Process32NextW(hSnap, &pe32));
+        }
+        CloseHandle(hSnap);
+    }
+    return count;
+}
+
+// Same as EmptyWorkingSet: the pages move to the standby list and fault back
+// in cheaply on use. Sandboxed WebView2 processes may refuse the access.
+BOOL OsTrimWorkingSet(DWORD processId, ULONGLONG* pBytesReleased) {
+    *pBytesReleased = 0;
+    HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_SET_QUOTA,
+                                  FALSE, processId);
+    if (!hProcess) {
+        return FALSE;
+    }
+    PROCESS_MEMORY_COUNTERS before = {}, after = {};
+    BOOL result = GetProcessMemoryInfo(hProcess, &before, sizeof(before)) &&
+                  SetProcessWorkingSetSize(hProcess, (SIZE_T)-1, (SIZE_T)-1);
+    if (result && GetProcessMemoryInfo(hProcess, &after, sizeof(after)) &&
+        after.WorkingSetSize < before.WorkingSetSize) {
+        *pBytesReleased = before.WorkingSetSize - after.WorkingSetSize;
+    }
+    CloseHandle(hProcess);
+    return result;
+}
+
+// SetProcessInformation(ProcessPowerThrottling) needs Windows 10 1709 and a
+// recent SDK; looked up at run time and declared here so neither is required
+struct PowerThrottlingState {
+    DWORD Version;
+    DWORD ControlMask;
+    DWORD StateMask;
+};
+typedef BOOL (WINAPI *SetProcessInformationProc)(HANDLE, int, LPVOID, DWORD);
+#define PROCESS_POWER_THROTTLING_CLASS  4       // ProcessPowerThrottling
+#define POWER_THROTTLING_VERSION        1
+#define POWER_THROTTLING_EXECUTION      0x1     // PROCESS_POWER_THROTTLING_EXECUTION_SPEED
+
+// ControlMask set = we decide; StateMask set = throttle. Both clear hands the
+// decision back to the system.
+// Looked up on each call: a function-local static would need the C++ runtime's
+// guard functions, which the hook DLL does not link
+static BOOL SetExecutionThrottling(HANDLE hProcess, BOOL throttle) {
+    SetProcessInformationProc setProcessInformation = (SetProcessInformationProc)
+        GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "SetProcessInformation");
+    if (!setProcessInformation) {
+        return FALSE;
+    }
+    PowerThrottlingState state = {};
+    state.Version = POWER_THROTTLING_VERSION;
+    state.ControlMask = throttle ? POWER_THROTTLING_EXECUTION : 0;
+    state.StateMask = throttle ? POWER_THROTTLING_EXECUTION : 0;
+    return setProcessInformation(hProcess, PROCESS_POWER_THROTTLING_CLASS, &state, sizeof(state));
+}
+
+BOOL OsEnterEfficiencyMode(DWORD processId, BOOL* pLowered) {
+    *pLowered = FALSE;
+    HANDLE hProcess = OpenProcess(PROCESS_SET_INFORMATION | PROCESS_QUERY_LIMITED_INFORMATION,
+                                  FALSE, processId);
+    if (!hProcess) {
+        return FALSE;
+    }
+    BOOL result = SetExecutionThrottling(hProcess, TRUE);
+    // A priority someone else chose (WebView2 lowers some of its own) is left alone
+    if (GetPriorityClass(hProcess) == NORMAL_PRIORITY_CLASS) {
+        *pLowered = SetPriorityClass(hProcess, BELOW_NORMAL_PRIORITY_CLASS);
+        result = result || *pLowered;
+    }
+    CloseHandle(hProcess);
+    return result;
+}
+
+BOOL OsLeaveEfficiencyMode(DWORD processId, BOOL raise) {
+    HANDLE hProcess = OpenProcess(PROCESS_SET_INFORMATION | PROCESS_QUERY_LIMITED_INFORMATION,
+                                  FALSE, processId);
+    if (!hProcess) {
+        return FALSE;
+    }
+    BOOL result = SetExecutionThrottling(hProcess, FALSE);
+    if (raise && GetPriorityClass(hProcess) == BELOW_NORMAL_PRIORITY_CLASS) {
+        result = SetPriorityClass(hProcess, NORMAL_PRIORITY_CLASS) || result;
+    }
+    CloseHandle(hProcess);
+    return result;
+}
+
+BOOL OsGetProcessCpuTime(DWORD processId, ULONGLONG* pCpuTime) {
+    HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId);
+    if (!hProcess) {
+        return FALSE;
+    }
+    FILETIME created, exited, kernel, user;
+    BOOL result = GetProcessTimes(hProcess, &created, &exited, &kernel, &user);
+    if (result) {
+        *pCpuTime = (((ULONGLONG)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+                    (((ULONGLONG)user.dwHighDateTime << 32) | user.dwLowDateTime);
+    }
+    CloseHandle(hProcess);
+    return result;
+}
+
+// The "GPU Engine" performance counters (Task Manager's GPU column) have one
+// instance per process and engine, named "pid_1234_luid_..._engtype_3D".
+// pdh.dll is loaded on first use, so only the tray ever loads it.
+typedef PDH_STATUS (WINAPI *PdhOpenQueryProc)(LPCWSTR, DWORD_PTR, PDH_HQUERY*);
+typedef PDH_STATUS (WINAPI *PdhAddEnglishCounterProc)(PDH_HQUERY, LPCWSTR, DWORD_PTR, PDH_HCOUNTER*);
+typedef PDH_STATUS (WINAPI *PdhCollectQueryDataProc)(PDH_HQUERY);
+typedef PDH_STATUS (WINAPI *PdhGetRawCounterArrayProc)(PDH_HCOUNTER, LPDWORD, LPDWORD, PPDH_RAW_COUNTER_ITEM_W);
+
+#ifndef PDH_MORE_DATA
+#define PDH_MORE_DATA ((PDH_STATUS)0x800007D2L)
+#endif
+
+static PdhCollectQueryDataProc s_pdhCollectQueryData = NULL;
+static PdhGetRawCounterArrayProc s_pdhGetRawCounterArray = NULL;
+static PDH_HQUERY s_gpuQuery = NULL;
+static PDH_HCOUNTER s_gpuCounter = NULL;
+
+static BOOL OpenGpuCounter() {
+    static BOOL s_tried = FALSE;
+    if (s_tried) {
+        return s_gpuCounter != NULL;
+    }
+    s_tried = TRUE;
+    HMODULE hPdh = LoadLibraryW(L"pdh.dll");
+    if (!hPdh) {
+        return FALSE;
+    }
+    PdhOpenQueryProc pdhOpenQuery = (PdhOpenQueryProc)GetProcAddress(hPdh, "PdhOpenQueryW");
+    PdhAddEnglishCounterProc pdhAddEnglishCounter =
+        (PdhAddEnglishCounterProc)GetProcAddress(hPdh, "PdhAddEnglishCounterW");
+    s_pdhCollectQueryData = (PdhCollectQueryDataProc)GetProcAddress(hPdh, "PdhCollectQueryData");
+    s_pdhGetRawCounterArray = (PdhGetRawCounterArrayProc)GetProcAddress(hPdh, "PdhGetRawCounterArrayW");
+    if (!pdhOpenQuery || !pdhAddEnglishCounter || !s_pdhCollectQueryData || !s_pdhGetRawCounterArray ||
+        pdhOpenQuery(NULL, 0, &s_gpuQuery) != ERROR_SUCCESS) {
+        return FALSE;
+    }
+    if (pdhAddEnglishCounter(s_gpuQuery, L"\\GPU Engine(*)\\Running Time", 0, &s_gpuCounter) != ERROR_SUCCESS) {
+        s_gpuCounter = NULL;
+    }
+    return s_gpuCounter != NULL;
+}
+
+BOOL OsGetProcessGpuTimes(const DWORD* processIds, int count, ULONGLONG* pGpuTimes) {
+    for (int i = 0; i < count; i++) {
+        pGpuTimes[i] = 0;
+    }
+    if (!OpenGpuCounter() || s_pdhCollectQueryData(s_gpuQuery) != ERROR_SUCCESS) {
+        return FALSE;
+    }
+    DWORD bufferSize = 0, itemCount = 0;
+    if (s_pdhGetRawCounterArray(s_gpuCounter, &bufferSize, &itemCount, NULL) != PDH_MORE_DATA) {
+        return FALSE;
+    }
+    PPDH_RAW_COUNTER_ITEM_W pItems = (PPDH_RAW_COUNTER_ITEM_W)malloc(bufferSize);
+    if (!pItems) {
+        return FALSE;
+    }
+    BOOL result = s_pdhGetRawCounterArray(s_gpuCounter, &bufferSize, &itemCount, pItems) == ERROR_SUCCESS;
+    for (DWORD n = 0; result && n < itemCount; n++) {
+        const wchar_t* name = pItems[n].szName;
+        if (wcsncmp(name, L"pid_", 4) != 0) continue;
+        DWORD processId = (DWORD)wcstoul(name + 4, NULL, 10);
+        for (int i = 0; i < count; i++) {
+            if (processIds[i] == processId) {
+                pGpuTimes[i] += (ULONGLONG)pItems[n].RawValue.FirstValue;
+            }
+        }
+    }
+    free(pItems);
+    return result;
+}
+
+// Settings storage
+
+static HKEY HiveKey(RegistryHive hive) {
+    return hive == HIVE_LOCAL_MACHINE ? HKEY_LOCAL_MACHINE : HKEY_CURRENT_USER;
+}
+
+BOOL OsReadRegistryDword(RegistryHive hive, const wchar_t* key, const wchar_t* name, DWORD* pValue) {
+    DWORD size = sizeof(*pValue);
+    return RegGetValueW(HiveKey(hive), key, name, RRF_RT_REG_DWORD, NULL, pValue, &size) == ERROR_SUCCESS;
+}
+
+BOOL OsReadRegistryString(RegistryHive hive, const wchar_t* key, const wchar_t* name,
+                          wchar_t* value, DWORD size) {
+    DWORD bytes = size * sizeof(wchar_t);
+    return RegGetValueW(HiveKey(hive), key, name, RRF_RT_REG_SZ, NULL, value, &bytes) == ERROR_SUCCESS;
+}
+
+// Reads at most size - 1 characters' worth of bytes; a UTF-8 BOM is skipped
+BOOL OsReadTextFile(const wchar_t* path, wchar_t* text, DWORD size) {
+    HANDLE hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return FALSE;
+    }
+    char bytes[4096];
+    DWORD read = 0;
+    BOOL ok = ReadFile(hFile, bytes, sizeof(bytes) < size ? (DWORD)sizeof(bytes) : size - 1, &read, NULL);
+    CloseHandle(hFile);
+    if (!ok) {
+        return FALSE;
+    }
+    const char* start = bytes;
+    if (read >= 3 && (BYTE)bytes[0] == 0xEF && (BYTE)bytes[1] == 0xBB && (BYTE)bytes[2] == 0xBF) {
+        start += 3;
+        read -= 3;
+    }
+    int length = read ? MultiByteToWideChar(CP_UTF8, 0, start, (int)read, text, (int)size - 1) : 0;
+    text[length] = L'\0';
+    return TRUE;
+}
+
+// Time
+
+ULONGLONG OsGetTickCount64() {
+    return GetTickCount64();
+}
+
+ULONGLONG OsGetSystemTime() {
+    FILETIME time;
+    GetSystemTimeAsFileTime(&time);
+    return ((ULONGLONG)time.dwHighDateTime << 32) | time.dwLowDateTime;
+}
+
+LONGLONG OsQueryPerformanceCounter() {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+LONGLONG OsQueryPerformanceFrequency() {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return frequency.QuadPart;
+}
+
+// Named objects
+
+// This user and SYSTEM only, whatever the default DACL of the creating token
+// (an elevated tray's would leave out the user's other processes). With
+// allowLowIntegrity the low mandatory label lets the user's low-integrity
+// processes, hooked too, write; without it the default medium label keeps them out.
+// Free lpSecurityDescriptor with LocalFree; FALSE leaves it NULL (default security)
+static BOOL BuildObjectSecurity(SECURITY_ATTRIBUTES* pAttributes, BOOL allowLowIntegrity) {
+    pAttributes->nLength = sizeof(*pAttributes);
+    pAttributes->lpSecurityDescriptor = NULL;
+    pAttributes->bInheritHandle = FALSE;
+
+    HANDLE hToken;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &hToken)) {
+        return FALSE;
+    }
+    BYTE buffer[sizeof(TOKEN_USER) + SECURITY_MAX_SID_SIZE];
+    DWORD size;
+    BOOL ok = GetTokenInformation(hToken, TokenUser, buffer, sizeof(buffer), &size);
+    CloseHandle(hToken);
+    wchar_t* sid = NULL;
+    if (!ok || !ConvertSidToStringSidW(((TOKEN_USER*)buffer)->User.Sid, &sid)) {
+        return FALSE;
+    }
+    wchar_t sddl[256];
+    swprintf(sddl, 256, L"D:P(A;;GA;;;SY)(A;;GA;;;%ls)%ls", sid,
+             allowLowIntegrity ? L"S:(ML;;NW;;;LW)" : L"");
+    LocalFree(sid);
+    return ConvertStringSecurityDescriptorToSecurityDescriptorW(sddl, SDDL_REVISION_1,
+                                                                &pAttributes->lpSecurityDescriptor, NULL);
+}
+
+HANDLE OsCreateMutex(const wchar_t* name, BOOL* pExisted) {
+    SECURITY_ATTRIBUTES attributes;
+    BuildObjectSecurity(&attributes, TRUE);
+    HANDLE hMutex = CreateMutexW(&attributes, TRUE, name);
+    DWORD error = GetLastError();
+    LocalFree(attributes.lpSecurityDescriptor);
+    *pExisted = error == ERROR_ALREADY_EXISTS || error == ERROR_ACCESS_DENIED;
+    return hMutex;
+}
+
+HANDLE OsCreatePipeInstance(const wchar_t* name, BOOL first, DWORD bufferSize) {
+    SECURITY_ATTRIBUTES attributes;
+    BuildObjectSecurity(&attributes, FALSE);    // Low-integrity clients may not command the tray
+    HANDLE hPipe = CreateNamedPipeW(name, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED |
+                                    (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+                                    PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                    PIPE_UNLIMITED_INSTANCES, bufferSize, bufferSize, 0, &attributes);
+    LocalFree(attributes.lpSecurityDescriptor);
+    return hPipe != INVALID_HANDLE_VALUE ? hPipe : NULL;
+}
+
+// Named shared memory
+
+void* OsMapSharedMemory(const wchar_t* name, size_t size, HANDLE* phMapping) {
+    // Try to open existing
+    HANDLE hMapping = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, name);
+
+    if (!hMapping) {
+        // Create new
+        SECURITY_ATTRIBUTES attributes;
+        BuildObjectSecurity(&attributes, TRUE);
+        hMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, &attributes, PAGE_READWRITE, 0, (DWORD)size, name);
+        LocalFree(attributes.lpSecurityDescriptor);
+    }
+
+    void* pView = NULL;
+    if (hMapping) {
+        pView = MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+        if (!pView) {
+            CloseHandle(hMapping);
+            hMapping = NULL;
+        }
+    }
+    *phMapping = hMapping;
+    return pView;
+}
+
+void* OsOpenSharedMemory(const wchar_t* name, HANDLE* phMapping) {
+    HANDLE hMapping = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, name);
+    void* pView = hMapping ? MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, 0) : NULL;
+    if (hMapping && !pView) {
+        CloseHandle(hMapping);
+        hMapping = NULL;
+    }
+    *phMapping = hMapping;
+    return pView;
+}
+
+void OsUnmapSharedMemory(void* pView, HANDLE hMapping) {
+    if (pView) {
+        UnmapViewOfFile(pView);
+    }
+    if (hMapping) {
+        CloseHandle(hMapping);
+    }
+}
+
+// File-backed mapping
+// The file handle can be closed right away; the mapping keeps the file open
+void* OsMapFile(const wchar_t* path, const wchar_t* name, size_t size, HANDLE* phMapping) {
+    *phMapping = NULL;
+    HANDLE hFile = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    SECURITY_ATTRIBUTES attributes;
+    BuildObjectSecurity(&attributes, TRUE);
+    HANDLE hMapping = CreateFileMappingW(hFile, &attributes, PAGE_READWRITE, (DWORD)((ULONGLONG)size >> 32),
+                                         (DWORD)size, name);
+    LocalFree(attributes.lpSecurityDescriptor);
+    CloseHandle(hFile);
+    void* pView = hMapping ? MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, size) : NULL;
+    if (hMapping && !pView) {
+        CloseHandle(hMapping);
+        hMapping = NULL;
+    }
+    *phMapping = hMapping;
+    return pView;
+}
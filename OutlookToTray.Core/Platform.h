@@ -0,0 +1,98 @@
+/*
+ * Outlook to Tray - Platform Types
+ * Win32 on Windows; a minimal stand-in for the Win32 types, constants and
+ * interlocked primitives used by the core everywhere else (test builds)
+ */
+
+#ifndef OUTLOOKTOTRAY_PLATFORM_H
+#define OUTLOOKTOTRAY_PLATFORM_H
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+#else
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int BOOL;
+typedef int LONG;                   // 32-bit, as on Windows
+typedef unsigned int UINT;
+typedef unsigned int DWORD;
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef long long LONGLONG;
+typedef unsigned long long ULONGLONG;
+typedef uintptr_t UINT_PTR;
+typedef uintptr_t WPARAM;
+typedef intptr_t LPARAM;
+typedef intptr_t LRESULT;
+typedef void* HANDLE;
+typedef struct HWND__* HWND;
+typedef struct HINSTANCE__* HINSTANCE;
+
+typedef struct tagRECT {
+    LONG left;
+    LONG top;
+    LONG right;
+    LONG bottom;
+} RECT;
+
+#define TRUE    1
+#define FALSE   0
+#ifndef NULL
+#define NULL    0
+#endif
+#define MAX_PATH 260
+
+// Window messages used by the core
+#define WM_DESTROY          0x0002
+#define WM_PAINT            0x000F
+#define WM_CLOSE            0x0010
+#define WM_SHOWWINDOW       0x0018
+#define WM_NCDESTROY        0x0082
+
+// Extended window styles used by the core
+#define WS_EX_TOOLWINDOW    0x00000080L
+#define WS_EX_APPWINDOW     0x00040000L
+
+inline LONG InterlockedIncrement(volatile LONG* p) {
+    return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedDecrement(volatile LONG* p) {
+    return __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedCompareExchange(volatile LONG* p, LONG exchange, LONG comparand) {
+    __atomic_compare_exchange_n(p, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+
+inline LONGLONG InterlockedExchangeAdd64(volatile LONGLONG* p, LONGLONG value) {
+    return __atomic_fetch_add(p, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONGLONG InterlockedCompareExchange64(volatile LONGLONG* p, LONGLONG exchange, LONGLONG comparand) {
+    __atomic_compare_exchange_n(p, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+
+inline void MemoryBarrier() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+inline void WriteRelease64(volatile LONGLONG* p, LONGLONG value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+inline void YieldProcessor() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+#endif // _WIN32
+
+#endif // OUTLOOKTOTRAY_PLATFORM_H
@@ -0,0 +1,370 @@
+/*
+ * Outlook to Tray - Settings
+ */
+
+#include "Settings.h"
+#include "Targets.h"
+#include "TrayCore.h"
+#include "Os.h"
+#include <wchar.h>
+
+#define MAX_SECONDS_SETTING (7 * 24 * 3600)     // A week
+#define MAX_MINUTES_SETTING (24 * 60)           // A day
+
+struct SettingInfo {
+    const wchar_t* name;
+    DWORD defaultValue;
+    DWORD maxValue;
+};
+
+static const SettingInfo SETTINGS[SETTING_COUNT] = {
+    { L"TrimDelaySeconds",    DEFAULT_TRIM_DELAY_SECONDS,    MAX_SECONDS_SETTING },
+    { L"TrimIntervalSeconds", DEFAULT_TRIM_INTERVAL_SECONDS, MAX_SECONDS_SETTING },
+    { L"EfficiencyMode",      1,                             1 },
+    { L"HideMode",            HIDE_OFFSCREEN,                HIDE_MODE_COUNT - 1 },
+    { L"TeamsToTray",         0,                             1 },
+    { L"PrewarmOnHover",      1,                             1 },
+    { L"LeanMode",            0,                             1 },
+    { L"Hotkey",              0,                             0xFFF },
+    { L"AutoHideIdleMinutes", 0,                             MAX_MINUTES_SETTING },
+    { L"AutoHideOnLock",      0,                             1 },
+};
+
+#define TARGET_SETTING_NAME L"TargetProcess"
+
+static const wchar_t* const SOURCE_NAMES[] = { L"default", L"config file", L"user", L"policy" };
+
+// Registry and file name of a setting
+const wchar_t* SettingName(SettingId id) {
+    return SETTINGS[id].name;
+}
+
+static void SetValue(TraySettings* pSettings, int id, DWORD value, SettingSource source) {
+    if (id == SETTING_HOTKEY && value != 0 && !HOTKEY_IS_VALID(value)) {
+        return;     // A number such as 79 ('O' alone) or 0x400 (Win alone)
+    }
+    if (value <= SETTINGS[id].maxValue) {
+        pSettings->values[id] = value;
+        pSettings->sources[id] = source;
+    }
+}
+
+// Copy a string that fits, or leave the destination alone
+// A plain loop: the CRT's unbounded copies are errors under /sdl
+static BOOL CopyIfFits(wchar_t* dest, const wchar_t* value, size_t size) {
+    size_t length = wcslen(value);
+    if (length >= size) {
+        return FALSE;
+    }
+    for (size_t i = 0; i <= length; i++) {
+        dest[i] = value[i];
+    }
+    return TRUE;
+}
+
+// A bare file name that fits; paths are cut to the name
+static void SetTarget(TraySettings* pSettings, const wchar_t* value, SettingSource source) {
+    const wchar_t* name = ImageBaseName(value);
+    if (*name && CopyIfFits(pSettings->targetImage, name, MAX_TARGET_IMAGE)) {
+        pSettings->targetSource = source;
+    }
+}
+
+// Every value set in one registry key; the hotkey may also be a string
+static void ReadRegistryLayer(TraySettings* pSettings, RegistryHive hive, const wchar_t* key,
+                              SettingSource source) {
+    for (int id = 0; id < SETTING_COUNT; id++) {
+        DWORD value;
+        if (OsReadRegistryDword(hive, key, SETTINGS[id].name, &value)) {
+            SetValue(pSettings, id, value, source);
+        }
+    }
+    wchar_t hotkey[MAX_HOTKEY_TEXT];
+    DWORD value;
+    if (OsReadRegistryString(hive, key, SETTINGS[SETTING_HOTKEY].name, hotkey, MAX_HOTKEY_TEXT) &&
+        ParseHotkey(hotkey, &value)) {
+        SetValue(pSettings, SETTING_HOTKEY, value, source);
+    }
+    wchar_t target[MAX_PATH];
+    if (OsReadRegistryString(hive, key, TARGET_SETTING_NAME, target, MAX_PATH)) {
+        SetTarget(pSettings, target, source);
+    }
+}
+
+// Load everything: defaults, then the config file (may be NULL), then HKCU, then policy
+void LoadSettings(TraySettings* pSettings, const wchar_t* configPath) {
+    *pSettings = TraySettings();
+    for (int id = 0; id < SETTING_COUNT; id++) {
+        pSettings->values[id] = SETTINGS[id].defaultValue;
+        pSettings->sources[id] = SOURCE_DEFAULT;
+    }
+    CopyIfFits(pSettings->targetImage, DEFAULT_TARGET_IMAGE, MAX_TARGET_IMAGE);
+    pSettings->targetSource = SOURCE_DEFAULT;
+
+    if (configPath) {
+        wchar_t text[MAX_SETTINGS_TEXT];
+        if (OsReadTextFile(configPath, text, MAX_SETTINGS_TEXT)) {
+            ParseSettingsText(pSettings, text);
+        }
+    }
+    ReadRegistryLayer(pSettings, HIVE_CURRENT_USER, SETTINGS_KEY, SOURCE_USER);
+    ReadRegistryLayer(pSettings, HIVE_CURRENT_USER, SETTINGS_POLICY_KEY, SOURCE_POLICY);
+    ReadRegistryLayer(pSettings, HIVE_LOCAL_MACHINE, SETTINGS_POLICY_KEY, SOURCE_POLICY);
+
+    wchar_t command[MAX_PATH];
+    pSettings->autoStart = OsReadRegistryString(HIVE_CURRENT_USER, AUTOSTART_KEY, AUTOSTART_VALUE,
+                                                command, MAX_PATH);
+}
+
+static BOOL IsBlank(wchar_t c) {
+    return c == L' ' || c == L'\t' || c == L'\r';
+}
+
+// Decimal number filling the whole string
+static BOOL ParseDword(const wchar_t* text, DWORD* pValue) {
+    ULONGLONG value = 0;
+    if (!*text) return FALSE;
+    for (; *text; text++) {
+        if (*text < L'0' || *text > L'9') return FALSE;
+        value = value * 10 + (*text - L'0');
+        if (value > 0xFFFFFFFFULL) return FALSE;
+    }
+    *pValue = (DWORD)value;
+    return TRUE;
+}
+
+// "[App:<Name>]" starts a new app, any other section ends it; NULL if there is no room
+static TargetRule* ParseSection(TraySettings* pSettings, wchar_t* section) {
+    size_t prefix = wcslen(APP_SECTION_PREFIX);
+    wchar_t* close = wcschr(section, L']');
+    if (!close || wcsncmp(section + 1, APP_SECTION_PREFIX, prefix) != 0 ||
+        pSettings->appCount == MAX_CUSTOM_APPS) {
+        return NULL;
+    }
+    *close = L'\0';
+    wchar_t* name = section + 1 + prefix;
+    while (IsBlank(*name)) name++;
+    for (size_t n = wcslen(name); n > 0 && IsBlank(name[n - 1]); n--) name[n - 1] = L'\0';
+    if (!*name || wcslen(name) >= MAX_RULE_NAME) {
+        return NULL;
+    }
+    TargetRule* pApp = &pSettings->apps[pSettings->appCount++];
+    *pApp = TargetRule();
+    CopyIfFits(pApp->name, name, MAX_RULE_NAME);
+    pApp->hideMode = HIDE_DEFAULT;
+    return pApp;
+}
+
+// One line of an [App:<Name>] section
+static void ParseAppValue(TargetRule* pApp, const wchar_t* name, const wchar_t* value) {
+    DWORD number;
+    if (NameEqualsNoCase(name, L"Process")) {
+        CopyIfFits(pApp->image, ImageBaseName(value), MAX_TARGET_IMAGE);
+    }
+    else if (NameEqualsNoCase(name, L"WindowClass")) {
+        CopyIfFits(pApp->windowClass, value, MAX_WINDOW_CLASS);
+    }
+    else if (NameEqualsNoCase(name, SETTINGS[SETTING_HIDE_MODE].name) && ParseDword(value, &number) &&
+             number < HIDE_MODE_COUNT) {
+        pApp->hideMode = (LONG)number;
+    }
+}
+
+// Apply "Name=Value" lines; blank lines, other [sections] and ; or # comments are skipped
+void ParseSettingsText(TraySettings* pSettings, const wchar_t* text) {
+    TargetRule* pApp = NULL;
+    while (*text) {
+        // One line, without surrounding blanks
+        const wchar_t* end = text;
+        while (*end && *end != L'\n') end++;
+        wchar_t line[MAX_PATH];
+        int length = 0;
+        for (const wchar_t* p = text; p < end && length < MAX_PATH - 1; p++) {
+            line[length++] = *p;
+        }
+        line[length] = L'\0';
+        text = *end ? end + 1 : end;
+
+        wchar_t* name = line;
+        while (IsBlank(*name)) name++;
+        if (*name == L'[') {
+            pApp = ParseSection(pSettings, name);
+            continue;
+        }
+        wchar_t* equals = wcschr(name, L'=');
+        if (!equals || *name == L';' || *name == L'#' || *name == L'[') {
+            continue;
+        }
+        wchar_t* value = equals + 1;
+        for (wchar_t* p = equals; p > name && IsBlank(p[-1]); p--) p[-1] = L'\0';
+        *equals = L'\0';
+        while (IsBlank(*value)) value++;
+        for (size_t n = wcslen(value); n > 0 && IsBlank(value[n - 1]); n--) value[n - 1] = L'\0';
+
+        if (pApp) {
+            ParseAppValue(pApp, name, value);
+            continue;
+        }
+        if (NameEqualsNoCase(name, TARGET_SETTING_NAME)) {
+            SetTarget(pSettings, value, SOURCE_FILE);
+            continue;
+        }
+        for (int id = 0; id < SETTING_COUNT; id++) {
+            DWORD number;
+            if (NameEqualsNoCase(name, SETTINGS[id].name) &&
+                (ParseDword(value, &number) || (id == SETTING_HOTKEY && ParseHotkey(value, &number)))) {
+                SetValue(pSettings, id, number, SOURCE_FILE);
+            }
+        }
+    }
+}
+
+static const struct {
+    const wchar_t* name;
+    UINT modifier;
+} HOTKEY_MODIFIER_NAMES[] = {
+    { L"Ctrl", HOTKEY_CONTROL }, { L"Control", HOTKEY_CONTROL }, { L"Alt", HOTKEY_ALT },
+    { L"Shift", HOTKEY_SHIFT }, { L"Win", HOTKEY_WIN },
+};
+
+#define VK_F1_CODE  0x70    // F1 to F24 are consecutive
+
+// Virtual key of a key name, or 0
+static UINT ParseKeyName(const wchar_t* name) {
+    if (name[0] && !name[1]) {
+        wchar_t c = name[0] >= L'a' && name[0] <= L'z' ? name[0] - L'a' + L'A' : name[0];
+        return (c >= L'A' && c <= L'Z') || (c >= L'0' && c <= L'9') ? (UINT)c : 0;
+    }
+    DWORD number;
+    if ((name[0] == L'F' || name[0] == L'f') && ParseDword(name + 1, &number) && number >= 1 && number <= 24) {
+        return VK_F1_CODE + number - 1;
+    }
+    return 0;
+}
+
+// "Ctrl+Alt+O": modifiers and one key, the key last
+BOOL ParseHotkey(const wchar_t* text, DWORD* pHotkey) {
+    UINT modifiers = 0;
+    UINT key = 0;
+    while (*text) {
+        wchar_t part[MAX_HOTKEY_TEXT];
+        int length = 0;
+        while (IsBlank(*text)) text++;
+        while (*text && *text != L'+' && length < MAX_HOTKEY_TEXT - 1) part[length++] = *text++;
+        while (length > 0 && IsBlank(part[length - 1])) length--;
+        part[length] = L'\0';
+        if (*text == L'+') text++;
+        if (key) {
+            return FALSE;       // Something after the key
+        }
+        UINT modifier = 0;
+        for (int i = 0; i < (int)(sizeof(HOTKEY_MODIFIER_NAMES) / sizeof(HOTKEY_MODIFIER_NAMES[0])); i++) {
+            if (NameEqualsNoCase(part, HOTKEY_MODIFIER_NAMES[i].name)) modifier = HOTKEY_MODIFIER_NAMES[i].modifier;
+        }
+        if (!modifier && !(key = ParseKeyName(part))) {
+            return FALSE;
+        }
+        modifiers |= modifier;
+    }
+    if (!key || !modifiers) {
+        return FALSE;
+    }
+    *pHotkey = modifiers << 8 | key;
+    return TRUE;
+}
+
+// The hotkey as text, in the form ParseHotkey reads
+void FormatHotkey(DWORD hotkey, wchar_t* text, int size) {
+    static const UINT ORDER[] = { HOTKEY_CONTROL, HOTKEY_ALT, HOTKEY_SHIFT, HOTKEY_WIN };
+    static const wchar_t* const NAMES[] = { L"Ctrl+", L"Alt+", L"Shift+", L"Win+" };
+    int length = 0;
+    text[0] = L'\0';
+    for (int i = 0; i < 4 && length >= 0; i++) {
+        if (HOTKEY_MODIFIERS(hotkey) & ORDER[i]) {
+            int written = swprintf(text + length, size - length, L"%ls", NAMES[i]);
+            length = written < 0 ? -1 : length + written;
+        }
+    }
+    if (length < 0) {
+        return;
+    }
+    UINT key = HOTKEY_KEY(hotkey);
+    if ((key >= L'A' && key <= L'Z') || (key >= L'0' && key <= L'9')) {
+        swprintf(text + length, size - length, L"%lc", (wchar_t)key);
+    }
+    else if (key >= VK_F1_CODE && key < VK_F1_CODE + 24) {
+        swprintf(text + length, size - length, L"F%u", key - VK_F1_CODE + 1);
+    }
+    else {
+        swprintf(text + length, size - length, L"0x%02X", key);
+    }
+}
+
+// TRUE if policy fixes the setting, so the menu must not offer to change it
+BOOL SettingLocked(const TraySettings* pSettings, SettingId id) {
+    return pSettings->sources[id] == SOURCE_POLICY;
+}
+
+// The part of the settings the hook needs, with the rule table built
+void GetHookSettings(const TraySettings* pSettings, HookSettings* pHookSettings) {
+    *pHookSettings = HookSettings();
+    pHookSettings->hideMode = (LONG)pSettings->values[SETTING_HIDE_MODE];
+
+    RuleTable* pTable = &pHookSettings->rules;
+    pTable->rules[pTable->count] = BUILTIN_RULES[BUILTIN_OUTLOOK];
+    CopyIfFits(pTable->rules[pTable->count++].image, pSettings->targetImage, MAX_TARGET_IMAGE);
+    if (pSettings->values[SETTING_TEAMS]) {
+        pTable->rules[pTable->count++] = BUILTIN_RULES[BUILTIN_TEAMS];
+    }
+    for (int i = 0; i < pSettings->appCount && pTable->count < MAX_TARGET_RULES; i++) {
+        pTable->rules[pTable->count++] = pSettings->apps[i];
+    }
+    BuildRuleTable(pTable);
+}
+
+// Settings and where each came from, for the Diagnostics view
+// Returns the number of characters written
+int FormatSettings(const TraySettings* pSettings, wchar_t* text, int size) {
+    int length = swprintf(text, size, L"Settings:\n");
+    for (int id = 0; id < SETTING_COUNT && length >= 0; id++) {
+        int written;
+        if (id == SETTING_HOTKEY && pSettings->values[id]) {
+            wchar_t hotkey[MAX_HOTKEY_TEXT];
+            FormatHotkey(pSettings->values[id], hotkey, MAX_HOTKEY_TEXT);
+            written = swprintf(text + length, size - length, L"  %ls = %ls (%ls)\n", SETTINGS[id].name,
+                               hotkey, SOURCE_NAMES[pSettings->sources[id]]);
+        }
+        else {
+            written = swprintf(text + length, size - length, L"  %ls = %u (%ls)\n", SETTINGS[id].name,
+                               pSettings->values[id], SOURCE_NAMES[pSettings->sources[id]]);
+        }
+        length = written < 0 ? -1 : length + written;
+    }
+    if (length >= 0) {
+        int written = swprintf(text + length, size - length, L"  %ls = %ls (%ls)\n", TARGET_SETTING_NAME,
+                               pSettings->targetImage, SOURCE_NAMES[pSettings->targetSource]);
+        length = written < 0 ? -1 : length + written;
+    }
+
+    // The rules as the hook gets them, after duplicates are dropped
+    HookSettings hookSettings;
+    GetHookSettings(pSettings, &hookSettings);
+    const RuleTable* pTable = &hookSettings.rules;
+    for (int i = 0; i < pTable->count && length >= 0; i++) {
+        const TargetRule* pRule = &pTable->rules[i];
+        wchar_t hideMode[16] = L"default";
+        if (pRule->hideMode != HIDE_DEFAULT) {
+            swprintf(hideMode, 16, L"%ld", (long)pRule->hideMode);
+        }
+        int written = swprintf(text + length, size - length, L"  App %ls = %ls, class %ls, hide mode %ls\n",
+                               pRule->name, pRule->image, pRule->windowClass[0] ? pRule->windowClass : L"any",
+                               hideMode);
+        length = written < 0 ? -1 : length + written;
+    }
+    if (length < 0) {
+        // Did not fit: keep what was written, terminated at the end of the buffer
+        text[size - 1] = L'\0';
+        return size - 1;
+    }
+    return length;
+}
@@ -0,0 +1,103 @@
+/*
+ * Outlook to Tray - Settings
+ * One in-memory copy of the settings, layered from defaults, the optional
+ * config file, the user's registry key and policy
+ */
+
+#ifndef OUTLOOKTOTRAY_SETTINGS_H
+#define OUTLOOKTOTRAY_SETTINGS_H
+
+#include "Platform.h"
+#include "SharedState.h"
+#include "Targets.h"
+
+// Where settings live; the menu writes to SETTINGS_KEY
+#define SETTINGS_KEY        L"Software\\OutlookToTray"
+#define SETTINGS_POLICY_KEY L"Software\\Policies\\OutlookToTray"
+#define SETTINGS_FILE_NAME  L"OutlookToTray.ini"    // Next to the EXE
+#define AUTOSTART_KEY       L"Software\\Microsoft\\Windows\\CurrentVersion\\Run"
+#define AUTOSTART_VALUE     L"OutlookToTray"
+
+// Longest config file read, in characters
+#define MAX_SETTINGS_TEXT   4096
+
+// Apps added in the config file ([App:<Name>] sections), after the built-in rules
+#define MAX_CUSTOM_APPS     (MAX_TARGET_RULES - BUILTIN_RULE_COUNT)
+#define APP_SECTION_PREFIX  L"App:"
+
+// Numeric settings, in the order of the settings table
+enum SettingId {
+    SETTING_TRIM_DELAY,         // TrimDelaySeconds
+    SETTING_TRIM_INTERVAL,      // TrimIntervalSeconds
+    SETTING_EFFICIENCY_MODE,    // EfficiencyMode
+    SETTING_HIDE_MODE,          // HideMode
+    SETTING_TEAMS,              // TeamsToTray: the built-in Teams rule
+    SETTING_PREWARM,            // PrewarmOnHover
+    SETTING_LEAN_MODE,          // LeanMode: everything on the UI thread (read at startup)
+    SETTING_HOTKEY,             // Hotkey: toggles Outlook between tray and foreground; 0 for none
+    SETTING_AUTOHIDE_IDLE,      // AutoHideIdleMinutes: hide Outlook after this long without input; 0 for never
+    SETTING_AUTOHIDE_LOCK,      // AutoHideOnLock: hide Outlook when the session locks or the display turns off
+    SETTING_COUNT
+};
+
+// Hotkey setting: modifiers (RegisterHotKey's MOD_ values) << 8 | virtual key
+// In the config file or as a registry string it may also be text, e.g. Ctrl+Alt+O
+#define HOTKEY_ALT          0x1
+#define HOTKEY_CONTROL      0x2
+#define HOTKEY_SHIFT        0x4
+#define HOTKEY_WIN          0x8
+#define HOTKEY_MODIFIERS(hotkey)    ((UINT)(hotkey) >> 8)
+#define HOTKEY_KEY(hotkey)          ((UINT)(hotkey) & 0xFF)
+// A key and at least one modifier; a bare key would be taken from every app
+#define HOTKEY_IS_VALID(hotkey)     (HOTKEY_MODIFIERS(hotkey) != 0 && HOTKEY_KEY(hotkey) != 0)
+#define MAX_HOTKEY_TEXT     32
+
+// Where a value came from; later sources override earlier ones
+enum SettingSource {
+    SOURCE_DEFAULT,
+    SOURCE_FILE,
+    SOURCE_USER,                // HKCU\Software\OutlookToTray
+    SOURCE_POLICY               // Software\Policies\OutlookToTray, HKCU then HKLM
+};
+
+// Every setting the tray uses, as last loaded
+struct TraySettings {
+    DWORD values[SETTING_COUNT];
+    SettingSource sources[SETTING_COUNT];
+    wchar_t targetImage[MAX_TARGET_IMAGE];  // TargetProcess, a file name such as olk.exe
+    SettingSource targetSource;
+    BOOL autoStart;             // The Run key has our value
+    TargetRule apps[MAX_CUSTOM_APPS];       // From the config file only
+    int appCount;
+};
+
+// Registry and file name of a setting
+const wchar_t* SettingName(SettingId id);
+
+// Load everything: defaults, then the config file (may be NULL), then HKCU, then policy
+// Values out of range are ignored, so the layer below stays in effect
+void LoadSettings(TraySettings* pSettings, const wchar_t* configPath);
+
+// Apply "Name=Value" lines; blank lines, other [sections] and ; or # comments are skipped
+// Lines after [App:<Name>] describe that app: Process, WindowClass and HideMode
+void ParseSettingsText(TraySettings* pSettings, const wchar_t* text);
+
+// "Ctrl+Alt+O": modifiers (Ctrl, Alt, Shift, Win) and one key (A-Z, 0-9, F1-F24)
+// FALSE without a modifier, so a plain key is never taken from every app
+BOOL ParseHotkey(const wchar_t* text, DWORD* pHotkey);
+
+// The hotkey as text, in the form ParseHotkey reads
+void FormatHotkey(DWORD hotkey, wchar_t* text, int size);
+
+// TRUE if policy fixes the setting, so the menu must not offer to change it
+BOOL SettingLocked(const TraySettings* pSettings, SettingId id);
+
+// The part of the settings the hook needs, with the rule table built:
+// Outlook (TargetProcess), Teams if turned on, then the config file's apps
+void GetHookSettings(const TraySettings* pSettings, HookSettings* pHookSettings);
+
+// Settings and where each came from, for the Diagnostics view
+// Returns the number of characters written
+int FormatSettings(const TraySettings* pSettings, wchar_t* text, int size);
+
+#endif // OUTLOOKTOTRAY_SETTINGS_H
@@ -0,0 +1,360 @@
+/*
+ * Outlook to Tray - Shared State
+ * Seqlock-protected table of hidden windows in shared memory
+ */
+
+#include "SharedState.h"
+#include "Os.h"
+
+// Map the named table, refusing one left behind by a different build
+SharedData* MapSharedData(const wchar_t* name, HANDLE* phMapping) {
+    SharedData* pData = (SharedData*)OsMapSharedMemory(name, sizeof(SharedData), phMapping);
+    if (pData) {
+        LONG version = InterlockedCompareExchange(&pData->version, SHARED_DATA_VERSION, 0);
+        if (version != 0 && version != SHARED_DATA_VERSION) {
+            OsUnmapSharedMemory(pData, *phMapping);
+            *phMapping = NULL;
+            pData = NULL;
+        }
+    }
+    return pData;
+}
+
+// Map the table only if it exists already, so the tray alone decides who may open it
+SharedData* OpenSharedData(const wchar_t* name, HANDLE* phMapping) {
+    SharedData* pData = (SharedData*)OsOpenSharedMemory(name, phMapping);
+    if (pData && pData->version != SHARED_DATA_VERSION) {
+        OsUnmapSharedMemory(pData, *phMapping);
+        *phMapping = NULL;
+        pData = NULL;
+    }
+    return pData;
+}
+
+// Counts spins on one odd sequence; TRUE once every ENTRY_STALL_SPINS of them
+static BOOL IsWriterStalled(LONG sequence, LONG* pStalled, int* pSpins) {
+    if (sequence != *pStalled) {
+        *pStalled = sequence;
+        *pSpins = 0;
+    }
+    if (++*pSpins < ENTRY_STALL_SPINS) {
+        return FALSE;
+    }
+    *pSpins = 0;
+    return TRUE;
+}
+
+// The writer holding an entry was killed mid-write: take the entry over and
+// publish it free (what it was writing is torn)
+// FALSE if the writer still runs or another thread recovered the entry first
+static BOOL RecoverAbandonedEntry(SharedData* pData, WindowEntry* pEntry, LONG sequence) {
+    DWORD writer = pEntry->writer;
+    ULONGLONG writerStart = pEntry->writerStart;
+    MemoryBarrier();
+    if (pEntry->sequence != sequence) {
+        return FALSE;
+    }
+    ULONGLONG startTime;
+    if (OsGetProcessStartTime(writer, &startTime) && (startTime == 0 || startTime == writerStart)) {
+        return FALSE;       // Still running (or cannot be opened to tell)
+    }
+    if (InterlockedCompareExchange(&pEntry->sequence, sequence + 2, sequence) != sequence) {
+        return FALSE;
+    }
+    HWND hwnd = pEntry->hwnd;
+    pEntry->writer = OsGetCurrentProcessId();
+    pEntry->writerStart = OsGetCurrentProcessStartTime();
+    pEntry->flags = 0;
+    pEntry->hwnd = NULL;
+    EndEntryWrite(pData, pEntry);     // Also balances the dead writer's generation bump
+    LOG_WARNING(&pData->log, LOG_ENTRY_ABANDONED, (UINT_PTR)hwnd, writer);
+    return TRUE;
+}
+
+// Take the writer side of an entry's seqlock
+void BeginEntryWrite(SharedData* pData, WindowEntry* pEntry) {
+    LONG stalled = 0;
+    int spins = 0;
+    for (;;) {
+        LONG sequence = pEntry->sequence;
+        if (!(sequence & 1)) {
+            if (InterlockedCompareExchange(&pEntry->sequence, sequence + 1, sequence) == sequence) {
+                break;
+            }
+        }
+        else if (IsWriterStalled(sequence, &stalled, &spins)) {
+            RecoverAbandonedEntry(pData, pEntry, sequence);
+        }
+        YieldProcessor();
+    }
+    pEntry->writer = OsGetCurrentProcessId();
+    pEntry->writerStart = OsGetCurrentProcessStartTime();
+    InterlockedIncrement(&pData->generation);
+}
+
+// Publish an entry's new contents
+void EndEntryWrite(SharedData* pData, WindowEntry* pEntry) {
+    InterlockedIncrement(&pEntry->sequence);
+    InterlockedIncrement(&pData->generation);
+}
+
+// Lock the entry for a window, optionally claiming a free slot for it
+// Returns NULL if the window has no entry (or the table is full)
+WindowEntry* LockWindowEntry(SharedData* pData, HWND hwnd, BOOL create) {
+    for (int i = 0; i < MAX_HIDDEN_WINDOWS; i++) {
+        WindowEntry* pEntry = &pData->windows[i];
+        if (pEntry->hwnd == hwnd) {
+            BeginEntryWrite(pData, pEntry);
+            if (pEntry->hwnd == hwnd) return pEntry;
+            EndEntryWrite(pData, pEntry);
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    for (int i = 0; i < MAX_HIDDEN_WINDOWS; i++) {
+        WindowEntry* pEntry = &pData->windows[i];
+        if (pEntry->hwnd == NULL) {
+            BeginEntryWrite(pData, pEntry);
+            if (pEntry->hwnd == NULL) {
+                pEntry->hwnd = hwnd;
+                return pEntry;
+            }
+            EndEntryWrite(pData, pEntry);
+        }
+    }
+    return NULL;
+}
+
+// Free a locked entry and publish it
+void ReleaseWindowEntry(SharedData* pData, WindowEntry* pEntry) {
+    pEntry->flags = 0;
+    pEntry->hwnd = NULL;
+    EndEntryWrite(pData, pEntry);
+}
+
+// Copy an entry without tearing
+void ReadWindowEntry(SharedData* pData, WindowEntry* pEntry, WindowEntry* pCopy) {
+    LONG stalled = 0;
+    int spins = 0;
+    for (;;) {
+        LONG sequence = pEntry->sequence;
+        if (!(sequence & 1)) {
+            MemoryBarrier();
+            *pCopy = *pEntry;
+            MemoryBarrier();
+            if (pEntry->sequence == sequence) return;
+        }
+        else if (IsWriterStalled(sequence, &stalled, &spins)) {
+            RecoverAbandonedEntry(pData, pEntry, sequence);
+        }
+        YieldProcessor();
+    }
+}
+
+// Consistent snapshot of all hidden windows, oldest first
+// Retries until no entry was written while the table was being copied
+int SnapshotHiddenWindows(SharedData* pData, HiddenWindowInfo* pWindows, int maxWindows) {
+    int count;
+    for (;;) {
+        LONG generation = pData->generation;
+        MemoryBarrier();
+
+        count = 0;
+        for (int i = 0; i < MAX_HIDDEN_WINDOWS && count < maxWindows; i++) {
+            WindowEntry entry;
+            ReadWindowEntry(pData, &pData->windows[i], &entry);
+            if (entry.hwnd && (entry.flags & ENTRY_HIDDEN)) {
+                HiddenWindowInfo* pInfo = &pWindows[count++];
+                pInfo->hwnd = entry.hwnd;
+                pInfo->originalRect = entry.originalRect;
+                pInfo->originalExStyle = entry.originalExStyle;
+                pInfo->processId = entry.processId;
+                pInfo->hiddenTick = entry.hiddenTick;
+                pInfo->cloaked = (entry.flags & ENTRY_CLOAKED) != 0;
+                pInfo->rule = entry.rule;
+            }
+        }
+
+        MemoryBarrier();
+        if (pData->generation == generation) break;
+        YieldProcessor();
+    }
+
+    // Oldest first, so restoring in order leaves the newest on top
+    for (int i = 1; i < count; i++) {
+        HiddenWindowInfo info = pWindows[i];
+        int j = i;
+        for (; j > 0 && pWindows[j - 1].hiddenTick > info.hiddenTick; j--) {
+            pWindows[j] = pWindows[j - 1];
+        }
+        pWindows[j] = info;
+    }
+    return count;
+}
+
+// Publish new settings for the hook
+void PublishHookSettings(SharedData* pData, const HookSettings* pSettings) {
+    for (;;) {
+        LONG sequence = pData->settingsSequence;
+        if (!(sequence & 1) &&
+            InterlockedCompareExchange(&pData->settingsSequence, sequence + 1, sequence) == sequence) {
+            break;
+        }
+        YieldProcessor();
+    }
+    pData->settings = *pSettings;
+    InterlockedIncrement(&pData->settingsSequence);
+}
+
+// Copy the settings without tearing
+void ReadHookSettings(SharedData* pData, HookSettings* pSettings) {
+    for (;;) {
+        LONG sequence = pData->settingsSequence;
+        if (!(sequence & 1)) {
+            MemoryBarrier();
+            *pSettings = pData->settings;
+            MemoryBarrier();
+            if (pData->settingsSequence == sequence) return;
+        }
+        YieldProcessor();
+    }
+}
+
+// Tell the tray (if any) that the table changed; posted, never blocks
+void NotifyTray(SharedData* pData, UINT event, HWND hwnd) {
+    HWND trayWindow = pData->trayWindow;
+    if (trayWindow) {
+        OsPostTrayNotification(trayWindow, event, hwnd);
+    }
+}
+
+// Forget one window
+BOOL ReleaseWindow(SharedData* pData, HWND hwnd) {
+    if (ForgetWindow(pData, hwnd)) {
+        NotifyTray(pData, TRAY_NOTIFY_WINDOW_RESTORED, hwnd);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// Forget a window that no longer exists: not a restore, so the tray is not told
+BOOL ForgetWindow(SharedData* pData, HWND hwnd) {
+    WindowEntry* pEntry = LockWindowEntry(pData, hwnd, FALSE);
+    if (pEntry) {
+        ReleaseWindowEntry(pData, pEntry);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// Forget every window of a process that has exited
+void ReleaseProcessWindows(SharedData* pData, DWORD processId) {
+    for (int i = 0; i < MAX_HIDDEN_WINDOWS; i++) {
+        WindowEntry* pEntry = &pData->windows[i];
+        HWND hwnd = pEntry->hwnd;
+        if (hwnd && pEntry->processId == processId) {
+            pEntry = LockWindowEntry(pData, hwnd, FALSE);
+            if (pEntry) {
+                if (pEntry->processId == processId) {
+                    ReleaseWindowEntry(pData, pEntry);
+                }
+                else {
+                    EndEntryWrite(pData, pEntry);
+                }
+            }
+        }
+    }
+}
+
+// Saved form of a snapshot
+void SaveHiddenWindows(const HiddenWindowInfo* pWindows, int count, HiddenWindowFile* pFile) {
+    pFile->magic = HIDDEN_FILE_MAGIC;
+    pFile->version = HIDDEN_FILE_VERSION;
+    pFile->count = 0;
+    for (int i = 0; i < count && i < MAX_HIDDEN_WINDOWS; i++) {
+        HiddenWindowRecord* pRecord = &pFile->records[pFile->count++];
+        pRecord->hwnd = (DWORD)(UINT_PTR)pWindows[i].hwnd;
+        pRecord->processId = pWindows[i].processId;
+        pRecord->originalRect = pWindows[i].originalRect;
+        pRecord->originalExStyle = pWindows[i].originalExStyle;
+        pRecord->rule = pWindows[i].rule;
+    }
+}
+
+// Saved record of a window, or NULL
+static const HiddenWindowRecord* FindHiddenRecord(const HiddenWindowFile* pFile, HWND hwnd, DWORD processId) {
+    if (!pFile || pFile->magic != HIDDEN_FILE_MAGIC || pFile->version != HIDDEN_FILE_VERSION) {
+        return NULL;
+    }
+    for (int i = 0; i < pFile->count && i < MAX_HIDDEN_WINDOWS; i++) {
+        const HiddenWindowRecord* pRecord = &pFile->records[i];
+        if (pRecord->hwnd == (DWORD)(UINT_PTR)hwnd && pRecord->processId == processId) {
+            return pRecord;
+        }
+    }
+    return NULL;
+}
+
+// Looks the way HideWindow leaves a window: an unowned tool window, visible
+// but parked at -32000,-32000 or cloaked by its own process
+// (Windows also parks minimized windows there, but without the tool-window style)
+static BOOL IsHiddenByUs(HWND hwnd, RECT* pRect, BOOL* pCloaked) {
+    if (OsGetWindowOwner(hwnd) != NULL || !OsIsWindowVisible(hwnd) ||
+        !(OsGetWindowExStyle(hwnd) & WS_EX_TOOLWINDOW) || !OsGetWindowRect(hwnd, pRect)) {
+        return FALSE;
+    }
+    *pCloaked = OsIsWindowCloaked(hwnd);
+    return *pCloaked || (pRect->left == -32000 && pRect->top == -32000);
+}
+
+// A restarted tray: take back the windows a previous tray left hidden
+// Only the process's own UI threads are enumerated, never the whole desktop
+int AdoptHiddenWindows(SharedData* pData, DWORD processId, int rule, const DWORD* threadIds,
+                       int threadCount, const HiddenWindowFile* pFile) {
+    int adopted = 0;
+    for (int t = 0; t < threadCount; t++) {
+        HWND windows[MAX_THREAD_WINDOWS];
+        int count = OsGetThreadWindows(threadIds[t], windows, MAX_THREAD_WINDOWS);
+        for (int i = 0; i < count; i++) {
+            HWND hwnd = windows[i];
+            RECT rect;
+            BOOL cloaked;
+            if (!IsHiddenByUs(hwnd, &rect, &cloaked)) {
+                continue;
+            }
+            WindowEntry* pEntry = LockWindowEntry(pData, hwnd, TRUE);
+            if (!pEntry) {
+                return adopted;     // Table full
+            }
+            if (pEntry->flags & ENTRY_HIDDEN) {
+                EndEntryWrite(pData, pEntry);   // The hook still has it
+                continue;
+            }
+            const HiddenWindowRecord* pRecord = FindHiddenRecord(pFile, hwnd, processId);
+            if (pRecord) {
+                pEntry->originalRect = pRecord->originalRect;
+                pEntry->originalExStyle = pRecord->originalExStyle;
+                pEntry->rule = pRecord->rule;
+            }
+            else {
+                // A cloaked window never moved; a parked one comes back near the corner
+                if (!cloaked) {
+                    rect.right += ADOPTED_WINDOW_POS - rect.left;
+                    rect.bottom += ADOPTED_WINDOW_POS - rect.top;
+                    rect.left = ADOPTED_WINDOW_POS;
+                    rect.top = ADOPTED_WINDOW_POS;
+                }
+                pEntry->originalRect = rect;
+                pEntry->originalExStyle = (OsGetWindowExStyle(hwnd) & ~WS_EX_TOOLWINDOW) | WS_EX_APPWINDOW;
+                pEntry->rule = rule;
+            }
+            pEntry->flags = ENTRY_HIDDEN | (cloaked ? ENTRY_CLOAKED : 0);
+            pEntry->processId = processId;
+            pEntry->hiddenTick = OsGetTickCount64();
+            EndEntryWrite(pData, pEntry);
+            adopted++;
+        }
+    }
+    return adopted;
+}
@@ -0,0 +1,215 @@
+/*
+ * Outlook to Tray - Shared State
+ * Layout of the memory-mapped table shared by the hook (inside Outlook)
+ * and the tray application, and the seqlock protocol protecting it
+ */
+
+#ifndef OUTLOOKTOTRAY_SHAREDSTATE_H
+#define OUTLOOKTOTRAY_SHAREDSTATE_H
+
+#include "Platform.h"
+#include "HookStats.h"
+#include "Log.h"
+
+// Bump whenever the SharedData layout changes
+#define SHARED_DATA_VERSION 13
+
+// Session-local: each terminal server session has its own tray and table
+#define SHARED_DATA_NAME    L"Local\\OutlookToTraySharedMem"
+
+// Maximum number of windows tracked at once (main, pop-outs, calendar...)
+#define MAX_HIDDEN_WINDOWS  16
+
+// Longest process name the hook can be pointed at, including the terminator
+#define MAX_TARGET_IMAGE    64
+
+// Target apps: rule table size, and its hash table (power of two, sparse
+// enough that a collision-free seed is found after a few tries)
+#define MAX_TARGET_RULES    8
+#define RULE_HASH_SIZE      32
+#define MAX_RULE_NAME       32
+#define MAX_WINDOW_CLASS    64
+#define RULE_OUTLOOK        0       // Rule 0 is always Outlook
+
+// Flags for WindowEntry
+#define ENTRY_HIDDEN        0x1
+#define ENTRY_CLOAKED       0x2     // Hidden by DWM cloaking, not moved off-screen
+
+// How the hook hides a window (SharedData::hideMode)
+enum HideMode {
+    HIDE_OFFSCREEN = 0,     // Park at -32000,-32000; the compositor still sees it
+    HIDE_CLOAK,             // DWM cloak in place; occluded, so WebView2 stops painting
+    HIDE_MODE_COUNT
+};
+
+#define HIDE_DEFAULT        (-1)    // TargetRule::hideMode: follow the HideMode setting
+
+// One target app: its process, which of its windows go to the tray, how they hide
+struct TargetRule {
+    wchar_t image[MAX_TARGET_IMAGE];        // Process file name, such as olk.exe
+    wchar_t name[MAX_RULE_NAME];            // Shown on the tray menu
+    wchar_t windowClass[MAX_WINDOW_CLASS];  // Only top-level windows of this class; empty means any
+    LONG hideMode;                          // HideMode, or HIDE_DEFAULT
+};
+
+// The rules and a perfect hash over their process names, built by the tray
+// Each hooked process hashes its own name once and compares one entry
+struct RuleTable {
+    LONG count;
+    DWORD seed;                             // Makes RuleHash() collision-free for these names
+    BYTE slots[RULE_HASH_SIZE];             // Rule index + 1 by hash; 0 is no rule
+    TargetRule rules[MAX_TARGET_RULES];
+};
+
+// Settings the hook reads, published by the tray (SharedData::settings)
+struct HookSettings {
+    LONG hideMode;          // HideMode for the next hide, unless the rule sets one
+    RuleTable rules;        // Processes the hook acts in; empty means olk.exe only
+};
+
+// Registered window message posted to the tray when its model is stale
+// wParam is one of the TRAY_NOTIFY_* events, lParam the window concerned
+#define TRAY_NOTIFY_MESSAGE L"OutlookToTray.Notify"
+
+// Registered window message the tray sends to a hidden window to have its
+// subclass procedure restore it in-process; lParam is the performance
+// counter at the click (truncated to pointer size), for latency tracking,
+// and wParam is TRUE if the tray pre-warmed the window before the click
+#define RESTORE_WINDOW_MESSAGE L"OutlookToTray.Restore"
+
+// Registered window message the tray sends to a shown window to have the hook
+// hide it as if it had been closed. Unlike WM_CLOSE it does nothing where the
+// hook is not loaded, so a window the tray cannot hide is never closed.
+#define HIDE_WINDOW_MESSAGE L"OutlookToTray.Hide"
+
+enum TrayNotifyEvent {
+    TRAY_NOTIFY_WINDOW_HIDDEN = 1,
+    TRAY_NOTIFY_WINDOW_RESTORED,
+    TRAY_NOTIFY_WINDOW_DESTROYED,
+    TRAY_NOTIFY_OUTLOOK_STARTED,
+    TRAY_NOTIFY_OUTLOOK_EXITED,
+    TRAY_NOTIFY_UNREAD_CHANGED      // Posted by the tray's own monitor thread
+};
+
+// One hidden window, as returned by SnapshotHiddenWindows()
+struct HiddenWindowInfo {
+    HWND hwnd;
+    RECT originalRect;      // Window position before hiding
+    LONG originalExStyle;   // Extended style before hiding
+    DWORD processId;
+    ULONGLONG hiddenTick;   // OsGetTickCount64() when hidden
+    BOOL cloaked;           // Only its own process can uncloak it (in-process restore)
+    int rule;               // Target rule that matched its process
+};
+
+// Per-window state, one cache line each
+// Protected by a seqlock: writers make 'sequence' odd with a CAS, update the
+// fields and make it even again; readers retry until they see the same even
+// value before and after copying. Writers only store fields while they hold
+// it (window calls happen before or after), so an odd value that does not
+// move for ENTRY_STALL_SPINS means the writer was killed if its process is
+// gone; whoever notices takes the entry over and publishes it free.
+#define ENTRY_STALL_SPINS   4096
+
+struct alignas(64) WindowEntry {
+    volatile LONG sequence;
+    LONG flags;
+    HWND hwnd;              // NULL while the slot is free
+    RECT originalRect;      // Original window position before hiding
+    LONG originalExStyle;   // Original extended style (to restore taskbar visibility)
+    DWORD processId;
+    ULONGLONG hiddenTick;
+    LONG rule;              // Target rule of the hiding process
+    DWORD writer;           // Process that last took the seqlock
+    ULONGLONG writerStart;  // Its start time, so a reused process ID is not mistaken for it
+};
+
+static_assert(sizeof(WindowEntry) == 64, "WindowEntry must fit one cache line");
+
+// Hidden windows as the tray saves them on disk, so that a restarted tray can
+// put them back where they were (the table does not outlive the last process
+// that maps it)
+#define HIDDEN_FILE_MAGIC   0x4E444948      // "HIDN"
+#define HIDDEN_FILE_VERSION 1
+
+// Windows of one thread looked at when adopting, and where a parked window
+// without a saved record comes back (its size is kept)
+#define MAX_THREAD_WINDOWS  256
+#define ADOPTED_WINDOW_POS  64
+
+struct HiddenWindowRecord {
+    DWORD hwnd;             // Window handles fit in 32 bits
+    DWORD processId;
+    RECT originalRect;
+    LONG originalExStyle;
+    LONG rule;
+};
+
+struct HiddenWindowFile {
+    DWORD magic;
+    DWORD version;
+    LONG count;
+    HiddenWindowRecord records[MAX_HIDDEN_WINDOWS];
+};
+
+// Shared memory structure
+struct SharedData {
+    volatile LONG version;          // SHARED_DATA_VERSION, set by whoever maps first
+    volatile LONG mappedProcesses;  // Processes that currently have the DLL loaded
+    volatile LONG generation;       // Bumped when any entry write starts and ends
+    HWND volatile trayWindow;       // Where notifications go; NULL while no tray runs
+    volatile LONG settingsSequence; // Seqlock over 'settings', same protocol as the entries
+    HookSettings settings;
+    WindowEntry windows[MAX_HIDDEN_WINDOWS];
+    volatile LONG uncountedProcesses;   // Processes that found no free stats slot
+    HookStats retiredStats;             // Counters of processes that have unloaded the DLL
+    HookStats stats[MAX_STATS_SLOTS];
+    LogRing log;                        // Written by every process, drained by the tray
+    volatile LONG traceSession;         // Message capture in progress (Trace.h); 0 for none
+    volatile LONG traceSessions;        // Captures started, so each gets a new mapping name
+};
+
+// Tray side: create the named table (or map the one a previous tray left),
+// refusing one left behind by a different build
+SharedData* MapSharedData(const wchar_t* name, HANDLE* phMapping);
+
+// Hook side: map the table the tray created; NULL if there is none (no tray
+// in this session) or it belongs to a different build
+SharedData* OpenSharedData(const wchar_t* name, HANDLE* phMapping);
+
+// Writer side
+void BeginEntryWrite(SharedData* pData, WindowEntry* pEntry);
+void EndEntryWrite(SharedData* pData, WindowEntry* pEntry);
+WindowEntry* LockWindowEntry(SharedData* pData, HWND hwnd, BOOL create);
+void ReleaseWindowEntry(SharedData* pData, WindowEntry* pEntry);
+
+// Reader side (a reader that finds the writer dead recovers the entry, so it writes too)
+void ReadWindowEntry(SharedData* pData, WindowEntry* pEntry, WindowEntry* pCopy);
+int SnapshotHiddenWindows(SharedData* pData, HiddenWindowInfo* pWindows, int maxWindows);
+
+// Settings: the tray publishes, each hooked process reads them when it starts
+// (hideMode is also read on its own at every hide)
+void PublishHookSettings(SharedData* pData, const HookSettings* pSettings);
+void ReadHookSettings(SharedData* pData, HookSettings* pSettings);
+
+// Tell the tray (if any) that the table changed; posted, never blocks
+void NotifyTray(SharedData* pData, UINT event, HWND hwnd);
+
+// Saved form of a snapshot
+void SaveHiddenWindows(const HiddenWindowInfo* pWindows, int count, HiddenWindowFile* pFile);
+
+// A restarted tray: take back the windows a previous tray left hidden on the
+// given threads of a process (parked off-screen or cloaked, with the tool-window
+// style), using the saved record where there is one ('pFile' may be NULL)
+// Windows the table still has are left alone. Returns the number adopted.
+int AdoptHiddenWindows(SharedData* pData, DWORD processId, int rule, const DWORD* threadIds,
+                       int threadCount, const HiddenWindowFile* pFile);
+
+// Forget windows (restored by the tray, or their process exited)
+BOOL ReleaseWindow(SharedData* pData, HWND hwnd);
+void ReleaseProcessWindows(SharedData* pData, DWORD processId);
+
+// Forget a window that no longer exists: not a restore, so the tray is not told
+BOOL ForgetWindow(SharedData* pData, HWND hwnd);
+
+#endif // OUTLOOKTOTRAY_SHAREDSTATE_H
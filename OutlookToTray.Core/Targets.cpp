@@ -0,0 +1,115 @@
+/*
+ * Outlook to Tray - Target Processes
+ */
+
+#include "Targets.h"
+
+// Tries before giving up on a seed for the current set of rules
+#define MAX_RULE_SEEDS  256
+
+// Built-in rules, fixed at compile time
+const TargetRule BUILTIN_RULES[BUILTIN_RULE_COUNT] = {
+    { DEFAULT_TARGET_IMAGE, L"Outlook", L"", HIDE_DEFAULT },
+    { L"ms-teams.exe",      L"Teams",   L"", HIDE_DEFAULT },
+};
+
+static wchar_t LowerAscii(wchar_t c) {
+    return (c >= L'A' && c <= L'Z') ? c + (L'a' - L'A') : c;
+}
+
+// Case-insensitive (ASCII) compare of process names, no CRT needed
+BOOL NameEqualsNoCase(const wchar_t* a, const wchar_t* b) {
+    for (;; a++, b++) {
+        wchar_t ca = LowerAscii(*a);
+        wchar_t cb = LowerAscii(*b);
+        if (ca != cb) return FALSE;
+        if (ca == 0) return TRUE;
+    }
+}
+
+// File name part of an image path
+const wchar_t* ImageBaseName(const wchar_t* path) {
+    const wchar_t* name = path;
+    for (const wchar_t* p = path; *p; p++) {
+        if (*p == L'\\' || *p == L'/') name = p + 1;
+    }
+    return name;
+}
+
+// The configured target process name, or olk.exe if none is set
+const wchar_t* TargetImageName(const wchar_t* targetImage) {
+    return targetImage && targetImage[0] ? targetImage : DEFAULT_TARGET_IMAGE;
+}
+
+// Check if an image path names the target process (olk.exe unless configured)
+BOOL IsOutlookImage(const wchar_t* path, const wchar_t* targetImage) {
+    return NameEqualsNoCase(ImageBaseName(path), TargetImageName(targetImage));
+}
+
+// Hash slot of a process name (case-insensitive) for a given seed
+// FNV-1a, with the seed folded into the offset basis
+UINT RuleHash(const wchar_t* image, DWORD seed) {
+    UINT hash = 2166136261u ^ (seed * 0x9E3779B9u);
+    for (; *image; image++) {
+        hash = (hash ^ LowerAscii(*image)) * 16777619u;
+    }
+    return (hash ^ (hash >> 16)) & (RULE_HASH_SIZE - 1);
+}
+
+// Try one seed; TRUE (and the slots filled) if no two rules share a slot
+static BOOL TryRuleSeed(RuleTable* pTable, DWORD seed) {
+    for (int i = 0; i < RULE_HASH_SIZE; i++) {
+        pTable->slots[i] = 0;
+    }
+    for (int i = 0; i < pTable->count; i++) {
+        UINT slot = RuleHash(pTable->rules[i].image, seed);
+        if (pTable->slots[slot]) return FALSE;
+        pTable->slots[slot] = (BYTE)(i + 1);
+    }
+    pTable->seed = seed;
+    return TRUE;
+}
+
+// Fill in seed and slots for the rules in the table
+void BuildRuleTable(RuleTable* pTable) {
+    if (pTable->count > MAX_TARGET_RULES) pTable->count = MAX_TARGET_RULES;
+    int kept = 0;
+    for (int i = 0; i < pTable->count; i++) {
+        const TargetRule* pRule = &pTable->rules[i];
+        bool usable = pRule->image[0] != L'\0';
+        for (int j = 0; j < kept && usable; j++) {
+            usable = !NameEqualsNoCase(pTable->rules[j].image, pRule->image);
+        }
+        if (usable) pTable->rules[kept++] = *pRule;
+    }
+    pTable->count = kept;
+
+    for (; pTable->count > 0; pTable->count--) {
+        for (DWORD seed = 0; seed < MAX_RULE_SEEDS; seed++) {
+            if (TryRuleSeed(pTable, seed)) return;
+        }
+    }
+    TryRuleSeed(pTable, 0);
+}
+
+// The table with only the built-in Outlook rule
+void DefaultRuleTable(RuleTable* pTable) {
+    pTable->count = 1;
+    pTable->rules[RULE_OUTLOOK] = BUILTIN_RULES[BUILTIN_OUTLOOK];
+    BuildRuleTable(pTable);
+}
+
+// Index of the rule whose process an image path names, or -1
+int MatchRule(const RuleTable* pTable, const wchar_t* path) {
+    const wchar_t* name = ImageBaseName(path);
+    int slot = pTable->slots[RuleHash(name, pTable->seed)];
+    if (slot == 0 || slot > pTable->count || !NameEqualsNoCase(pTable->rules[slot - 1].image, name)) {
+        return -1;
+    }
+    return slot - 1;
+}
+
+// Check if an image path names msedgewebview2.exe (Outlook's web content)
+BOOL IsWebViewImage(const wchar_t* path) {
+    return NameEqualsNoCase(ImageBaseName(path), L"msedgewebview2.exe");
+}
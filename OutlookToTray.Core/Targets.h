@@ -0,0 +1,53 @@
+/*
+ * Outlook to Tray - Target Processes
+ * Recognizing the processes the hook is meant for
+ */
+
+#ifndef OUTLOOKTOTRAY_TARGETS_H
+#define OUTLOOKTOTRAY_TARGETS_H
+
+#include "Platform.h"
+#include "SharedState.h"
+
+// Process the hook acts in unless the settings name another
+#define DEFAULT_TARGET_IMAGE    L"olk.exe"
+
+// Rules that ship with the app; Outlook first (RULE_OUTLOOK)
+enum BuiltinRule {
+    BUILTIN_OUTLOOK,
+    BUILTIN_TEAMS,
+    BUILTIN_RULE_COUNT
+};
+extern const TargetRule BUILTIN_RULES[BUILTIN_RULE_COUNT];
+
+// Case-insensitive (ASCII) compare of process names, no CRT needed
+BOOL NameEqualsNoCase(const wchar_t* a, const wchar_t* b);
+
+// File name part of an image path
+const wchar_t* ImageBaseName(const wchar_t* path);
+
+// The configured target process name, or olk.exe if none is set
+const wchar_t* TargetImageName(const wchar_t* targetImage);
+
+// Check if an image path names the target process (olk.exe unless configured)
+BOOL IsOutlookImage(const wchar_t* path, const wchar_t* targetImage);
+
+// Hash slot of a process name (case-insensitive) for a given seed
+UINT RuleHash(const wchar_t* image, DWORD seed);
+
+// Fill in seed and slots for the rules in the table
+// Rules without a process name or repeating an earlier one are dropped; if no
+// seed separates the rest, rules are dropped from the end until one does
+void BuildRuleTable(RuleTable* pTable);
+
+// The table with only the built-in Outlook rule
+void DefaultRuleTable(RuleTable* pTable);
+
+// Index of the rule whose process an image path names, or -1
+// One hash and one compare, however many rules there are
+int MatchRule(const RuleTable* pTable, const wchar_t* path);
+
+// Check if an image path names msedgewebview2.exe (Outlook's web content)
+BOOL IsWebViewImage(const wchar_t* path);
+
+#endif // OUTLOOKTOTRAY_TARGETS_H
@@ -0,0 +1,84 @@
+/*
+ * Outlook to Tray - Message Trace
+ */
+
+#include "Trace.h"
+#include "SharedState.h"
+#include "Os.h"
+#include <wchar.h>
+
+// TRACE_MAPPING_PREFIX followed by the session number
+void TraceMappingName(LONG session, wchar_t* name, int size) {
+    swprintf(name, size, L"%ls%ld", TRACE_MAPPING_PREFIX, (long)session);
+}
+
+// Record one message of the process in slot 'process'; a full capture records nothing more
+// Checking 'next' first keeps a full capture from costing an interlocked
+// operation per message. The stamp goes out with a release store, which orders
+// it after the other fields without a full fence.
+void TraceMessage(TraceHeader* pTrace, int process, LONGLONG time, HWND hwnd, UINT message,
+                  HookDecision decision, LONGLONG cost) {
+    LONG capacity = (LONG)pTrace->capacity;
+    if (pTrace->next >= capacity) {
+        return;
+    }
+    LONG index = InterlockedIncrement(&pTrace->next) - 1;
+    if (index >= capacity) {
+        return;
+    }
+    TraceRecord* pRecord = &TraceRecords(pTrace)[index];
+    LONGLONG elapsed = time - pTrace->startCounter;
+    pRecord->hwnd = (DWORD)(UINT_PTR)hwnd;
+    pRecord->message = message < TRACE_MESSAGE_OTHER ? (WORD)message : TRACE_MESSAGE_OTHER;
+    pRecord->cost = cost < TRACE_COST_MAX ? (WORD)cost : TRACE_COST_MAX;
+    ULONGLONG stamp = (ULONGLONG)(elapsed > 0 ? elapsed : 0) << 16 | (ULONGLONG)(process & 0xFF) << 8 |
+                      TRACE_RECORD_DONE | decision;
+    WriteRelease64((volatile LONGLONG*)&pRecord->stamp, (LONGLONG)stamp);
+}
+
+// Name the calling process in the header (once per process and capture)
+// Returns its slot, TRACE_PROCESS_UNNAMED once the table is full
+int TraceAddProcess(TraceHeader* pTrace, DWORD processId, const wchar_t* image) {
+    LONG index = InterlockedIncrement(&pTrace->processCount) - 1;
+    if (index >= TRACE_MAX_PROCESSES) {
+        return TRACE_PROCESS_UNNAMED;
+    }
+    TraceProcess* pProcess = &pTrace->processes[index];
+    int i = 0;
+    for (; image[i] && i < TRACE_MAX_IMAGE - 1; i++) {
+        pProcess->image[i] = image[i];
+    }
+    pProcess->image[i] = L'\0';
+    MemoryBarrier();
+    pProcess->processId = processId;
+    return (int)index;
+}
+
+// Tray side: create the capture file at 'path' and publish its session, so
+// the hook in every process joins at its next message
+TraceHeader* StartTrace(SharedData* pData, const wchar_t* path, DWORD capacity, HANDLE* phMapping) {
+    LONG session = InterlockedIncrement(&pData->traceSessions);
+    wchar_t name[64];
+    TraceMappingName(session, name, 64);
+    TraceHeader* pTrace = (TraceHeader*)OsMapFile(path, name, TraceFileSize(capacity), phMapping);
+    if (!pTrace) {
+        return NULL;
+    }
+    pTrace->version = TRACE_VERSION;
+    pTrace->recordSize = sizeof(TraceRecord);
+    pTrace->capacity = capacity;
+    pTrace->frequency = OsQueryPerformanceFrequency();
+    pTrace->startCounter = OsQueryPerformanceCounter();
+    pTrace->startTime = OsGetSystemTime();
+    MemoryBarrier();
+    pTrace->magic = TRACE_MAGIC;
+    pData->traceSession = session;
+    return pTrace;
+}
+
+// Stop recording and release the tray's view; hooked processes let go of
+// theirs when the next capture starts or the DLL unloads
+void StopTrace(SharedData* pData, TraceHeader* pTrace, HANDLE hMapping) {
+    pData->traceSession = 0;
+    OsUnmapSharedMemory(pTrace, hMapping);
+}
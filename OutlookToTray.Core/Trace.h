@@ -0,0 +1,132 @@
+/*
+ * Outlook to Tray - Message Trace
+ * Opt-in capture of every message the hook sees into a memory-mapped file
+ * of fixed-size records, written lock-free from every hooked process
+ */
+
+#ifndef OUTLOOKTOTRAY_TRACE_H
+#define OUTLOOKTOTRAY_TRACE_H
+
+#include "Platform.h"
+
+#define TRACE_MAGIC         0x5854544F      // "OTTX"
+#define TRACE_VERSION       2
+#define TRACE_DEFAULT_RECORDS (1 << 20)     // 16 MB of records per capture
+#define TRACE_MAX_PROCESSES 255             // Processes named in the header
+#define TRACE_PROCESS_UNNAMED 0xFF          // Slot of a process that joined after the table filled
+#define TRACE_MAX_IMAGE     30              // Process file name, including the terminator
+
+// Named file mapping of a capture: the prefix and the capture session number
+// Session-local, like the table that announces it
+#define TRACE_MAPPING_PREFIX L"Local\\OutlookToTrayTrace."
+
+// What the hook did with a message
+enum HookDecision {
+    HOOK_OTHER_PROCESS,     // The process matches no rule: only counted
+    HOOK_IGNORED,           // Target process, a message the hook does not act on
+    HOOK_CHECKED,           // Close or show of a window that needs nothing (not selected, hidden or done)
+    HOOK_SUBCLASSED,
+    HOOK_SUBCLASS_FAILED,
+    HOOK_CACHE_EVICTED,     // WM_NCDESTROY dropped the window from the cache
+    HOOK_DECISION_COUNT
+};
+
+// One hooked message, half a cache line: the writer touches as little memory
+// as it can, and the process is a slot of the header's table, not its id
+// 'stamp' is stored last and is 0 until then, which marks a record whose
+// writer had not finished when the capture stopped. It holds, from the top:
+// 48 bits of performance-counter ticks since the capture started, the process
+// slot, and TRACE_RECORD_DONE | the HookDecision.
+struct TraceRecord {
+    ULONGLONG stamp;
+    DWORD hwnd;             // Window handles fit in 32 bits, also in 64-bit processes
+    WORD message;           // TRACE_MESSAGE_OTHER for that id and above
+    WORD cost;              // Performance-counter ticks the hook spent deciding, up to TRACE_COST_MAX
+};
+
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord must stay 16 bytes");
+
+#define TRACE_RECORD_DONE   0x80
+#define TRACE_MESSAGE_OTHER 0xFFFF      // Registered messages end below; private ids beyond are pooled
+#define TRACE_COST_MAX      0xFFFF      // 6.5 ms at the usual 10 MHz counter
+
+// The parts of a finished record
+inline BOOL TraceRecordDone(const TraceRecord* pRecord) {
+    return (pRecord->stamp & TRACE_RECORD_DONE) != 0;
+}
+
+inline HookDecision TraceRecordDecision(const TraceRecord* pRecord) {
+    return (HookDecision)(pRecord->stamp & (TRACE_RECORD_DONE - 1));
+}
+
+inline int TraceRecordProcess(const TraceRecord* pRecord) {
+    return (int)(pRecord->stamp >> 8) & 0xFF;
+}
+
+inline LONGLONG TraceRecordTime(const TraceRecord* pRecord) {
+    return (LONGLONG)(pRecord->stamp >> 16);
+}
+
+// A process that joined the capture, so the summary can name it
+struct TraceProcess {
+    DWORD processId;
+    wchar_t image[TRACE_MAX_IMAGE];
+};
+
+// Start of the file; the records follow
+// A writer claims record 'next' with one interlocked increment; once 'next'
+// reaches 'capacity' the capture is full and later messages are not recorded
+struct alignas(64) TraceHeader {
+    DWORD magic;
+    DWORD version;
+    DWORD recordSize;
+    DWORD capacity;                 // Records
+    LONGLONG frequency;             // Performance-counter ticks per second
+    LONGLONG startCounter;          // Performance counter when the capture started; record times count from here
+    ULONGLONG startTime;            // FILETIME (UTC) of the same moment
+    volatile LONG next;             // Records claimed; may pass 'capacity' by a few
+    volatile LONG processCount;     // Entries claimed in 'processes'
+    TraceProcess processes[TRACE_MAX_PROCESSES];
+};
+
+// File size for a capture of 'capacity' records
+inline size_t TraceFileSize(DWORD capacity) {
+    return sizeof(TraceHeader) + (size_t)capacity * sizeof(TraceRecord);
+}
+
+// TRUE if the mapping starts with a header of this format
+inline BOOL IsTraceHeader(const TraceHeader* pTrace, size_t size) {
+    return pTrace && size >= sizeof(TraceHeader) && pTrace->magic == TRACE_MAGIC &&
+           pTrace->version == TRACE_VERSION && pTrace->recordSize == sizeof(TraceRecord);
+}
+
+// The records after the header
+inline TraceRecord* TraceRecords(TraceHeader* pTrace) {
+    return (TraceRecord*)(pTrace + 1);
+}
+
+inline const TraceRecord* TraceRecords(const TraceHeader* pTrace) {
+    return (const TraceRecord*)(pTrace + 1);
+}
+
+// TRACE_MAPPING_PREFIX followed by the session number
+void TraceMappingName(LONG session, wchar_t* name, int size);
+
+// Record one message of the process in slot 'process'; a full capture records nothing more
+void TraceMessage(TraceHeader* pTrace, int process, LONGLONG time, HWND hwnd, UINT message,
+                  HookDecision decision, LONGLONG cost);
+
+// Name the calling process in the header (once per process and capture)
+// Returns its slot, TRACE_PROCESS_UNNAMED once the table is full
+int TraceAddProcess(TraceHeader* pTrace, DWORD processId, const wchar_t* image);
+
+// Tray side: create the capture file at 'path' and publish its session, so
+// the hook in every process joins at its next message
+struct SharedData;
+TraceHeader* StartTrace(SharedData* pData, const wchar_t* path, DWORD capacity, HANDLE* phMapping);
+
+// Stop recording and release the tray's view; hooked processes let go of
+// theirs when the next capture starts (or the one after) or the DLL unloads
+void StopTrace(SharedData* pData, TraceHeader* pTrace, HANDLE hMapping);
+
+#endif // OUTLOOKTOTRAY_TRACE_H
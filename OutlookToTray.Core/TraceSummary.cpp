@@ -0,0 +1,265 @@
+/*
+ * Outlook to Tray - Trace Summary
+ */
+
+#include "TraceSummary.h"
+#include <stdarg.h>
+#include <string.h>
+#include <wchar.h>
+
+static const wchar_t* const DECISION_NAMES[HOOK_DECISION_COUNT] = {
+    L"other process", L"ignored", L"checked", L"subclassed",
+    L"subclass failed", L"cache evicted"
+};
+
+// Names of the messages that usually dominate a capture
+struct MessageName {
+    UINT message;
+    const wchar_t* name;
+};
+
+static const MessageName MESSAGE_NAMES[] = {
+    { 0x0001, L"WM_CREATE" },           { 0x0002, L"WM_DESTROY" },
+    { 0x0003, L"WM_MOVE" },             { 0x0005, L"WM_SIZE" },
+    { 0x0006, L"WM_ACTIVATE" },         { 0x0007, L"WM_SETFOCUS" },
+    { 0x0008, L"WM_KILLFOCUS" },        { 0x000C, L"WM_SETTEXT" },
+    { 0x000D, L"WM_GETTEXT" },          { 0x000E, L"WM_GETTEXTLENGTH" },
+    { 0x0010, L"WM_CLOSE" },            { 0x0018, L"WM_SHOWWINDOW" },
+    { 0x001C, L"WM_ACTIVATEAPP" },      { 0x0020, L"WM_SETCURSOR" },
+    { 0x0021, L"WM_MOUSEACTIVATE" },    { 0x0024, L"WM_GETMINMAXINFO" },
+    { 0x0046, L"WM_WINDOWPOSCHANGING" }, { 0x0047, L"WM_WINDOWPOSCHANGED" },
+    { 0x004E, L"WM_NOTIFY" },           { 0x007C, L"WM_STYLECHANGING" },
+    { 0x007D, L"WM_STYLECHANGED" },     { 0x007F, L"WM_GETICON" },
+    { 0x0081, L"WM_NCCREATE" },         { 0x0082, L"WM_NCDESTROY" },
+    { 0x0083, L"WM_NCCALCSIZE" },       { 0x0084, L"WM_NCHITTEST" },
+    { 0x0086, L"WM_NCACTIVATE" },       { 0x0087, L"WM_GETDLGCODE" },
+    { 0x00AE, L"WM_NCUAHDRAWCAPTION" }, { 0x0111, L"WM_COMMAND" },
+    { 0x0112, L"WM_SYSCOMMAND" },       { 0x0113, L"WM_TIMER" },
+    { 0x0117, L"WM_INITMENUPOPUP" },    { 0x011F, L"WM_MENUSELECT" },
+    { 0x0128, L"WM_UPDATEUISTATE" },    { 0x0129, L"WM_QUERYUISTATE" },
+    { 0x0210, L"WM_PARENTNOTIFY" },     { 0x0215, L"WM_CAPTURECHANGED" },
+    { 0x0281, L"WM_IME_SETCONTEXT" },   { 0x0282, L"WM_IME_NOTIFY" },
+    { 0x02A1, L"WM_MOUSEHOVER" },       { 0x02A3, L"WM_MOUSELEAVE" },
+    { 0x031A, L"WM_THEMECHANGED" },     { 0x031F, L"WM_DWMNCRENDERINGCHANGED" },
+    { 0x0320, L"WM_DWMCOLORIZATIONCOLORCHANGED" },
+};
+
+// Add one message and the hook time it took
+static void CountMessage(TraceCount* pCount, DWORD cost) {
+    pCount->messages++;
+    pCount->cost += cost;
+    if (cost > pCount->maxCost) {
+        pCount->maxCost = cost;
+    }
+}
+
+// Slot of a process id (open addressing); NULL when every slot is taken
+static TraceProcessSummary* FindProcess(TraceSummary* pSummary, DWORD processId) {
+    DWORD slot = (processId * 2654435761u) >> 22;   // Top 10 bits
+    for (int probe = 0; probe < TRACE_SUMMARY_PROCESSES; probe++) {
+        TraceProcessSummary* pProcess = &pSummary->processes[(slot + probe) & (TRACE_SUMMARY_PROCESSES - 1)];
+        if (pProcess->processId == processId) {
+            return pProcess;
+        }
+        if (pProcess->processId == 0) {
+            pProcess->processId = processId;
+            pSummary->processCount++;
+            return pProcess;
+        }
+    }
+    return NULL;
+}
+
+// Number of significant bits: [i] holds costs below 2^i ticks
+static int CostBucket(DWORD cost) {
+    int bucket = 0;
+    while (cost) {
+        bucket++;
+        cost >>= 1;
+    }
+    return bucket < TRACE_COST_BUCKETS ? bucket : TRACE_COST_BUCKETS - 1;
+}
+
+// Count the records of a trace file held in memory ('size' bytes)
+// FALSE if it is not a trace of this format
+BOOL SummarizeTrace(const void* pFile, size_t size, TraceSummary* pSummary) {
+    const TraceHeader* pTrace = (const TraceHeader*)pFile;
+    if (!IsTraceHeader(pTrace, size)) {
+        return FALSE;
+    }
+    memset(pSummary, 0, sizeof(*pSummary));     // Too big for a temporary on the stack
+    pSummary->capacity = pTrace->capacity;
+    pSummary->frequency = pTrace->frequency;
+
+    // A file cut short still gives the records it holds
+    ULONGLONG claimed = pTrace->next > 0 ? (ULONGLONG)pTrace->next : 0;
+    ULONGLONG count = (size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+    pSummary->full = claimed >= pTrace->capacity;
+    if (claimed < count) count = claimed;
+    if (pTrace->capacity < count) count = pTrace->capacity;
+
+    // Records name their process by its slot in the header
+    LONG named = pTrace->processCount < TRACE_MAX_PROCESSES ? pTrace->processCount : TRACE_MAX_PROCESSES;
+    const TraceRecord* pRecords = TraceRecords(pTrace);
+    for (ULONGLONG i = 0; i < count; i++) {
+        const TraceRecord* pRecord = &pRecords[i];
+        HookDecision decision = TraceRecordDecision(pRecord);
+        if (!TraceRecordDone(pRecord) || decision >= HOOK_DECISION_COUNT) {
+            pSummary->incomplete++;
+            continue;
+        }
+        LONGLONG time = TraceRecordTime(pRecord);
+        if (pSummary->records == 0 || time < pSummary->firstTime) {
+            pSummary->firstTime = time;
+        }
+        if (pSummary->records == 0 || time > pSummary->lastTime) {
+            pSummary->lastTime = time;
+        }
+        pSummary->records++;
+
+        int slot = TraceRecordProcess(pRecord);
+        DWORD processId = slot < named ? pTrace->processes[slot].processId : 0;
+        CountMessage(&pSummary->total, pRecord->cost);
+        TraceProcessSummary* pProcess = processId ? FindProcess(pSummary, processId) : NULL;
+        CountMessage(pProcess ? &pProcess->count : &pSummary->otherProcesses, pRecord->cost);
+        CountMessage(pRecord->message < TRACE_MESSAGE_IDS ? &pSummary->messages[pRecord->message]
+                                                          : &pSummary->otherMessages, pRecord->cost);
+        CountMessage(&pSummary->decisions[decision], pRecord->cost);
+        if (decision != HOOK_OTHER_PROCESS) {
+            pSummary->costBuckets[CostBucket(pRecord->cost)]++;
+        }
+    }
+
+    // Names of the processes that joined
+    for (LONG i = 0; i < named; i++) {
+        const TraceProcess* pNamed = &pTrace->processes[i];
+        for (int j = 0; j < TRACE_SUMMARY_PROCESSES; j++) {
+            if (pNamed->processId && pSummary->processes[j].processId == pNamed->processId) {
+                pSummary->processes[j].image = pNamed->image;
+            }
+        }
+    }
+    return TRUE;
+}
+
+// Indices of the largest entries (by messages or by hook time), largest first;
+// equal ones keep their order. 'stride' is the distance between counts in bytes
+static int TopRows(const TraceCount* pFirst, size_t stride, int count, BOOL byCost, int* rows, int maxRows) {
+    int found = 0;
+    ULONGLONG previousKey = ~0ULL;
+    int previous = -1;
+    while (found < maxRows) {
+        int best = -1;
+        ULONGLONG bestKey = 0;
+        for (int i = 0; i < count; i++) {
+            const TraceCount* pCount = (const TraceCount*)((const BYTE*)pFirst + i * stride);
+            ULONGLONG key = byCost ? pCount->cost : pCount->messages;
+            BOOL later = key < previousKey || (key == previousKey && i > previous);
+            if (pCount->messages && later && (best < 0 || key > bestKey)) {
+                best = i;
+                bestKey = key;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        rows[found++] = best;
+        previousKey = bestKey;
+        previous = best;
+    }
+    return found;
+}
+
+static double TicksToNs(const TraceSummary* pSummary, ULONGLONG ticks) {
+    return pSummary->frequency ? ticks * 1e9 / pSummary->frequency : 0;
+}
+
+static void FormatMessageName(UINT message, wchar_t* name, int size) {
+    for (const MessageName& known : MESSAGE_NAMES) {
+        if (known.message == message) {
+            swprintf(name, size, L"%ls", known.name);
+            return;
+        }
+    }
+    swprintf(name, size, message >= 0xC000 ? L"registered 0x%04X" : message >= 0x0400 ? L"WM_USER+%u" : L"0x%04X",
+             message >= 0x0400 && message < 0xC000 ? message - 0x0400 : message);
+}
+
+// Append to the text; a negative length means it no longer fits
+static void Append(wchar_t* text, int size, int* pLength, const wchar_t* format, ...) {
+    if (*pLength < 0) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int written = vswprintf(text + *pLength, size - *pLength, format, args);
+    va_end(args);
+    *pLength = written < 0 ? -1 : *pLength + written;
+}
+
+// The summary as text; returns the number of characters written
+int FormatTraceSummary(const TraceSummary* pSummary, wchar_t* text, int size) {
+    int length = 0;
+    double seconds = pSummary->frequency ? (double)(pSummary->lastTime - pSummary->firstTime) / pSummary->frequency : 0;
+    Append(text, size, &length, L"%llu message(s) in %.1f s, %.0f per second; capacity %u%ls\n",
+           pSummary->records, seconds, seconds > 0 ? pSummary->records / seconds : 0.0, pSummary->capacity,
+           pSummary->full ? L" (full: later messages were not recorded)" : L"");
+    if (pSummary->incomplete) {
+        Append(text, size, &length, L"%llu record(s) unfinished when the capture stopped\n", pSummary->incomplete);
+    }
+
+    int rows[TRACE_TOP_ROWS];
+    int count = TopRows(&pSummary->processes[0].count, sizeof(TraceProcessSummary), TRACE_SUMMARY_PROCESSES,
+                        FALSE, rows, TRACE_TOP_ROWS);
+    Append(text, size, &length, L"\nBy process (%d of %d):\n  %8ls  %-24ls %10ls %7ls %12ls\n", count,
+           pSummary->processCount, L"PID", L"Image", L"Messages", L"Share", L"Hook us");
+    for (int i = 0; i < count; i++) {
+        const TraceProcessSummary* pProcess = &pSummary->processes[rows[i]];
+        Append(text, size, &length, L"  %8u  %-24ls %10llu %6.1f%% %12.1f\n", pProcess->processId,
+               pProcess->image ? pProcess->image : L"?", pProcess->count.messages,
+               100.0 * pProcess->count.messages / pSummary->records, TicksToNs(pSummary, pProcess->count.cost) / 1000);
+    }
+    if (pSummary->otherProcesses.messages) {
+        Append(text, size, &length, L"  %8ls  %-24ls %10llu\n", L"-", L"(not counted)", pSummary->otherProcesses.messages);
+    }
+
+    for (int byCost = 0; byCost < 2; byCost++) {
+        count = TopRows(pSummary->messages, sizeof(TraceCount), TRACE_MESSAGE_IDS, byCost, rows, TRACE_TOP_ROWS);
+        Append(text, size, &length, byCost ? L"\nBy hook time, per message:\n" : L"\nBy message:\n");
+        Append(text, size, &length, L"  %-32ls %10ls %7ls %12ls %10ls\n", L"Message", L"Messages", L"Share",
+               L"Hook us", L"Max ns");
+        for (int i = 0; i < count; i++) {
+            const TraceCount* pCount = &pSummary->messages[rows[i]];
+            wchar_t name[40];
+            FormatMessageName((UINT)rows[i], name, 40);
+            Append(text, size, &length, L"  %-32ls %10llu %6.1f%% %12.1f %10.0f\n", name, pCount->messages,
+                   100.0 * pCount->messages / pSummary->records, TicksToNs(pSummary, pCount->cost) / 1000,
+                   TicksToNs(pSummary, pCount->maxCost));
+        }
+    }
+
+    Append(text, size, &length, L"\nBy hook decision:\n  %-20ls %10ls %12ls %10ls %10ls\n", L"Decision",
+           L"Messages", L"Hook us", L"Mean ns", L"Max ns");
+    for (int i = 0; i < HOOK_DECISION_COUNT; i++) {
+        const TraceCount* pCount = &pSummary->decisions[i];
+        if (pCount->messages) {
+            Append(text, size, &length, L"  %-20ls %10llu %12.1f %10.0f %10.0f\n", DECISION_NAMES[i],
+                   pCount->messages, TicksToNs(pSummary, pCount->cost) / 1000,
+                   TicksToNs(pSummary, pCount->cost) / pCount->messages, TicksToNs(pSummary, pCount->maxCost));
+        }
+    }
+
+    Append(text, size, &length, L"\nHook time per target-process message:\n");
+    for (int i = 0; i < TRACE_COST_BUCKETS; i++) {
+        if (pSummary->costBuckets[i]) {
+            Append(text, size, &length, L"  < %10.0f ns %10llu\n", TicksToNs(pSummary, 1ULL << i),
+                   pSummary->costBuckets[i]);
+        }
+    }
+    if (length < 0) {
+        // Did not fit: keep what was written, terminated at the end of the buffer
+        text[size - 1] = L'\0';
+        return size - 1;
+    }
+    return length;
+}
@@ -0,0 +1,56 @@
+/*
+ * Outlook to Tray - Trace Summary
+ * Offline summary of a message capture: by process, by message and by hook
+ * cost. Needs nothing but the file, so the trace tool builds on any host.
+ */
+
+#ifndef OUTLOOKTOTRAY_TRACESUMMARY_H
+#define OUTLOOKTOTRAY_TRACESUMMARY_H
+
+#include "Platform.h"
+#include "Trace.h"
+
+#define TRACE_SUMMARY_PROCESSES 1024    // Distinct processes counted one by one (power of two)
+#define TRACE_MESSAGE_IDS   TRACE_MESSAGE_OTHER     // Message ids counted one by one; larger ones are pooled
+#define TRACE_COST_BUCKETS  24          // log2 of the cost in performance-counter ticks
+#define TRACE_TOP_ROWS      15          // Rows per table in the text form
+
+// Messages and the hook time they took
+struct TraceCount {
+    ULONGLONG messages;
+    ULONGLONG cost;         // Performance-counter ticks
+    ULONGLONG maxCost;
+};
+
+struct TraceProcessSummary {
+    DWORD processId;        // 0 while the slot is free
+    const wchar_t* image;   // Points into the trace; NULL if the process was not named
+    TraceCount count;
+};
+
+struct TraceSummary {
+    DWORD capacity;
+    LONGLONG frequency;
+    LONGLONG firstTime;             // Performance counter of the earliest and latest record
+    LONGLONG lastTime;
+    ULONGLONG records;              // Complete records
+    ULONGLONG incomplete;           // Claimed, but not finished when the capture stopped
+    BOOL full;
+    TraceCount total;
+    int processCount;
+    TraceProcessSummary processes[TRACE_SUMMARY_PROCESSES];
+    TraceCount otherProcesses;      // Beyond TRACE_SUMMARY_PROCESSES
+    TraceCount messages[TRACE_MESSAGE_IDS];
+    TraceCount otherMessages;       // Recorded as TRACE_MESSAGE_OTHER
+    TraceCount decisions[HOOK_DECISION_COUNT];
+    ULONGLONG costBuckets[TRACE_COST_BUCKETS];  // Target-process messages by cost; [i] is < 2^i ticks
+};
+
+// Count the records of a trace file held in memory ('size' bytes)
+// FALSE if it is not a trace of this format
+BOOL SummarizeTrace(const void* pFile, size_t size, TraceSummary* pSummary);
+
+// The summary as text; returns the number of characters written
+int FormatTraceSummary(const TraceSummary* pSummary, wchar_t* text, int size);
+
+#endif // OUTLOOKTOTRAY_TRACESUMMARY_H
@@ -0,0 +1,860 @@
+/*
+ * Outlook to Tray - Tray Logic
+ * Outlook process tracking and window restore
+ */
+
+#include "TrayCore.h"
+#include "Targets.h"
+#include "Os.h"
+#include <stdarg.h>
+#include <wchar.h>
+
+// Check if a process is the target (olk.exe unless configured), without walking the process list
+BOOL IsOutlookPid(DWORD processId, const wchar_t* targetImage) {
+    wchar_t path[MAX_PATH];
+    return OsGetProcessImageName(processId, path, MAX_PATH) && IsOutlookImage(path, targetImage);
+}
+
+// Forget UI threads that have exited (their hooks are already gone)
+static void PruneDeadThreads(DWORD* threads, int* pCount) {
+    int kept = 0;
+    for (int i = 0; i < *pCount; i++) {
+        if (OsIsThreadAlive(threads[i])) {
+            threads[kept++] = threads[i];
+        }
+    }
+    *pCount = kept;
+}
+
+// Record a newly seen UI thread
+static TrackerAction AddThread(DWORD* threads, int* pCount, DWORD threadId) {
+    for (int i = 0; i < *pCount; i++) {
+        if (threads[i] == threadId) return TRACKER_NONE;
+    }
+    if (*pCount == MAX_UI_THREADS) {
+        PruneDeadThreads(threads, pCount);
+    }
+    if (*pCount < MAX_UI_THREADS) {
+        threads[(*pCount)++] = threadId;
+        return TRACKER_THREADS_CHANGED;
+    }
+    return TRACKER_NONE;
+}
+
+// Start tracking a running Outlook process
+// One thread snapshot per Outlook start; later threads arrive as events
+TrackerAction TrackerStart(OutlookTracker* pTracker, DWORD processId) {
+    pTracker->processId = processId;
+    pTracker->outlookOtherBitness = OsIsOtherBitness(processId);
+    pTracker->uiThreadCount = OsFindUiThreads(processId, pTracker->uiThreads, MAX_UI_THREADS);
+    if (pTracker->outlookOtherBitness) {
+        for (int i = 0; i < pTracker->uiThreadCount; i++) {
+            AddThread(pTracker->skippedThreads, &pTracker->skippedThreadCount, pTracker->uiThreads[i]);
+        }
+        pTracker->uiThreadCount = 0;
+    }
+    return TRACKER_STARTED;
+}
+
+// Outlook exited
+void TrackerStop(OutlookTracker* pTracker) {
+    pTracker->processId = 0;
+    pTracker->outlookOtherBitness = FALSE;
+    pTracker->uiThreadCount = 0;
+}
+
+// The image name the tracker looks for as Outlook
+const wchar_t* TrackerOutlookImage(const OutlookTracker* pTracker) {
+    return pTracker->rules.count ? pTracker->rules.rules[RULE_OUTLOOK].image : DEFAULT_TARGET_IMAGE;
+}
+
+// Rule a process matches, -1 for none
+// Not cached: process ids are reused, and this only runs for new top-level windows
+static int ProcessRule(const OutlookTracker* pTracker, DWORD processId) {
+    wchar_t path[MAX_PATH];
+    if (!OsGetProcessImageName(processId, path, MAX_PATH)) {
+        return -1;
+    }
+    if (pTracker->rules.count == 0) {
+        return IsOutlookImage(path, NULL) ? RULE_OUTLOOK : -1;
+    }
+    return MatchRule(&pTracker->rules, path);
+}
+
+// A new UI thread of Outlook's process; only counted if the hook cannot load there
+static TrackerAction AddOutlookThread(OutlookTracker* pTracker, DWORD threadId) {
+    if (pTracker->outlookOtherBitness) {
+        AddThread(pTracker->skippedThreads, &pTracker->skippedThreadCount, threadId);
+        return TRACKER_NONE;
+    }
+    return AddThread(pTracker->uiThreads, &pTracker->uiThreadCount, threadId);
+}
+
+// A UI thread of another target app's process; only counted if the hook cannot load there
+static TrackerAction AddAppThread(OutlookTracker* pTracker, DWORD processId, DWORD threadId) {
+    if (OsIsOtherBitness(processId)) {
+        AddThread(pTracker->skippedThreads, &pTracker->skippedThreadCount, threadId);
+        return TRACKER_NONE;
+    }
+    return AddThread(pTracker->appThreads, &pTracker->appThreadCount, threadId);
+}
+
+// Window-creation event: Outlook starting, or a target app opening a new UI thread
+TrackerAction TrackerOnWindowCreated(OutlookTracker* pTracker, HWND hwnd, DWORD threadId) {
+    BOOL otherApps = pTracker->rules.count > 1;
+    if (pTracker->processId && !otherApps) {
+        // Events are scoped to Outlook's process, so this is one of its threads
+        return AddOutlookThread(pTracker, threadId);
+    }
+    DWORD processId = OsGetWindowProcessId(hwnd);
+    if (processId && processId == pTracker->processId) {
+        return AddOutlookThread(pTracker, threadId);
+    }
+    if (!processId || !OsIsTopLevelWindow(hwnd)) {
+        return TRACKER_NONE;
+    }
+    int rule = ProcessRule(pTracker, processId);
+    if (rule == RULE_OUTLOOK && !pTracker->processId) {
+        return TrackerStart(pTracker, processId);
+    }
+    if (rule > RULE_OUTLOOK) {
+        return AddAppThread(pTracker, processId, threadId);
+    }
+    return TRACKER_NONE;
+}
+
+// New rules: forget the other apps' threads and look for their running processes
+TrackerAction TrackerSetRules(OutlookTracker* pTracker, const RuleTable* pRules) {
+    pTracker->rules = *pRules;
+    pTracker->appThreadCount = 0;
+    pTracker->skippedThreadCount = 0;
+    for (int i = RULE_OUTLOOK + 1; i < pRules->count; i++) {
+        DWORD processId = OsFindProcessId(pRules->rules[i].image);
+        if (processId) {
+            DWORD threads[MAX_UI_THREADS];
+            int count = OsFindUiThreads(processId, threads, MAX_UI_THREADS);
+            for (int j = 0; j < count; j++) {
+                AddAppThread(pTracker, processId, threads[j]);
+            }
+        }
+    }
+    return TRACKER_THREADS_CHANGED;
+}
+
+// Bring one hidden window back to where it was
+void RestoreWindow(const HiddenWindowInfo* pInfo) {
+    HWND hwnd = pInfo->hwnd;
+
+    // Restore original extended style (shows in taskbar again)
+    if (pInfo->originalExStyle != 0) {
+        OsSetWindowExStyle(hwnd, pInfo->originalExStyle);
+    }
+
+    // Restore original window position
+    OsMoveWindow(hwnd, pInfo->originalRect.left, pInfo->originalRect.top, TRUE);
+    OsShowWindow(hwnd);
+}
+
+// Pointer over the tray icon: TRUE if the hidden windows should be pre-warmed now
+// The shell sends a mouse move for every pixel crossed; one pre-warm covers them
+BOOL PrewarmOnHover(PrewarmState* pState, ULONGLONG now) {
+    if (pState->lastTick && now - pState->lastTick < PREWARM_INTERVAL_MS) {
+        return FALSE;
+    }
+    pState->lastTick = now;
+    pState->prewarms++;
+    return TRUE;
+}
+
+// A restore is starting: TRUE if a pre-warm was still in effect; it ends here
+BOOL PrewarmOnRestore(PrewarmState* pState, ULONGLONG now) {
+    BOOL prewarmed = PrewarmHolding(pState, now);
+    if (prewarmed) {
+        pState->used++;
+    }
+    pState->lastTick = 0;
+    return prewarmed;
+}
+
+// TRUE while a pre-warm keeps efficiency mode off
+BOOL PrewarmHolding(const PrewarmState* pState, ULONGLONG now) {
+    return pState->lastTick && now - pState->lastTick < PREWARM_HOLD_MS;
+}
+
+// Have every hidden window repaint while still out of sight; returns how many
+// Off-screen windows render into their redirection surface, so the first frame
+// after the restore is current. Cloaked ones repaint too, but WebView2 content
+// stays occluded until the uncloak.
+int RepaintHiddenWindows(const TrayModel* pModel) {
+    for (int i = 0; i < pModel->hiddenCount; i++) {
+        OsRepaintWindow(pModel->hidden[i].hwnd);
+    }
+    return pModel->hiddenCount;
+}
+
+// Replace the model with a fresh snapshot; TRUE if what the tray shows changed
+BOOL TrayModelUpdate(TrayModel* pModel, BOOL outlookRunning,
+                     const HiddenWindowInfo* pWindows, int count) {
+    BOOL changed = pModel->outlookRunning != outlookRunning || pModel->hiddenCount != count;
+    for (int i = 0; i < count && !changed; i++) {
+        changed = pModel->hidden[i].hwnd != pWindows[i].hwnd;
+    }
+    pModel->outlookRunning = outlookRunning;
+    pModel->hiddenCount = count;
+    for (int i = 0; i < count; i++) {
+        pModel->hidden[i] = pWindows[i];
+    }
+    return changed;
+}
+
+// Most recently hidden window of a rule (-1 for any rule), or NULL
+// The model is sorted oldest first
+const HiddenWindowInfo* NewestHiddenWindow(const TrayModel* pModel, int rule) {
+    for (int i = pModel->hiddenCount - 1; i >= 0; i--) {
+        if (rule < 0 || pModel->hidden[i].rule == rule) return &pModel->hidden[i];
+    }
+    return NULL;
+}
+
+// Set the unread count; TRUE if it changed
+BOOL TrayModelSetUnread(TrayModel* pModel, int unreadCount) {
+    BOOL changed = pModel->unreadCount != unreadCount;
+    pModel->unreadCount = unreadCount;
+    return changed;
+}
+
+// Tooltip for the current model
+void FormatTrayTooltip(const TrayModel* pModel, wchar_t* text, int size) {
+    wchar_t unread[32] = L"";
+    if (pModel->unreadCount > 0) {
+        swprintf(unread, 32, L" (%d unread)", pModel->unreadCount);
+    }
+    if (pModel->hiddenCount > 0) {
+        swprintf(text, size, L"Outlook to Tray - %d window%ls hidden%ls", pModel->hiddenCount,
+                 pModel->hiddenCount == 1 ? L"" : L"s", unread);
+    }
+    else if (pModel->outlookRunning) {
+        swprintf(text, size, L"Outlook to Tray - Outlook open%ls", unread);
+    }
+    else {
+        swprintf(text, size, L"Outlook to Tray - Outlook not running");
+    }
+}
+
+// Unread count in a title such as "Inbox (3) - Outlook"; -1 if there is none
+int ParseUnreadCount(const wchar_t* title) {
+    for (const wchar_t* p = title; *p; p++) {
+        if (*p != L'(' || p[1] < L'0' || p[1] > L'9') {
+            continue;
+        }
+        int count = 0;
+        const wchar_t* q = p + 1;
+        for (; *q >= L'0' && *q <= L'9'; q++) {
+            if (count < 100000) {
+                count = count * 10 + (*q - L'0');
+            }
+        }
+        if (*q == L')') {
+            return count;
+        }
+    }
+    return -1;
+}
+
+// A window title changed; TRUE if the unread count changed
+BOOL UnreadOnTitleChange(UnreadTracker* pTracker, HWND hwnd, const wchar_t* title) {
+    int count = ParseUnreadCount(title);
+    if (count >= 0) {
+        pTracker->source = hwnd;
+    }
+    else if (hwnd == pTracker->source) {
+        count = 0;
+    }
+    else {
+        return FALSE;
+    }
+    BOOL changed = pTracker->count != count;
+    pTracker->count = count;
+    return changed;
+}
+
+// Badge icon index for an unread count (0 = no badge)
+int BadgeIndex(int unreadCount) {
+    if (unreadCount <= 0) return 0;
+    return unreadCount <= MAX_BADGE_NUMBER ? unreadCount : MAX_BADGE_NUMBER + 1;
+}
+
+void FormatBadgeLabel(int badgeIndex, wchar_t* text, int size) {
+    if (badgeIndex > MAX_BADGE_NUMBER) {
+        swprintf(text, size, L"%d+", MAX_BADGE_NUMBER);
+    }
+    else {
+        swprintf(text, size, L"%d", badgeIndex);
+    }
+}
+
+// Coalesce icon updates: at most one per TRAY_UPDATE_INTERVAL_MS
+TrayUpdateAction TrayUpdateRequest(TrayUpdateLimiter* pLimiter, ULONGLONG now, ULONGLONG* pDelay) {
+    if (pLimiter->pending) {
+        return TRAY_UPDATE_PENDING;
+    }
+    ULONGLONG elapsed = now - pLimiter->lastUpdateTick;
+    if (pLimiter->lastUpdateTick == 0 || elapsed >= TRAY_UPDATE_INTERVAL_MS) {
+        pLimiter->lastUpdateTick = now;
+        return TRAY_UPDATE_NOW;
+    }
+    pLimiter->pending = TRUE;
+    *pDelay = TRAY_UPDATE_INTERVAL_MS - elapsed;
+    return TRAY_UPDATE_LATER;
+}
+
+void TrayUpdateTimerFired(TrayUpdateLimiter* pLimiter, ULONGLONG now) {
+    pLimiter->pending = FALSE;
+    pLimiter->lastUpdateTick = now;
+}
+
+// Explorer restarted (or never had the icon): it has to be added again
+void TrayIconLost(TrayIconState* pState) {
+    pState->added = FALSE;
+    pState->attempts = 0;
+}
+
+// Outcome of one NIM_ADD at 'now' (FILETIME)
+// Backs off so a logon with a slow Explorer costs a few calls, not a busy loop;
+// the TaskbarCreated broadcast cuts the wait short once Explorer is up
+ULONGLONG TrayIconAddResult(TrayIconState* pState, BOOL added, ULONGLONG now) {
+    pState->attempts++;
+    if (added) {
+        pState->added = TRUE;
+        if (!pState->iconVisible) {
+            pState->iconVisible = now;
+            pState->startupAttempts = pState->attempts;
+        }
+        return 0;
+    }
+    ULONGLONG delay = ICON_RETRY_FIRST_MS;
+    for (int i = 1; i < pState->attempts && delay < ICON_RETRY_MAX_MS; i++) {
+        delay *= 2;
+    }
+    return delay < ICON_RETRY_MAX_MS ? delay : ICON_RETRY_MAX_MS;
+}
+
+// Outlook's process followed by its WebView2 descendants, from a process list
+// Breadth-first over parent ids; a reused parent id cannot loop because ids
+// already collected are skipped
+int CollectProcessTree(const ProcessLink* links, int linkCount, DWORD rootId,
+                       DWORD* processIds, int maxIds) {
+    if (maxIds <= 0) return 0;
+    int count = 0;
+    processIds[count++] = rootId;
+    for (int next = 0; next < count; next++) {
+        for (int i = 0; i < linkCount && count < maxIds; i++) {
+            if (links[i].parentId != processIds[next] || !links[i].webView) continue;
+            bool known = false;
+            for (int j = 0; j < count && !known; j++) known = (processIds[j] == links[i].processId);
+            if (!known) processIds[count++] = links[i].processId;
+        }
+    }
+    return count;
+}
+
+// When the next trim is due (tick), or 0 if none is
+ULONGLONG TrimDueTick(const TrimPolicy* pPolicy, const TrayModel* pModel, ULONGLONG lastTrimTick) {
+    const HiddenWindowInfo* pNewest = NewestHiddenWindow(pModel, RULE_OUTLOOK);
+    if (pPolicy->delayMs == 0 || !pNewest) {
+        return 0;
+    }
+    ULONGLONG firstTrim = pNewest->hiddenTick + pPolicy->delayMs;
+    if (lastTrimTick < firstTrim) {
+        return firstTrim;       // Not trimmed since this hide settled
+    }
+    return pPolicy->intervalMs ? lastTrimTick + pPolicy->intervalMs : 0;
+}
+
+// Empty the working sets of Outlook and its WebView2 processes
+void TrimProcessTree(DWORD rootId, TrimReport* pReport) {
+    ProcessLink links[MAX_PROCESS_LINKS];
+    DWORD processIds[MAX_TREE_PROCESSES];
+    int linkCount = OsListProcesses(links, MAX_PROCESS_LINKS);
+    int count = CollectProcessTree(links, linkCount, rootId, processIds, MAX_TREE_PROCESSES);
+
+    *pReport = TrimReport();
+    for (int i = 0; i < count; i++) {
+        ULONGLONG released = 0;
+        if (OsTrimWorkingSet(processIds[i], &released)) {
+            pReport->trimmed++;
+            pReport->bytesReleased += released;
+        }
+        else {
+            pReport->skipped++;
+        }
+    }
+}
+
+// Add a trim to the history
+void RecordTrim(TrimHistory* pHistory, const TrimReport* pReport) {
+    pHistory->recent[pHistory->trims % TRIM_HISTORY_SIZE] = *pReport;
+    pHistory->trims++;
+    pHistory->totalBytes += pReport->bytesReleased;
+}
+
+// Put one process of the tree in efficiency mode; its times are read by the next sample
+static void AddThrottledProcess(ThrottleState* pState, DWORD processId) {
+    ThrottledProcess* pProcess = &pState->processes[pState->count++];
+    *pProcess = ThrottledProcess();
+    pProcess->processId = processId;
+    if (pState->efficient) {
+        OsEnterEfficiencyMode(processId, &pProcess->lowered);
+    }
+}
+
+// Read CPU and GPU time of every process in the tree (one GPU counter query)
+static void SampleThrottledProcesses(ThrottleState* pState) {
+    DWORD processIds[MAX_TREE_PROCESSES];
+    ULONGLONG gpuTimes[MAX_TREE_PROCESSES];
+    for (int i = 0; i < pState->count; i++) {
+        processIds[i] = pState->processes[i].processId;
+        OsGetProcessCpuTime(processIds[i], &pState->processes[i].lastCpu);
+    }
+    if (OsGetProcessGpuTimes(processIds, pState->count, gpuTimes)) {
+        for (int i = 0; i < pState->count; i++) {
+            pState->processes[i].lastGpu = gpuTimes[i];
+        }
+    }
+}
+
+// Outlook was hidden: start measuring its tree, in efficiency mode if 'efficient'
+void ThrottleStart(ThrottleState* pState, DWORD rootId, BOOL efficient, ULONGLONG now) {
+    ProcessLink links[MAX_PROCESS_LINKS];
+    DWORD processIds[MAX_TREE_PROCESSES];
+    int linkCount = OsListProcesses(links, MAX_PROCESS_LINKS);
+    int count = CollectProcessTree(links, linkCount, rootId, processIds, MAX_TREE_PROCESSES);
+
+    pState->active = TRUE;
+    pState->efficient = efficient;
+    pState->startTick = now;
+    pState->exitedCpu = 0;
+    pState->exitedGpu = 0;
+    pState->count = 0;
+    for (int i = 0; i < count; i++) {
+        AddThrottledProcess(pState, processIds[i]);
+    }
+    SampleThrottledProcesses(pState);
+    for (int i = 0; i < pState->count; i++) {
+        pState->processes[i].startCpu = pState->processes[i].lastCpu;
+        pState->processes[i].startGpu = pState->processes[i].lastGpu;
+    }
+}
+
+// Re-read the tree: take in new processes, account for the ones that exited
+// Processes found later were born while hidden, so all their time counts
+void ThrottleRescan(ThrottleState* pState, DWORD rootId) {
+    if (!pState->active) return;
+    ProcessLink links[MAX_PROCESS_LINKS];
+    DWORD processIds[MAX_TREE_PROCESSES];
+    int linkCount = OsListProcesses(links, MAX_PROCESS_LINKS);
+    int count = CollectProcessTree(links, linkCount, rootId, processIds, MAX_TREE_PROCESSES);
+
+    // Gone: keep the times last read (what it used since then is lost)
+    int kept = 0;
+    for (int i = 0; i < pState->count; i++) {
+        const ThrottledProcess* pProcess = &pState->processes[i];
+        bool present = false;
+        for (int j = 0; j < count && !present; j++) present = (processIds[j] == pProcess->processId);
+        if (present) {
+            pState->processes[kept++] = *pProcess;
+        }
+        else {
+            pState->exitedCpu += pProcess->lastCpu - pProcess->startCpu;
+            pState->exitedGpu += pProcess->lastGpu - pProcess->startGpu;
+        }
+    }
+    pState->count = kept;
+
+    for (int j = 0; j < count && pState->count < MAX_TREE_PROCESSES; j++) {
+        bool known = false;
+        for (int i = 0; i < pState->count && !known; i++) known = (pState->processes[i].processId == processIds[j]);
+        if (!known) {
+            AddThrottledProcess(pState, processIds[j]);
+        }
+    }
+    SampleThrottledProcesses(pState);
+}
+
+// Add the running period (sampled now) to 'pTotal' without ending it
+void ThrottleMeasure(ThrottleState* pState, ULONGLONG now, HiddenCpu* pTotal) {
+    if (!pState->active) return;
+    SampleThrottledProcesses(pState);
+    ThrottleTotal(pState, now, pTotal);
+}
+
+// Add the running period, as of the last sample, to 'pTotal'; reads no counters
+void ThrottleTotal(const ThrottleState* pState, ULONGLONG now, HiddenCpu* pTotal) {
+    if (!pState->active) return;
+    ULONGLONG cpuTime = pState->exitedCpu;
+    ULONGLONG gpuTime = pState->exitedGpu;
+    for (int i = 0; i < pState->count; i++) {
+        cpuTime += pState->processes[i].lastCpu - pState->processes[i].startCpu;
+        gpuTime += pState->processes[i].lastGpu - pState->processes[i].startGpu;
+    }
+    pTotal->periods++;
+    pTotal->hiddenMs += now - pState->startTick;
+    pTotal->cpuTime += cpuTime;
+    pTotal->gpuTime += gpuTime;
+}
+
+// Outlook is about to be shown: leave efficiency mode right away, without
+// sampling; ThrottleStop adds the period to the totals afterwards
+void ThrottleLift(const ThrottledProcess* processes, int count) {
+    for (int i = 0; i < count; i++) {
+        OsLeaveEfficiencyMode(processes[i].processId, processes[i].lowered);
+    }
+}
+
+// Outlook is about to be shown: leave efficiency mode and add the period to 'pTotal'
+// Leaving again after a ThrottleLift changes nothing
+void ThrottleStop(ThrottleState* pState, ULONGLONG now, HiddenCpu* pTotal) {
+    if (!pState->active) return;
+    // Full speed first: this may run right before the restore
+    if (pState->efficient) {
+        ThrottleLift(pState->processes, pState->count);
+    }
+    ThrottleMeasure(pState, now, pTotal);
+    pState->active = FALSE;
+    pState->count = 0;
+}
+
+// Append formatted text, never overrunning the buffer
+void AppendText(wchar_t* text, int size, int* pLength, const wchar_t* format, ...) {
+    if (*pLength >= size - 1) return;
+    va_list args;
+    va_start(args, format);
+    int written = vswprintf(text + *pLength, size - *pLength, format, args);
+    va_end(args);
+    if (written < 0) {
+        // Did not fit: keep what was written, terminated at the end of the buffer
+        text[size - 1] = L'\0';
+        *pLength = size - 1;
+    }
+    else {
+        *pLength += written;
+    }
+}
+
+// One line of click-to-visible latency for a restore path
+// Returns the number of characters written
+int FormatRestoreTiming(const wchar_t* label, const RestoreTiming* pTiming, LONGLONG frequency,
+                        wchar_t* text, int size) {
+    int length = 0;
+    text[0] = L'\0';
+    if (pTiming->count == 0 || frequency <= 0) {
+        AppendText(text, size, &length, L"%ls: none yet\n", label);
+        return length;
+    }
+    double msPerTick = 1000.0 / (double)frequency;
+    AppendText(text, size, &length, L"%ls: %llu, mean %.2f ms, max %.2f ms\n", label,
+               pTiming->count, (double)pTiming->totalTicks * msPerTick / (double)pTiming->count,
+               (double)pTiming->maxTicks * msPerTick);
+    return length;
+}
+
+// Render aggregated hook counters as text for the Diagnostics view and dump
+// Returns the number of characters written
+int FormatHookStats(const HookStats* pTotal, int liveProcesses, LONG uncountedProcesses,
+                    LONGLONG frequency, wchar_t* text, int size) {
+    int length = 0;
+    double nsPerTick = frequency > 0 ? 1e9 / (double)frequency : 0.0;
+    text[0] = L'\0';
+
+    AppendText(text, size, &length,
+        L"Processes with the hook loaded: %d (%ld more not counted)\n"
+        L"Messages seen: %llu\n"
+        L"Outlook messages: %llu\n"
+        L"Subclass installs: %llu\n"
+        L"Hides: %llu\n"
+        L"Restores: %llu\n",
+        liveProcesses, (long)uncountedProcesses, pTotal->messagesSeen, pTotal->outlookMessages,
+        pTotal->subclassInstalls, pTotal->hides, pTotal->restores);
+    length += FormatRestoreTiming(L"In-process restores, off-screen (click to visible)",
+                                  &pTotal->inProcessRestore, frequency, text + length, size - length);
+    length += FormatRestoreTiming(L"In-process restores, cloaked (click to visible)",
+                                  &pTotal->cloakedRestore, frequency, text + length, size - length);
+    length += FormatRestoreTiming(L"Click to first paint, cold",
+                                  &pTotal->firstPaint[0], frequency, text + length, size - length);
+    length += FormatRestoreTiming(L"Click to first paint, pre-warmed on hover",
+                                  &pTotal->firstPaint[1], frequency, text + length, size - length);
+
+    if (pTotal->outlookMessages == 0) {
+        AppendText(text, size, &length, L"No Outlook messages timed yet.\n");
+        return length;
+    }
+
+    // A tick is usually 100 ns; the mean is still exact because tick
+    // boundaries fall at random points of each call
+    AppendText(text, size, &length,
+        L"Mean Outlook-path time: %.1f ns (timer resolution %.0f ns)\n"
+        L"Outlook-path time histogram:\n",
+        (double)pTotal->hookTicks * nsPerTick / (double)pTotal->outlookMessages, nsPerTick);
+    for (int b = 0; b < HOOK_HISTOGRAM_BUCKETS; b++) {
+        if (pTotal->histogram[b] == 0) continue;
+        double upper = (double)(1ULL << b) * nsPerTick;
+        if (b == 0) {
+            AppendText(text, size, &length, L"  < %.0f ns: %llu\n", upper, pTotal->histogram[b]);
+        }
+        else {
+            double lower = (double)(1ULL << (b - 1)) * nsPerTick;
+            AppendText(text, size, &length, L"  %.0f - %.0f ns: %llu\n", lower, upper,
+                       pTotal->histogram[b]);
+        }
+    }
+    return length;
+}
+
+// Trim settings and history as text for the Diagnostics view
+// Returns the number of characters written
+int FormatTrimHistory(const TrimPolicy* pPolicy, const TrimHistory* pHistory, wchar_t* text, int size) {
+    const double MB = 1024.0 * 1024.0;
+    int length = 0;
+    text[0] = L'\0';
+    if (pPolicy->delayMs == 0) {
+        AppendText(text, size, &length, L"Working-set trimming: off\n");
+        return length;
+    }
+    AppendText(text, size, &length, L"Working-set trimming: after %llu s hidden", pPolicy->delayMs / 1000);
+    if (pPolicy->intervalMs) {
+        AppendText(text, size, &length, L", then every %llu s\n", pPolicy->intervalMs / 1000);
+    }
+    else {
+        AppendText(text, size, &length, L", once\n");
+    }
+    AppendText(text, size, &length, L"Trims: %llu, %.1f MB reclaimed in total\n",
+               pHistory->trims, (double)pHistory->totalBytes / MB);
+
+    // Newest first
+    ULONGLONG shown = pHistory->trims < TRIM_HISTORY_SIZE ? pHistory->trims : TRIM_HISTORY_SIZE;
+    for (ULONGLONG n = 0; n < shown; n++) {
+        const TrimReport* pReport = &pHistory->recent[(pHistory->trims - 1 - n) % TRIM_HISTORY_SIZE];
+        AppendText(text, size, &length, L"  %.1f MB from %d process(es)",
+                   (double)pReport->bytesReleased / MB, pReport->trimmed);
+        if (pReport->skipped) {
+            AppendText(text, size, &length, L", %d not accessible", pReport->skipped);
+        }
+        AppendText(text, size, &length, L"\n");
+    }
+    return length;
+}
+
+// One line of CPU and GPU use while Outlook was hidden
+// Returns the number of characters written
+int FormatHiddenCpu(const wchar_t* label, const HiddenCpu* pCpu, wchar_t* text, int size) {
+    int length = 0;
+    text[0] = L'\0';
+    if (pCpu->periods == 0 || pCpu->hiddenMs == 0) {
+        AppendText(text, size, &length, L"%ls: none yet\n", label);
+        return length;
+    }
+    // Times are in 100 ns units
+    AppendText(text, size, &length,
+               L"%ls: %.1f s CPU, %.1f s GPU over %.1f min hidden (%.2f%% of one core), %llu period(s)\n",
+               label, (double)pCpu->cpuTime / 1e7, (double)pCpu->gpuTime / 1e7,
+               (double)pCpu->hiddenMs / 60000.0, (double)pCpu->cpuTime / 100.0 / (double)pCpu->hiddenMs,
+               pCpu->periods);
+    return length;
+}
+
+// Startup milestones and icon registrations as text for the Diagnostics view
+// Returns the number of characters written
+int FormatStartupTimes(const TrayIconState* pState, wchar_t* text, int size) {
+    int length = 0;
+    text[0] = L'\0';
+    // FILETIME units are 100 ns
+    if (pState->processStart && pState->windowCreated >= pState->processStart) {
+        AppendText(text, size, &length, L"Startup: window after %.0f ms",
+                   (double)(pState->windowCreated - pState->processStart) / 1e4);
+    }
+    else {
+        AppendText(text, size, &length, L"Startup: start time unknown");
+    }
+    if (pState->iconVisible && pState->iconVisible >= pState->processStart) {
+        AppendText(text, size, &length, L", tray icon after %.0f ms (%d attempt(s))\n",
+                   (double)(pState->iconVisible - pState->processStart) / 1e4, pState->startupAttempts);
+    }
+    else {
+        AppendText(text, size, &length, L", tray icon not added yet (%d attempt(s))\n", pState->attempts);
+    }
+    AppendText(text, size, &length, L"Explorer restarts: %d, icon %ls\n", pState->explorerRestarts,
+               pState->added ? L"shown" : L"being re-added");
+    return length;
+}
+
+// Queue a copy of 'pItem'; FALSE if the queue is full
+// The item is written before the tail moves, so the worker never sees half of it
+BOOL WorkQueuePush(WorkQueue* pQueue, const WorkItem* pItem) {
+    LONG tail = pQueue->tail;
+    if (tail - pQueue->head >= WORK_QUEUE_SIZE) {
+        return FALSE;
+    }
+    pQueue->items[tail & (WORK_QUEUE_SIZE - 1)] = *pItem;
+    MemoryBarrier();
+    pQueue->tail = tail + 1;
+    return TRUE;
+}
+
+// Take the oldest item; FALSE if there is none
+BOOL WorkQueuePop(WorkQueue* pQueue, WorkItem* pItem) {
+    LONG head = pQueue->head;
+    if (head == pQueue->tail) {
+        return FALSE;
+    }
+    MemoryBarrier();
+    *pItem = pQueue->items[head & (WORK_QUEUE_SIZE - 1)];
+    MemoryBarrier();
+    pQueue->head = head + 1;
+    return TRUE;
+}
+
+// Count one dispatched message that took 'ticks'; TRUE if it was a stall
+BOOL RecordDispatch(StallStats* pStats, UINT message, LONGLONG ticks, LONGLONG frequency) {
+    pStats->dispatched++;
+    if ((ULONGLONG)ticks > pStats->maxTicks) {
+        pStats->maxTicks = (ULONGLONG)ticks;
+        pStats->maxMessage = message;
+    }
+    if (ticks * 1000 <= frequency * STALL_THRESHOLD_MS) {
+        return FALSE;
+    }
+    pStats->stalls++;
+    return TRUE;
+}
+
+// Stall counts as text for the Diagnostics view
+// Returns the number of characters written
+int FormatStallStats(const StallStats* pStats, LONGLONG frequency, wchar_t* text, int size) {
+    int length = 0;
+    text[0] = L'\0';
+    AppendText(text, size, &length, L"UI thread: %llu message(s), %llu over %d ms",
+               pStats->dispatched, pStats->stalls, STALL_THRESHOLD_MS);
+    if (pStats->dispatched > 0) {
+        AppendText(text, size, &length, L", longest %.2f ms (message 0x%04X)",
+                   (double)pStats->maxTicks * 1000.0 / (double)frequency, pStats->maxMessage);
+    }
+    AppendText(text, size, &length, L"\n");
+    return length;
+}
+
+// Hide when Outlook owns the foreground, restore when it has windows hidden,
+// otherwise leave it to the shell, which activates or launches Outlook
+int ChooseHotkeyAction(const TrayModel* pModel, DWORD outlookPid, DWORD foregroundPid) {
+    if (outlookPid && foregroundPid == outlookPid) {
+        return HOTKEY_HIDE;
+    }
+    if (outlookPid && NewestHiddenWindow(pModel, RULE_OUTLOOK)) {
+        return HOTKEY_RESTORE;
+    }
+    return HOTKEY_OPEN;
+}
+
+// A press started 'action'; one still in progress is given up
+void HotkeyStart(HotkeyToggle* pToggle, int action, int windows, LONGLONG startTicks) {
+    pToggle->presses++;
+    if (pToggle->action != HOTKEY_NONE) {
+        pToggle->unfinished++;
+    }
+    pToggle->action = windows > 0 ? action : HOTKEY_NONE;
+    pToggle->pending = windows;
+    pToggle->startTicks = startTicks;
+}
+
+// The toggle in progress is done
+LONGLONG HotkeyFinish(HotkeyToggle* pToggle, LONGLONG now, LONGLONG frequency) {
+    LONGLONG ticks = now - pToggle->startTicks;
+    RecordRestoreTime(&pToggle->timing[pToggle->action == HOTKEY_HIDE ? 0 : 1], ticks);
+    if (ticks * 1000 > frequency * HOTKEY_BUDGET_MS) {
+        pToggle->overBudget++;
+    }
+    pToggle->action = HOTKEY_NONE;
+    pToggle->pending = 0;
+    return ticks;
+}
+
+// One of the windows the toggle waits for was hidden or restored
+LONGLONG HotkeyOnNotify(HotkeyToggle* pToggle, UINT event, LONGLONG now, LONGLONG frequency) {
+    UINT expected = pToggle->action == HOTKEY_HIDE ? TRAY_NOTIFY_WINDOW_HIDDEN : TRAY_NOTIFY_WINDOW_RESTORED;
+    if (pToggle->action == HOTKEY_NONE || event != expected || --pToggle->pending > 0) {
+        return -1;
+    }
+    return HotkeyFinish(pToggle, now, frequency);
+}
+
+// Presses and latency as text for the Diagnostics view
+// Returns the number of characters written
+int FormatHotkeyStats(const HotkeyToggle* pToggle, LONGLONG frequency, wchar_t* text, int size) {
+    int length = 0;
+    text[0] = L'\0';
+    AppendText(text, size, &length, L"Hotkey presses: %llu, %llu over %d ms, %llu unfinished\n",
+               pToggle->presses, pToggle->overBudget, HOTKEY_BUDGET_MS, pToggle->unfinished);
+    length += FormatRestoreTiming(L"Hotkey hides (key to hidden)", &pToggle->timing[0], frequency,
+                                  text + length, size - length);
+    length += FormatRestoreTiming(L"Hotkey restores (key to visible)", &pToggle->timing[1], frequency,
+                                  text + length, size - length);
+    return length;
+}
+
+// Wait for the rest of the threshold; once it has passed, for a whole one again,
+// so a user away for hours costs one wake-up per threshold
+DWORD AutoHideIdleDue(DWORD thresholdMs, DWORD idleMs) {
+    if (thresholdMs == 0) {
+        return 0;
+    }
+    DWORD due = idleMs < thresholdMs ? thresholdMs - idleMs : thresholdMs;
+    return due < AUTOHIDE_MIN_CHECK_MS ? AUTOHIDE_MIN_CHECK_MS : due;
+}
+
+// Outlook's windows were asked to hide for 'reason'
+void AutoHideStart(AutoHideState* pState, int reason) {
+    pState->requested = reason;
+}
+
+// The first hidden window puts a requested hide in effect; the first restore of
+// one of Outlook's windows ends it: the user is back
+LONGLONG AutoHideOnNotify(AutoHideState* pState, UINT event, ULONGLONG now) {
+    if (pState->requested != AUTOHIDE_NONE) {
+        if (event == TRAY_NOTIFY_WINDOW_HIDDEN) {
+            pState->reason = pState->requested;
+            pState->startTick = now;
+            pState->hides[pState->reason]++;
+        }
+        if (event != TRAY_NOTIFY_WINDOW_DESTROYED) {
+            pState->requested = AUTOHIDE_NONE;  // Took effect, or the user came back first
+        }
+        return -1;
+    }
+    if (pState->reason == AUTOHIDE_NONE ||
+        (event != TRAY_NOTIFY_WINDOW_RESTORED && event != TRAY_NOTIFY_OUTLOOK_EXITED)) {
+        return -1;
+    }
+    ULONGLONG hiddenMs = now - pState->startTick;
+    pState->reason = AUTOHIDE_NONE;
+    pState->ended++;
+    pState->hiddenMs += hiddenMs;
+    if (hiddenMs > pState->longestMs) {
+        pState->longestMs = hiddenMs;
+    }
+    return (LONGLONG)hiddenMs;
+}
+
+// Hides per reason and time hidden as text for the Diagnostics view
+// Returns the number of characters written
+int FormatAutoHideStats(const AutoHideState* pState, ULONGLONG now, wchar_t* text, int size) {
+    int length = 0;
+    text[0] = L'\0';
+    AppendText(text, size, &length, L"Automatic hides: %llu idle, %llu locked, %llu display off; "
+               L"%llu over, %.1f min hidden in total, longest %.1f min\n",
+               pState->hides[AUTOHIDE_IDLE], pState->hides[AUTOHIDE_LOCKED], pState->hides[AUTOHIDE_DISPLAY_OFF],
+               pState->ended, pState->hiddenMs / 60000.0, pState->longestMs / 60000.0);
+    if (pState->reason != AUTOHIDE_NONE) {
+        AppendText(text, size, &length, L"  Hidden automatically for %.1f min now\n",
+                   (now - pState->startTick) / 60000.0);
+    }
+    return length;
+}
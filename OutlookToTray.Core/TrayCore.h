@@ -0,0 +1,423 @@
+/*
+ * Outlook to Tray - Tray Logic
+ * Outlook process tracking and window restore, as used by the tray app
+ */
+
+#ifndef OUTLOOKTOTRAY_TRAYCORE_H
+#define OUTLOOKTOTRAY_TRAYCORE_H
+
+#include "Platform.h"
+#include "SharedState.h"
+#include "Os.h"
+
+#define MAX_UI_THREADS      32
+
+// Badge icons: 1-9 shown as the number, anything above as "9+"
+#define MAX_BADGE_NUMBER    9
+#define BADGE_COUNT         (MAX_BADGE_NUMBER + 2)  // Index 0 is "no badge"
+
+// Minimum time between two icon updates sent to Explorer
+#define TRAY_UPDATE_INTERVAL_MS 250
+
+// Tray icon registration retries: the first after this, then doubling up to the cap
+#define ICON_RETRY_FIRST_MS 250
+#define ICON_RETRY_MAX_MS   8000
+
+// Working-set trimming while Outlook is hidden (settings defaults)
+#define DEFAULT_TRIM_DELAY_SECONDS      600     // 0 turns trimming off
+#define DEFAULT_TRIM_INTERVAL_SECONDS   1800    // 0 trims once per hide
+#define MAX_PROCESS_LINKS   1024    // Process list rows read per trim
+#define MAX_TREE_PROCESSES  64      // Outlook plus its WebView2 processes
+#define TRIM_HISTORY_SIZE   8       // Trims kept for the Diagnostics view
+
+// New WebView2 processes do not announce themselves; while Outlook is hidden
+// the tree is re-read this often to throttle and measure them too
+#define THROTTLE_RESCAN_MS  30000
+
+// Pre-warming: the pointer over the tray icon lifts efficiency mode and has the
+// hidden windows repaint, so the click that usually follows shows a current frame
+#define PREWARM_HOLD_MS     5000    // Efficiency mode stays off this long after the last hover
+#define PREWARM_INTERVAL_MS 1000    // Hovers closer together than this do not repaint again
+
+// What the tracker wants the caller to do after an event
+enum TrackerAction {
+    TRACKER_NONE,
+    TRACKER_STARTED,            // Outlook found: hook its threads, wait on its process
+    TRACKER_THREADS_CHANGED     // New UI thread: re-apply thread hooks
+};
+
+// The Outlook process being tracked and its known UI threads, plus the UI
+// threads of the other target apps' processes
+// Threads of target processes of the other bitness are left unhooked: the DLL
+// cannot load there, so Windows would call the hook back in the tray for
+// every message they handle, and the app would wait on the tray each time
+struct OutlookTracker {
+    RuleTable rules;            // What to track; empty means olk.exe only
+    DWORD processId;            // 0 while Outlook is not running
+    BOOL outlookOtherBitness;   // Outlook's threads go to skippedThreads
+    DWORD uiThreads[MAX_UI_THREADS];
+    int uiThreadCount;
+    DWORD appThreads[MAX_UI_THREADS];
+    int appThreadCount;
+    DWORD skippedThreads[MAX_UI_THREADS];
+    int skippedThreadCount;
+};
+
+// What the tray shows, kept current by TRAY_NOTIFY_MESSAGE
+struct TrayModel {
+    BOOL outlookRunning;
+    int unreadCount;
+    int hiddenCount;
+    HiddenWindowInfo hidden[MAX_HIDDEN_WINDOWS];    // Oldest first
+};
+
+// Unread count as read from Outlook's window titles
+struct UnreadTracker {
+    HWND source;                // Window whose title last carried a count
+    int count;
+};
+
+// Outcome of asking for an icon update
+enum TrayUpdateAction {
+    TRAY_UPDATE_NOW,            // Send it now
+    TRAY_UPDATE_LATER,          // Arm a timer for the returned delay
+    TRAY_UPDATE_PENDING         // A timer is already armed; it will pick this up
+};
+
+// Rate limiter for icon updates
+struct TrayUpdateLimiter {
+    ULONGLONG lastUpdateTick;
+    BOOL pending;
+};
+
+// Our icon in Explorer's notification area, and how long startup took
+// Times are FILETIME values (100 ns units); 0 until reached
+struct TrayIconState {
+    BOOL added;                 // Explorer has the icon
+    int attempts;               // NIM_ADD calls for the registration in progress
+    int startupAttempts;        // Calls the first registration took
+    int explorerRestarts;       // TaskbarCreated broadcasts seen
+    ULONGLONG processStart;
+    ULONGLONG windowCreated;
+    ULONGLONG iconVisible;      // First successful registration
+};
+
+// When to trim, in milliseconds
+struct TrimPolicy {
+    ULONGLONG delayMs;          // Hidden this long before the first trim; 0 = never
+    ULONGLONG intervalMs;       // Then again this often while still hidden; 0 = once
+};
+
+// Outcome of one trim of the Outlook process tree
+struct TrimReport {
+    int trimmed;                // Processes whose working set was emptied
+    int skipped;                // Processes that could not be opened
+    ULONGLONG bytesReleased;
+};
+
+// Trims done since the tray started
+struct TrimHistory {
+    ULONGLONG trims;
+    ULONGLONG totalBytes;
+    TrimReport recent[TRIM_HISTORY_SIZE];   // Ring, newest at (trims - 1) % size
+};
+
+// One process of the hidden Outlook tree
+struct ThrottledProcess {
+    DWORD processId;
+    BOOL lowered;               // We lowered its priority and raise it again
+    ULONGLONG startCpu;         // CPU time when the hidden period began for it
+    ULONGLONG lastCpu;          // Latest reading
+    ULONGLONG startGpu;         // The same for GPU engine time
+    ULONGLONG lastGpu;
+};
+
+// Hover pre-warming
+struct PrewarmState {
+    ULONGLONG lastTick;         // Last pre-warm; 0 while none is in effect
+    ULONGLONG prewarms;         // Since the tray started
+    ULONGLONG used;             // Followed by a restore while still in effect
+};
+
+// CPU and GPU time the Outlook tree used while hidden, for one combination of
+// hide mode and efficiency mode
+struct HiddenCpu {
+    ULONGLONG periods;
+    ULONGLONG hiddenMs;
+    ULONGLONG cpuTime;          // 100 ns units, all processes together
+    ULONGLONG gpuTime;          // 100 ns units, all processes and GPU engines together
+};
+
+// The Outlook tree while it is hidden
+struct ThrottleState {
+    BOOL active;
+    BOOL efficient;             // Efficiency mode applied (otherwise only measured)
+    ULONGLONG startTick;
+    ULONGLONG exitedCpu;        // CPU time of processes that exited during the period
+    ULONGLONG exitedGpu;
+    ThrottledProcess processes[MAX_TREE_PROCESSES];
+    int count;
+};
+
+// Check if a process is the target (olk.exe unless configured), without walking the process list
+BOOL IsOutlookPid(DWORD processId, const wchar_t* targetImage);
+
+// Start tracking a running Outlook process
+TrackerAction TrackerStart(OutlookTracker* pTracker, DWORD processId);
+
+// Outlook exited
+void TrackerStop(OutlookTracker* pTracker);
+
+// Window-creation event: Outlook starting, or a target app opening a new UI thread
+// Events are only desktop-wide while Outlook is not running or other apps are targeted
+TrackerAction TrackerOnWindowCreated(OutlookTracker* pTracker, HWND hwnd, DWORD threadId);
+
+// New rules: forget the other apps' threads and look for their running processes
+// One process list walk per rule besides Outlook's
+TrackerAction TrackerSetRules(OutlookTracker* pTracker, const RuleTable* pRules);
+
+// The image name the tracker looks for as Outlook
+const wchar_t* TrackerOutlookImage(const OutlookTracker* pTracker);
+
+// Most recently hidden window of a rule (-1 for any rule), or NULL
+const HiddenWindowInfo* NewestHiddenWindow(const TrayModel* pModel, int rule);
+
+// Pointer over the tray icon: TRUE if the hidden windows should be pre-warmed now
+BOOL PrewarmOnHover(PrewarmState* pState, ULONGLONG now);
+
+// A restore is starting: TRUE if a pre-warm was still in effect; it ends here
+BOOL PrewarmOnRestore(PrewarmState* pState, ULONGLONG now);
+
+// TRUE while a pre-warm keeps efficiency mode off
+BOOL PrewarmHolding(const PrewarmState* pState, ULONGLONG now);
+
+// Have every hidden window repaint while still out of sight; returns how many
+int RepaintHiddenWindows(const TrayModel* pModel);
+
+// Bring one hidden window back to where it was
+void RestoreWindow(const HiddenWindowInfo* pInfo);
+
+// Replace the model with a fresh snapshot; TRUE if what the tray shows changed
+BOOL TrayModelUpdate(TrayModel* pModel, BOOL outlookRunning,
+                     const HiddenWindowInfo* pWindows, int count);
+
+// Set the unread count; TRUE if it changed
+BOOL TrayModelSetUnread(TrayModel* pModel, int unreadCount);
+
+// Tooltip for the current model
+void FormatTrayTooltip(const TrayModel* pModel, wchar_t* text, int size);
+
+// Append formatted text at *pLength, never overrunning the buffer
+// Text that does not fit is cut off and the buffer stays terminated
+void AppendText(wchar_t* text, int size, int* pLength, const wchar_t* format, ...);
+
+// Unread count in a title such as "Inbox (3) - Outlook"; -1 if there is none
+int ParseUnreadCount(const wchar_t* title);
+
+// A window title changed; TRUE if the unread count changed
+// A title without a count only clears the count if it came from that window,
+// so compose windows and dialogs do not reset it.
+BOOL UnreadOnTitleChange(UnreadTracker* pTracker, HWND hwnd, const wchar_t* title);
+
+// Badge icon index for an unread count (0 = no badge), and its label
+int BadgeIndex(int unreadCount);
+void FormatBadgeLabel(int badgeIndex, wchar_t* text, int size);
+
+// Coalesce icon updates: at most one per TRAY_UPDATE_INTERVAL_MS
+TrayUpdateAction TrayUpdateRequest(TrayUpdateLimiter* pLimiter, ULONGLONG now, ULONGLONG* pDelay);
+void TrayUpdateTimerFired(TrayUpdateLimiter* pLimiter, ULONGLONG now);
+
+// Explorer restarted (or never had the icon): it has to be added again
+void TrayIconLost(TrayIconState* pState);
+
+// Outcome of one NIM_ADD at 'now' (FILETIME)
+// Returns the delay before the next attempt in ms, or 0 once the icon is added
+ULONGLONG TrayIconAddResult(TrayIconState* pState, BOOL added, ULONGLONG now);
+
+// Startup milestones and icon registrations as text for the Diagnostics view
+// Returns the number of characters written
+int FormatStartupTimes(const TrayIconState* pState, wchar_t* text, int size);
+
+// Outlook's process followed by its WebView2 descendants, from a process list
+// Returns the number of ids written
+int CollectProcessTree(const ProcessLink* links, int linkCount, DWORD rootId,
+                       DWORD* processIds, int maxIds);
+
+// When the next trim is due (tick), or 0 if none is: no Outlook window hidden, or trimming off
+// The delay runs from the most recently hidden Outlook window
+ULONGLONG TrimDueTick(const TrimPolicy* pPolicy, const TrayModel* pModel, ULONGLONG lastTrimTick);
+
+// Empty the working sets of Outlook and its WebView2 processes
+void TrimProcessTree(DWORD rootId, TrimReport* pReport);
+
+// Add a trim to the history
+void RecordTrim(TrimHistory* pHistory, const TrimReport* pReport);
+
+// Trim settings and history as text for the Diagnostics view
+// Returns the number of characters written
+int FormatTrimHistory(const TrimPolicy* pPolicy, const TrimHistory* pHistory, wchar_t* text, int size);
+
+// Outlook was hidden: start measuring its tree, in efficiency mode if 'efficient'
+void ThrottleStart(ThrottleState* pState, DWORD rootId, BOOL efficient, ULONGLONG now);
+
+// Re-read the tree: take in new processes, account for the ones that exited
+void ThrottleRescan(ThrottleState* pState, DWORD rootId);
+
+// Add the running period (sampled now) to 'pTotal' without ending it
+void ThrottleMeasure(ThrottleState* pState, ULONGLONG now, HiddenCpu* pTotal);
+
+// Add the running period, as of the last sample, to 'pTotal'; reads no counters
+void ThrottleTotal(const ThrottleState* pState, ULONGLONG now, HiddenCpu* pTotal);
+
+// Outlook is about to be shown: leave efficiency mode right away, without
+// sampling; ThrottleStop adds the period to the totals afterwards
+void ThrottleLift(const ThrottledProcess* processes, int count);
+
+// Outlook is about to be shown: leave efficiency mode and add the period to 'pTotal'
+void ThrottleStop(ThrottleState* pState, ULONGLONG now, HiddenCpu* pTotal);
+
+// One line of CPU and GPU use while Outlook was hidden
+// Returns the number of characters written
+int FormatHiddenCpu(const wchar_t* label, const HiddenCpu* pCpu, wchar_t* text, int size);
+
+// One line of click-to-visible latency for a restore path
+// Returns the number of characters written
+int FormatRestoreTiming(const wchar_t* label, const RestoreTiming* pTiming, LONGLONG frequency,
+                        wchar_t* text, int size);
+
+// Render aggregated hook counters as text for the Diagnostics view and dump
+// Returns the number of characters written
+int FormatHookStats(const HookStats* pTotal, int liveProcesses, LONG uncountedProcesses,
+                    LONGLONG frequency, wchar_t* text, int size);
+
+// Work the UI thread hands to the worker thread: registry writes, ShellExecute,
+// file writes, and walking and sampling the hidden Outlook tree. The UI thread
+// is the only producer, the worker the only consumer.
+#define WORK_QUEUE_SIZE     16      // Power of two
+
+enum WorkKind {
+    WORK_SET_AUTOSTART,         // value: TRUE adds the Run value, FALSE removes it
+    WORK_WRITE_SETTING,         // id, value
+    WORK_OPEN_OUTLOOK,          // ms-outlook:
+    WORK_SAVE_HIDDEN,           // hidden
+    WORK_SAVE_DIAGNOSTICS,      // text, freed by the worker; the report is then opened
+    WORK_THROTTLE_START,        // id: Outlook's pid; value: efficiency mode | hide mode << 1
+    WORK_THROTTLE_RESCAN,       // id: Outlook's pid
+    WORK_THROTTLE_STOP,
+};
+
+struct WorkItem {
+    int kind;                   // WorkKind
+    DWORD id;
+    DWORD value;
+    LONGLONG queuedTicks;       // Performance counter when queued
+    wchar_t* text;
+    HiddenWindowFile hidden;
+};
+
+struct WorkQueue {
+    volatile LONG head;         // Next item to run (worker)
+    volatile LONG tail;         // Next free slot (UI thread)
+    WorkItem items[WORK_QUEUE_SIZE];
+};
+
+// Queue a copy of 'pItem'; FALSE if the queue is full
+BOOL WorkQueuePush(WorkQueue* pQueue, const WorkItem* pItem);
+
+// Take the oldest item; FALSE if there is none
+BOOL WorkQueuePop(WorkQueue* pQueue, WorkItem* pItem);
+
+// Message loop stalls: a message that took longer than a frame to handle
+#define STALL_THRESHOLD_MS  16
+
+struct StallStats {
+    ULONGLONG dispatched;       // Messages timed
+    ULONGLONG stalls;           // Of those, over STALL_THRESHOLD_MS
+    ULONGLONG maxTicks;
+    UINT maxMessage;            // Message that took maxTicks
+};
+
+// Count one dispatched message that took 'ticks'; TRUE if it was a stall
+BOOL RecordDispatch(StallStats* pStats, UINT message, LONGLONG ticks, LONGLONG frequency);
+
+// Stall counts as text for the Diagnostics view
+// Returns the number of characters written
+int FormatStallStats(const StallStats* pStats, LONGLONG frequency, wchar_t* text, int size);
+
+// Hotkey toggle: hide Outlook when it is in front, otherwise bring it back
+// Timed from the key press to the hook's last hidden or restored notification
+#define HOTKEY_BUDGET_MS    50
+
+enum HotkeyAction {
+    HOTKEY_NONE,
+    HOTKEY_HIDE,                // Outlook is in front: ask the hook to hide its windows
+    HOTKEY_RESTORE,             // Windows hidden: restore them, like a click
+    HOTKEY_OPEN                 // Neither: the shell activates or launches Outlook
+};
+
+struct HotkeyToggle {
+    int action;                 // HotkeyAction still in progress, or HOTKEY_NONE
+    int pending;                // Notifications still to come
+    LONGLONG startTicks;        // Performance counter at the key press
+    ULONGLONG presses;
+    ULONGLONG overBudget;       // Done, but later than HOTKEY_BUDGET_MS
+    ULONGLONG unfinished;       // Still in progress at the next press
+    RestoreTiming timing[2];    // Key press to done: [0] hide, [1] restore
+};
+
+// What a press does now; 'foregroundPid' owns the foreground window
+int ChooseHotkeyAction(const TrayModel* pModel, DWORD outlookPid, DWORD foregroundPid);
+
+// A press started 'action', done once 'windows' notifications have come
+void HotkeyStart(HotkeyToggle* pToggle, int action, int windows, LONGLONG startTicks);
+
+// The toggle in progress is done; returns the ticks since the key press
+LONGLONG HotkeyFinish(HotkeyToggle* pToggle, LONGLONG now, LONGLONG frequency);
+
+// A window of Outlook's was hidden or restored (TRAY_NOTIFY_*)
+// Returns the ticks since the key press if that finished the toggle, otherwise -1
+LONGLONG HotkeyOnNotify(HotkeyToggle* pToggle, UINT event, LONGLONG now, LONGLONG frequency);
+
+// Presses and key-press-to-done latency for the Diagnostics view
+// Returns the number of characters written
+int FormatHotkeyStats(const HotkeyToggle* pToggle, LONGLONG frequency, wchar_t* text, int size);
+
+// Automatic hide: Outlook goes to the tray while the user is away, and stays
+// there until they restore it. Each hide is timed until then.
+#define AUTOHIDE_MIN_CHECK_MS   1000    // Idle is never checked more often
+
+enum AutoHideReason {
+    AUTOHIDE_NONE,
+    AUTOHIDE_IDLE,              // No input for AutoHideIdleMinutes
+    AUTOHIDE_LOCKED,            // The session was locked
+    AUTOHIDE_DISPLAY_OFF,
+    AUTOHIDE_REASON_COUNT
+};
+
+struct AutoHideState {
+    int reason;                 // Of the automatic hide in effect, or AUTOHIDE_NONE
+    int requested;              // Asked for, no window hidden yet; AUTOHIDE_NONE otherwise
+    ULONGLONG startTick;
+    ULONGLONG hides[AUTOHIDE_REASON_COUNT];
+    ULONGLONG ended;            // Hides that are over
+    ULONGLONG hiddenMs;         // Their total time hidden
+    ULONGLONG longestMs;
+};
+
+// Milliseconds until the idle time should be looked at again; 0 if idle never hides
+DWORD AutoHideIdleDue(DWORD thresholdMs, DWORD idleMs);
+
+// Outlook's windows were asked to hide for 'reason'
+// The hide takes effect with the hook's first hidden notification, so a request
+// the hook never acts on (no hook, table full) leaves nothing in effect
+void AutoHideStart(AutoHideState* pState, int reason);
+
+// A window of Outlook's was hidden or restored, or Outlook exited (TRAY_NOTIFY_*)
+// Returns how long the automatic hide lasted if that ended it, otherwise -1
+LONGLONG AutoHideOnNotify(AutoHideState* pState, UINT event, ULONGLONG now);
+
+// Hides per reason and time hidden for the Diagnostics view
+// Returns the number of characters written
+int FormatAutoHideStats(const AutoHideState* pState, ULONGLONG now, wchar_t* text, int size);
+
+#endif // OUTLOOKTOTRAY_TRAYCORE_H
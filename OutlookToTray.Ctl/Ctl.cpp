@@ -0,0 +1,80 @@
+/*
+ * Outlook to Tray - Control Client
+ * Sends one command to the tray of this session over its control pipe and
+ * prints the reply, for logon and kiosk scripts:
+ *   OutlookToTray.Ctl hide [app]
+ *   OutlookToTray.Ctl restore [app]
+ *   OutlookToTray.Ctl status
+ *   OutlookToTray.Ctl stats
+ * Exits with 0 for an "ok" reply, 1 for an error reply and 3 if no tray answers.
+ */
+
+#include <windows.h>
+#include <stdio.h>
+#include "../OutlookToTray.Core/Control.h"
+
+#define CONNECT_TIMEOUT_MS  2000    // All instances busy serving other scripts
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s hide [app] | restore [app] | status | stats\n", argv[0]);
+        return 2;
+    }
+
+    // The arguments, joined by spaces, are the request
+    wchar_t request[CONTROL_MAX_REQUEST];
+    int length = 0;
+    for (int i = 1; i < argc; i++) {
+        if (i > 1 && length < CONTROL_MAX_REQUEST - 1) {
+            request[length++] = L' ';
+        }
+        int written = MultiByteToWideChar(CP_ACP, 0, argv[i], -1, request + length, CONTROL_MAX_REQUEST - length);
+        if (written == 0) {
+            fprintf(stderr, "Command too long\n");
+            return 2;
+        }
+        length += written - 1;
+    }
+
+    DWORD sessionId = 0;
+    ProcessIdToSessionId(GetCurrentProcessId(), &sessionId);
+    wchar_t name[64];
+    ControlPipeName(sessionId, name, 64);
+
+    HANDLE hPipe;
+    ULONGLONG deadline = GetTickCount64() + CONNECT_TIMEOUT_MS;
+    for (;;) {
+        hPipe = CreateFileW(name, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+        if (hPipe != INVALID_HANDLE_VALUE) {
+            break;
+        }
+        DWORD error = GetLastError();
+        ULONGLONG now = GetTickCount64();
+        if (error != ERROR_PIPE_BUSY || now >= deadline || !WaitNamedPipeW(name, (DWORD)(deadline - now))) {
+            fprintf(stderr, "Outlook to Tray is not running in this session (error %lu)\n", (unsigned long)error);
+            return 3;
+        }
+    }
+    DWORD mode = PIPE_READMODE_MESSAGE;
+    SetNamedPipeHandleState(hPipe, &mode, NULL, NULL);
+
+    // A restore activates the app; a script started by the user may pass that right on
+    ULONG serverId;
+    if (GetNamedPipeServerProcessId(hPipe, &serverId)) {
+        AllowSetForegroundWindow(serverId);
+    }
+
+    wchar_t reply[CONTROL_MAX_REPLY];
+    DWORD bytes = 0;
+    BOOL ok = TransactNamedPipe(hPipe, request, (DWORD)(length * sizeof(wchar_t)), reply,
+                                sizeof(reply) - sizeof(wchar_t), &bytes, NULL);
+    DWORD error = GetLastError();
+    CloseHandle(hPipe);
+    if (!ok) {
+        fprintf(stderr, "No reply from the tray (error %lu)\n", (unsigned long)error);
+        return 3;
+    }
+    reply[bytes / sizeof(wchar_t)] = L'\0';
+    printf("%ls\n", reply);
+    return wcsncmp(reply, L"ok", 2) == 0 ? 0 : 1;
+}
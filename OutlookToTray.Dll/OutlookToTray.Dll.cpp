@@ -2,128 +2,73 @@
  * Outlook to Tray - Hook DLL
  * Intercepts Outlook window close and hides to tray instead
  * Uses memory-mapped file for cross-process communication
+ * Built without the C++ runtime (no exceptions, RTTI or standard library),
+ * since it is loaded into every hooked process in every session
+ * The decisions live in OutlookToTray.Core; this file is the Win32 glue
  */
 
 #include <windows.h>
-#include <psapi.h>
-#include <tchar.h>
 #include <commctrl.h>
+#include "../OutlookToTray.Core/HookCore.h"
+#include "../OutlookToTray.Core/SharedState.h"
+#include "../OutlookToTray.Core/HookStats.h"
+#include "../OutlookToTray.Core/Trace.h"
+#include "../OutlookToTray.Core/Os.h"
 
-#pragma comment(lib, "Psapi.lib")
 #pragma comment(lib, "Comctl32.lib")
 
-// Shared memory structure
-struct SharedData {
-    HWND hiddenWindow;
-    BOOL subclassed;
-    RECT originalRect;      // Original window position before hiding
-    LONG originalExStyle;   // Original extended style (to restore taskbar visibility)
-};
+// Thread-scoped hooks (targeted mode, owned by the tray process)
+#define MAX_THREAD_HOOKS 64     // Outlook's UI threads plus the other target apps'
 
 // Global state (per-process)
 HINSTANCE g_hInstance = NULL;
 HHOOK g_hook = NULL;
+HHOOK g_threadHooks[MAX_THREAD_HOOKS] = {};
+DWORD g_hookedThreads[MAX_THREAD_HOOKS] = {};
+int g_threadHookCount = 0;
 HANDLE g_hMapFile = NULL;
 SharedData* g_pShared = NULL;
+HookState g_hookState = {};
+TraceHeader* g_pTrace = NULL;       // Capture started by the tray (tray process only)
+HANDLE g_hTraceMapping = NULL;
 
-const wchar_t* SHARED_MEM_NAME = L"OutlookToTraySharedMem";
-
-// Get or create shared memory
+// Open the shared memory; the tray creates it (secured to its user) before it loads the DLL
+// With no tray in this session there is none, and the hook leaves the process alone
 SharedData* GetSharedData() {
-    if (g_pShared) return g_pShared;
-
-    // Try to open existing
-    g_hMapFile = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, SHARED_MEM_NAME);
-
-    if (!g_hMapFile) {
-        // Create new
-        g_hMapFile = CreateFileMappingW(
-            INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(SharedData), SHARED_MEM_NAME);
-    }
-
-    if (g_hMapFile) {
-        g_pShared = (SharedData*)MapViewOfFile(g_hMapFile, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SharedData));
+    if (!g_pShared) {
+        g_pShared = OpenSharedData(SHARED_DATA_NAME, &g_hMapFile);
     }
-
     return g_pShared;
 }
 
-// Check if window belongs to olk.exe (new Outlook)
-BOOL IsOutlookProcess(HWND hwnd) {
-    DWORD processId;
-    GetWindowThreadProcessId(hwnd, &processId);
+LRESULT CALLBACK SubclassProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam,
+                               UINT_PTR uIdSubclass, DWORD_PTR dwRefData);
 
-    HANDLE hProcess = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, processId);
-    if (hProcess) {
-        TCHAR processName[MAX_PATH];
-        if (GetModuleBaseName(hProcess, NULL, processName, sizeof(processName) / sizeof(TCHAR))) {
-            CloseHandle(hProcess);
-            return _tcsicmp(processName, L"olk.exe") == 0;
-        }
-        CloseHandle(hProcess);
-    }
-    return FALSE;
+// OS interface: subclassing needs this DLL's SubclassProc
+BOOL OsSubclassWindow(HWND hwnd) {
+    return SetWindowSubclass(hwnd, SubclassProc, 1, 0);
 }
 
-// Check if this is a main/top-level window
-BOOL IsMainWindow(HWND hwnd) {
-    return GetWindow(hwnd, GW_OWNER) == NULL && IsWindowVisible(hwnd);
+void OsRemoveSubclass(HWND hwnd) {
+    RemoveWindowSubclass(hwnd, SubclassProc, 1);
 }
 
-// Subclass procedure to block WM_CLOSE
+// Subclass procedure to block WM_CLOSE and restore on the tray's request
 LRESULT CALLBACK SubclassProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam,
                                UINT_PTR uIdSubclass, DWORD_PTR dwRefData) {
-    if (uMsg == WM_CLOSE) {
-        SharedData* pData = GetSharedData();
-        if (pData) {
-            // Save original position
-            GetWindowRect(hwnd, &pData->originalRect);
-
-            // Save original extended style and hide from taskbar
-            pData->originalExStyle = GetWindowLong(hwnd, GWL_EXSTYLE);
-            SetWindowLong(hwnd, GWL_EXSTYLE,
-                         (pData->originalExStyle | WS_EX_TOOLWINDOW) & ~WS_EX_APPWINDOW);
-
-            // Move window off-screen instead of hiding it completely
-            // This allows notifications to still work (SW_HIDE suppresses them)
-            SetWindowPos(hwnd, NULL, -32000, -32000, 0, 0,
-                         SWP_NOSIZE | SWP_NOZORDER | SWP_NOACTIVATE | SWP_FRAMECHANGED);
-
-            pData->hiddenWindow = hwnd;
-        }
-        return 0;  // Block the close
-    }
-    else if (uMsg == WM_DESTROY) {
-        SharedData* pData = GetSharedData();
-        if (pData && pData->hiddenWindow == hwnd) {
-            pData->hiddenWindow = NULL;
-            pData->subclassed = FALSE;
-        }
-        RemoveWindowSubclass(hwnd, SubclassProc, 1);
+    if (SubclassOnMessage(&g_hookState, GetSharedData(), hwnd, uMsg, wParam, lParam)) {
+        return 0;
     }
     return DefSubclassProc(hwnd, uMsg, wParam, lParam);
 }
 
 // Main hook callback - runs in the target process
+// HookDispatch counts every call and times the Outlook path
+// With nCode < 0, lParam is not ours to read: pass it straight on
 LRESULT CALLBACK CallWndProc(int nCode, WPARAM wParam, LPARAM lParam) {
     if (nCode >= 0) {
-        CWPSTRUCT* pCwp = (CWPSTRUCT*)lParam;
-
-        // Check for Outlook windows
-        if (IsOutlookProcess(pCwp->hwnd) && IsMainWindow(pCwp->hwnd)) {
-            SharedData* pData = GetSharedData();
-
-            // Subclass on first WM_CLOSE or when window becomes visible
-            if (pCwp->message == WM_CLOSE ||
-                (pCwp->message == WM_SHOWWINDOW && pCwp->wParam == TRUE)) {
-
-                if (pData && !pData->subclassed) {
-                    if (SetWindowSubclass(pCwp->hwnd, SubclassProc, 1, 0)) {
-                        pData->subclassed = TRUE;
-                    }
-                }
-            }
-        }
+        const CWPSTRUCT* pCwp = (const CWPSTRUCT*)lParam;
+        HookDispatch(&g_hookState, nCode, pCwp->hwnd, pCwp->message, pCwp->wParam);
     }
     return CallNextHookEx(g_hook, nCode, wParam, lParam);
 }
@@ -144,55 +89,177 @@ extern "C" __declspec(dllexport) BOOL InstallHook(HINSTANCE hInst) {
     return (g_hook != NULL);
 }
 
+// Exported: Hook exactly the given threads (targeted mode)
+// Threads not in the list are unhooked, new ones are hooked. Pass an
+// empty list to drop all thread hooks, e.g. when Outlook exits.
+// The threads now hooked go to 'hookedIds' (room for 'count'); returns how many
+extern "C" __declspec(dllexport) int RetargetThreadHooks(HINSTANCE hInst, const DWORD* threadIds,
+                                                         int count, DWORD* hookedIds) {
+    if (!GetSharedData()) {
+        return 0;
+    }
+
+    // Drop hooks on threads that are gone or no longer wanted
+    int kept = 0;
+    for (int i = 0; i < g_threadHookCount; i++) {
+        BOOL wanted = FALSE;
+        for (int j = 0; j < count && !wanted; j++) {
+            wanted = (threadIds[j] == g_hookedThreads[i]);
+        }
+        if (wanted) {
+            g_threadHooks[kept] = g_threadHooks[i];
+            g_hookedThreads[kept] = g_hookedThreads[i];
+            kept++;
+        }
+        else {
+            UnhookWindowsHookEx(g_threadHooks[i]);
+        }
+    }
+    g_threadHookCount = kept;
+
+    // Hook threads we have not seen yet
+    for (int j = 0; j < count && g_threadHookCount < MAX_THREAD_HOOKS; j++) {
+        BOOL hooked = FALSE;
+        for (int i = 0; i < g_threadHookCount && !hooked; i++) {
+            hooked = (g_hookedThreads[i] == threadIds[j]);
+        }
+        if (!hooked) {
+            HHOOK hook = SetWindowsHookExW(WH_CALLWNDPROC, CallWndProc, hInst, threadIds[j]);
+            if (hook) {
+                g_threadHooks[g_threadHookCount] = hook;
+                g_hookedThreads[g_threadHookCount] = threadIds[j];
+                g_threadHookCount++;
+            }
+        }
+    }
+
+    for (int i = 0; i < g_threadHookCount; i++) {
+        hookedIds[i] = g_hookedThreads[i];
+    }
+    return g_threadHookCount;
+}
+
 // Exported: Remove the hook
 extern "C" __declspec(dllexport) BOOL UninstallHook() {
+    BOOL removed = (g_hook != NULL || g_threadHookCount > 0);
     if (g_hook != NULL) {
         UnhookWindowsHookEx(g_hook);
         g_hook = NULL;
-
-        SharedData* pData = GetSharedData();
-        if (pData) {
-            pData->subclassed = FALSE;
-        }
-        return TRUE;
     }
-    return FALSE;
+    for (int i = 0; i < g_threadHookCount; i++) {
+        UnhookWindowsHookEx(g_threadHooks[i]);
+    }
+    g_threadHookCount = 0;
+    return removed;
 }
 
-// Exported: Get handle of hidden Outlook window
-extern "C" __declspec(dllexport) HWND GetHiddenOutlookWindow() {
+// Exported: Number of processes that currently have the DLL mapped
+extern "C" __declspec(dllexport) LONG GetMappedProcessCount() {
     SharedData* pData = GetSharedData();
     if (pData) {
-        return pData->hiddenWindow;
+        return pData->mappedProcesses;
     }
-    return NULL;
+    return 0;
 }
 
-// Exported: Clear hidden window tracking
-extern "C" __declspec(dllexport) void ClearHiddenWindow() {
+// Exported: Consistent snapshot of all hidden windows, oldest first
+extern "C" __declspec(dllexport) int GetHiddenWindows(HiddenWindowInfo* pWindows, int maxWindows) {
     SharedData* pData = GetSharedData();
-    if (pData) {
-        pData->hiddenWindow = NULL;
+    if (!pData || !pWindows) {
+        return 0;
+    }
+    return SnapshotHiddenWindows(pData, pWindows, maxWindows);
+}
+
+// Exported: Take back windows a previous tray left hidden on the given threads
+// Returns the number of windows adopted
+extern "C" __declspec(dllexport) int RecoverHiddenWindows(DWORD processId, int rule, const DWORD* threadIds,
+                                                          int count, const HiddenWindowFile* pFile) {
+    SharedData* pData = GetSharedData();
+    if (!pData || !threadIds) {
+        return 0;
     }
+    return AdoptHiddenWindows(pData, processId, rule, threadIds, count, pFile);
 }
 
-// Exported: Get original window rect (for restoring position)
-extern "C" __declspec(dllexport) BOOL GetOriginalRect(RECT* pRect) {
+// Exported: Window that receives TRAY_NOTIFY_MESSAGE (NULL to stop)
+extern "C" __declspec(dllexport) BOOL SetTrayWindow(HWND hwnd) {
     SharedData* pData = GetSharedData();
-    if (pData && pRect) {
-        *pRect = pData->originalRect;
+    if (!pData) {
+        return FALSE;
+    }
+    pData->trayWindow = hwnd;
+    return TRUE;
+}
+
+// Exported: Settings for the hook (hide mode, target rules); the hook never reads the registry
+extern "C" __declspec(dllexport) BOOL SetHookSettings(const HookSettings* pSettings) {
+    SharedData* pData = GetSharedData();
+    if (!pData || !pSettings || pSettings->hideMode < 0 || pSettings->hideMode >= HIDE_MODE_COUNT) {
+        return FALSE;
+    }
+    PublishHookSettings(pData, pSettings);
+    return TRUE;
+}
+
+// Exported: Forget a window after the tray restored it
+extern "C" __declspec(dllexport) BOOL MarkWindowRestored(HWND hwnd) {
+    SharedData* pData = GetSharedData();
+    if (pData && ReleaseWindow(pData, hwnd)) {
+        g_hookState.stats->restores++;
         return TRUE;
     }
     return FALSE;
 }
 
-// Exported: Get original extended style (for restoring taskbar visibility)
-extern "C" __declspec(dllexport) LONG GetOriginalExStyle() {
+// Exported: Forget a window that was destroyed while hidden (not a restore)
+extern "C" __declspec(dllexport) BOOL ForgetDestroyedWindow(HWND hwnd) {
+    SharedData* pData = GetSharedData();
+    return pData && ForgetWindow(pData, hwnd);
+}
+
+// Exported: Forget every window of a process that has exited
+extern "C" __declspec(dllexport) void ForgetProcessWindows(DWORD processId) {
     SharedData* pData = GetSharedData();
     if (pData) {
-        return pData->originalExStyle;
+        ReleaseProcessWindows(pData, processId);
     }
-    return 0;
+}
+
+// Exported: Hook counters summed over every process that has loaded the DLL
+// Returns the number of processes currently counted
+extern "C" __declspec(dllexport) int GetHookStats(HookStats* pTotal, LONG* pUncounted) {
+    SharedData* pData = GetSharedData();
+    *pUncounted = pData ? pData->uncountedProcesses : 0;
+    return AggregateHookStats(pData, pTotal);
+}
+
+// Exported: The log ring the hook writes to, so the tray can write and drain it too
+extern "C" __declspec(dllexport) LogRing* GetLogRing() {
+    SharedData* pData = GetSharedData();
+    return pData ? &pData->log : NULL;
+}
+
+// Exported: Start capturing every hooked message into a new file of 'capacity' records
+extern "C" __declspec(dllexport) BOOL StartMessageTrace(const wchar_t* path, DWORD capacity) {
+    SharedData* pData = GetSharedData();
+    if (!pData || g_pTrace || capacity == 0) {
+        return FALSE;
+    }
+    g_pTrace = StartTrace(pData, path, capacity, &g_hTraceMapping);
+    return g_pTrace != NULL;
+}
+
+// Exported: Stop the capture; returns the number of messages recorded
+extern "C" __declspec(dllexport) LONG StopMessageTrace() {
+    if (!g_pTrace) {
+        return 0;
+    }
+    LONG records = g_pTrace->next < (LONG)g_pTrace->capacity ? g_pTrace->next : (LONG)g_pTrace->capacity;
+    StopTrace(g_pShared, g_pTrace, g_hTraceMapping);
+    g_pTrace = NULL;
+    g_hTraceMapping = NULL;
+    return records;
 }
 
 // DLL entry point
@@ -201,16 +268,19 @@ BOOL APIENTRY DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpReserved) {
     case DLL_PROCESS_ATTACH:
         g_hInstance = hinstDLL;
         DisableThreadLibraryCalls(hinstDLL);
+        if (GetSharedData()) {
+            InterlockedIncrement(&g_pShared->mappedProcesses);
+        }
+        HookInitProcess(&g_hookState, g_pShared);
         break;
     case DLL_PROCESS_DETACH:
+        HookExitProcess(&g_hookState, g_pShared);
         if (g_pShared) {
-            UnmapViewOfFile(g_pShared);
-            g_pShared = NULL;
-        }
-        if (g_hMapFile) {
-            CloseHandle(g_hMapFile);
-            g_hMapFile = NULL;
+            InterlockedDecrement(&g_pShared->mappedProcesses);
         }
+        OsUnmapSharedMemory(g_pShared, g_hMapFile);
+        g_pShared = NULL;
+        g_hMapFile = NULL;
         break;
     }
     return TRUE;
@@ -8,48 +8,241 @@
 
 #include <windows.h>
 #include <shellapi.h>
-#include <tlhelp32.h>
+#include <wtsapi32.h>
 #include <tchar.h>
 #include <string>
 #include <thread>
-#include <psapi.h>
+#include <atomic>
+#include <vector>
 #include "resource.h"
+#include "../OutlookToTray.Core/SharedState.h"
+#include "../OutlookToTray.Core/TrayCore.h"
+#include "../OutlookToTray.Core/Settings.h"
+#include "../OutlookToTray.Core/Targets.h"
+#include "../OutlookToTray.Core/Log.h"
+#include "../OutlookToTray.Core/Trace.h"
+#include "../OutlookToTray.Core/Control.h"
+#include "../OutlookToTray.Core/Os.h"
 
 #pragma comment(lib, "Shell32.lib")
-#pragma comment(lib, "Psapi.lib")
+#pragma comment(lib, "Gdi32.lib")
+#pragma comment(lib, "Ole32.lib")
+#pragma comment(lib, "Wtsapi32.lib")
+
+// Not in headers for Windows Vista; older systems ignore it
+#ifndef MOD_NOREPEAT
+#define MOD_NOREPEAT        0x4000
+#endif
 
 // Menu item IDs
 #define ID_TRAY_ICON        1001
-#define ID_TRAY_RESTORE     1002
 #define ID_TRAY_AUTOSTART   1003
 #define ID_TRAY_ABOUT       1004
 #define ID_TRAY_EXIT        1005
+#define ID_TRAY_DIAGNOSTICS 1006
+#define ID_TRAY_EFFICIENCY  1007
+#define ID_TRAY_CLOAK       1008
+#define ID_TRAY_TRACE       1009
+#define ID_TRAY_WINDOW_FIRST 1100   // One item per hidden window
+#define ID_TRAY_APP_FIRST   1200    // One "Restore <app>" item per target rule
 #define WM_TRAYICON         (WM_USER + 1)
+#define ID_HOTKEY_TOGGLE    1
+#define ID_TIMER_TRAY_UPDATE 1
+#define ID_TIMER_TRIM       2
+#define ID_TIMER_THROTTLE   3
+#define ID_TIMER_ICON_RETRY 4
+#define ID_TIMER_PREWARM    5
+#define ID_TIMER_LOG_DRAIN  6                   // Lean mode: the log drain's backstop
+#define ID_TIMER_IDLE       7                   // Input idle time, for the automatic hide
+#define WM_TRIM_OUTLOOK     (WM_USER + 300)     // Posted to the monitor thread (see PostToMonitor)
+#define WM_SETTINGS_CHANGED (WM_USER + 301)     // Posted to the tray window
+#define WM_RULES_CHANGED    (WM_USER + 302)     // Posted to the monitor thread (see PostToMonitor)
+#define WM_WORK_DONE        (WM_USER + 303)     // Posted to the tray window by the worker thread
+#define WM_RETARGET_HOOKS   (WM_USER + 304)     // Posted to the hook thread
+#define WM_CONTROL_RESTORE  (WM_USER + 305)     // Posted to the tray window by the pipe server
+#define LOG_DRAIN_BACKSTOP_MS 60000             // Records no UI wakeup noticed wait at most this long
+#define LOG_DRAIN_BATCH     64                  // Lean mode also drains once this many are waiting
+#define LOG_FILE_MAX_BYTES  (1024 * 1024)       // Rotated beyond this
+#define LOG_FILE_KEEP       3                   // OutlookToTray.log.1 to .3
+#define CONTROL_INSTANCES   4                   // Pipe clients served at once; more wait for a free one
 
 // DLL function types
 typedef BOOL (*InstallHookProc)(HINSTANCE);
 typedef BOOL (*UninstallHookProc)();
-typedef HWND (*GetHiddenOutlookWindowProc)();
-typedef void (*ClearHiddenWindowProc)();
-typedef BOOL (*GetOriginalRectProc)(RECT*);
-typedef LONG (*GetOriginalExStyleProc)();
+typedef int (*GetHiddenWindowsProc)(HiddenWindowInfo*, int);
+typedef BOOL (*MarkWindowRestoredProc)(HWND);
+typedef void (*ForgetProcessWindowsProc)(DWORD);
+typedef BOOL (*ForgetDestroyedWindowProc)(HWND);
+typedef int (*RetargetThreadHooksProc)(HINSTANCE, const DWORD*, int, DWORD*);
+typedef LONG (*GetMappedProcessCountProc)();
+typedef int (*GetHookStatsProc)(HookStats*, LONG*);
+typedef BOOL (*SetTrayWindowProc)(HWND);
+typedef BOOL (*SetHookSettingsProc)(const HookSettings*);
+typedef LogRing* (*GetLogRingProc)();
+typedef BOOL (*StartMessageTraceProc)(const wchar_t*, DWORD);
+typedef LONG (*StopMessageTraceProc)();
+typedef int (*RecoverHiddenWindowsProc)(DWORD, int, const DWORD*, int, const HiddenWindowFile*);
 
 // Globals
 HINSTANCE g_hInstance = NULL;
 HWND g_hwnd = NULL;
 NOTIFYICONDATA g_nid = {};
 HMENU g_hMenu = NULL;
+HMENU g_hWindowMenu = NULL;
+HWND g_menuWindows[MAX_HIDDEN_WINDOWS] = {};
 HMODULE g_hDll = NULL;
 HICON g_hIcon = NULL;
+TrayIconState g_trayIcon = {};  // Registration with Explorer and startup times (UI thread only)
+UINT g_taskbarCreatedMessage = 0;
 bool g_running = true;
+bool g_targetedHook = true;     // Hook only Outlook's UI threads (/globalhook to disable)
+bool g_inProcessRestore = true; // Outlook restores its own windows (/trayrestore to disable)
+bool g_lean = false;            // LeanMode: the UI thread is also the monitor, hook, worker and log thread
+HANDLE g_hSharedMapping = NULL; // The table, created here before the DLL is loaded
+SharedData* g_pSharedView = NULL;
+UINT g_restoreMessage = 0;
+RestoreTiming g_trayRestoreTiming = {};     // Click-to-visible for the tray-side path
+
+// Unread badge
+UnreadTracker g_unread = {};                // Monitor thread only
+std::atomic<int> g_unreadCount(0);          // Copy of g_unread.count for the UI thread
+HWINEVENTHOOK g_hNameHook = NULL;
+HICON g_badgeIcons[BADGE_COUNT] = {};       // Rendered on first use; [0] is the plain icon
+TrayUpdateLimiter g_trayUpdate = {};
+
+// Working-set trimming while hidden
+TrimPolicy g_trimPolicy = {};
+ULONGLONG g_lastTrimTick = 0;               // UI thread only
+TrimHistory g_trimHistory = {};             // Written by the monitor thread
+CRITICAL_SECTION g_trimLock;
+
+// Efficiency mode while hidden: the UI thread decides, the worker thread walks
+// and samples the process tree (toolhelp, GetProcessTimes, the GPU counters)
+bool g_throttling = false;                  // Start queued, stop not yet (UI thread only)
+ThrottleState g_throttle = {};              // Worker thread only
+LONG g_throttleHideMode = HIDE_OFFSCREEN;   // Hide mode of the period being measured (worker)
+HiddenCpu g_hiddenCpu[HIDE_MODE_COUNT][2] = {};     // [hide mode][efficiency mode] (worker)
+// Published by the worker after each step, under g_throttleLock
+HiddenCpu g_hiddenCpuShown[HIDE_MODE_COUNT][2] = {};    // With the running period so far
+ThrottledProcess g_lowered[MAX_TREE_PROCESSES];         // What a restore lifts at once
+int g_loweredCount = 0;
+CRITICAL_SECTION g_throttleLock;
+PrewarmState g_prewarm = {};                // Pointer over the tray icon (UI thread only)
+
+// Settings (UI thread only), reloaded when the monitor thread sees a change
+TraySettings g_settings = {};
+wchar_t g_configPath[MAX_PATH] = {};
+RuleTable g_rules = {};         // As published to the hook; the monitor thread copies it under g_settingsLock
+CRITICAL_SECTION g_settingsLock;
+
+// Settings change notifications (monitor thread only)
+#define WATCHED_KEY_COUNT 4
+HKEY g_hWatchedKeys[WATCHED_KEY_COUNT] = {};
+HANDLE g_hSettingsEvent = NULL;
+HANDLE g_hConfigChange = INVALID_HANDLE_VALUE;
+
+// What the tray shows (UI thread only), refreshed on TRAY_NOTIFY_MESSAGE
+TrayModel g_model = {};
+UINT g_notifyMessage = 0;
+
+// Outlook process tracking (owned by the monitor thread)
+OutlookTracker g_tracker = {};
+std::atomic<DWORD> g_outlookPid(0);     // Copy of g_tracker.processId for other threads
+HANDLE g_hOutlookProcess = NULL;
+HWINEVENTHOOK g_hCreateHook = NULL;
+std::atomic<DWORD> g_monitorThreadId(0);
+std::atomic<LONG> g_monitorWakeups(0);
+
+// Log ring in the shared memory, drained to a file by the log thread
+LogRing* g_pLogRing = NULL;                 // NULL when the DLL has no log
+LogReader g_logReader = {};                 // Log thread only (after startup)
+std::atomic<ULONGLONG> g_logWritten(0);     // Copies of the reader's counts for Diagnostics
+std::atomic<ULONGLONG> g_logLost(0);
+wchar_t g_logPath[MAX_PATH] = {};
+HANDLE g_hLogStop = NULL;
+HANDLE g_hLogWake = NULL;                   // Set by the UI thread when new records are in the ring
+LONG g_logSignalled = 0;                    // Ring head when the drain was last woken (UI thread only)
+std::atomic<LONG> g_logWakeups(0);          // Drains run, for Diagnostics
+
+// Hidden windows saved for a restarted tray: read before the monitor thread
+// starts (which adopts them), rewritten by the UI thread when the model changes
+#define HIDDEN_FILE_NAME L"Hidden.dat"
+HiddenWindowFile g_savedHidden = {};
+
+// Message capture (UI thread only)
+wchar_t g_tracePath[MAX_PATH] = {};     // Empty while no capture runs
+
+// Slow calls run on the worker thread; each result comes back as WM_WORK_DONE
+WorkQueue g_workQueue = {};             // Pushed by the UI thread only
+HANDLE g_hWorkEvent = NULL;             // Set after each push
+std::atomic<bool> g_workStop(false);
+RestoreTiming g_workTiming = {};        // Queued to done (UI thread only)
+
+// The hooks belong to a thread that only pumps messages (see HookThread)
+std::atomic<DWORD> g_hookThreadId(0);
+HANDLE g_hHookThreadReady = NULL;
+DWORD g_hookTargets[2 * MAX_UI_THREADS] = {};   // Known UI threads of the target apps, under g_hookLock
+int g_hookTargetCount = 0;
+int g_hookAppCount = 0;                         // Of those, other apps' threads
+int g_hookSkippedCount = 0;                     // Left out: other bitness
+DWORD g_hookedTargets[2 * MAX_UI_THREADS] = {}; // Of those, the ones a hook is confirmed on, under g_hookLock
+int g_hookedTargetCount = 0;
+std::atomic<bool> g_globalHookInstalled(false);
+CRITICAL_SECTION g_hookLock;
+
+// Message loop stalls (UI thread only)
+StallStats g_stalls = {};
+LONGLONG g_dispatchStart = 0;
+
+// Hotkey toggle (UI thread only)
+HotkeyToggle g_hotkey = {};
+DWORD g_hotkeyRegistered = 0;   // The Hotkey setting as registered; 0 while none is
+bool g_hotkeyTaken = false;     // Registering it failed: another app has the key
+
+// Automatic hide while the user is away (UI thread only)
+AutoHideState g_autoHide = {};
+HPOWERNOTIFY g_hDisplayNotify = NULL;
+// GUID_CONSOLE_DISPLAY_STATE, defined here so no GUID library is needed
+static const GUID CONSOLE_DISPLAY_STATE =
+    { 0x6fe69556, 0x704a, 0x47a0, { 0x8f, 0x24, 0xc2, 0x8d, 0x93, 0x6f, 0xda, 0x47 } };
+
+// Control pipe (pipe thread, or the UI thread in lean mode)
+enum ControlPipeState {
+    PIPE_CONNECTING,
+    PIPE_READING,
+    PIPE_WRITING
+};
+
+struct ControlPipe {
+    HANDLE hPipe;
+    OVERLAPPED overlapped;      // Its manual-reset event is what the server waits on
+    int state;                  // ControlPipeState
+    wchar_t request[CONTROL_MAX_REQUEST];
+    wchar_t reply[CONTROL_MAX_REPLY];
+};
+
+ControlPipe g_controlPipes[CONTROL_INSTANCES] = {};
+int g_controlPipeCount = 0;
+HANDLE g_hControlStop = NULL;
+ControlStatus g_controlStatus = {};     // Published by the UI thread, under g_controlLock
+CRITICAL_SECTION g_controlLock;
 
 // DLL function pointers
 InstallHookProc g_InstallHook = NULL;
 UninstallHookProc g_UninstallHook = NULL;
-GetHiddenOutlookWindowProc g_GetHiddenOutlookWindow = NULL;
-ClearHiddenWindowProc g_ClearHiddenWindow = NULL;
-GetOriginalRectProc g_GetOriginalRect = NULL;
-GetOriginalExStyleProc g_GetOriginalExStyle = NULL;
+GetHiddenWindowsProc g_GetHiddenWindows = NULL;
+MarkWindowRestoredProc g_MarkWindowRestored = NULL;
+ForgetProcessWindowsProc g_ForgetProcessWindows = NULL;
+ForgetDestroyedWindowProc g_ForgetDestroyedWindow = NULL;
+RetargetThreadHooksProc g_RetargetThreadHooks = NULL;
+GetMappedProcessCountProc g_GetMappedProcessCount = NULL;
+GetHookStatsProc g_GetHookStats = NULL;
+SetTrayWindowProc g_SetTrayWindow = NULL;
+SetHookSettingsProc g_SetHookSettings = NULL;
+GetLogRingProc g_GetLogRing = NULL;
+StartMessageTraceProc g_StartMessageTrace = NULL;
+StopMessageTraceProc g_StopMessageTrace = NULL;
+RecoverHiddenWindowsProc g_RecoverHiddenWindows = NULL;
 
 // Debug helper
 void DebugMsg(const wchar_t* msg) {
@@ -57,108 +250,559 @@ void DebugMsg(const wchar_t* msg) {
     OutputDebugString(L"\n");
 }
 
-// Find process ID by name
-DWORD FindProcessId(const std::wstring& processName) {
-    DWORD processId = 0;
-    HANDLE hSnap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
-    if (hSnap != INVALID_HANDLE_VALUE) {
-        PROCESSENTRY32 pe32 = {};
-        pe32.dwSize = sizeof(PROCESSENTRY32);
-        if (Process32First(hSnap, &pe32)) {
-            do {
-                if (_wcsicmp(pe32.szExeFile, processName.c_str()) == 0) {
-                    processId = pe32.th32ProcessID;
-                    break;
-                }
-            } while (Process32Next(hSnap, &pe32));
-        }
-        CloseHandle(hSnap);
+// Non-blocking message at the tray icon, in place of a modal message box
+// A modal box runs its own message loop until dismissed
+void ShowBalloon(const wchar_t* text, DWORD icon) {
+    DebugMsg(text);
+    if (!g_trayIcon.added) {
+        return;
     }
-    return processId;
+    NOTIFYICONDATA nid = {};
+    nid.cbSize = sizeof(NOTIFYICONDATA);
+    nid.hWnd = g_hwnd;
+    nid.uID = ID_TRAY_ICON;
+    nid.uFlags = NIF_INFO;
+    nid.dwInfoFlags = icon;
+    wcscpy_s(nid.szInfoTitle, L"Outlook to Tray");
+    wcsncpy_s(nid.szInfo, text, _TRUNCATE);
+    Shell_NotifyIcon(NIM_MODIFY, &nid);
 }
 
-// Check if autostart is enabled
-bool IsAutoStartEnabled() {
-    HKEY hKey;
-    if (RegOpenKeyEx(HKEY_CURRENT_USER,
-        L"Software\\Microsoft\\Windows\\CurrentVersion\\Run",
-        0, KEY_QUERY_VALUE, &hKey) == ERROR_SUCCESS) {
-        DWORD type, size = 0;
-        LONG result = RegQueryValueEx(hKey, L"OutlookToTray", NULL, &type, NULL, &size);
-        RegCloseKey(hKey);
-        return result == ERROR_SUCCESS;
+void CompleteWork(const WorkItem* pItem);
+void PostToMonitor(UINT message);
+
+// Hand a slow call to the worker thread
+// In lean mode, or should the queue ever be full, the call is made here
+void QueueWork(WorkItem* pItem) {
+    pItem->queuedTicks = OsQueryPerformanceCounter();
+    if (!g_lean) {
+        if (WorkQueuePush(&g_workQueue, pItem)) {
+            SetEvent(g_hWorkEvent);
+            return;
+        }
+        DebugMsg(L"Work queue full, running inline");
     }
-    return false;
+    CompleteWork(pItem);
 }
 
-// Toggle autostart in registry
+// Toggle autostart in registry; the worker writes it, WM_WORK_DONE confirms
 void ToggleAutoStart() {
-    HKEY hKey;
-    if (RegOpenKeyEx(HKEY_CURRENT_USER,
-        L"Software\\Microsoft\\Windows\\CurrentVersion\\Run",
-        0, KEY_SET_VALUE, &hKey) == ERROR_SUCCESS) {
+    WorkItem item = {};
+    item.kind = WORK_SET_AUTOSTART;
+    item.value = g_settings.autoStart ? FALSE : TRUE;
+    QueueWork(&item);
+}
+
+// Write a setting to HKCU\Software\OutlookToTray and use it right away
+// The change notification that follows finds nothing new
+void WriteSetting(SettingId id, DWORD value) {
+    WorkItem item = {};
+    item.kind = WORK_WRITE_SETTING;
+    item.id = id;
+    item.value = value;
+    QueueWork(&item);
+    g_settings.values[id] = value;
+    g_settings.sources[id] = SOURCE_USER;
+}
+
+// Put the settings into effect: trim policy here, hide mode and rules in the
+// hook, rules in the monitor thread; efficiency mode is read at the next hide
+void ApplyHotkey();
+void CheckIdleTime();
+
+void ApplySettings() {
+    ApplyHotkey();
+    CheckIdleTime();
+    g_trimPolicy.delayMs = 1000ULL * g_settings.values[SETTING_TRIM_DELAY];
+    g_trimPolicy.intervalMs = 1000ULL * g_settings.values[SETTING_TRIM_INTERVAL];
+
+    HookSettings hookSettings;
+    GetHookSettings(&g_settings, &hookSettings);
+    if (g_SetHookSettings) {
+        g_SetHookSettings(&hookSettings);
+    }
+
+    EnterCriticalSection(&g_settingsLock);
+    bool rulesChanged = memcmp(&g_rules, &hookSettings.rules, sizeof(g_rules)) != 0;
+    g_rules = hookSettings.rules;
+    LeaveCriticalSection(&g_settingsLock);
+    if (rulesChanged) {
+        PostToMonitor(WM_RULES_CHANGED);
+    }
+}
+
+// OutlookToTray.ini next to the EXE
+void GetConfigPath(wchar_t* path, DWORD size) {
+    DWORD length = GetModuleFileName(NULL, path, size);
+    while (length > 0 && path[length - 1] != L'\\') {
+        length--;
+    }
+    path[length] = L'\0';
+    wcscat_s(path, size, SETTINGS_FILE_NAME);
+}
+
+// %LOCALAPPDATA%\OutlookToTray\<name>, creating the folder
+bool GetDataPath(const wchar_t* name, wchar_t* path, DWORD size) {
+    DWORD length = GetEnvironmentVariableW(L"LOCALAPPDATA", path, size);
+    if (length == 0 || length >= size) {
+        return false;
+    }
+    wcscat_s(path, size, L"\\OutlookToTray");
+    CreateDirectoryW(path, NULL);
+    wcscat_s(path, size, L"\\");
+    return wcscat_s(path, size, name) == 0;
+}
+
+// Ask the window's subclass procedure to restore it in one batched update
+// Returns immediately; the restored notification is the acknowledgement.
+// Sent rather than posted so the hook sees it too, and subclasses a window a
+// previous tray hid before this Outlook process had the hook.
+bool RequestInProcessRestore(const HiddenWindowInfo* pInfo, BOOL prewarmed, LONGLONG clickTicks) {
+    // We hold the foreground right from the click; Outlook needs it to activate
+    AllowSetForegroundWindow(pInfo->processId);
+    return SendNotifyMessage(pInfo->hwnd, g_restoreMessage, prewarmed, (LPARAM)clickTicks) != FALSE;
+}
+
+// Outlook is about to be shown (or already was): full speed again
+// Only the lift happens here, one call per process; the worker then samples the
+// period and leaves the mode again for any process it put in after the copy
+void StopThrottle() {
+    if (!g_throttling) {
+        return;
+    }
+    g_throttling = false;
+    KillTimer(g_hwnd, ID_TIMER_THROTTLE);
+    ThrottledProcess lowered[MAX_TREE_PROCESSES];
+    EnterCriticalSection(&g_throttleLock);
+    int count = g_loweredCount;
+    memcpy(lowered, g_lowered, count * sizeof(ThrottledProcess));
+    g_loweredCount = 0;
+    LeaveCriticalSection(&g_throttleLock);
+    ThrottleLift(lowered, count);
+    WorkItem item = {};
+    item.kind = WORK_THROTTLE_STOP;
+    QueueWork(&item);
+}
+
+// Start measuring, and in efficiency mode throttling, once Outlook is out of sight
+// Other target apps' hidden windows do not count
+void UpdateThrottle() {
+    DWORD pid = g_outlookPid;
+    const HiddenWindowInfo* pNewest = NewestHiddenWindow(&g_model, RULE_OUTLOOK);
+    if (!pNewest || !pid) {
+        StopThrottle();
+    }
+    else if (!g_throttling && !PrewarmHolding(&g_prewarm, GetTickCount64()) && !OsHasOnScreenWindow(pid)) {
+        g_throttling = true;
+        WorkItem item = {};
+        item.kind = WORK_THROTTLE_START;
+        item.id = pid;
+        item.value = (g_settings.values[SETTING_EFFICIENCY_MODE] != 0) | (pNewest->cloaked ? HIDE_CLOAK : HIDE_OFFSCREEN) << 1;
+        QueueWork(&item);
+        SetTimer(g_hwnd, ID_TIMER_THROTTLE, THROTTLE_RESCAN_MS, NULL);
+    }
+}
+
+// Throttle work queued by the UI thread (worker thread)
+void RunThrottleWork(const WorkItem* pItem) {
+    switch (pItem->kind) {
+    case WORK_THROTTLE_START: {
+        BOOL efficient = pItem->value & 1;
+        ThrottleStart(&g_throttle, pItem->id, efficient, GetTickCount64());
+        g_throttleHideMode = pItem->value >> 1;
+        wchar_t buf[100];
+        swprintf_s(buf, L"Outlook hidden: %d process(es)%s", g_throttle.count,
+                   efficient ? L" in efficiency mode" : L"");
+        DebugMsg(buf);
+        break;
+    }
+    case WORK_THROTTLE_RESCAN:
+        ThrottleRescan(&g_throttle, pItem->id);
+        break;
+    case WORK_THROTTLE_STOP:
+        if (g_throttle.active) {
+            ThrottleStop(&g_throttle, GetTickCount64(), &g_hiddenCpu[g_throttleHideMode][g_throttle.efficient]);
+            DebugMsg(L"Outlook processes back to normal scheduling");
+        }
+        break;
+    }
+    // What Diagnostics shows and what a restore has to lift
+    EnterCriticalSection(&g_throttleLock);
+    memcpy(g_hiddenCpuShown, g_hiddenCpu, sizeof(g_hiddenCpuShown));
+    ThrottleTotal(&g_throttle, GetTickCount64(), &g_hiddenCpuShown[g_throttleHideMode][g_throttle.efficient]);
+    g_loweredCount = g_throttle.active && g_throttle.efficient ? g_throttle.count : 0;
+    memcpy(g_lowered, g_throttle.processes, g_loweredCount * sizeof(ThrottledProcess));
+    LeaveCriticalSection(&g_throttleLock);
+}
+
+// Pointer over the tray icon: a click may follow, so get the hidden windows ready
+// Efficiency mode is lifted until a restore or PREWARM_HOLD_MS after the last hover
+void PrewarmHiddenWindows() {
+    if (!g_settings.values[SETTING_PREWARM] || g_model.hiddenCount == 0 ||
+        !PrewarmOnHover(&g_prewarm, GetTickCount64())) {
+        return;
+    }
+    StopThrottle();
+    int repainted = RepaintHiddenWindows(&g_model);
+    SetTimer(g_hwnd, ID_TIMER_PREWARM, PREWARM_HOLD_MS, NULL);
+    wchar_t buf[64];
+    swprintf_s(buf, L"Pre-warmed %d hidden window(s)", repainted);
+    DebugMsg(buf);
+}
 
-        if (IsAutoStartEnabled()) {
-            RegDeleteValue(hKey, L"OutlookToTray");
-            MessageBox(g_hwnd, L"Removed from startup.", L"Outlook to Tray", MB_OK | MB_ICONINFORMATION);
+// Toggle efficiency mode; takes effect from the next time Outlook is hidden
+void ToggleEfficiencyMode() {
+    WriteSetting(SETTING_EFFICIENCY_MODE, g_settings.values[SETTING_EFFICIENCY_MODE] ? 0 : 1);
+}
+
+// Toggle cloaking as the hide strategy; takes effect from the next window hidden
+void ToggleHideMode() {
+    WriteSetting(SETTING_HIDE_MODE, g_settings.values[SETTING_HIDE_MODE] == HIDE_CLOAK ? HIDE_OFFSCREEN : HIDE_CLOAK);
+    ApplySettings();
+}
+
+// Restore hidden windows: all of them, only 'only', or only those of one rule
+// 'clickTicks' is when the user asked, if not now. Returns the number of
+// in-process restores requested, whose notifications are still to come.
+int RestoreHiddenWindows(HWND only = NULL, int rule = -1, LONGLONG clickTicks = 0) {
+    DebugMsg(L"RestoreHiddenWindows called");
+
+    // Undo efficiency mode before anything of Outlook's becomes visible
+    if (rule < 0 || rule == RULE_OUTLOOK) {
+        StopThrottle();
+    }
+    BOOL prewarmed = PrewarmOnRestore(&g_prewarm, GetTickCount64());
+    KillTimer(g_hwnd, ID_TIMER_PREWARM);
+
+    // Oldest first, so the most recently hidden window ends up in front
+    // The model stays as it is until the DLL's notifications arrive
+    if (!clickTicks) {
+        clickTicks = OsQueryPerformanceCounter();
+    }
+    int restored = 0;
+    int requested = 0;
+    for (int i = 0; i < g_model.hiddenCount; i++) {
+        const HiddenWindowInfo* pInfo = &g_model.hidden[i];
+        if ((only && pInfo->hwnd != only) || (rule >= 0 && pInfo->rule != rule)) {
+            continue;
         }
-        else {
-            wchar_t exePath[MAX_PATH];
-            GetModuleFileName(NULL, exePath, MAX_PATH);
-            RegSetValueEx(hKey, L"OutlookToTray", 0, REG_SZ,
-                (BYTE*)exePath, (DWORD)(wcslen(exePath) + 1) * sizeof(wchar_t));
-            MessageBox(g_hwnd, L"Added to startup.", L"Outlook to Tray", MB_OK | MB_ICONINFORMATION);
-        }
-        RegCloseKey(hKey);
-    }
-}
-
-// Restore hidden Outlook window
-void RestoreOutlookWindow() {
-    DebugMsg(L"RestoreOutlookWindow called");
-    if (g_GetHiddenOutlookWindow) {
-        HWND hwnd = g_GetHiddenOutlookWindow();
-        DebugMsg(hwnd ? L"Got hidden window handle" : L"No hidden window");
-        if (hwnd && IsWindow(hwnd)) {
-            // Restore original extended style (shows in taskbar again)
-            if (g_GetOriginalExStyle) {
-                LONG exStyle = g_GetOriginalExStyle();
-                if (exStyle != 0) {
-                    SetWindowLong(hwnd, GWL_EXSTYLE, exStyle);
-                }
-            }
+        restored++;
+        // Only Outlook itself can uncloak its windows, whatever the restore mode
+        if ((g_inProcessRestore || pInfo->cloaked) && RequestInProcessRestore(pInfo, prewarmed, clickTicks)) {
+            requested++;
+            continue;
+        }
+        RestoreWindow(pInfo);
+        g_MarkWindowRestored(pInfo->hwnd);
+        RecordRestoreTime(&g_trayRestoreTiming, OsQueryPerformanceCounter() - clickTicks);
+    }
+
+    if (restored > 0) {
+        DebugMsg(L"Window restored");
+    }
+    else if (rule < 0 || rule == RULE_OUTLOOK) {
+        // Nothing hidden: the shell activates a running Outlook or launches it
+        DebugMsg(L"No hidden window, opening Outlook");
+        WorkItem item = {};
+        item.kind = WORK_OPEN_OUTLOOK;
+        QueueWork(&item);
+    }
+    return requested;
+}
 
-            // Restore original window position
-            RECT origRect = {0};
-            if (g_GetOriginalRect && g_GetOriginalRect(&origRect)) {
-                SetWindowPos(hwnd, NULL, origRect.left, origRect.top, 0, 0,
-                             SWP_NOSIZE | SWP_NOZORDER | SWP_FRAMECHANGED);
+// Draw the unread badge over the tray icon
+// The circle is written straight into the pixels so it keeps full alpha;
+// GDI text clears alpha, so it is made opaque again inside the circle.
+HICON RenderBadgeIcon(HICON hBase, int badgeIndex) {
+    int cx = GetSystemMetrics(SM_CXSMICON);
+    int cy = GetSystemMetrics(SM_CYSMICON);
+
+    BITMAPINFO bmi = {};
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = cx;
+    bmi.bmiHeader.biHeight = -cy;   // Top-down
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    HDC hdcScreen = GetDC(NULL);
+    void* pBits = NULL;
+    HBITMAP hColor = CreateDIBSection(hdcScreen, &bmi, DIB_RGB_COLORS, &pBits, NULL, 0);
+    HDC hdc = CreateCompatibleDC(hdcScreen);
+    ReleaseDC(NULL, hdcScreen);
+    if (!hColor || !hdc) {
+        if (hColor) DeleteObject(hColor);
+        if (hdc) DeleteDC(hdc);
+        return NULL;
+    }
+    HGDIOBJ hOldBitmap = SelectObject(hdc, hColor);
+    DrawIconEx(hdc, 0, 0, hBase, cx, cy, 0, NULL, DI_NORMAL);
+    GdiFlush();
+
+    // Filled circle in the lower-right corner
+    DWORD* pixels = (DWORD*)pBits;
+    int radius = cx * 5 / 16;
+    int centerX = cx - radius - 1;
+    int centerY = cy - radius - 1;
+    for (int y = 0; y < cy; y++) {
+        for (int x = 0; x < cx; x++) {
+            int dx = x - centerX, dy = y - centerY;
+            if (dx * dx + dy * dy <= radius * radius + radius) {
+                pixels[y * cx + x] = 0xFFD32F2F;
             }
+        }
+    }
 
-            ShowWindow(hwnd, SW_SHOW);
-            ShowWindow(hwnd, SW_RESTORE);
-            SetForegroundWindow(hwnd);
-            BringWindowToTop(hwnd);
-            if (g_ClearHiddenWindow) {
-                g_ClearHiddenWindow();
+    wchar_t label[8];
+    FormatBadgeLabel(badgeIndex, label, ARRAYSIZE(label));
+    HFONT hFont = CreateFontW(-(radius * 2), 0, 0, 0, FW_BOLD, FALSE, FALSE, FALSE,
+                              DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS,
+                              NONANTIALIASED_QUALITY, DEFAULT_PITCH, L"Segoe UI");
+    HGDIOBJ hOldFont = SelectObject(hdc, hFont);
+    SetBkMode(hdc, TRANSPARENT);
+    SetTextColor(hdc, RGB(255, 255, 255));
+    RECT rc = { centerX - radius - 2, centerY - radius, centerX + radius + 2, centerY + radius + 1 };
+    DrawTextW(hdc, label, -1, &rc, DT_CENTER | DT_VCENTER | DT_SINGLELINE | DT_NOCLIP);
+    GdiFlush();
+    SelectObject(hdc, hOldFont);
+    DeleteObject(hFont);
+
+    for (int y = 0; y < cy; y++) {
+        for (int x = 0; x < cx; x++) {
+            int dx = x - centerX, dy = y - centerY;
+            if (dx * dx + dy * dy <= radius * radius + radius) {
+                pixels[y * cx + x] |= 0xFF000000;
             }
-            DebugMsg(L"Window restored");
+        }
+    }
+    SelectObject(hdc, hOldBitmap);
+    DeleteDC(hdc);
+
+    // All-zero mask: the color bitmap's alpha decides transparency
+    std::vector<BYTE> maskBits(((cx + 15) / 16) * 2 * cy, 0);
+    HBITMAP hMask = CreateBitmap(cx, cy, 1, 1, maskBits.data());
+    ICONINFO ii = {};
+    ii.fIcon = TRUE;
+    ii.hbmMask = hMask;
+    ii.hbmColor = hColor;
+    HICON hIcon = CreateIconIndirect(&ii);
+    DeleteObject(hMask);
+    DeleteObject(hColor);
+    return hIcon;
+}
+
+// Icon for a badge index, rendering each badge at most once
+HICON GetBadgeIcon(int badgeIndex) {
+    if (badgeIndex == 0 || !g_hIcon) {
+        return g_hIcon;
+    }
+    if (!g_badgeIcons[badgeIndex]) {
+        g_badgeIcons[badgeIndex] = RenderBadgeIcon(g_hIcon, badgeIndex);
+    }
+    return g_badgeIcons[badgeIndex] ? g_badgeIcons[badgeIndex] : g_hIcon;
+}
+
+// Send the model's icon and tooltip to Explorer in one call
+// Without the icon there is nothing to update; the next add sends the model
+void UpdateTrayIcon() {
+    if (!g_trayIcon.added) {
+        return;
+    }
+    g_nid.hIcon = GetBadgeIcon(BadgeIndex(g_model.unreadCount));
+    FormatTrayTooltip(&g_model, g_nid.szTip, ARRAYSIZE(g_nid.szTip));
+    g_nid.uFlags = NIF_ICON | NIF_TIP;
+    Shell_NotifyIcon(NIM_MODIFY, &g_nid);
+}
+
+// The model changed: update the icon now, or once the rate limit allows
+// Changes arriving while a timer is armed are picked up when it fires
+void ScheduleTrayUpdate() {
+    ULONGLONG delay = 0;
+    switch (TrayUpdateRequest(&g_trayUpdate, GetTickCount64(), &delay)) {
+    case TRAY_UPDATE_NOW:
+        UpdateTrayIcon();
+        break;
+    case TRAY_UPDATE_LATER:
+        SetTimer(g_hwnd, ID_TIMER_TRAY_UPDATE, (UINT)delay, NULL);
+        break;
+    case TRAY_UPDATE_PENDING:
+        break;
+    }
+}
+
+// Arm the trim timer for the next due trim, or stop it (nothing hidden any more)
+void ScheduleTrim() {
+    ULONGLONG due = TrimDueTick(&g_trimPolicy, &g_model, g_lastTrimTick);
+    if (!due) {
+        KillTimer(g_hwnd, ID_TIMER_TRIM);
+        return;
+    }
+    ULONGLONG now = GetTickCount64();
+    ULONGLONG delay = due > now ? due - now : 0;
+    SetTimer(g_hwnd, ID_TIMER_TRIM, delay < USER_TIMER_MAXIMUM ? (UINT)delay : USER_TIMER_MAXIMUM, NULL);
+}
+
+// Trim timer: hand the trim to the monitor thread if Outlook is still out of sight
+// A window the user is working in (a compose window, say) postpones it by one interval
+void OnTrimTimer() {
+    KillTimer(g_hwnd, ID_TIMER_TRIM);
+    ULONGLONG now = GetTickCount64();
+    ULONGLONG due = TrimDueTick(&g_trimPolicy, &g_model, g_lastTrimTick);
+    DWORD pid = g_outlookPid;
+    if (due && due <= now && pid) {
+        g_lastTrimTick = now;
+        if (OsHasOnScreenWindow(pid)) {
+            DebugMsg(L"Outlook has a window on screen, not trimming");
         }
         else {
-            // No hidden window - check if Outlook is running
-            DWORD pid = FindProcessId(L"olk.exe");
-            if (pid) {
-                // Outlook is running but no hidden window tracked
-                MessageBox(NULL, L"Outlook is running but window not found.\nPlease open Outlook manually.",
-                          L"Outlook to Tray", MB_OK | MB_ICONINFORMATION);
-            } else {
-                // Outlook not running - launch it
-                DebugMsg(L"Launching Outlook");
-                // Use shell to open the new Outlook app
-                ShellExecute(NULL, L"open", L"ms-outlook:", NULL, NULL, SW_SHOWNORMAL);
-            }
+            PostToMonitor(WM_TRIM_OUTLOOK);
+        }
+    }
+    ScheduleTrim();
+}
+
+// Saved hidden windows of the previous run; empty if there are none
+void LoadHiddenWindowFile() {
+    wchar_t path[MAX_PATH];
+    if (!GetDataPath(HIDDEN_FILE_NAME, path, MAX_PATH)) {
+        return;
+    }
+    HANDLE hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    DWORD read = 0;
+    if (!ReadFile(hFile, &g_savedHidden, sizeof(g_savedHidden), &read, NULL) || read != sizeof(g_savedHidden)) {
+        g_savedHidden = HiddenWindowFile();
+    }
+    CloseHandle(hFile);
+}
+
+// Write the saved hidden windows (worker thread)
+bool WriteHiddenWindowFile(const HiddenWindowFile* pFile) {
+    wchar_t path[MAX_PATH];
+    if (!GetDataPath(HIDDEN_FILE_NAME, path, MAX_PATH)) {
+        return false;
+    }
+    HANDLE hFile = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    DWORD written = 0;
+    bool ok = WriteFile(hFile, pFile, sizeof(*pFile), &written, NULL) && written == sizeof(*pFile);
+    CloseHandle(hFile);
+    return ok;
+}
+
+// Keep the hidden windows on disk, for a tray started after this one crashes
+// At most a few hundred bytes, written only when the set of windows changes
+void SaveHiddenWindowFile(const HiddenWindowInfo* pWindows, int count) {
+    WorkItem item = {};
+    item.kind = WORK_SAVE_HIDDEN;
+    SaveHiddenWindows(pWindows, count, &item.hidden);
+    QueueWork(&item);
+}
+
+// Copy what the status command reports for the pipe server (UI thread)
+// Clients are answered from this copy and never wait on the UI thread
+void PublishControlStatus() {
+    ControlStatus status = {};
+    status.outlookRunning = g_model.outlookRunning;
+    status.outlookPid = g_outlookPid;
+    status.unreadCount = g_model.unreadCount;
+    status.hiddenCount = g_model.hiddenCount;
+    for (int i = 0; i < g_model.hiddenCount; i++) {
+        int rule = g_model.hidden[i].rule;
+        if (rule >= 0 && rule < MAX_TARGET_RULES) {
+            status.hiddenByRule[rule]++;
         }
     }
+    status.targetedHook = g_targetedHook;
+    status.lean = g_lean;
+    status.stalls = g_stalls.stalls;
+    status.maxStallUs = g_stalls.maxTicks * 1000000 / OsQueryPerformanceFrequency();
+    EnterCriticalSection(&g_controlLock);
+    g_controlStatus = status;
+    LeaveCriticalSection(&g_controlLock);
+}
+
+// Something changed in the hidden-window table or Outlook's state
+// The notification only says the model is stale; the table is the truth
+// Windows of another target app that exited are dropped here, without counting
+// as restores (Outlook's go when the monitor thread sees it exit)
+void RefreshTrayModel() {
+    HiddenWindowInfo windows[MAX_HIDDEN_WINDOWS];
+    int count = g_GetHiddenWindows(windows, MAX_HIDDEN_WINDOWS);
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (IsWindow(windows[i].hwnd)) {
+            windows[kept++] = windows[i];
+        }
+        else {
+            g_ForgetDestroyedWindow(windows[i].hwnd);
+        }
+    }
+    count = kept;
+    if (TrayModelUpdate(&g_model, g_outlookPid != 0, windows, count)) {
+        ScheduleTrayUpdate();
+        SaveHiddenWindowFile(windows, count);
+    }
+    ScheduleTrim();
+    UpdateThrottle();
+    PublishControlStatus();
+}
+
+// A settings key or the config file changed: reload, and apply if anything differs
+void ReloadSettings() {
+    TraySettings settings = {};
+    LoadSettings(&settings, g_configPath);
+    if (memcmp(&settings, &g_settings, sizeof(settings)) == 0) {
+        return;
+    }
+    g_settings = settings;
+    ApplySettings();
+    ScheduleTrim();
+    DebugMsg(L"Settings reloaded");
+    LOG_INFO(g_pLogRing, LOG_SETTINGS_RELOADED);
+}
+
+// Rebuild the per-window restore submenu from the model
+void UpdateWindowMenu() {
+    while (GetMenuItemCount(g_hWindowMenu) > 0) {
+        DeleteMenu(g_hWindowMenu, 0, MF_BYPOSITION);
+    }
+
+    for (int i = 0; i < g_model.hiddenCount; i++) {
+        wchar_t title[128];
+        int rule = g_model.hidden[i].rule;
+        if (GetWindowText(g_model.hidden[i].hwnd, title, 128) == 0) {
+            lstrcpyW(title, rule < g_rules.count ? g_rules.rules[rule].name : L"Outlook");
+        }
+        g_menuWindows[i] = g_model.hidden[i].hwnd;
+        AppendMenu(g_hWindowMenu, MF_STRING, ID_TRAY_WINDOW_FIRST + i, title);
+    }
+    if (g_model.hiddenCount == 0) {
+        AppendMenu(g_hWindowMenu, MF_STRING | MF_GRAYED, 0, L"No hidden windows");
+    }
+}
+
+// One "Restore <app>" item per rule at the top of the menu; grayed while the
+// app has nothing hidden, except Outlook, which the item opens instead
+void UpdateAppMenu() {
+    for (int i = 0; i < MAX_TARGET_RULES; i++) {
+        DeleteMenu(g_hMenu, ID_TRAY_APP_FIRST + i, MF_BYCOMMAND);
+    }
+    int count = g_rules.count > 0 ? g_rules.count : 1;
+    for (int i = 0; i < count; i++) {
+        const wchar_t* name = g_rules.count > 0 ? g_rules.rules[i].name : L"Outlook";
+        wchar_t label[64];
+        swprintf_s(label, L"Restore %s", name);
+        UINT flags = MF_BYPOSITION | MF_STRING;
+        if (i != RULE_OUTLOOK && !NewestHiddenWindow(&g_model, i)) {
+            flags |= MF_GRAYED;
+        }
+        InsertMenu(g_hMenu, i, flags, ID_TRAY_APP_FIRST + i, label);
+    }
 }
 
 // Show context menu
@@ -167,103 +811,222 @@ void ShowContextMenu() {
     GetCursorPos(&pt);
     SetForegroundWindow(g_hwnd);
 
-    // Update autostart checkmark
-    UINT autoStartState = IsAutoStartEnabled() ? MF_CHECKED : MF_UNCHECKED;
-    CheckMenuItem(g_hMenu, ID_TRAY_AUTOSTART, MF_BYCOMMAND | autoStartState);
+    // Checkmarks from the cached settings; settings fixed by policy are grayed
+    CheckMenuItem(g_hMenu, ID_TRAY_AUTOSTART,
+                  MF_BYCOMMAND | (g_settings.autoStart ? MF_CHECKED : MF_UNCHECKED));
+    CheckMenuItem(g_hMenu, ID_TRAY_EFFICIENCY,
+                  MF_BYCOMMAND | (g_settings.values[SETTING_EFFICIENCY_MODE] ? MF_CHECKED : MF_UNCHECKED));
+    CheckMenuItem(g_hMenu, ID_TRAY_CLOAK,
+                  MF_BYCOMMAND | (g_settings.values[SETTING_HIDE_MODE] == HIDE_CLOAK ? MF_CHECKED : MF_UNCHECKED));
+    CheckMenuItem(g_hMenu, ID_TRAY_TRACE, MF_BYCOMMAND | (g_tracePath[0] ? MF_CHECKED : MF_UNCHECKED));
+    EnableMenuItem(g_hMenu, ID_TRAY_EFFICIENCY,
+                   MF_BYCOMMAND | (SettingLocked(&g_settings, SETTING_EFFICIENCY_MODE) ? MF_GRAYED : MF_ENABLED));
+    EnableMenuItem(g_hMenu, ID_TRAY_CLOAK,
+                   MF_BYCOMMAND | (SettingLocked(&g_settings, SETTING_HIDE_MODE) ? MF_GRAYED : MF_ENABLED));
+    // Another target app may have exited since the last notification
+    RefreshTrayModel();
+    UpdateAppMenu();
+    UpdateWindowMenu();
 
     TrackPopupMenu(g_hMenu, TPM_LEFTALIGN | TPM_RIGHTBUTTON, pt.x, pt.y, 0, g_hwnd, NULL);
     PostMessage(g_hwnd, WM_NULL, 0, 0);
+    // Time spent in the menu is the user's, not a stall
+    g_dispatchStart = OsQueryPerformanceCounter();
 }
 
-// Show about dialog
-void ShowAboutDialog() {
-    MessageBox(g_hwnd,
-        L"Outlook to Tray\n\n"
-        L"Minimizes Outlook to the system tray when closed.\n\n"
-        L"Left-click tray icon to restore.\n"
-        L"Right-click for menu.",
-        L"About Outlook to Tray",
-        MB_OK | MB_ICONINFORMATION);
+// Show about information at the tray icon
+void ShowAbout() {
+    wchar_t text[256];
+    LONG mapped = g_GetMappedProcessCount ? g_GetMappedProcessCount() : 0;
+    swprintf_s(text,
+        L"Minimizes Outlook to the system tray when closed. "
+        L"Left-click the icon to restore, right-click for the menu.\n"
+        L"Hook mode: %s, loaded in %ld process(es)\n"
+        L"Monitor wakeups since start: %ld",
+        g_targetedHook ? L"Outlook threads only" : L"global", mapped,
+        (LONG)g_monitorWakeups);
+    ShowBalloon(text, NIIF_INFO);
 }
 
-// Create tray icon
-bool CreateTrayIcon() {
-    wchar_t dbg[256];
-
-    // Verify window handle
-    swprintf_s(dbg, L"CreateTrayIcon: hwnd=%p, IsWindow=%d", g_hwnd, IsWindow(g_hwnd));
-    DebugMsg(dbg);
+// Write a diagnostics report to %TEMP% as UTF-16 text
+bool SaveDiagnostics(const wchar_t* text, wchar_t* path, DWORD pathSize) {
+    SYSTEMTIME now;
+    GetLocalTime(&now);
+    wchar_t tempDir[MAX_PATH];
+    if (!GetTempPathW(MAX_PATH, tempDir)) {
+        return false;
+    }
+    swprintf_s(path, pathSize, L"%sOutlookToTray-Diagnostics-%04u%02u%02u-%02u%02u%02u.txt", tempDir,
+               now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond);
 
-    if (!g_hwnd || !IsWindow(g_hwnd)) {
-        MessageBox(NULL, L"Invalid window handle", L"Error", MB_ICONERROR);
+    HANDLE hFile = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
         return false;
     }
 
-    // Load gear icon from shell32.dll (icon index 316 is a gear on Windows 10/11)
-    g_hIcon = ExtractIconW(g_hInstance, L"shell32.dll", 316);
-    if (!g_hIcon || g_hIcon == (HICON)1) {
-        // Fallback: try imageres.dll (index 109 = gear)
-        g_hIcon = ExtractIconW(g_hInstance, L"imageres.dll", 109);
+    // Byte order mark, then the report with CRLF line ends for Notepad
+    const wchar_t bom = 0xFEFF;
+    DWORD written;
+    bool ok = WriteFile(hFile, &bom, sizeof(bom), &written, NULL) != FALSE;
+    for (const wchar_t* p = text; ok && *p; p++) {
+        if (*p == L'\n') {
+            ok = WriteFile(hFile, L"\r", sizeof(wchar_t), &written, NULL) != FALSE;
+        }
+        if (ok) {
+            ok = WriteFile(hFile, p, sizeof(wchar_t), &written, NULL) != FALSE;
+        }
+    }
+    CloseHandle(hFile);
+    return ok;
+}
+
+// Hook counters aggregated over every process and the tray's own figures,
+// saved by the worker thread and opened in the default text editor
+void ShowDiagnostics() {
+    if (!g_GetHookStats) {
+        ShowBalloon(L"The hook DLL does not provide diagnostics.", NIIF_ERROR);
+        return;
+    }
+
+    HookStats total;
+    LONG uncounted = 0;
+    int live = g_GetHookStats(&total, &uncounted);
+
+    wchar_t text[8192];
+    LONGLONG frequency = OsQueryPerformanceFrequency();
+    int length = swprintf_s(text, L"Hook mode: %s\nRestore mode: %s\nHide mode: %s\n",
+                            g_targetedHook ? L"Outlook threads only" : L"global",
+                            g_inProcessRestore ? L"in-process" : L"from the tray",
+                            g_settings.values[SETTING_HIDE_MODE] == HIDE_CLOAK ? L"cloak" : L"off-screen");
+    DWORD sessionId = 0;
+    ProcessIdToSessionId(GetCurrentProcessId(), &sessionId);
+    length += swprintf_s(text + length, ARRAYSIZE(text) - length, L"Session: %lu, %s\n", sessionId,
+                         g_lean ? L"lean mode (one thread)" : L"threads: UI, hook, monitor, worker, log, pipe");
+    length += FormatSettings(&g_settings, text + length, ARRAYSIZE(text) - length);
+    length += FormatHookStats(&total, live, uncounted, frequency,
+                              text + length, ARRAYSIZE(text) - length);
+    length += FormatStartupTimes(&g_trayIcon, text + length, ARRAYSIZE(text) - length);
+    length += FormatRestoreTiming(L"Tray-path restores (click to visible)", &g_trayRestoreTiming,
+                                  frequency, text + length, ARRAYSIZE(text) - length);
+    length += FormatStallStats(&g_stalls, frequency, text + length, ARRAYSIZE(text) - length);
+    if (g_settings.values[SETTING_HOTKEY]) {
+        wchar_t hotkey[MAX_HOTKEY_TEXT];
+        FormatHotkey(g_settings.values[SETTING_HOTKEY], hotkey, MAX_HOTKEY_TEXT);
+        length += swprintf_s(text + length, ARRAYSIZE(text) - length, L"Hotkey %s: %s\n", hotkey,
+                             g_hotkeyTaken ? L"taken by another app" : L"registered");
+        length += FormatHotkeyStats(&g_hotkey, frequency, text + length, ARRAYSIZE(text) - length);
+    }
+    length += FormatAutoHideStats(&g_autoHide, GetTickCount64(), text + length, ARRAYSIZE(text) - length);
+    length += FormatRestoreTiming(L"Background work (queued to done)", &g_workTiming,
+                                  frequency, text + length, ARRAYSIZE(text) - length);
+    EnterCriticalSection(&g_trimLock);
+    length += FormatTrimHistory(&g_trimPolicy, &g_trimHistory, text + length, ARRAYSIZE(text) - length);
+    LeaveCriticalSection(&g_trimLock);
+    if (g_pLogRing) {
+        length += swprintf_s(text + length, ARRAYSIZE(text) - length,
+                             L"Log: %llu record(s) written, %llu lost, %ld drain wakeup(s), to %s\n",
+                             g_logWritten.load(), g_logLost.load(), (LONG)g_logWakeups, g_logPath);
+    }
+    length += swprintf_s(text + length, ARRAYSIZE(text) - length,
+                         L"Hover pre-warms: %llu, followed by a restore: %llu\n",
+                         g_prewarm.prewarms, g_prewarm.used);
+
+    // Include the period Outlook is hidden in right now
+    static const wchar_t* const labels[HIDE_MODE_COUNT][2] = {
+        { L"  Off-screen", L"  Off-screen, efficiency mode" },
+        { L"  Cloaked", L"  Cloaked, efficiency mode" },
+    };
+    HiddenCpu hiddenCpu[HIDE_MODE_COUNT][2];
+    EnterCriticalSection(&g_throttleLock);
+    memcpy(hiddenCpu, g_hiddenCpuShown, sizeof(hiddenCpu));
+    LeaveCriticalSection(&g_throttleLock);
+    length += swprintf_s(text + length, ARRAYSIZE(text) - length,
+                         L"CPU and GPU time of Outlook's processes while hidden:\n");
+    for (int mode = 0; mode < HIDE_MODE_COUNT; mode++) {
+        for (int efficient = 0; efficient < 2; efficient++) {
+            length += FormatHiddenCpu(labels[mode][efficient], &hiddenCpu[mode][efficient],
+                                      text + length, ARRAYSIZE(text) - length);
+        }
     }
-    if (!g_hIcon || g_hIcon == (HICON)1) {
-        // Final fallback: stock icon
-        g_hIcon = LoadIcon(NULL, IDI_APPLICATION);
+
+    WorkItem item = {};
+    item.kind = WORK_SAVE_DIAGNOSTICS;
+    item.text = _wcsdup(text);
+    if (item.text) {
+        QueueWork(&item);
     }
+}
 
-    swprintf_s(dbg, L"LoadIcon result: %p", g_hIcon);
-    DebugMsg(dbg);
+// Current time as a FILETIME value
+ULONGLONG FileTimeNow() {
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    return ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+}
 
-    if (!g_hIcon) {
-        MessageBox(NULL, L"Failed to load icon", L"Error", MB_ICONERROR);
-        return false;
+// When this process started, as a FILETIME value
+ULONGLONG ProcessStartTime() {
+    FILETIME creation, exitTime, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exitTime, &kernel, &user)) {
+        return 0;
     }
+    return ((ULONGLONG)creation.dwHighDateTime << 32) | creation.dwLowDateTime;
+}
+
+// Tray icon from our own resources, at the small-icon size
+HICON LoadTrayIcon() {
+    HICON hIcon = (HICON)LoadImageW(g_hInstance, MAKEINTRESOURCEW(IDI_TRAY), IMAGE_ICON,
+                                    GetSystemMetrics(SM_CXSMICON), GetSystemMetrics(SM_CYSMICON),
+                                    LR_DEFAULTCOLOR | LR_SHARED);
+    return hIcon ? hIcon : LoadIcon(NULL, IDI_APPLICATION);
+}
 
-    // Initialize NOTIFYICONDATA
+// Add the icon to the notification area; on failure try again from a timer
+// A NIM_ADD that timed out may still have gone through, so an icon that
+// already exists counts as added
+void AddTrayIcon() {
     ZeroMemory(&g_nid, sizeof(g_nid));
     g_nid.cbSize = sizeof(NOTIFYICONDATA);
     g_nid.hWnd = g_hwnd;
     g_nid.uID = ID_TRAY_ICON;
     g_nid.uFlags = NIF_ICON | NIF_MESSAGE | NIF_TIP;
     g_nid.uCallbackMessage = WM_TRAYICON;
-    g_nid.hIcon = g_hIcon;
-    lstrcpyW(g_nid.szTip, L"Outlook to Tray");
-
-    swprintf_s(dbg, L"NOTIFYICONDATA: cbSize=%u, hWnd=%p, uID=%u",
-               g_nid.cbSize, g_nid.hWnd, g_nid.uID);
-    DebugMsg(dbg);
-
-    // Try to add the icon
-    BOOL result = Shell_NotifyIconW(NIM_ADD, &g_nid);
-    swprintf_s(dbg, L"Shell_NotifyIconW result: %d", result);
-    DebugMsg(dbg);
-
-    if (!result) {
-        // Retry a few times
-        for (int i = 0; i < 3 && !result; i++) {
-            Sleep(1000);
-            result = Shell_NotifyIconW(NIM_ADD, &g_nid);
-            swprintf_s(dbg, L"Retry %d: result=%d", i + 1, result);
-            DebugMsg(dbg);
-        }
+    g_nid.hIcon = GetBadgeIcon(BadgeIndex(g_model.unreadCount));
+    FormatTrayTooltip(&g_model, g_nid.szTip, ARRAYSIZE(g_nid.szTip));
+
+    bool firstTime = g_trayIcon.iconVisible == 0;
+    BOOL added = Shell_NotifyIconW(NIM_ADD, &g_nid) || Shell_NotifyIconW(NIM_MODIFY, &g_nid);
+    ULONGLONG delay = TrayIconAddResult(&g_trayIcon, added, FileTimeNow());
+    if (delay) {
+        wchar_t dbg[128];
+        swprintf_s(dbg, L"Shell_NotifyIcon failed (attempt %d), retrying in %llu ms",
+                   g_trayIcon.attempts, delay);
+        DebugMsg(dbg);
+        SetTimer(g_hwnd, ID_TIMER_ICON_RETRY, (UINT)delay, NULL);
+        return;
     }
-
-    if (!result) {
-        MessageBox(NULL, L"Shell_NotifyIcon failed after retries.\n"
-                        L"Try restarting Windows Explorer.",
-                   L"Outlook to Tray", MB_ICONERROR);
-        return false;
+    if (firstTime) {
+        LOG_INFO(g_pLogRing, LOG_ICON_ADDED, g_trayIcon.attempts);
+        wchar_t text[256];
+        FormatStartupTimes(&g_trayIcon, text, ARRAYSIZE(text));
+        DebugMsg(text);
     }
-
-    DebugMsg(L"Tray icon created successfully!");
-    return true;
 }
 
 // Create context menu
 void CreateContextMenu() {
     g_hMenu = CreatePopupMenu();
-    AppendMenu(g_hMenu, MF_STRING, ID_TRAY_RESTORE, L"Restore Outlook");
+    g_hWindowMenu = CreatePopupMenu();
+    AppendMenu(g_hMenu, MF_POPUP, (UINT_PTR)g_hWindowMenu, L"Restore Window");
     AppendMenu(g_hMenu, MF_SEPARATOR, 0, NULL);
     AppendMenu(g_hMenu, MF_STRING, ID_TRAY_AUTOSTART, L"Run at Startup");
+    AppendMenu(g_hMenu, MF_STRING, ID_TRAY_EFFICIENCY, L"Efficiency Mode While Hidden");
+    AppendMenu(g_hMenu, MF_STRING, ID_TRAY_CLOAK, L"Hide by Cloaking");
+    AppendMenu(g_hMenu, MF_STRING, ID_TRAY_DIAGNOSTICS, L"Diagnostics");
+    if (g_StartMessageTrace && g_StopMessageTrace) {
+        AppendMenu(g_hMenu, MF_STRING, ID_TRAY_TRACE, L"Capture Message Trace");
+    }
     AppendMenu(g_hMenu, MF_STRING, ID_TRAY_ABOUT, L"About");
     AppendMenu(g_hMenu, MF_SEPARATOR, 0, NULL);
     AppendMenu(g_hMenu, MF_STRING, ID_TRAY_EXIT, L"Exit");
@@ -294,12 +1057,26 @@ bool LoadHookDll() {
 
     g_InstallHook = (InstallHookProc)GetProcAddress(g_hDll, "InstallHook");
     g_UninstallHook = (UninstallHookProc)GetProcAddress(g_hDll, "UninstallHook");
-    g_GetHiddenOutlookWindow = (GetHiddenOutlookWindowProc)GetProcAddress(g_hDll, "GetHiddenOutlookWindow");
-    g_ClearHiddenWindow = (ClearHiddenWindowProc)GetProcAddress(g_hDll, "ClearHiddenWindow");
-    g_GetOriginalRect = (GetOriginalRectProc)GetProcAddress(g_hDll, "GetOriginalRect");
-    g_GetOriginalExStyle = (GetOriginalExStyleProc)GetProcAddress(g_hDll, "GetOriginalExStyle");
+    g_GetHiddenWindows = (GetHiddenWindowsProc)GetProcAddress(g_hDll, "GetHiddenWindows");
+    g_MarkWindowRestored = (MarkWindowRestoredProc)GetProcAddress(g_hDll, "MarkWindowRestored");
+    g_ForgetProcessWindows = (ForgetProcessWindowsProc)GetProcAddress(g_hDll, "ForgetProcessWindows");
+    g_ForgetDestroyedWindow = (ForgetDestroyedWindowProc)GetProcAddress(g_hDll, "ForgetDestroyedWindow");
+    g_RetargetThreadHooks = (RetargetThreadHooksProc)GetProcAddress(g_hDll, "RetargetThreadHooks");
+    g_GetMappedProcessCount = (GetMappedProcessCountProc)GetProcAddress(g_hDll, "GetMappedProcessCount");
+    g_GetHookStats = (GetHookStatsProc)GetProcAddress(g_hDll, "GetHookStats");
+    g_SetTrayWindow = (SetTrayWindowProc)GetProcAddress(g_hDll, "SetTrayWindow");
+    g_SetHookSettings = (SetHookSettingsProc)GetProcAddress(g_hDll, "SetHookSettings");
+    g_GetLogRing = (GetLogRingProc)GetProcAddress(g_hDll, "GetLogRing");
+    g_StartMessageTrace = (StartMessageTraceProc)GetProcAddress(g_hDll, "StartMessageTrace");
+    g_StopMessageTrace = (StopMessageTraceProc)GetProcAddress(g_hDll, "StopMessageTrace");
+    g_RecoverHiddenWindows = (RecoverHiddenWindowsProc)GetProcAddress(g_hDll, "RecoverHiddenWindows");
+
+    if (!g_RetargetThreadHooks) {
+        g_targetedHook = false;
+    }
 
-    if (!g_InstallHook || !g_UninstallHook || !g_GetHiddenOutlookWindow) {
+    if (!g_InstallHook || !g_UninstallHook || !g_GetHiddenWindows ||
+        !g_MarkWindowRestored || !g_ForgetProcessWindows || !g_ForgetDestroyedWindow || !g_SetTrayWindow) {
         MessageBox(NULL, L"DLL missing required functions", L"Outlook to Tray", MB_ICONERROR);
         FreeLibrary(g_hDll);
         g_hDll = NULL;
@@ -310,51 +1087,1099 @@ bool LoadHookDll() {
     return true;
 }
 
-// Background thread: monitor for Outlook process
-void MonitorOutlook() {
-    DebugMsg(L"Monitor thread started");
-    DWORD lastPid = 0;
+void RetargetHooks();
+
+// Publish the known UI thread set, and hand it to the hook thread (targeted mode)
+// The set never holds threads of the other bitness: the hook does not run there
+// in either mode. Hide requests only go to the threads a hook is confirmed on:
+// in targeted mode RetargetHooks publishes those once the hooks are set, in
+// global mode they are the whole set if the global hook went in.
+// In lean mode the hooks belong to this thread, so they are set right away
+void ApplyThreadHooks() {
+    EnterCriticalSection(&g_hookLock);
+    g_hookTargetCount = 0;
+    for (int i = 0; i < g_tracker.uiThreadCount; i++) g_hookTargets[g_hookTargetCount++] = g_tracker.uiThreads[i];
+    for (int i = 0; i < g_tracker.appThreadCount; i++) g_hookTargets[g_hookTargetCount++] = g_tracker.appThreads[i];
+    g_hookAppCount = g_tracker.appThreadCount;
+    g_hookSkippedCount = g_tracker.skippedThreadCount;
+    if (!g_targetedHook) {
+        g_hookedTargetCount = g_globalHookInstalled ? g_hookTargetCount : 0;
+        memcpy(g_hookedTargets, g_hookTargets, g_hookedTargetCount * sizeof(DWORD));
+    }
+    LeaveCriticalSection(&g_hookLock);
+    if (g_targetedHook && g_RetargetThreadHooks) {
+        if (g_hookThreadId.load() == GetCurrentThreadId()) {
+            RetargetHooks();
+        }
+        else {
+            PostThreadMessage(g_hookThreadId.load(), WM_RETARGET_HOOKS, 0, 0);
+        }
+    }
+}
+
+// Hook the threads ApplyThreadHooks asked for (hook thread)
+// Threads whose hook could not be set are left out of the confirmed set
+void RetargetHooks() {
+    DWORD threads[2 * MAX_UI_THREADS];
+    EnterCriticalSection(&g_hookLock);
+    int count = g_hookTargetCount;
+    int apps = g_hookAppCount;
+    int skipped = g_hookSkippedCount;
+    memcpy(threads, g_hookTargets, count * sizeof(DWORD));
+    LeaveCriticalSection(&g_hookLock);
+    DWORD hookedThreads[2 * MAX_UI_THREADS];
+    int hooked = g_RetargetThreadHooks(g_hDll, threads, count, hookedThreads);
+    EnterCriticalSection(&g_hookLock);
+    g_hookedTargetCount = hooked;
+    memcpy(g_hookedTargets, hookedThreads, hooked * sizeof(DWORD));
+    LeaveCriticalSection(&g_hookLock);
+    wchar_t buf[128];
+    swprintf_s(buf, L"Hooked %d UI thread(s), %d of other apps; %d of the other bitness left out",
+               hooked, apps, skipped);
+    DebugMsg(buf);
+    LOG_INFO(g_pLogRing, LOG_THREADS_HOOKED, hooked, apps, skipped);
+}
+
+// UI threads a hook is confirmed on, for hide requests; returns how many
+int CopyHookedTargets(DWORD* threads) {
+    EnterCriticalSection(&g_hookLock);
+    int count = g_hookedTargetCount;
+    memcpy(threads, g_hookedTargets, count * sizeof(DWORD));
+    LeaveCriticalSection(&g_hookLock);
+    return count;
+}
 
-    // Install hook immediately (pass DLL's module handle)
-    if (g_InstallHook && g_hDll) {
+// Global mode: install hook immediately (pass DLL's module handle)
+// The hooks belong to the calling thread, which must keep pumping messages
+void InstallGlobalHook() {
+    if (!g_targetedHook && g_InstallHook && g_hDll) {
         DebugMsg(L"Installing hook...");
         BOOL result = g_InstallHook(g_hDll);
+        g_globalHookInstalled = result != FALSE;
         if (result) {
             DebugMsg(L"Hook installed successfully");
         } else {
             DebugMsg(L"Hook installation FAILED");
         }
     }
+}
 
-    while (g_running) {
-        DWORD pid = FindProcessId(L"olk.exe");
+// Remove every hook before the DLL is unloaded (on the thread that set them)
+void RemoveHooks() {
+    if (g_UninstallHook) {
+        DebugMsg(L"Removing hook...");
+        g_UninstallHook();
+    }
+}
+
+// Hook thread: owns the hooks and does nothing but wait for messages
+// Windows runs the hook for a process the DLL cannot load into (32-bit apps,
+// for a 64-bit tray) on this thread, and the app waits for the answer. The
+// monitor thread may be busy trimming or scanning processes; this one never is.
+void HookThread() {
+    MSG msg;
+    PeekMessage(&msg, NULL, WM_USER, WM_USER, PM_NOREMOVE);
+    g_hookThreadId = GetCurrentThreadId();
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_ABOVE_NORMAL);
+    InstallGlobalHook();
+    SetEvent(g_hHookThreadReady);
+
+    // GetMessage also handles the hook calls sent from other processes
+    while (GetMessage(&msg, NULL, 0, 0)) {
+        if (msg.message == WM_RETARGET_HOOKS) {
+            RetargetHooks();
+        }
+    }
+
+    RemoveHooks();
+    DebugMsg(L"Hook thread exiting");
+}
+
+void CALLBACK OnWindowCreated(HWINEVENTHOOK hHook, DWORD event, HWND hwnd,
+                              LONG idObject, LONG idChild, DWORD idEventThread, DWORD dwmsEventTime);
+
+// Listen for window creation: desktop-wide while Outlook is not running
+// (to see it start), only Outlook's windows while it is (to see new UI threads)
+// Stays desktop-wide when other apps' threads have to be hooked too
+void WatchWindowCreation(DWORD processId) {
+    if (g_targetedHook && g_tracker.rules.count > 1) {
+        processId = 0;
+    }
+    if (g_hCreateHook) {
+        UnhookWinEvent(g_hCreateHook);
+    }
+    g_hCreateHook = SetWinEventHook(EVENT_OBJECT_CREATE, EVENT_OBJECT_CREATE, NULL,
+                                    OnWindowCreated, processId, 0,
+                                    WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+}
+
+void CALLBACK OnWindowNameChanged(HWINEVENTHOOK hHook, DWORD event, HWND hwnd,
+                                  LONG idObject, LONG idChild, DWORD idEventThread, DWORD dwmsEventTime);
+
+// Follow title changes of Outlook's windows (0 stops)
+void WatchTitleChanges(DWORD processId) {
+    if (g_hNameHook) {
+        UnhookWinEvent(g_hNameHook);
+        g_hNameHook = NULL;
+    }
+    if (processId) {
+        g_hNameHook = SetWinEventHook(EVENT_OBJECT_NAMECHANGE, EVENT_OBJECT_NAMECHANGE, NULL,
+                                      OnWindowNameChanged, processId, 0, WINEVENT_OUTOFCONTEXT);
+    }
+}
+
+// New unread count: hand it to the UI thread (only when it changed)
+void PublishUnreadCount() {
+    g_unreadCount = g_unread.count;
+    OsPostTrayNotification(g_hwnd, TRAY_NOTIFY_UNREAD_CHANGED, NULL);
+}
+
+// WinEvent callback for Outlook's name changes (runs on the monitor thread)
+// Most of these come from accessible objects inside the page; only the
+// window captions matter, and reading those does not block on Outlook.
+void CALLBACK OnWindowNameChanged(HWINEVENTHOOK hHook, DWORD event, HWND hwnd,
+                                  LONG idObject, LONG idChild, DWORD idEventThread, DWORD dwmsEventTime) {
+    if (!hwnd || idObject != OBJID_WINDOW || idChild != CHILDID_SELF ||
+        GetWindow(hwnd, GW_OWNER) != NULL || !OsIsTopLevelWindow(hwnd)) {
+        return;
+    }
+    wchar_t title[256];
+    GetWindowTextW(hwnd, title, ARRAYSIZE(title));
+    if (UnreadOnTitleChange(&g_unread, hwnd, title)) {
+        PublishUnreadCount();
+    }
+}
+
+// Take back Outlook windows a previous tray left hidden (crashed or restarted)
+// Only Outlook's known UI threads are enumerated, so this takes well under a millisecond
+void RecoverOutlookWindows() {
+    if (!g_RecoverHiddenWindows) {
+        return;
+    }
+    LONGLONG start = OsQueryPerformanceCounter();
+    int count = g_RecoverHiddenWindows(g_tracker.processId, RULE_OUTLOOK, g_tracker.uiThreads,
+                                       g_tracker.uiThreadCount, &g_savedHidden);
+    LONGLONG us = (OsQueryPerformanceCounter() - start) * 1000000 / OsQueryPerformanceFrequency();
+    wchar_t buf[100];
+    swprintf_s(buf, L"Recovered %d hidden window(s) in %lld us", count, us);
+    DebugMsg(buf);
+    if (count > 0) {
+        LOG_INFO(g_pLogRing, LOG_WINDOWS_RECOVERED, count, us);
+    }
+}
+
+// Outlook found by the tracker: wait on its process and hook its threads
+void OnOutlookStarted() {
+    g_hOutlookProcess = OpenProcess(SYNCHRONIZE, FALSE, g_tracker.processId);
+    if (!g_hOutlookProcess) {
+        TrackerStop(&g_tracker);
+        return;
+    }
+    DebugMsg(L"Outlook detected");
+    LOG_INFO(g_pLogRing, LOG_OUTLOOK_STARTED, g_tracker.processId);
+    g_outlookPid = g_tracker.processId;
+    ApplyThreadHooks();
+    RecoverOutlookWindows();
+    WatchWindowCreation(g_tracker.processId);
+    WatchTitleChanges(g_tracker.processId);
+    OsPostTrayNotification(g_hwnd, TRAY_NOTIFY_OUTLOOK_STARTED, NULL);
+}
+
+// Outlook exited: drop its handle and hooks, wait for the next start
+void OnOutlookExited() {
+    DebugMsg(L"Outlook closed");
+    LOG_INFO(g_pLogRing, LOG_OUTLOOK_EXITED, g_tracker.processId);
+    g_ForgetProcessWindows(g_tracker.processId);
+    CloseHandle(g_hOutlookProcess);
+    g_hOutlookProcess = NULL;
+    g_outlookPid = 0;
+    TrackerStop(&g_tracker);
+    ApplyThreadHooks();
+    WatchWindowCreation(0);
+    WatchTitleChanges(0);
+    if (g_unread.count != 0) {
+        g_unread = UnreadTracker();
+        PublishUnreadCount();
+    }
+    OsPostTrayNotification(g_hwnd, TRAY_NOTIFY_OUTLOOK_EXITED, NULL);
+}
+
+// Empty the working sets of Outlook and its WebView2 processes (monitor thread)
+void TrimOutlook() {
+    if (!g_tracker.processId) {
+        return;
+    }
+    TrimReport report;
+    TrimProcessTree(g_tracker.processId, &report);
+    EnterCriticalSection(&g_trimLock);
+    RecordTrim(&g_trimHistory, &report);
+    LeaveCriticalSection(&g_trimLock);
+
+    wchar_t buf[128];
+    swprintf_s(buf, L"Trimmed %d process(es), %llu KB released, %d skipped",
+               report.trimmed, report.bytesReleased / 1024, report.skipped);
+    DebugMsg(buf);
+    LOG_INFO(g_pLogRing, LOG_OUTLOOK_TRIMMED, report.trimmed, report.bytesReleased, report.skipped);
+}
+
+// Act on what the tracker decided
+void HandleTrackerAction(TrackerAction action) {
+    if (action == TRACKER_STARTED) {
+        OnOutlookStarted();
+    }
+    else if (action == TRACKER_THREADS_CHANGED) {
+        ApplyThreadHooks();
+    }
+}
+
+// WinEvent callback (runs on the monitor thread)
+void CALLBACK OnWindowCreated(HWINEVENTHOOK hHook, DWORD event, HWND hwnd,
+                              LONG idObject, LONG idChild, DWORD idEventThread, DWORD dwmsEventTime) {
+    if (!hwnd || idObject != OBJID_WINDOW || idChild != CHILDID_SELF) {
+        return;
+    }
+    HandleTrackerAction(TrackerOnWindowCreated(&g_tracker, hwnd, idEventThread));
+}
+
+// Ask for the next change to the settings keys (monitor thread)
+// Registry notifications fire once and belong to the thread that asked for them
+void WatchSettingsKeys() {
+    for (int i = 0; i < WATCHED_KEY_COUNT; i++) {
+        if (g_hWatchedKeys[i]) {
+            RegNotifyChangeKeyValue(g_hWatchedKeys[i], TRUE, REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET,
+                                    g_hSettingsEvent, TRUE);
+        }
+    }
+}
+
+// Watch our key, the Run key, both policy trees and the EXE folder (for the config file)
+// The policy keys usually do not exist, so their parents are watched
+void StartWatchingSettings() {
+    g_hSettingsEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    RegCreateKeyExW(HKEY_CURRENT_USER, SETTINGS_KEY, 0, NULL, 0, KEY_NOTIFY, NULL, &g_hWatchedKeys[0], NULL);
+    RegOpenKeyExW(HKEY_CURRENT_USER, AUTOSTART_KEY, 0, KEY_NOTIFY, &g_hWatchedKeys[1]);
+    RegOpenKeyExW(HKEY_CURRENT_USER, L"Software\\Policies", 0, KEY_NOTIFY, &g_hWatchedKeys[2]);
+    RegOpenKeyExW(HKEY_LOCAL_MACHINE, L"Software\\Policies", 0, KEY_NOTIFY, &g_hWatchedKeys[3]);
+    if (g_hSettingsEvent) {
+        WatchSettingsKeys();
+    }
+
+    wchar_t folder[MAX_PATH];
+    wcscpy_s(folder, g_configPath);
+    wchar_t* name = wcsrchr(folder, L'\\');
+    if (name) {
+        *name = L'\0';
+        g_hConfigChange = FindFirstChangeNotificationW(folder, FALSE,
+                                                       FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+    }
+}
 
-        if (pid != 0 && lastPid == 0) {
-            DebugMsg(L"Outlook detected");
+void StopWatchingSettings() {
+    for (int i = 0; i < WATCHED_KEY_COUNT; i++) {
+        if (g_hWatchedKeys[i]) {
+            RegCloseKey(g_hWatchedKeys[i]);
+            g_hWatchedKeys[i] = NULL;
         }
-        else if (pid == 0 && lastPid != 0) {
-            DebugMsg(L"Outlook closed");
+    }
+    if (g_hSettingsEvent) {
+        CloseHandle(g_hSettingsEvent);
+        g_hSettingsEvent = NULL;
+    }
+    if (g_hConfigChange != INVALID_HANDLE_VALUE) {
+        FindCloseChangeNotification(g_hConfigChange);
+        g_hConfigChange = INVALID_HANDLE_VALUE;
+    }
+}
+
+// The target rules changed, or the monitor is starting (monitor thread)
+// An Outlook process of the old target being tracked is kept until it exits
+void OnRulesChanged() {
+    RuleTable rules;
+    EnterCriticalSection(&g_settingsLock);
+    rules = g_rules;
+    LeaveCriticalSection(&g_settingsLock);
+    HandleTrackerAction(TrackerSetRules(&g_tracker, &rules));
+    if (!g_tracker.processId) {
+        DWORD pid = OsFindProcessId(TrackerOutlookImage(&g_tracker));
+        if (pid) {
+            HandleTrackerAction(TrackerStart(&g_tracker, pid));
         }
+    }
+    WatchWindowCreation(g_tracker.processId);
+}
 
-        lastPid = pid;
-        Sleep(500);
+// Shift OutlookToTray.log to .1, .1 to .2 and so on; the oldest is dropped
+void RotateLogFiles() {
+    for (int i = LOG_FILE_KEEP; i > 0; i--) {
+        wchar_t from[MAX_PATH + 4], to[MAX_PATH + 4];
+        swprintf_s(to, L"%s.%d", g_logPath, i);
+        if (i > 1) {
+            swprintf_s(from, L"%s.%d", g_logPath, i - 1);
+        }
+        else {
+            wcscpy_s(from, g_logPath);
+        }
+        MoveFileExW(from, to, MOVEFILE_REPLACE_EXISTING);
     }
+}
 
-    // Cleanup
-    if (g_UninstallHook) {
-        DebugMsg(L"Removing hook...");
-        g_UninstallHook();
+// Append UTF-8 text to the log file, rotating it first when it is full
+void AppendLogText(const char* text, int length) {
+    HANDLE hFile = CreateFileW(g_logPath, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+                               OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER size;
+    if (hFile != INVALID_HANDLE_VALUE && GetFileSizeEx(hFile, &size) && size.QuadPart >= LOG_FILE_MAX_BYTES) {
+        CloseHandle(hFile);
+        RotateLogFiles();
+        hFile = CreateFileW(g_logPath, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+                            OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    }
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    DWORD written;
+    WriteFile(hFile, text, (DWORD)length, &written, NULL);
+    CloseHandle(hFile);
+}
+
+// Move everything in the ring to the file, one batch per write (log thread)
+void FlushLog() {
+    static LogRecord records[LOG_DRAIN_BATCH];
+    static wchar_t text[LOG_DRAIN_BATCH * 256 + 128];
+    static char utf8[LOG_DRAIN_BATCH * 256 + 128];
+    ULONGLONG lostBefore = g_logReader.lost;
+    for (;;) {
+        int count = LogDrain(g_pLogRing, &g_logReader, records, LOG_DRAIN_BATCH);
+        int length = 0;
+        if (g_logReader.lost != lostBefore) {
+            length += swprintf_s(text, L"%llu record(s) lost\r\n", g_logReader.lost - lostBefore);
+            lostBefore = g_logReader.lost;
+        }
+        if (count == 0 && length == 0) {
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            length += FormatLogRecord(&records[i], text + length, ARRAYSIZE(text) - length);
+        }
+        int bytes = WideCharToMultiByte(CP_UTF8, 0, text, length, utf8, sizeof(utf8), NULL, NULL);
+        AppendLogText(utf8, bytes);
+        if (count < LOG_DRAIN_BATCH) {
+            break;
+        }
+    }
+    g_logWritten = g_logReader.read;
+    g_logLost = g_logReader.lost;
+}
+
+// Background thread: drain the log ring when the UI thread saw new records, at
+// least every LOG_DRAIN_BACKSTOP_MS, and once more on exit
+void DrainLog() {
+    HANDLE handles[2] = { g_hLogStop, g_hLogWake };
+    bool stopping;
+    do {
+        stopping = WaitForMultipleObjects(2, handles, FALSE, LOG_DRAIN_BACKSTOP_MS) == WAIT_OBJECT_0;
+        g_logWakeups++;
+        FlushLog();
+    } while (!stopping);
+}
+
+// The UI thread is awake anyway: if records were written since the drain last
+// ran, wake it, instead of the drain polling. The hook's records mostly come
+// with a NotifyTray message, the tray's own with the message that caused them.
+// In lean mode the drain runs right here, so it waits for a batch (or the backstop)
+void WakeLogDrain() {
+    if (!g_pLogRing) {
+        return;
     }
+    LONG head = g_pLogRing->head;
+    if (head == g_logSignalled || (g_lean && head - g_logSignalled < LOG_DRAIN_BATCH)) {
+        return;
+    }
+    g_logSignalled = head;
+    if (g_lean) {
+        g_logWakeups++;
+        FlushLog();
+    }
+    else {
+        SetEvent(g_hLogWake);
+    }
+}
+
+// Start capturing hooked messages to %LOCALAPPDATA%\OutlookToTray\Trace-<date>-<time>.ott
+bool StartMessageTrace() {
+    SYSTEMTIME now;
+    GetLocalTime(&now);
+    wchar_t name[64];
+    swprintf_s(name, L"Trace-%04u%02u%02u-%02u%02u%02u.ott", now.wYear, now.wMonth, now.wDay,
+               now.wHour, now.wMinute, now.wSecond);
+    wchar_t path[MAX_PATH];
+    if (!g_StartMessageTrace || !g_StopMessageTrace || !GetDataPath(name, path, MAX_PATH) ||
+        !g_StartMessageTrace(path, TRACE_DEFAULT_RECORDS)) {
+        return false;
+    }
+    wcscpy_s(g_tracePath, path);
+    DebugMsg(L"Message trace started");
+    return true;
+}
+
+// Stop the capture; returns the number of messages recorded
+LONG StopMessageTrace() {
+    g_tracePath[0] = L'\0';
+    return g_StopMessageTrace();
+}
+
+// Menu: start a capture, or stop the running one and say where it went
+void ToggleMessageTrace() {
+    if (!g_tracePath[0]) {
+        if (!StartMessageTrace()) {
+            ShowBalloon(L"Could not create the trace file.", NIIF_ERROR);
+        }
+        return;
+    }
+    const wchar_t* name = wcsrchr(g_tracePath, L'\\');
+    wchar_t file[MAX_PATH];
+    wcscpy_s(file, name ? name + 1 : g_tracePath);
+    LONG records = StopMessageTrace();
+    wchar_t text[256];
+    swprintf_s(text, L"Captured %ld message(s)%s to %s in %%LOCALAPPDATA%%\\OutlookToTray.\n"
+               L"Summarize it with OutlookToTray.TraceTool.exe.",
+               records, records >= TRACE_DEFAULT_RECORDS ? L" (capture full)" : L"", file);
+    ShowBalloon(text, NIIF_INFO);
+}
+
+// Run one queued call (worker thread); true if it succeeded
+bool RunWork(const WorkItem* pItem) {
+    bool ok = false;
+    HKEY hKey;
+    switch (pItem->kind) {
+    case WORK_SET_AUTOSTART:
+        if (RegOpenKeyEx(HKEY_CURRENT_USER, AUTOSTART_KEY, 0, KEY_SET_VALUE, &hKey) == ERROR_SUCCESS) {
+            if (pItem->value) {
+                wchar_t exePath[MAX_PATH];
+                GetModuleFileName(NULL, exePath, MAX_PATH);
+                ok = RegSetValueEx(hKey, AUTOSTART_VALUE, 0, REG_SZ,
+                    (BYTE*)exePath, (DWORD)(wcslen(exePath) + 1) * sizeof(wchar_t)) == ERROR_SUCCESS;
+            }
+            else {
+                LONG result = RegDeleteValue(hKey, AUTOSTART_VALUE);
+                ok = result == ERROR_SUCCESS || result == ERROR_FILE_NOT_FOUND;
+            }
+            RegCloseKey(hKey);
+        }
+        break;
+    case WORK_WRITE_SETTING:
+        if (RegCreateKeyExW(HKEY_CURRENT_USER, SETTINGS_KEY, 0, NULL, 0,
+                            KEY_SET_VALUE, NULL, &hKey, NULL) == ERROR_SUCCESS) {
+            ok = RegSetValueExW(hKey, SettingName((SettingId)pItem->id), 0, REG_DWORD,
+                                (const BYTE*)&pItem->value, sizeof(pItem->value)) == ERROR_SUCCESS;
+            RegCloseKey(hKey);
+        }
+        break;
+    case WORK_OPEN_OUTLOOK:
+        // The shell activates a running Outlook or launches it
+        ok = (INT_PTR)ShellExecute(NULL, L"open", L"ms-outlook:", NULL, NULL, SW_SHOWNORMAL) > 32;
+        break;
+    case WORK_SAVE_HIDDEN:
+        ok = WriteHiddenWindowFile(&pItem->hidden);
+        break;
+    case WORK_SAVE_DIAGNOSTICS: {
+        wchar_t path[MAX_PATH];
+        ok = SaveDiagnostics(pItem->text, path, MAX_PATH) &&
+             (INT_PTR)ShellExecute(NULL, L"open", path, NULL, NULL, SW_SHOWNORMAL) > 32;
+        free(pItem->text);
+        break;
+    }
+    case WORK_THROTTLE_START:
+    case WORK_THROTTLE_RESCAN:
+    case WORK_THROTTLE_STOP:
+        RunThrottleWork(pItem);
+        ok = true;
+        break;
+    }
+    return ok;
+}
+
+// Run one call and post its result back, the value in the high word and
+// -1 for a failure in place of the time taken
+void CompleteWork(const WorkItem* pItem) {
+    bool ok = RunWork(pItem);
+    LONGLONG ticks = OsQueryPerformanceCounter() - pItem->queuedTicks;
+    PostMessage(g_hwnd, WM_WORK_DONE, MAKEWPARAM(pItem->kind, pItem->value), ok ? (LPARAM)ticks : -1);
+}
+
+// Worker thread: runs the queued calls in order
+void ProcessWork() {
+    // ShellExecute may hand the request to COM objects
+    CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+    bool stopping = false;
+    do {
+        WaitForSingleObject(g_hWorkEvent, INFINITE);
+        stopping = g_workStop;
+        WorkItem item;
+        while (WorkQueuePop(&g_workQueue, &item)) {
+            CompleteWork(&item);
+        }
+    } while (!stopping);
+    CoUninitialize();
+}
+
+// A queued call finished: count it, and tell the user what they asked for
+void OnWorkDone(int kind, DWORD value, LPARAM result) {
+    bool ok = result >= 0;
+    if (ok) {
+        RecordRestoreTime(&g_workTiming, (LONGLONG)result);
+    }
+    switch (kind) {
+    case WORK_SET_AUTOSTART:
+        if (ok) {
+            g_settings.autoStart = value;
+        }
+        ShowBalloon(!ok ? L"Could not change the startup setting." :
+                    value ? L"Added to startup." : L"Removed from startup.", ok ? NIIF_INFO : NIIF_ERROR);
+        break;
+    case WORK_OPEN_OUTLOOK:
+        if (!ok) {
+            ShowBalloon(L"Could not start Outlook.", NIIF_ERROR);
+        }
+        break;
+    case WORK_SAVE_DIAGNOSTICS:
+        if (!ok) {
+            ShowBalloon(L"Could not write the diagnostics file.", NIIF_ERROR);
+        }
+        break;
+    default:
+        if (!ok) {
+            DebugMsg(L"Background work failed");
+        }
+        break;
+    }
+}
+
+// Time one dispatched message; a stall over a frame is logged
+void WatchDispatch(UINT message, LONGLONG frequency) {
+    LONGLONG ticks = OsQueryPerformanceCounter() - g_dispatchStart;
+    if (RecordDispatch(&g_stalls, message, ticks, frequency)) {
+        LONGLONG us = ticks * 1000000 / frequency;
+        LOG_WARNING(g_pLogRing, LOG_UI_STALL, message, us);
+        wchar_t buf[80];
+        swprintf_s(buf, L"Message 0x%04X blocked the UI thread for %lld us", message, us);
+        DebugMsg(buf);
+        PublishControlStatus();
+    }
+    WakeLogDrain();
+}
+
+// Register the toggle hotkey, or move it to the key now set; 0 turns it off
+// A key another app holds is retried on the next settings change
+void ApplyHotkey() {
+    DWORD hotkey = g_settings.values[SETTING_HOTKEY];
+    if (hotkey == g_hotkeyRegistered && !(hotkey && g_hotkeyTaken)) {
+        return;
+    }
+    if (g_hotkeyRegistered) {
+        UnregisterHotKey(g_hwnd, ID_HOTKEY_TOGGLE);
+        g_hotkeyRegistered = 0;
+    }
+    g_hotkeyTaken = false;
+    if (!hotkey) {
+        return;
+    }
+    wchar_t buf[80];
+    if (!HOTKEY_IS_VALID(hotkey)) {
+        swprintf_s(buf, L"Hotkey 0x%lX not registered: it needs a key and a modifier", hotkey);
+        DebugMsg(buf);
+        return;
+    }
+    wchar_t name[MAX_HOTKEY_TEXT];
+    FormatHotkey(hotkey, name, MAX_HOTKEY_TEXT);
+    if (RegisterHotKey(g_hwnd, ID_HOTKEY_TOGGLE, HOTKEY_MODIFIERS(hotkey) | MOD_NOREPEAT, HOTKEY_KEY(hotkey))) {
+        g_hotkeyRegistered = hotkey;
+        swprintf_s(buf, L"Hotkey %s registered", name);
+    }
+    else {
+        g_hotkeyTaken = true;
+        swprintf_s(buf, L"Hotkey %s not registered (error %lu)", name, GetLastError());
+    }
+    DebugMsg(buf);
+}
+
+// Ask the hook to hide Outlook's shown windows, without waiting
+// Only threads a hook is confirmed on are asked, and the request is never a
+// WM_CLOSE, so no window really closes. Returns how many were asked.
+int HideOutlookWindows() {
+    DWORD threads[2 * MAX_UI_THREADS];
+    int count = CopyHookedTargets(threads);
+    return RequestHideWindows(&g_rules, RULE_OUTLOOK, threads, count);
+}
+
+// A hotkey toggle finished: log it, as a warning if it missed the budget
+void ReportHotkeyToggle(int action, LONGLONG ticks, LONGLONG frequency) {
+    LONGLONG us = ticks * 1000000 / frequency;
+    if (us > HOTKEY_BUDGET_MS * 1000) {
+        LOG_WARNING(g_pLogRing, LOG_HOTKEY_TOGGLE, action, us);
+    }
+    else {
+        LOG_INFO(g_pLogRing, LOG_HOTKEY_TOGGLE, action, us);
+    }
+    wchar_t buf[64];
+    swprintf_s(buf, L"Hotkey %s took %lld us", action == HOTKEY_HIDE ? L"hide" : L"restore", us);
+    DebugMsg(buf);
+}
+
+// The hotkey was pressed: hide Outlook if it is in front, otherwise bring it back
+// Nothing here waits on Outlook: hide and restore are sent without waiting and
+// the hook's notifications mark the end. Timing starts when the key was pressed,
+// so a wait in this thread's queue counts too.
+void OnHotkey() {
+    LONGLONG frequency = OsQueryPerformanceFrequency();
+    LONGLONG now = OsQueryPerformanceCounter();
+    LONGLONG startTicks = now - (LONGLONG)(GetTickCount() - (DWORD)GetMessageTime()) * frequency / 1000;
+    DWORD foregroundPid = 0;
+    HWND foreground = GetForegroundWindow();
+    if (foreground) {
+        GetWindowThreadProcessId(foreground, &foregroundPid);
+    }
+    int action = ChooseHotkeyAction(&g_model, g_outlookPid, foregroundPid);
+    switch (action) {
+    case HOTKEY_HIDE:
+        HotkeyStart(&g_hotkey, action, HideOutlookWindows(), startTicks);
+        break;
+    case HOTKEY_RESTORE: {
+        // Restores done from the tray (/trayrestore) are finished when the call returns
+        int requested = RestoreHiddenWindows(NULL, RULE_OUTLOOK, startTicks);
+        HotkeyStart(&g_hotkey, action, requested > 0 ? requested : 1, startTicks);
+        if (requested == 0) {
+            ReportHotkeyToggle(action, HotkeyFinish(&g_hotkey, OsQueryPerformanceCounter(), frequency), frequency);
+        }
+        break;
+    }
+    default: {
+        HotkeyStart(&g_hotkey, action, 0, startTicks);
+        WorkItem item = {};
+        item.kind = WORK_OPEN_OUTLOOK;
+        QueueWork(&item);
+        break;
+    }
+    }
+}
+
+// The user is away: have the hook hide Outlook as closing its windows would
+// It stays hidden until the user restores it; nothing on screen means nothing to do
+// The hide is in effect once the hook reports a window hidden (see AutoHideOnNotify)
+void AutoHideOutlook(int reason, DWORD idleMs) {
+    if (g_autoHide.reason != AUTOHIDE_NONE || !g_outlookPid) {
+        return;
+    }
+    int requested = HideOutlookWindows();
+    if (requested == 0) {
+        return;
+    }
+    AutoHideStart(&g_autoHide, reason);
+    LOG_INFO(g_pLogRing, LOG_AUTO_HIDE, reason, requested, idleMs / 1000);
+    wchar_t buf[80];
+    swprintf_s(buf, L"Automatic hide (reason %d) of %d window(s)", reason, requested);
+    DebugMsg(buf);
+}
+
+// Hide Outlook if the user has been idle long enough, then wait for the
+// earliest time the threshold could be reached again (no polling meanwhile)
+void CheckIdleTime() {
+    DWORD thresholdMs = 60000 * g_settings.values[SETTING_AUTOHIDE_IDLE];
+    LASTINPUTINFO input = {};
+    input.cbSize = sizeof(input);
+    DWORD idleMs = GetLastInputInfo(&input) ? GetTickCount() - input.dwTime : 0;
+    if (thresholdMs && idleMs >= thresholdMs) {
+        AutoHideOutlook(AUTOHIDE_IDLE, idleMs);
+    }
+    DWORD due = AutoHideIdleDue(thresholdMs, idleMs);
+    if (due) {
+        SetTimer(g_hwnd, ID_TIMER_IDLE, due, NULL);
+    }
+    else {
+        KillTimer(g_hwnd, ID_TIMER_IDLE);
+    }
+}
+
+// The session locked or the display went off
+void OnUserAway(int reason) {
+    if (g_settings.values[SETTING_AUTOHIDE_LOCK]) {
+        LASTINPUTINFO input = {};
+        input.cbSize = sizeof(input);
+        AutoHideOutlook(reason, GetLastInputInfo(&input) ? GetTickCount() - input.dwTime : 0);
+    }
+}
+
+// Answer one control request (pipe thread); nothing here waits on another thread
+// Hide asks the windows itself; restore is handed to the UI thread, like a click
+void HandleControlRequest(const wchar_t* request, wchar_t* reply, int size) {
+    RuleTable rules;
+    EnterCriticalSection(&g_settingsLock);
+    rules = g_rules;
+    LeaveCriticalSection(&g_settingsLock);
+    ControlCommand command;
+    if (!ParseControlCommand(request, &rules, &command, reply, size)) {
+        return;
+    }
+    if (rules.count == 0) {
+        DefaultRuleTable(&rules);
+    }
+    EnterCriticalSection(&g_controlLock);
+    ControlStatus status = g_controlStatus;
+    LeaveCriticalSection(&g_controlLock);
+
+    switch (command.verb) {
+    case CONTROL_HIDE: {
+        DWORD threads[2 * MAX_UI_THREADS];
+        int count = CopyHookedTargets(threads);
+        int requested = RequestHideWindows(&rules, command.rule, threads, count);
+        swprintf_s(reply, size, L"ok requested=%d", requested);
+        LOG_INFO(g_pLogRing, LOG_CONTROL_COMMAND, command.verb, requested);
+        break;
+    }
+    case CONTROL_RESTORE: {
+        int hidden = command.rule < 0 ? status.hiddenCount : status.hiddenByRule[command.rule];
+        PostMessage(g_hwnd, WM_CONTROL_RESTORE, (WPARAM)command.rule, 0);
+        swprintf_s(reply, size, L"ok requested=%d", hidden);
+        LOG_INFO(g_pLogRing, LOG_CONTROL_COMMAND, command.verb, hidden);
+        break;
+    }
+    case CONTROL_STATUS:
+        FormatControlStatus(&status, &rules, reply, size);
+        break;
+    case CONTROL_STATS: {
+        ControlStats stats = {};
+        LONG uncounted = 0;
+        stats.processes = g_GetHookStats ? g_GetHookStats(&stats.hooks, &uncounted) : 0;
+        stats.stalls = status.stalls;
+        stats.maxStallUs = status.maxStallUs;
+        stats.logWritten = g_logWritten;
+        stats.logLost = g_logLost;
+        stats.logWakeups = g_logWakeups;
+        stats.monitorWakeups = g_monitorWakeups;
+        FormatControlStats(&stats, reply, size);
+        break;
+    }
+    }
+}
+
+void ReadControlRequest(ControlPipe* pPipe);
+
+// The client went away or misbehaved: drop it and wait for the next one
+// Every step is overlapped; its event is set when it completes, even at once
+void ConnectControlPipe(ControlPipe* pPipe) {
+    pPipe->state = PIPE_CONNECTING;
+    if (!ConnectNamedPipe(pPipe->hPipe, &pPipe->overlapped)) {
+        DWORD error = GetLastError();
+        if (error == ERROR_PIPE_CONNECTED) {
+            // Connected between create and connect: no I/O was started, so
+            // there is no result to collect, go straight to the first read
+            ReadControlRequest(pPipe);
+        }
+        else if (error != ERROR_IO_PENDING) {
+            ResetEvent(pPipe->overlapped.hEvent);
+            DebugMsg(L"ConnectNamedPipe failed, pipe instance unused");
+        }
+    }
+}
+
+void RestartControlPipe(ControlPipe* pPipe) {
+    DisconnectNamedPipe(pPipe->hPipe);
+    ConnectControlPipe(pPipe);
+}
+
+void ReadControlRequest(ControlPipe* pPipe) {
+    pPipe->state = PIPE_READING;
+    if (!ReadFile(pPipe->hPipe, pPipe->request, (CONTROL_MAX_REQUEST - 1) * sizeof(wchar_t), NULL,
+                  &pPipe->overlapped) && GetLastError() != ERROR_IO_PENDING) {
+        RestartControlPipe(pPipe);
+    }
+}
+
+void WriteControlReply(ControlPipe* pPipe) {
+    pPipe->state = PIPE_WRITING;
+    if (!WriteFile(pPipe->hPipe, pPipe->reply, (DWORD)wcslen(pPipe->reply) * sizeof(wchar_t), NULL,
+                   &pPipe->overlapped) && GetLastError() != ERROR_IO_PENDING) {
+        RestartControlPipe(pPipe);
+    }
+}
+
+// A step on one pipe instance finished: take the next one for its client
+// A client may send any number of requests before it closes its end
+void OnControlPipe(ControlPipe* pPipe) {
+    DWORD bytes = 0;
+    if (!GetOverlappedResult(pPipe->hPipe, &pPipe->overlapped, &bytes, FALSE)) {
+        RestartControlPipe(pPipe);      // Disconnected, or a request too long for one read
+        return;
+    }
+    if (pPipe->state == PIPE_READING) {
+        pPipe->request[bytes / sizeof(wchar_t)] = L'\0';
+        HandleControlRequest(pPipe->request, pPipe->reply, CONTROL_MAX_REPLY);
+        WriteControlReply(pPipe);
+    }
+    else {
+        ReadControlRequest(pPipe);      // Connected, or the reply went out
+    }
+}
+
+// Open the session's control pipe; FALSE if another process holds the name
+bool StartControlServer() {
+    DWORD sessionId = 0;
+    ProcessIdToSessionId(GetCurrentProcessId(), &sessionId);
+    wchar_t name[64];
+    ControlPipeName(sessionId, name, ARRAYSIZE(name));
+    for (int i = 0; i < CONTROL_INSTANCES; i++) {
+        ControlPipe* pPipe = &g_controlPipes[i];
+        pPipe->hPipe = OsCreatePipeInstance(name, i == 0, CONTROL_MAX_REPLY * sizeof(wchar_t));
+        if (!pPipe->hPipe) {
+            break;
+        }
+        pPipe->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        g_controlPipeCount++;
+        ConnectControlPipe(pPipe);
+    }
+    return g_controlPipeCount > 0;
+}
+
+// Close every instance; pending steps are cancelled with it
+void StopControlServer() {
+    for (int i = 0; i < g_controlPipeCount; i++) {
+        CancelIo(g_controlPipes[i].hPipe);
+        CloseHandle(g_controlPipes[i].hPipe);
+        CloseHandle(g_controlPipes[i].overlapped.hEvent);
+    }
+    g_controlPipeCount = 0;
+}
+
+// What the pipe server waits on: one event per instance
+DWORD GetControlHandles(HANDLE* handles) {
+    for (int i = 0; i < g_controlPipeCount; i++) {
+        handles[i] = g_controlPipes[i].overlapped.hEvent;
+    }
+    return g_controlPipeCount;
+}
+
+// Pipe thread: serves every instance of the control pipe at once
+void ControlThread() {
+    HANDLE handles[CONTROL_INSTANCES + 1];
+    DWORD count = GetControlHandles(handles);
+    handles[count] = g_hControlStop;
+    for (;;) {
+        DWORD wait = WaitForMultipleObjects(count + 1, handles, FALSE, INFINITE);
+        if (wait - WAIT_OBJECT_0 >= count) {
+            break;
+        }
+        OnControlPipe(&g_controlPipes[wait - WAIT_OBJECT_0]);
+    }
+}
+
+#define MONITOR_HANDLES 3
+
+// What the monitor waits on besides messages: Outlook's process and the
+// settings notifications
+DWORD GetMonitorHandles(HANDLE* handles) {
+    DWORD count = 0;
+    if (g_hOutlookProcess) {
+        handles[count++] = g_hOutlookProcess;
+    }
+    if (g_hSettingsEvent) {
+        handles[count++] = g_hSettingsEvent;
+    }
+    if (g_hConfigChange != INVALID_HANDLE_VALUE) {
+        handles[count++] = g_hConfigChange;
+    }
+    return count;
+}
+
+// One of them was signaled (monitor thread)
+void OnMonitorHandle(HANDLE handle) {
+    if (handle == g_hOutlookProcess) {
+        OnOutlookExited();
+        return;
+    }
+    // Re-arm first, so a change made while the tray reloads is not missed
+    if (handle == g_hSettingsEvent) {
+        WatchSettingsKeys();
+    }
+    else {
+        FindNextChangeNotification(g_hConfigChange);
+    }
+    PostMessage(g_hwnd, WM_SETTINGS_CHANGED, 0, 0);
+}
+
+// A request for the monitor thread (monitor thread)
+void OnMonitorRequest(UINT message) {
+    if (message == WM_TRIM_OUTLOOK) {
+        TrimOutlook();
+    }
+    else if (message == WM_RULES_CHANGED) {
+        OnRulesChanged();
+    }
+}
+
+// Hand a request to the monitor thread, once it has started
+// In lean mode the UI thread is the monitor, and the request runs right here
+void PostToMonitor(UINT message) {
+    DWORD threadId = g_monitorThreadId.load();
+    if (threadId == GetCurrentThreadId()) {
+        OnMonitorRequest(message);
+    }
+    else if (threadId) {
+        PostThreadMessage(threadId, message, 0, 0);
+    }
+}
+
+// Start tracking Outlook and watching the settings (monitor thread)
+void StartMonitor() {
+    g_monitorThreadId = GetCurrentThreadId();
+
+    // Outlook and the other apps may already be running; the only process snapshots
+    OnRulesChanged();
+    StartWatchingSettings();
+}
+
+// Drop the watches and Outlook's handle (monitor thread)
+void StopMonitor() {
+    StopWatchingSettings();
+    if (g_hCreateHook) {
+        UnhookWinEvent(g_hCreateHook);
+        g_hCreateHook = NULL;
+    }
+    WatchTitleChanges(0);
+    if (g_hOutlookProcess) {
+        CloseHandle(g_hOutlookProcess);
+        g_hOutlookProcess = NULL;
+    }
+}
+
+// Background thread: track the Outlook process without polling
+// Sleeps until Outlook exits (process handle), a window is created (WinEvent)
+// or a setting changes (registry or folder notification)
+void MonitorOutlook() {
+    DebugMsg(L"Monitor thread started");
+
+    // Make sure the thread has a message queue before anyone posts to it
+    MSG msg;
+    PeekMessage(&msg, NULL, WM_USER, WM_USER, PM_NOREMOVE);
+    StartMonitor();
+
+    while (g_running) {
+        HANDLE handles[MONITOR_HANDLES];
+        DWORD handleCount = GetMonitorHandles(handles);
+        DWORD wait = MsgWaitForMultipleObjects(handleCount, handles, FALSE, INFINITE, QS_ALLINPUT);
+        g_monitorWakeups++;
+        if (wait - WAIT_OBJECT_0 < handleCount) {
+            OnMonitorHandle(handles[wait - WAIT_OBJECT_0]);
+            continue;
+        }
+
+        // Input (or failure): delivers WinEvent callbacks
+        while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+            if (msg.message == WM_QUIT) {
+                g_running = false;
+                break;
+            }
+            if (msg.message == WM_TRIM_OUTLOOK || msg.message == WM_RULES_CHANGED) {
+                OnMonitorRequest(msg.message);
+                continue;
+            }
+            DispatchMessage(&msg);
+        }
+    }
+
+    StopMonitor();
     DebugMsg(L"Monitor thread exiting");
 }
 
+// Lean mode message loop: the UI thread waits on the monitor's handles, the
+// control pipe and its message queue together, timing every message like the
+// usual loop; WinEvent callbacks and the hook calls of other processes arrive
+// in here too
+int RunLeanMessageLoop(LONGLONG frequency) {
+    MSG msg;
+    for (;;) {
+        HANDLE handles[MONITOR_HANDLES + CONTROL_INSTANCES];
+        DWORD monitorCount = GetMonitorHandles(handles);
+        DWORD handleCount = monitorCount + GetControlHandles(handles + monitorCount);
+        DWORD wait = MsgWaitForMultipleObjects(handleCount, handles, FALSE, INFINITE, QS_ALLINPUT);
+        if (wait - WAIT_OBJECT_0 < monitorCount) {
+            g_monitorWakeups++;
+            OnMonitorHandle(handles[wait - WAIT_OBJECT_0]);
+            continue;
+        }
+        if (wait - WAIT_OBJECT_0 < handleCount) {
+            OnControlPipe(&g_controlPipes[wait - WAIT_OBJECT_0 - monitorCount]);
+            continue;
+        }
+        g_monitorWakeups++;
+        while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+            if (msg.message == WM_QUIT) {
+                return (int)msg.wParam;
+            }
+            g_dispatchStart = OsQueryPerformanceCounter();
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+            WatchDispatch(msg.message, frequency);
+        }
+    }
+}
+
 #define WM_INITTRAY (WM_USER + 200)
 
 // Window procedure
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
+    // Registered message, so it cannot be a case label
+    // Explorer (re)started and has no icons: add ours again right away
+    if (uMsg == g_taskbarCreatedMessage && g_taskbarCreatedMessage != 0) {
+        DebugMsg(L"TaskbarCreated - adding tray icon again");
+        if (g_trayIcon.iconVisible) {
+            g_trayIcon.explorerRestarts++;
+        }
+        TrayIconLost(&g_trayIcon);
+        KillTimer(hwnd, ID_TIMER_ICON_RETRY);
+        AddTrayIcon();
+        return 0;
+    }
+
+    if (uMsg == g_notifyMessage && g_notifyMessage != 0) {
+        wchar_t buf[64];
+        swprintf_s(buf, L"Tray notification %u", (UINT)wParam);
+        DebugMsg(buf);
+        if (g_hotkey.action != HOTKEY_NONE && lParam && OsGetWindowProcessId((HWND)lParam) == g_outlookPid) {
+            LONGLONG frequency = OsQueryPerformanceFrequency();
+            int action = g_hotkey.action;
+            LONGLONG ticks = HotkeyOnNotify(&g_hotkey, (UINT)wParam, OsQueryPerformanceCounter(), frequency);
+            if (ticks >= 0) {
+                ReportHotkeyToggle(action, ticks, frequency);
+            }
+        }
+        // The hook hiding a window puts an automatic hide in effect; the user
+        // restoring Outlook, or Outlook exiting, ends it
+        if ((g_autoHide.reason != AUTOHIDE_NONE || g_autoHide.requested != AUTOHIDE_NONE) &&
+            (wParam == TRAY_NOTIFY_OUTLOOK_EXITED || (lParam && OsGetWindowProcessId((HWND)lParam) == g_outlookPid))) {
+            int reason = g_autoHide.reason;
+            LONGLONG hiddenMs = AutoHideOnNotify(&g_autoHide, (UINT)wParam, GetTickCount64());
+            if (hiddenMs >= 0) {
+                LOG_INFO(g_pLogRing, LOG_AUTO_HIDE_ENDED, reason, hiddenMs);
+                swprintf_s(buf, L"Automatic hide ended after %lld s", hiddenMs / 1000);
+                DebugMsg(buf);
+            }
+        }
+        if (wParam == TRAY_NOTIFY_UNREAD_CHANGED) {
+            if (TrayModelSetUnread(&g_model, g_unreadCount)) {
+                ScheduleTrayUpdate();
+                PublishControlStatus();
+            }
+        }
+        else {
+            RefreshTrayModel();
+        }
+        return 0;
+    }
+
     switch (uMsg) {
     case WM_CREATE:
         DebugMsg(L"WM_CREATE");
+        g_trayIcon.windowCreated = FileTimeNow();
         CreateContextMenu();
         // Defer tray icon creation
         PostMessage(hwnd, WM_INITTRAY, 0, 0);
@@ -362,44 +2187,147 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 
     case WM_INITTRAY:
         DebugMsg(L"WM_INITTRAY - creating tray icon");
-        if (!CreateTrayIcon()) {
-            MessageBox(NULL, L"Could not create tray icon. Exiting.", L"Error", MB_ICONERROR);
-            DestroyWindow(hwnd);
+        RefreshTrayModel();
+        AddTrayIcon();
+        return 0;
+
+    case WM_SETTINGS_CHANGED:
+        ReloadSettings();
+        return 0;
+
+    case WM_WORK_DONE:
+        OnWorkDone(LOWORD(wParam), HIWORD(wParam), lParam);
+        return 0;
+
+    case WM_CONTROL_RESTORE:
+        RestoreHiddenWindows(NULL, (int)wParam);
+        return 0;
+
+    case WM_TIMER:
+        if (wParam == ID_TIMER_TRAY_UPDATE) {
+            KillTimer(hwnd, ID_TIMER_TRAY_UPDATE);
+            TrayUpdateTimerFired(&g_trayUpdate, GetTickCount64());
+            UpdateTrayIcon();
+        }
+        else if (wParam == ID_TIMER_TRIM) {
+            OnTrimTimer();
+        }
+        else if (wParam == ID_TIMER_THROTTLE) {
+            WorkItem item = {};
+            item.kind = WORK_THROTTLE_RESCAN;
+            item.id = g_outlookPid;
+            QueueWork(&item);
+        }
+        else if (wParam == ID_TIMER_ICON_RETRY) {
+            KillTimer(hwnd, ID_TIMER_ICON_RETRY);
+            AddTrayIcon();
+        }
+        else if (wParam == ID_TIMER_PREWARM) {
+            // No click came: throttle again if Outlook is still hidden
+            KillTimer(hwnd, ID_TIMER_PREWARM);
+            UpdateThrottle();
+        }
+        else if (wParam == ID_TIMER_LOG_DRAIN) {
+            g_logSignalled = g_pLogRing->head;
+            g_logWakeups++;
+            FlushLog();
+        }
+        else if (wParam == ID_TIMER_IDLE) {
+            CheckIdleTime();
+        }
+        return 0;
+
+    case WM_WTSSESSION_CHANGE:
+        if (wParam == WTS_SESSION_LOCK) {
+            OnUserAway(AUTOHIDE_LOCKED);
+        }
+        return 0;
+
+    case WM_POWERBROADCAST:
+        if (wParam == PBT_POWERSETTINGCHANGE) {
+            const POWERBROADCAST_SETTING* pSetting = (const POWERBROADCAST_SETTING*)lParam;
+            if (IsEqualGUID(pSetting->PowerSetting, CONSOLE_DISPLAY_STATE) && pSetting->DataLength >= sizeof(DWORD) &&
+                *(const DWORD*)pSetting->Data == 0) {
+                OnUserAway(AUTOHIDE_DISPLAY_OFF);
+            }
+        }
+        return TRUE;
+
+    case WM_HOTKEY:
+        if (wParam == ID_HOTKEY_TOGGLE) {
+            OnHotkey();
         }
         return 0;
 
     case WM_TRAYICON:
         // lParam contains the mouse message
         if (lParam == WM_LBUTTONUP || lParam == WM_LBUTTONDBLCLK) {
-            RestoreOutlookWindow();
+            RestoreHiddenWindows();
         }
         else if (lParam == WM_RBUTTONUP) {
             ShowContextMenu();
         }
+        else if (lParam == WM_MOUSEMOVE) {
+            PrewarmHiddenWindows();
+        }
         return 0;
 
     case WM_COMMAND:
         switch (LOWORD(wParam)) {
-        case ID_TRAY_RESTORE:
-            RestoreOutlookWindow();
-            break;
         case ID_TRAY_AUTOSTART:
             ToggleAutoStart();
             break;
+        case ID_TRAY_EFFICIENCY:
+            ToggleEfficiencyMode();
+            break;
+        case ID_TRAY_CLOAK:
+            ToggleHideMode();
+            break;
+        case ID_TRAY_DIAGNOSTICS:
+            ShowDiagnostics();
+            break;
+        case ID_TRAY_TRACE:
+            ToggleMessageTrace();
+            break;
         case ID_TRAY_ABOUT:
-            ShowAboutDialog();
+            ShowAbout();
             break;
         case ID_TRAY_EXIT:
             DestroyWindow(hwnd);
             break;
+        default:
+            if (LOWORD(wParam) >= ID_TRAY_WINDOW_FIRST &&
+                LOWORD(wParam) < ID_TRAY_WINDOW_FIRST + MAX_HIDDEN_WINDOWS) {
+                RestoreHiddenWindows(g_menuWindows[LOWORD(wParam) - ID_TRAY_WINDOW_FIRST]);
+            }
+            else if (LOWORD(wParam) >= ID_TRAY_APP_FIRST &&
+                     LOWORD(wParam) < ID_TRAY_APP_FIRST + MAX_TARGET_RULES) {
+                RestoreHiddenWindows(NULL, LOWORD(wParam) - ID_TRAY_APP_FIRST);
+            }
+            break;
         }
         return 0;
 
     case WM_DESTROY:
         DebugMsg(L"WM_DESTROY");
         g_running = false;
+        g_SetTrayWindow(NULL);
+        if (g_hotkeyRegistered) {
+            UnregisterHotKey(hwnd, ID_HOTKEY_TOGGLE);
+        }
+        WTSUnRegisterSessionNotification(hwnd);
+        if (g_hDisplayNotify) {
+            UnregisterPowerSettingNotification(g_hDisplayNotify);
+        }
+        StopThrottle();
+        if (!g_lean) {
+            PostThreadMessage(g_monitorThreadId.load(), WM_QUIT, 0, 0);
+        }
         Shell_NotifyIcon(NIM_DELETE, &g_nid);
         if (g_hMenu) DestroyMenu(g_hMenu);
+        for (int i = 0; i < BADGE_COUNT; i++) {
+            if (g_badgeIcons[i]) DestroyIcon(g_badgeIcons[i]);
+        }
         PostQuitMessage(0);
         return 0;
 
@@ -413,19 +2341,54 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
                      LPSTR lpCmdLine, int nCmdShow) {
     DebugMsg(L"=== Outlook to Tray Starting ===");
 
-    // Single instance check
-    HANDLE hMutex = CreateMutex(NULL, TRUE, L"OutlookToTrayMutex");
-    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+    // Single instance check, per session: every user on a terminal server runs their own
+    BOOL running;
+    HANDLE hMutex = OsCreateMutex(L"Local\\OutlookToTrayMutex", &running);
+    if (running) {
         MessageBox(NULL, L"Outlook to Tray is already running.",
             L"Outlook to Tray", MB_OK | MB_ICONINFORMATION);
-        CloseHandle(hMutex);
+        if (hMutex) CloseHandle(hMutex);
         return 0;
     }
 
     g_hInstance = hInstance;
+    g_trayIcon.processStart = ProcessStartTime();
+    g_hIcon = LoadTrayIcon();
+    InitializeCriticalSection(&g_trimLock);
+    InitializeCriticalSection(&g_throttleLock);
+    InitializeCriticalSection(&g_settingsLock);
+    InitializeCriticalSection(&g_hookLock);
+    InitializeCriticalSection(&g_controlLock);
+    GetConfigPath(g_configPath, MAX_PATH);
+    LoadSettings(&g_settings, g_configPath);
+    g_lean = g_settings.values[SETTING_LEAN_MODE] != 0;
+
+    // Legacy desktop-wide hook on request
+    if (strstr(lpCmdLine, "/globalhook")) {
+        g_targetedHook = false;
+    }
+
+    // Legacy restore from the tray process, e.g. to compare latencies
+    if (strstr(lpCmdLine, "/trayrestore")) {
+        g_inProcessRestore = false;
+    }
+
+    // Capture hooked messages from the start, e.g. to trace Outlook's startup
+    bool traceAtStart = strstr(lpCmdLine, "/trace") != NULL;
+
+    // The table is created here, secured to this user, before anything loads
+    // the DLL; the DLL only ever opens it. Kept mapped until the tray exits.
+    g_pSharedView = MapSharedData(SHARED_DATA_NAME, &g_hSharedMapping);
+    if (!g_pSharedView) {
+        MessageBox(NULL, L"Could not create the shared memory. Is an older version still running?",
+            L"Outlook to Tray", MB_ICONERROR);
+        CloseHandle(hMutex);
+        return 1;
+    }
 
     // Load hook DLL first
     if (!LoadHookDll()) {
+        OsUnmapSharedMemory(g_pSharedView, g_hSharedMapping);
         CloseHandle(hMutex);
         return 1;
     }
@@ -435,6 +2398,8 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     wcex.cbSize = sizeof(WNDCLASSEX);
     wcex.lpfnWndProc = WindowProc;
     wcex.hInstance = hInstance;
+    wcex.hIcon = LoadIcon(hInstance, MAKEINTRESOURCE(IDI_TRAY));
+    wcex.hIconSm = g_hIcon;
     wcex.lpszClassName = L"OutlookToTrayClass";
 
     if (!RegisterClassEx(&wcex)) {
@@ -468,27 +2433,148 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
         return 1;
     }
 
-    DebugMsg(L"Window created, starting monitor thread");
+    // Let the hook DLL push table changes to us, even from a lower integrity level
+    g_notifyMessage = RegisterWindowMessageW(TRAY_NOTIFY_MESSAGE);
+    g_restoreMessage = RegisterWindowMessageW(RESTORE_WINDOW_MESSAGE);
+    ChangeWindowMessageFilter(g_notifyMessage, MSGFLT_ADD);
+    g_taskbarCreatedMessage = RegisterWindowMessageW(L"TaskbarCreated");
+    ChangeWindowMessageFilter(g_taskbarCreatedMessage, MSGFLT_ADD);
+    g_SetTrayWindow(g_hwnd);
+    // Session lock and display-off, for the automatic hide; both are rare messages
+    WTSRegisterSessionNotification(g_hwnd, NOTIFY_FOR_THIS_SESSION);
+    g_hDisplayNotify = RegisterPowerSettingNotification(g_hwnd, &CONSOLE_DISPLAY_STATE, DEVICE_NOTIFY_WINDOW_HANDLE);
+    ApplySettings();
+
+    // Registry writes, ShellExecute and file writes from here on run on the worker
+    // In lean mode they run here, like everything else
+    std::thread workThread;
+    if (g_lean) {
+        CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+    }
+    else {
+        g_hWorkEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+        workThread = std::thread(ProcessWork);
+    }
+
+    // Records written from here on go to the log file
+    g_pLogRing = g_GetLogRing ? g_GetLogRing() : NULL;
+    std::thread logThread;
+    if (g_pLogRing && GetDataPath(L"OutlookToTray.log", g_logPath, MAX_PATH)) {
+        LogReaderStart(g_pLogRing, &g_logReader);
+        g_logSignalled = g_pLogRing->head;
+        if (g_lean) {
+            SetTimer(g_hwnd, ID_TIMER_LOG_DRAIN, LOG_DRAIN_BACKSTOP_MS, NULL);
+        }
+        else {
+            g_hLogStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+            g_hLogWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+            logThread = std::thread(DrainLog);
+        }
+    }
+    else {
+        g_pLogRing = NULL;
+    }
+    LOG_INFO(g_pLogRing, LOG_TRAY_STARTED, g_targetedHook, g_inProcessRestore, g_rules.count);
+    if (traceAtStart) {
+        StartMessageTrace();
+    }
 
-    // Start monitor thread
-    std::thread monitorThread(MonitorOutlook);
-    monitorThread.detach();
+    LoadHiddenWindowFile();
 
-    DebugMsg(L"Entering message loop");
+    // Scripts drive the tray through the session's control pipe, served by a
+    // thread of its own (by the UI thread in lean mode)
+    PublishControlStatus();
+    std::thread controlThread;
+    if (!StartControlServer()) {
+        DebugMsg(L"Control pipe not available; another process holds its name");
+    }
+    else if (!g_lean) {
+        g_hControlStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+        controlThread = std::thread(ControlThread);
+    }
 
-    // Message loop
+    LONGLONG frequency = OsQueryPerformanceFrequency();
     MSG msg;
-    while (GetMessage(&msg, NULL, 0, 0)) {
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
+    if (g_lean) {
+        // One thread: it owns the hooks and does the monitor's waiting too
+        DebugMsg(L"Lean mode, entering message loop");
+        g_hookThreadId = GetCurrentThreadId();
+        InstallGlobalHook();
+        StartMonitor();
+        msg.wParam = RunLeanMessageLoop(frequency);
+
+        DebugMsg(L"Exiting");
+        StopControlServer();
+        StopMonitor();
+        RemoveHooks();
+        if (g_tracePath[0]) {
+            StopMessageTrace();
+        }
+        if (g_pLogRing) {
+            FlushLog();
+        }
+        CoUninitialize();
     }
+    else {
+        DebugMsg(L"Window created, starting monitor thread");
+
+        // The hook thread first, so it is listening before the monitor hands it threads
+        g_hHookThreadReady = CreateEvent(NULL, TRUE, FALSE, NULL);
+        std::thread hookThread(HookThread);
+        WaitForSingleObject(g_hHookThreadReady, INFINITE);
+        CloseHandle(g_hHookThreadReady);
+
+        // Start monitor thread
+        std::thread monitorThread(MonitorOutlook);
+
+        DebugMsg(L"Entering message loop");
+
+        // Message loop, timing every message
+        while (GetMessage(&msg, NULL, 0, 0)) {
+            g_dispatchStart = OsQueryPerformanceCounter();
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+            WatchDispatch(msg.message, frequency);
+        }
 
-    DebugMsg(L"Exiting");
+        DebugMsg(L"Exiting");
+        if (controlThread.joinable()) {
+            SetEvent(g_hControlStop);
+            controlThread.join();
+            CloseHandle(g_hControlStop);
+        }
+        StopControlServer();
+
+        // Let the hook thread remove the hooks before the DLL is unloaded
+        monitorThread.join();
+        PostThreadMessage(g_hookThreadId.load(), WM_QUIT, 0, 0);
+        hookThread.join();
+        if (g_tracePath[0]) {
+            StopMessageTrace();
+        }
+        // Finish what is queued, e.g. the last hidden-window file
+        g_workStop = true;
+        SetEvent(g_hWorkEvent);
+        workThread.join();
+        CloseHandle(g_hWorkEvent);
+        if (logThread.joinable()) {
+            SetEvent(g_hLogStop);
+            logThread.join();
+            CloseHandle(g_hLogStop);
+            CloseHandle(g_hLogWake);
+        }
+    }
+    DeleteCriticalSection(&g_trimLock);
+    DeleteCriticalSection(&g_throttleLock);
+    DeleteCriticalSection(&g_settingsLock);
+    DeleteCriticalSection(&g_hookLock);
+    DeleteCriticalSection(&g_controlLock);
 
     // Cleanup
     if (g_hDll) {
         FreeLibrary(g_hDll);
     }
+    OsUnmapSharedMemory(g_pSharedView, g_hSharedMapping);
     CloseHandle(hMutex);
 
     return (int)msg.wParam;
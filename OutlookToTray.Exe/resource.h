@@ -10,4 +10,7 @@
 #define VER_MINOR   0
 #define VER_PATCH   0
 
+// Icons
+#define IDI_TRAY    101
+
 #endif // RESOURCE_H
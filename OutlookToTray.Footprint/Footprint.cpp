@@ -0,0 +1,131 @@
+/*
+ * Outlook to Tray - Footprint
+ * What the tray costs a terminal server, per session: the tray processes'
+ * private bytes, threads and CPU over an interval, and the processes the
+ * hook DLL is loaded in. Run elevated to see every session:
+ *   OutlookToTray.Footprint [seconds]
+ */
+
+#ifndef PSAPI_VERSION
+#define PSAPI_VERSION 2
+#endif
+
+#include <windows.h>
+#include <tlhelp32.h>
+#include <psapi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../OutlookToTray.Core/Footprint.h"
+
+#define DEFAULT_SECONDS     10
+#define MAX_TRAYS           MAX_FOOTPRINT_SESSIONS
+
+static const wchar_t TRAY_IMAGE[] = L"OutlookToTray.exe";
+static const wchar_t DLL_IMAGE[] = L"OutlookToTray.dll";
+
+// A tray process, between its two CPU samples
+struct Tray {
+    HANDLE hProcess;
+    FootprintSample sample;
+    ULONGLONG cpuStart;
+};
+
+static Tray g_trays[MAX_TRAYS];
+static FootprintReport g_report;
+static wchar_t g_text[128 * 1024];
+
+// User plus kernel time in 100 ns units
+static ULONGLONG CpuTime(HANDLE hProcess) {
+    FILETIME creation, exitTime, kernel, user;
+    if (!GetProcessTimes(hProcess, &creation, &exitTime, &kernel, &user)) {
+        return 0;
+    }
+    return (((ULONGLONG)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+           (((ULONGLONG)user.dwHighDateTime << 32) | user.dwLowDateTime);
+}
+
+// Whether the process has the hook DLL loaded (either bitness)
+static BOOL HasHookDll(DWORD processId) {
+    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE | TH32CS_SNAPMODULE32, processId);
+    if (hSnapshot == INVALID_HANDLE_VALUE) {
+        return FALSE;
+    }
+    MODULEENTRY32W module = {};
+    module.dwSize = sizeof(module);
+    BOOL found = FALSE;
+    for (BOOL more = Module32FirstW(hSnapshot, &module); more && !found; more = Module32NextW(hSnapshot, &module)) {
+        found = _wcsicmp(module.szModule, DLL_IMAGE) == 0;
+    }
+    CloseHandle(hSnapshot);
+    return found;
+}
+
+int main(int argc, char** argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : DEFAULT_SECONDS;
+    if (seconds <= 0) {
+        fprintf(stderr, "Usage: %s [seconds]\n", argv[0]);
+        return 2;
+    }
+
+    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (hSnapshot == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "CreateToolhelp32Snapshot failed: %lu\n", (unsigned long)GetLastError());
+        return 1;
+    }
+
+    // Trays are sampled now and again after the interval; hooked processes
+    // are only counted (their memory is their own, not the tray's)
+    int trayCount = 0, unreadable = 0;
+    PROCESSENTRY32W entry = {};
+    entry.dwSize = sizeof(entry);
+    for (BOOL more = Process32FirstW(hSnapshot, &entry); more; more = Process32NextW(hSnapshot, &entry)) {
+        DWORD sessionId;
+        if (entry.th32ProcessID == 0 || !ProcessIdToSessionId(entry.th32ProcessID, &sessionId)) {
+            continue;
+        }
+        if (_wcsicmp(entry.szExeFile, TRAY_IMAGE) != 0) {
+            if (HasHookDll(entry.th32ProcessID)) {
+                FootprintSample sample = {};
+                sample.sessionId = sessionId;
+                AddFootprintSample(&g_report, &sample);
+            }
+            continue;
+        }
+        HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_VM_READ, FALSE,
+                                      entry.th32ProcessID);
+        if (!hProcess || trayCount == MAX_TRAYS) {
+            unreadable++;
+            if (hProcess) CloseHandle(hProcess);
+            continue;
+        }
+        Tray* pTray = &g_trays[trayCount++];
+        pTray->hProcess = hProcess;
+        pTray->sample.sessionId = sessionId;
+        pTray->sample.tray = TRUE;
+        pTray->sample.threads = entry.cntThreads;
+        pTray->cpuStart = CpuTime(hProcess);
+    }
+    CloseHandle(hSnapshot);
+
+    ULONGLONG start = GetTickCount64();
+    Sleep((DWORD)seconds * 1000);
+    g_report.interval = (GetTickCount64() - start) * 10000;
+
+    for (int i = 0; i < trayCount; i++) {
+        Tray* pTray = &g_trays[i];
+        PROCESS_MEMORY_COUNTERS_EX counters = {};
+        if (GetProcessMemoryInfo(pTray->hProcess, (PROCESS_MEMORY_COUNTERS*)&counters, sizeof(counters))) {
+            pTray->sample.privateBytes = counters.PrivateUsage;
+        }
+        pTray->sample.cpuTime = CpuTime(pTray->hProcess) - pTray->cpuStart;
+        AddFootprintSample(&g_report, &pTray->sample);
+        CloseHandle(pTray->hProcess);
+    }
+
+    FormatFootprint(&g_report, g_text, sizeof(g_text) / sizeof(g_text[0]));
+    printf("%ls", g_text);
+    if (unreadable) {
+        printf("%d tray process(es) could not be opened; run elevated to see every session\n", unreadable);
+    }
+    return 0;
+}
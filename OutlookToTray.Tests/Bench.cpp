@@ -0,0 +1,154 @@
+/*
+ * Outlook to Tray - Benchmarks
+ * Cost of the core logic per message / operation, measured on the fake OS.
+ * Numbers cover our own code only; real Win32 calls (OpenProcess, Toolhelp
+ * snapshots, SetWindowPos...) are replaced by in-memory lookups.
+ */
+
+#include "FakeOs.h"
+#include "../OutlookToTray.Core/HookCore.h"
+#include "../OutlookToTray.Core/SharedState.h"
+#include "../OutlookToTray.Core/TrayCore.h"
+#include "../OutlookToTray.Core/Targets.h"
+#include "../OutlookToTray.Core/Log.h"
+#include "../OutlookToTray.Core/Trace.h"
+#include "../OutlookToTray.Core/Os.h"
+#include <stdio.h>
+#include <wchar.h>
+#include <chrono>
+
+#define WM_MOUSEMOVE_BENCH  0x0200
+
+static volatile LONGLONG g_sink = 0;
+
+// Run 'body' 'iterations' times and print ns per iteration
+template <typename Body>
+static void Bench(const char* name, long iterations, Body body) {
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        body(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    printf("%-40s %10.2f ns/op\n", name, ns / iterations);
+}
+
+int main() {
+    FakeReset();
+
+    // Hook fast path, as CallWndProc runs it
+    DWORD explorer = FakeCreateProcess(L"C:\\Windows\\explorer.exe", TRUE);
+    DWORD outlook = FakeCreateProcess(L"C:\\Apps\\olk.exe", TRUE);
+    HookState* pOther = &FakeGetProcess(explorer)->hookState;
+    HookState* pOutlook = &FakeGetProcess(outlook)->hookState;
+    RECT rect = { 0, 0, 800, 600 };
+    HWND hwnd = FakeCreateWindow(outlook, 1, NULL, rect);
+    FakeShowWindow(hwnd, TRUE);
+    FakeShowWindow(hwnd, TRUE);
+
+    Bench("hook: other process", 100000000, [&](long i) {
+        HookDispatch(pOther, 0, hwnd, WM_MOUSEMOVE_BENCH, (WPARAM)i);
+    });
+    // What the hook did before deciding once per process: look up the window's
+    // process image on every message (OpenProcess + GetModuleBaseName on Windows)
+    HWND otherHwnd = FakeCreateWindow(explorer, 1, NULL, rect);
+    Bench("hook: other process, image per message", 10000000, [&](long i) {
+        g_sink += IsOutlookPid(OsGetWindowProcessId(otherHwnd), NULL);
+        HookDispatch(pOther, 0, otherHwnd, WM_MOUSEMOVE_BENCH, (WPARAM)i);
+    });
+    Bench("hook: Outlook, unrelated message", 100000000, [&](long i) {
+        HookDispatch(pOutlook, 0, hwnd, WM_MOUSEMOVE_BENCH, (WPARAM)i);
+    });
+    Bench("hook: Outlook, WM_SHOWWINDOW (cached)", 10000000, [&](long i) {
+        HookDispatch(pOutlook, 0, hwnd, WM_SHOWWINDOW, TRUE);
+    });
+
+    // The same paths while a message capture records every call
+    HANDLE hTrace;
+    TraceHeader* pTrace = StartTrace(FakeSharedData(), L"bench.ott", 2000000, &hTrace);
+    Bench("hook: other process, capturing", 1000000, [&](long i) {
+        HookDispatch(pOther, 0, hwnd, WM_MOUSEMOVE_BENCH, (WPARAM)i);
+    });
+    Bench("hook: Outlook, unrelated, capturing", 1000000, [&](long i) {
+        HookDispatch(pOutlook, 0, hwnd, WM_MOUSEMOVE_BENCH, (WPARAM)i);
+    });
+    StopTrace(FakeSharedData(), pTrace, hTrace);
+
+    // Rule table: the per-process match the hook makes when it loads, with a full table
+    RuleTable rules = {};
+    for (int i = 0; i < MAX_TARGET_RULES; i++) {
+        swprintf(rules.rules[rules.count++].image, MAX_TARGET_IMAGE, L"target%d.exe", i);
+    }
+    BuildRuleTable(&rules);
+    Bench("rules: build table (8 rules)", 100000, [&](long i) {
+        RuleTable copy = rules;
+        BuildRuleTable(&copy);
+        g_sink += copy.seed;
+    });
+    Bench("rules: match a process (8 rules)", 10000000, [&](long i) {
+        g_sink += MatchRule(&rules, (i & 1) ? L"C:\\Windows\\explorer.exe" : L"C:\\Apps\\target5.exe");
+    });
+
+    // Hook statistics: the counter and histogram update alone, and a real
+    // clock read for scale (the fake performance counter is nearly free)
+    HookStats* pStats = pOutlook->stats;
+    Bench("stats: record one hook call", 100000000, [&](long i) {
+        RecordHookTime(pStats, i & 7);
+    });
+    Bench("stats: host clock read (for scale)", 10000000, [&](long i) {
+        g_sink += std::chrono::steady_clock::now().time_since_epoch().count();
+    });
+
+    // Shared-state protocol
+    SharedData* pData = FakeSharedData();
+    Bench("log: write one record", 10000000, [&](long i) {
+        LOG_INFO(&pData->log, LOG_WINDOW_HIDDEN, (ULONGLONG)i, 0, 1);
+    });
+    Bench("log: level compiled out", 100000000, [&](long i) {
+        LOG_DEBUG(&pData->log, LOG_WINDOW_SUBCLASSED, (ULONGLONG)i);
+        g_sink += i;
+    });
+    HWND hidden[4];
+    for (int i = 0; i < 4; i++) {
+        hidden[i] = (HWND)(UINT_PTR)(0x5000 + 0x10 * i);
+        WindowEntry* pEntry = LockWindowEntry(pData, hidden[i], TRUE);
+        pEntry->flags |= ENTRY_HIDDEN;
+        EndEntryWrite(pData, pEntry);
+    }
+    Bench("shared: lock + publish entry", 10000000, [&](long i) {
+        WindowEntry* pEntry = LockWindowEntry(pData, hidden[i & 3], FALSE);
+        pEntry->hiddenTick = (ULONGLONG)i;
+        EndEntryWrite(pData, pEntry);
+    });
+    Bench("shared: read one entry", 10000000, [&](long i) {
+        WindowEntry entry;
+        ReadWindowEntry(pData, &pData->windows[i & 3], &entry);
+        g_sink += entry.flags;
+    });
+    Bench("shared: snapshot (4 hidden)", 1000000, [&](long i) {
+        HiddenWindowInfo windows[MAX_HIDDEN_WINDOWS];
+        g_sink += SnapshotHiddenWindows(pData, windows, MAX_HIDDEN_WINDOWS);
+    });
+
+    // Process lookup: name scan vs. image check vs. cached tracker
+    for (int i = 0; i < 300; i++) {
+        wchar_t image[64];
+        swprintf(image, 64, L"C:\\Program Files\\App%d\\app%d.exe", i, i);
+        FakeCreateProcess(image, FALSE);
+    }
+    DWORD late = FakeCreateProcess(L"C:\\Apps\\olk.exe", FALSE);
+    FakeExitProcess(outlook);
+    OutlookTracker tracker = {};
+    TrackerStart(&tracker, late);
+
+    Bench("process: find by name (300 procs)", 100000, [&](long i) {
+        g_sink += OsFindProcessId(L"olk.exe");
+    });
+    Bench("process: check one PID's image", 10000000, [&](long i) {
+        g_sink += IsOutlookPid(late, NULL);
+    });
+    Bench("process: cached tracker PID", 100000000, [&](long i) {
+        g_sink += *(volatile DWORD*)&tracker.processId;
+    });
+    return 0;
+}
@@ -0,0 +1,637 @@
+/*
+ * Outlook to Tray - Fake OS
+ * In-memory implementation of the OS interface
+ */
+
+#include "FakeOs.h"
+#include "../OutlookToTray.Core/Os.h"
+#include "../OutlookToTray.Core/SharedState.h"
+#include "../OutlookToTray.Core/Targets.h"
+#include <string.h>
+#include <wchar.h>
+#include <new>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+static std::vector<FakeProcess> g_processes;
+static std::map<HWND, FakeWindow> g_windows;
+static std::set<DWORD> g_deadThreads;
+static std::map<std::wstring, void*> g_mappings;
+static std::set<std::wstring> g_mutexes;
+static int g_unmappedViews = 0;
+static void (*g_onNextWindowStyle)(HWND) = NULL;
+static DWORD g_nextProcessId = 100;
+static UINT_PTR g_nextHandle = 0x10010;
+static DWORD g_currentProcessId = 0;   // Process whose code is "running" (0 = tray)
+static ULONGLONG g_ticks = 1000;
+static std::vector<UINT> g_notifications;
+static std::map<std::wstring, UINT> g_registeredMessages;
+static LONGLONG g_counter = 0;
+static LONGLONG g_counterStep = 0;
+static SharedData* g_pShared = NULL;
+static std::map<std::wstring, DWORD> g_registryDwords;          // "hive:key\\name"
+static std::map<std::wstring, std::wstring> g_registryStrings;
+static std::map<std::wstring, std::wstring> g_files;
+
+// Start over with no processes, windows or shared memory
+void FakeReset() {
+    g_processes.clear();
+    g_windows.clear();
+    g_deadThreads.clear();
+    for (auto& mapping : g_mappings) {
+        ::operator delete(mapping.second, std::align_val_t(64));
+    }
+    g_mappings.clear();
+    g_mutexes.clear();
+    g_unmappedViews = 0;
+    g_onNextWindowStyle = NULL;
+    g_nextProcessId = 100;
+    g_nextHandle = 0x10010;
+    g_currentProcessId = 0;
+    g_ticks = 1000;
+    g_notifications.clear();
+    g_counter = 0;
+    g_counterStep = 0;
+    g_registryDwords.clear();
+    g_registryStrings.clear();
+    g_files.clear();
+
+    HANDLE hMapping;
+    g_pShared = MapSharedData(SHARED_DATA_NAME, &hMapping);
+}
+
+SharedData* FakeSharedData() {
+    return g_pShared;
+}
+
+int FakeUnmappedViewCount() {
+    return g_unmappedViews;
+}
+
+void FakeOnNextWindowStyle(void (*callback)(HWND hwnd)) {
+    g_onNextWindowStyle = callback;
+}
+
+// Processes and threads
+
+DWORD FakeCreateProcess(const wchar_t* image, BOOL hooked, DWORD parentId) {
+    FakeProcess process = {};
+    process.processId = g_nextProcessId;
+    g_nextProcessId += 4;
+    wcsncpy(process.image, image, MAX_PATH - 1);
+    process.parentId = parentId;
+    process.startTime = FAKE_SYSTEM_TIME_BASE + process.processId * 10000ULL;
+    process.hooked = hooked;
+    g_processes.push_back(process);
+
+    // DLL_PROCESS_ATTACH runs inside the new process
+    DWORD saved = g_currentProcessId;
+    g_currentProcessId = process.processId;
+    HookInitProcess(&g_processes.back().hookState, hooked ? g_pShared : NULL);
+    g_currentProcessId = saved;
+    return process.processId;
+}
+
+// The tray went away: the DLL unloads from the process, taking its subclasses
+// along, and loads again once a new tray hooks the process
+void FakeReloadHook(DWORD processId) {
+    FakeProcess* pProcess = FakeGetProcess(processId);
+    if (!pProcess || !pProcess->hooked) return;
+    DWORD saved = g_currentProcessId;
+    g_currentProcessId = processId;
+    HookExitProcess(&pProcess->hookState, g_pShared);
+    for (auto& entry : g_windows) {
+        if (entry.second.processId == processId) entry.second.subclassed = FALSE;
+    }
+    pProcess->hookState = HookState();
+    HookInitProcess(&pProcess->hookState, g_pShared);
+    g_currentProcessId = saved;
+}
+
+FakeProcess* FakeGetProcess(DWORD processId) {
+    for (FakeProcess& process : g_processes) {
+        if (process.processId == processId) return &process;
+    }
+    return NULL;
+}
+
+void FakeExitProcess(DWORD processId) {
+    for (auto it = g_windows.begin(); it != g_windows.end();) {
+        it = (it->second.processId == processId) ? g_windows.erase(it) : ++it;
+    }
+    for (auto it = g_processes.begin(); it != g_processes.end(); ++it) {
+        if (it->processId == processId) {
+            // DLL_PROCESS_DETACH
+            if (it->hooked) {
+                HookExitProcess(&it->hookState, g_pShared);
+            }
+            g_processes.erase(it);
+            break;
+        }
+    }
+}
+
+void FakeExitThread(DWORD threadId) {
+    g_deadThreads.insert(threadId);
+}
+
+// Windows
+
+HWND FakeCreateWindow(DWORD processId, DWORD threadId, HWND owner, RECT rect, HWND handle) {
+    if (!handle) {
+        handle = (HWND)g_nextHandle;
+        g_nextHandle += 0x10;
+    }
+    FakeWindow window = {};
+    window.hwnd = handle;
+    window.processId = processId;
+    window.threadId = threadId;
+    window.owner = owner;
+    window.rect = rect;
+    window.exStyle = WS_EX_APPWINDOW;
+    g_windows[handle] = window;
+    return handle;
+}
+
+FakeWindow* FakeGetWindow(HWND hwnd) {
+    auto it = g_windows.find(hwnd);
+    return it != g_windows.end() ? &it->second : NULL;
+}
+
+int FakeWindowCount() {
+    return (int)g_windows.size();
+}
+
+// DestroyWindow: WM_DESTROY, WM_NCDESTROY, then the handle is gone
+void FakeDestroyWindow(HWND hwnd) {
+    FakeSendMessage(hwnd, WM_DESTROY, 0);
+    FakeSendMessage(hwnd, WM_NCDESTROY, 0);
+    g_windows.erase(hwnd);
+}
+
+// DefWindowProc: closing destroys the window
+static void DefaultWindowProc(HWND hwnd, UINT message) {
+    if (message == WM_CLOSE) {
+        FakeDestroyWindow(hwnd);
+    }
+}
+
+// Messages, delivered like SendMessage: hook, then subclass, then default handling
+void FakeSendMessage(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    if (!pWindow) {
+        return;
+    }
+    FakeProcess* pProcess = FakeGetProcess(pWindow->processId);
+    DWORD saved = g_currentProcessId;
+    g_currentProcessId = pWindow->processId;
+
+    if (pProcess && pProcess->hooked) {
+        HookDispatch(&pProcess->hookState, 0, hwnd, message, wParam);
+    }
+
+    // The hook may have just subclassed the window; the subclass sees this message
+    BOOL handled = FALSE;
+    pWindow = FakeGetWindow(hwnd);
+    if (pWindow && pWindow->subclassed && pProcess) {
+        handled = SubclassOnMessage(&pProcess->hookState, g_pShared, hwnd, message, wParam, lParam);
+    }
+    if (!handled) {
+        DefaultWindowProc(hwnd, message);
+    }
+    g_currentProcessId = saved;
+}
+
+// ShowWindow: WM_SHOWWINDOW is sent before the window becomes visible
+void FakeShowWindow(HWND hwnd, BOOL show) {
+    FakeSendMessage(hwnd, WM_SHOWWINDOW, show);
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    if (pWindow) {
+        pWindow->visible = show;
+    }
+}
+
+void FakeSetCounterStep(LONGLONG ticks) {
+    g_counterStep = ticks;
+}
+
+void FakeAdvanceTicks(ULONGLONG ms) {
+    g_ticks += ms;
+}
+
+int FakeNotificationCount(UINT event) {
+    int count = 0;
+    for (UINT posted : g_notifications) {
+        count += (posted == event);
+    }
+    return count;
+}
+
+// OS interface: windows
+
+HWND OsGetWindowOwner(HWND hwnd) {
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    return pWindow ? pWindow->owner : NULL;
+}
+
+BOOL OsIsWindow(HWND hwnd) {
+    return FakeGetWindow(hwnd) != NULL;
+}
+
+BOOL OsIsWindowVisible(HWND hwnd) {
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    return pWindow && pWindow->visible;
+}
+
+BOOL OsIsTopLevelWindow(HWND hwnd) {
+    return FakeGetWindow(hwnd) != NULL;     // No child windows in the model
+}
+
+DWORD OsGetWindowProcessId(HWND hwnd) {
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    return pWindow ? pWindow->processId : 0;
+}
+
+BOOL OsGetWindowClassName(HWND hwnd, wchar_t* name, int size) {
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    if (!pWindow || !pWindow->className[0] || size <= 0) return FALSE;
+    wcsncpy(name, pWindow->className, size - 1);
+    name[size - 1] = L'\0';
+    return TRUE;
+}
+
+BOOL OsGetWindowRect(HWND hwnd, RECT* pRect) {
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    if (!pWindow) return FALSE;
+    *pRect = pWindow->rect;
+    return TRUE;
+}
+
+LONG OsGetWindowExStyle(HWND hwnd) {
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    return pWindow ? pWindow->exStyle : 0;
+}
+
+void OsSetWindowExStyle(HWND hwnd, LONG exStyle) {
+    if (g_onNextWindowStyle) {
+        void (*callback)(HWND) = g_onNextWindowStyle;
+        g_onNextWindowStyle = NULL;
+        callback(hwnd);
+    }
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    if (pWindow) pWindow->exStyle = exStyle;
+}
+
+void OsMoveWindow(HWND hwnd, int x, int y, BOOL activate) {
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    if (!pWindow) return;
+    pWindow->rect.right += x - pWindow->rect.left;
+    pWindow->rect.bottom += y - pWindow->rect.top;
+    pWindow->rect.left = x;
+    pWindow->rect.top = y;
+    if (activate) {
+        for (auto& other : g_windows) other.second.foreground = FALSE;
+        pWindow->foreground = TRUE;
+    }
+}
+
+void OsShowWindow(HWND hwnd) {
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    if (!pWindow) return;
+    for (auto& other : g_windows) other.second.foreground = FALSE;
+    pWindow->visible = TRUE;
+    pWindow->foreground = TRUE;
+}
+
+void OsRestoreWindow(HWND hwnd, LONG exStyle, const RECT* pRect, BOOL cloaked) {
+    if (exStyle != 0) {
+        OsSetWindowExStyle(hwnd, exStyle);
+    }
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    if (!pWindow) return;
+    if (cloaked) {
+        pWindow->cloaked = FALSE;
+        OsMoveWindow(hwnd, pWindow->rect.left, pWindow->rect.top, TRUE);
+    }
+    else {
+        OsMoveWindow(hwnd, pRect->left, pRect->top, TRUE);
+    }
+    pWindow->visible = TRUE;
+}
+
+// Cloaking is refused for windows of other processes, as DWM does
+BOOL OsCloakWindow(HWND hwnd, BOOL cloak) {
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    if (!pWindow || pWindow->processId != g_currentProcessId) return FALSE;
+    pWindow->cloaked = cloak;
+    return TRUE;
+}
+
+BOOL OsIsWindowCloaked(HWND hwnd) {
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    return pWindow && pWindow->cloaked;
+}
+
+void OsRepaintWindow(HWND hwnd) {
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    if (pWindow) pWindow->repaints++;
+}
+
+// Same name, same id, like RegisterWindowMessage across processes
+UINT OsRegisterMessage(const wchar_t* name) {
+    UINT& id = g_registeredMessages[name];
+    if (!id) {
+        id = 0xC000 + (UINT)g_registeredMessages.size();
+    }
+    return id;
+}
+
+BOOL OsPostTrayNotification(HWND trayWindow, UINT event, HWND hwnd) {
+    g_notifications.push_back(event);
+    return TRUE;
+}
+
+// Delivered right away; the real one returns before the window's thread handles it
+BOOL OsRequestHide(HWND hwnd) {
+    if (!FakeGetWindow(hwnd)) return FALSE;
+    FakeSendMessage(hwnd, OsRegisterMessage(HIDE_WINDOW_MESSAGE), 0);
+    return TRUE;
+}
+
+BOOL OsSubclassWindow(HWND hwnd) {
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    if (!pWindow) return FALSE;
+    pWindow->subclassed = TRUE;
+    return TRUE;
+}
+
+void OsRemoveSubclass(HWND hwnd) {
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    if (pWindow) pWindow->subclassed = FALSE;
+}
+
+// OS interface: processes and threads
+
+DWORD OsGetCurrentProcessId() {
+    return g_currentProcessId;
+}
+
+DWORD OsGetCurrentThreadId() {
+    return 1;       // The model has no current thread
+}
+
+BOOL OsGetModuleImageName(wchar_t* path, DWORD size) {
+    return OsGetProcessImageName(g_currentProcessId, path, size);
+}
+
+BOOL OsGetProcessImageName(DWORD processId, wchar_t* path, DWORD size) {
+    FakeProcess* pProcess = FakeGetProcess(processId);
+    if (!pProcess || wcslen(pProcess->image) >= size) return FALSE;
+    wcscpy(path, pProcess->image);
+    return TRUE;
+}
+
+DWORD OsFindProcessId(const wchar_t* name) {
+    for (const FakeProcess& process : g_processes) {
+        if (NameEqualsNoCase(ImageBaseName(process.image), name)) {
+            return process.processId;
+        }
+    }
+    return 0;
+}
+
+int OsFindUiThreads(DWORD processId, DWORD* threadIds, int maxThreads) {
+    int count = 0;
+    for (const auto& entry : g_windows) {
+        const FakeWindow& window = entry.second;
+        if (window.processId != processId || !OsIsThreadAlive(window.threadId)) continue;
+        bool known = false;
+        for (int i = 0; i < count && !known; i++) known = (threadIds[i] == window.threadId);
+        if (!known && count < maxThreads) threadIds[count++] = window.threadId;
+    }
+    return count;
+}
+
+BOOL OsIsOtherBitness(DWORD processId) {
+    FakeProcess* pProcess = FakeGetProcess(processId);
+    return pProcess && pProcess->otherBitness;
+}
+
+// The tray (process 0) always runs
+BOOL OsGetProcessStartTime(DWORD processId, ULONGLONG* pStartTime) {
+    if (processId == 0) {
+        *pStartTime = FAKE_SYSTEM_TIME_BASE;
+        return TRUE;
+    }
+    FakeProcess* pProcess = FakeGetProcess(processId);
+    *pStartTime = pProcess ? pProcess->startTime : 0;
+    return pProcess != NULL;
+}
+
+ULONGLONG OsGetCurrentProcessStartTime() {
+    ULONGLONG startTime;
+    OsGetProcessStartTime(g_currentProcessId, &startTime);
+    return startTime;
+}
+
+BOOL OsIsThreadAlive(DWORD threadId) {
+    return g_deadThreads.count(threadId) == 0;
+}
+
+// Unowned and owned alike, as EnumThreadWindows returns them
+int OsGetThreadWindows(DWORD threadId, HWND* windows, int maxWindows) {
+    int count = 0;
+    for (const auto& entry : g_windows) {
+        if (entry.second.threadId == threadId && count < maxWindows) {
+            windows[count++] = entry.first;
+        }
+    }
+    return count;
+}
+
+BOOL OsHasOnScreenWindow(DWORD processId) {
+    for (const auto& entry : g_windows) {
+        const FakeWindow& window = entry.second;
+        if (window.processId == processId && window.visible && !window.cloaked &&
+            window.rect.left > -30000) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+int OsListProcesses(ProcessLink* links, int maxLinks) {
+    int count = 0;
+    for (const FakeProcess& process : g_processes) {
+        if (count == maxLinks) break;
+        links[count].processId = process.processId;
+        links[count].parentId = process.parentId;
+        links[count].webView = IsWebViewImage(process.image);
+        count++;
+    }
+    return count;
+}
+
+BOOL OsTrimWorkingSet(DWORD processId, ULONGLONG* pBytesReleased) {
+    *pBytesReleased = 0;
+    FakeProcess* pProcess = FakeGetProcess(processId);
+    if (!pProcess || pProcess->accessDenied) return FALSE;
+    if (pProcess->workingSet > FAKE_TRIMMED_WORKING_SET) {
+        *pBytesReleased = pProcess->workingSet - FAKE_TRIMMED_WORKING_SET;
+        pProcess->workingSet = FAKE_TRIMMED_WORKING_SET;
+    }
+    return TRUE;
+}
+
+BOOL OsEnterEfficiencyMode(DWORD processId, BOOL* pLowered) {
+    *pLowered = FALSE;
+    FakeProcess* pProcess = FakeGetProcess(processId);
+    if (!pProcess || pProcess->accessDenied) return FALSE;
+    pProcess->efficient = TRUE;
+    if (!pProcess->belowNormal) {
+        pProcess->belowNormal = TRUE;
+        *pLowered = TRUE;
+    }
+    return TRUE;
+}
+
+BOOL OsLeaveEfficiencyMode(DWORD processId, BOOL raise) {
+    FakeProcess* pProcess = FakeGetProcess(processId);
+    if (!pProcess || pProcess->accessDenied) return FALSE;
+    pProcess->efficient = FALSE;
+    if (raise) pProcess->belowNormal = FALSE;
+    return TRUE;
+}
+
+BOOL OsGetProcessCpuTime(DWORD processId, ULONGLONG* pCpuTime) {
+    FakeProcess* pProcess = FakeGetProcess(processId);
+    if (!pProcess) return FALSE;
+    *pCpuTime = pProcess->cpuTime;
+    return TRUE;
+}
+
+BOOL OsGetProcessGpuTimes(const DWORD* processIds, int count, ULONGLONG* pGpuTimes) {
+    for (int i = 0; i < count; i++) {
+        FakeProcess* pProcess = FakeGetProcess(processIds[i]);
+        pGpuTimes[i] = pProcess ? pProcess->gpuTime : 0;
+    }
+    return TRUE;
+}
+
+// Registry and files
+
+static std::wstring RegistryPath(RegistryHive hive, const wchar_t* key, const wchar_t* name) {
+    return std::wstring(hive == HIVE_LOCAL_MACHINE ? L"HKLM:" : L"HKCU:") + key + L"\\" + name;
+}
+
+void FakeSetRegistryDword(RegistryHive hive, const wchar_t* key, const wchar_t* name, DWORD value) {
+    g_registryDwords[RegistryPath(hive, key, name)] = value;
+}
+
+void FakeSetRegistryString(RegistryHive hive, const wchar_t* key, const wchar_t* name, const wchar_t* value) {
+    g_registryStrings[RegistryPath(hive, key, name)] = value;
+}
+
+void FakeDeleteRegistryValue(RegistryHive hive, const wchar_t* key, const wchar_t* name) {
+    g_registryDwords.erase(RegistryPath(hive, key, name));
+    g_registryStrings.erase(RegistryPath(hive, key, name));
+}
+
+void FakeSetTextFile(const wchar_t* path, const wchar_t* text) {
+    if (text) {
+        g_files[path] = text;
+    }
+    else {
+        g_files.erase(path);
+    }
+}
+
+// OS interface: settings storage
+
+BOOL OsReadRegistryDword(RegistryHive hive, const wchar_t* key, const wchar_t* name, DWORD* pValue) {
+    auto it = g_registryDwords.find(RegistryPath(hive, key, name));
+    if (it == g_registryDwords.end()) return FALSE;
+    *pValue = it->second;
+    return TRUE;
+}
+
+BOOL OsReadRegistryString(RegistryHive hive, const wchar_t* key, const wchar_t* name,
+                          wchar_t* value, DWORD size) {
+    auto it = g_registryStrings.find(RegistryPath(hive, key, name));
+    if (it == g_registryStrings.end() || it->second.size() >= size) return FALSE;
+    wcscpy(value, it->second.c_str());
+    return TRUE;
+}
+
+BOOL OsReadTextFile(const wchar_t* path, wchar_t* text, DWORD size) {
+    auto it = g_files.find(path);
+    if (it == g_files.end()) return FALSE;
+    wcsncpy(text, it->second.c_str(), size - 1);
+    text[size - 1] = L'\0';
+    return TRUE;
+}
+
+// OS interface: time and shared memory
+
+ULONGLONG OsGetTickCount64() {
+    return g_ticks;
+}
+
+// The clock follows the tick count, starting at FAKE_SYSTEM_TIME_BASE
+ULONGLONG OsGetSystemTime() {
+    return FAKE_SYSTEM_TIME_BASE + g_ticks * 10000;
+}
+
+// The performance counter advances a fixed step per read, at the 10 MHz
+// Windows usually reports, so tests can predict histogram buckets
+LONGLONG OsQueryPerformanceCounter() {
+    g_counter += g_counterStep;
+    return g_counter;
+}
+
+LONGLONG OsQueryPerformanceFrequency() {
+    return 10000000;
+}
+
+// Names are never released; each reset starts a new session
+HANDLE OsCreateMutex(const wchar_t* name, BOOL* pExisted) {
+    *pExisted = !g_mutexes.insert(name).second;
+    return (HANDLE)g_nextHandle++;
+}
+
+// Pipes are not modelled
+HANDLE OsCreatePipeInstance(const wchar_t* name, BOOL first, DWORD bufferSize) {
+    return NULL;
+}
+
+void* OsMapSharedMemory(const wchar_t* name, size_t size, HANDLE* phMapping) {
+    void*& pView = g_mappings[name];
+    if (!pView) {
+        size_t rounded = (size + 63) & ~(size_t)63;
+        pView = ::operator new(rounded, std::align_val_t(64));
+        memset(pView, 0, rounded);
+    }
+    *phMapping = pView;
+    return pView;
+}
+
+void* OsOpenSharedMemory(const wchar_t* name, HANDLE* phMapping) {
+    auto it = g_mappings.find(name);
+    *phMapping = it != g_mappings.end() ? it->second : NULL;
+    return *phMapping;
+}
+
+void OsUnmapSharedMemory(void* pView, HANDLE hMapping) {
+    // Views stay valid until FakeReset(), like a mapping other processes still hold
+    g_unmappedViews++;
+}
+
+// The file itself is not modelled; the mapping is what the hook opens
+void* OsMapFile(const wchar_t* path, const wchar_t* name, size_t size, HANDLE* phMapping) {
+    if (g_mappings.count(name)) {
+        return NULL;    // A new capture always gets a new name
+    }
+    return OsMapSharedMemory(name, size, phMapping);
+}
@@ -0,0 +1,91 @@
+/*
+ * Outlook to Tray - Fake OS
+ * In-memory model of windows, processes, messages and the shared mapping,
+ * implementing the OS interface for the test and benchmark builds
+ */
+
+#ifndef OUTLOOKTOTRAY_FAKEOS_H
+#define OUTLOOKTOTRAY_FAKEOS_H
+
+#include "../OutlookToTray.Core/Platform.h"
+#include "../OutlookToTray.Core/HookCore.h"
+#include "../OutlookToTray.Core/Os.h"
+
+struct FakeWindow {
+    HWND hwnd;
+    DWORD processId;
+    DWORD threadId;
+    HWND owner;
+    BOOL visible;
+    BOOL subclassed;
+    BOOL foreground;
+    BOOL cloaked;
+    int repaints;           // OsRepaintWindow calls
+    RECT rect;
+    LONG exStyle;
+    wchar_t className[64];
+};
+
+struct FakeProcess {
+    DWORD processId;
+    wchar_t image[MAX_PATH];
+    DWORD parentId;
+    ULONGLONG startTime;    // FILETIME, a millisecond after the previous process's
+    BOOL hooked;            // Hook DLL loaded (its CallWndProc sees messages)
+    BOOL accessDenied;      // Cannot be opened to trim or throttle (sandboxed)
+    BOOL otherBitness;      // 32-bit: the hook DLL cannot load
+    ULONGLONG workingSet;   // Bytes; trimming leaves FAKE_TRIMMED_WORKING_SET
+    BOOL efficient;         // EcoQoS on
+    BOOL belowNormal;       // Priority class
+    ULONGLONG cpuTime;      // 100 ns units
+    ULONGLONG gpuTime;      // 100 ns units
+    HookState hookState;    // That process's copy of the DLL globals
+};
+
+#define FAKE_TRIMMED_WORKING_SET  (1024 * 1024)
+#define FAKE_SYSTEM_TIME_BASE     134116992000000000ULL     // 2026-01-01 00:00 UTC as FILETIME
+
+// Start over with no processes, windows or shared memory
+void FakeReset();
+
+// Processes and threads
+DWORD FakeCreateProcess(const wchar_t* image, BOOL hooked, DWORD parentId = 0);
+void FakeExitProcess(DWORD processId);
+FakeProcess* FakeGetProcess(DWORD processId);
+void FakeExitThread(DWORD threadId);
+void FakeReloadHook(DWORD processId);   // DLL unloaded (its subclasses gone) and loaded again
+
+// Windows (handle 0 picks the next free one)
+HWND FakeCreateWindow(DWORD processId, DWORD threadId, HWND owner, RECT rect, HWND handle = NULL);
+void FakeDestroyWindow(HWND hwnd);
+FakeWindow* FakeGetWindow(HWND hwnd);
+int FakeWindowCount();
+
+// Messages, delivered like SendMessage: hook, then subclass, then default handling
+void FakeSendMessage(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam = 0);
+void FakeShowWindow(HWND hwnd, BOOL show);
+
+// TRAY_NOTIFY_MESSAGE posts of one event since FakeReset()
+int FakeNotificationCount(UINT event);
+
+// The shared mapping, as the hook DLL in every fake process sees it
+SharedData* FakeSharedData();
+
+// OsUnmapSharedMemory calls since FakeReset() (views stay readable regardless)
+int FakeUnmappedViewCount();
+
+// Called once from the next OsSetWindowExStyle, the hook's first window call
+// while hiding (e.g. to keep the table as a process killed there leaves it)
+void FakeOnNextWindowStyle(void (*callback)(HWND hwnd));
+
+// Registry values and files read by the settings
+void FakeSetRegistryDword(RegistryHive hive, const wchar_t* key, const wchar_t* name, DWORD value);
+void FakeSetRegistryString(RegistryHive hive, const wchar_t* key, const wchar_t* name, const wchar_t* value);
+void FakeDeleteRegistryValue(RegistryHive hive, const wchar_t* key, const wchar_t* name);
+void FakeSetTextFile(const wchar_t* path, const wchar_t* text);     // NULL deletes it
+
+// Time
+void FakeAdvanceTicks(ULONGLONG ms);
+void FakeSetCounterStep(LONGLONG ticks);   // Performance-counter ticks added per read
+
+#endif // OUTLOOKTOTRAY_FAKEOS_H
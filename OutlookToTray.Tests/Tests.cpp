@@ -0,0 +1,1730 @@
+/*
+ * Outlook to Tray - Tests
+ * Replays scripted message sequences against the core logic on the fake OS
+ */
+
+#include "FakeOs.h"
+#include "../OutlookToTray.Core/HookCore.h"
+#include "../OutlookToTray.Core/SharedState.h"
+#include "../OutlookToTray.Core/TrayCore.h"
+#include "../OutlookToTray.Core/Settings.h"
+#include "../OutlookToTray.Core/Targets.h"
+#include "../OutlookToTray.Core/Log.h"
+#include "../OutlookToTray.Core/Trace.h"
+#include "../OutlookToTray.Core/TraceSummary.h"
+#include "../OutlookToTray.Core/Footprint.h"
+#include "../OutlookToTray.Core/Control.h"
+#include "../OutlookToTray.Core/Os.h"
+#include <stdio.h>
+#include <wchar.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+static int g_failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("  FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            g_failures++; \
+        } \
+    } while (0)
+
+static const RECT MAIN_RECT = { 100, 50, 1300, 850 };
+
+// Outlook with its main window shown on thread 1
+static HWND StartOutlook(DWORD* pProcessId) {
+    *pProcessId = FakeCreateProcess(L"C:\\Program Files\\WindowsApps\\olk.exe", TRUE);
+    HWND hwnd = FakeCreateWindow(*pProcessId, 1, NULL, MAIN_RECT);
+    FakeShowWindow(hwnd, TRUE);
+    return hwnd;
+}
+
+// Test: the verdict is made once per process from its image name
+static void TestProcessVerdict() {
+    FakeReset();
+    DWORD outlook = FakeCreateProcess(L"C:\\Apps\\OLK.EXE", TRUE);
+    DWORD explorer = FakeCreateProcess(L"C:\\Windows\\explorer.exe", TRUE);
+    DWORD lookalike = FakeCreateProcess(L"C:\\Apps\\olk.exe.bak", TRUE);
+    CHECK(FakeGetProcess(outlook)->hookState.isTargetProcess);
+    CHECK(!FakeGetProcess(explorer)->hookState.isTargetProcess);
+    CHECK(!FakeGetProcess(lookalike)->hookState.isTargetProcess);
+}
+
+// Test: closing a window outside Outlook is left alone
+static void TestCloseOtherProcess() {
+    FakeReset();
+    DWORD pid = FakeCreateProcess(L"C:\\Windows\\notepad.exe", TRUE);
+    HWND hwnd = FakeCreateWindow(pid, 1, NULL, MAIN_RECT);
+    FakeShowWindow(hwnd, TRUE);
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    CHECK(!OsIsWindow(hwnd));
+
+    HiddenWindowInfo windows[MAX_HIDDEN_WINDOWS];
+    CHECK(SnapshotHiddenWindows(FakeSharedData(), windows, MAX_HIDDEN_WINDOWS) == 0);
+}
+
+// Test: show, close hides off-screen and out of the taskbar, restore undoes it
+static void TestShowCloseRestore() {
+    FakeReset();
+    DWORD pid;
+    HWND hwnd = StartOutlook(&pid);
+
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    CHECK(pWindow != NULL);
+    if (!pWindow) return;
+    CHECK(pWindow->subclassed);
+    CHECK(pWindow->rect.left == -32000 && pWindow->rect.top == -32000);
+    CHECK(pWindow->rect.right - pWindow->rect.left == MAIN_RECT.right - MAIN_RECT.left);
+    CHECK(pWindow->exStyle & WS_EX_TOOLWINDOW);
+    CHECK(!(pWindow->exStyle & WS_EX_APPWINDOW));
+
+    HiddenWindowInfo windows[MAX_HIDDEN_WINDOWS];
+    int count = SnapshotHiddenWindows(FakeSharedData(), windows, MAX_HIDDEN_WINDOWS);
+    CHECK(count == 1);
+    CHECK(windows[0].hwnd == hwnd);
+    CHECK(windows[0].processId == pid);
+    CHECK(windows[0].originalRect.left == MAIN_RECT.left);
+    CHECK(windows[0].originalExStyle == WS_EX_APPWINDOW);
+
+    // A second close while hidden must not overwrite the saved position
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    count = SnapshotHiddenWindows(FakeSharedData(), windows, MAX_HIDDEN_WINDOWS);
+    CHECK(count == 1);
+    CHECK(windows[0].originalRect.left == MAIN_RECT.left);
+
+    RestoreWindow(&windows[0]);
+    CHECK(ReleaseWindow(FakeSharedData(), hwnd));
+    CHECK(pWindow->rect.left == MAIN_RECT.left && pWindow->rect.top == MAIN_RECT.top);
+    CHECK(pWindow->exStyle == WS_EX_APPWINDOW);
+    CHECK(pWindow->visible && pWindow->foreground);
+    CHECK(SnapshotHiddenWindows(FakeSharedData(), windows, MAX_HIDDEN_WINDOWS) == 0);
+
+    // Still subclassed: closing again hides again
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    CHECK(OsIsWindow(hwnd));
+    CHECK(SnapshotHiddenWindows(FakeSharedData(), windows, MAX_HIDDEN_WINDOWS) == 1);
+
+    // A window gone without the hook seeing it is forgotten, not restored
+    int restores = FakeNotificationCount(TRAY_NOTIFY_WINDOW_RESTORED);
+    CHECK(ForgetWindow(FakeSharedData(), hwnd) && !ForgetWindow(FakeSharedData(), hwnd));
+    CHECK(SnapshotHiddenWindows(FakeSharedData(), windows, MAX_HIDDEN_WINDOWS) == 0);
+    CHECK(FakeNotificationCount(TRAY_NOTIFY_WINDOW_RESTORED) == restores);
+}
+
+// Test: owned windows (dialogs) and invisible windows close normally
+static void TestOwnedAndInvisibleWindows() {
+    FakeReset();
+    DWORD pid;
+    HWND main = StartOutlook(&pid);
+    HWND dialog = FakeCreateWindow(pid, 1, main, MAIN_RECT);
+    FakeShowWindow(dialog, TRUE);
+    HWND invisible = FakeCreateWindow(pid, 1, NULL, MAIN_RECT);
+
+    FakeSendMessage(dialog, WM_CLOSE, 0);
+    FakeSendMessage(invisible, WM_CLOSE, 0);
+    CHECK(!OsIsWindow(dialog));
+    CHECK(!OsIsWindow(invisible));
+    CHECK(OsIsWindow(main));
+}
+
+// Test: destroying a hidden window frees its entry
+static void TestDestroyWhileHidden() {
+    FakeReset();
+    DWORD pid;
+    HWND hwnd = StartOutlook(&pid);
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    FakeDestroyWindow(hwnd);
+
+    HiddenWindowInfo windows[MAX_HIDDEN_WINDOWS];
+    CHECK(SnapshotHiddenWindows(FakeSharedData(), windows, MAX_HIDDEN_WINDOWS) == 0);
+}
+
+// Test: a reused handle is classified afresh after WM_NCDESTROY
+static void TestHandleReuse() {
+    FakeReset();
+    DWORD pid;
+    HWND main = StartOutlook(&pid);
+    HWND popup = FakeCreateWindow(pid, 1, NULL, MAIN_RECT);
+    FakeShowWindow(popup, TRUE);
+    FakeShowWindow(popup, TRUE);    // Visible now: cached as top-level and subclassed
+    CHECK(FakeGetWindow(popup)->subclassed);
+    FakeDestroyWindow(popup);
+
+    // The handle comes back as a dialog owned by the main window
+    FakeCreateWindow(pid, 1, main, MAIN_RECT, popup);
+    FakeShowWindow(popup, TRUE);
+    FakeShowWindow(popup, TRUE);
+    FakeSendMessage(popup, WM_CLOSE, 0);
+    CHECK(!OsIsWindow(popup));
+}
+
+// Test: several windows hide independently; snapshot is oldest first
+static void TestMultipleWindows() {
+    FakeReset();
+    DWORD pid;
+    HWND main = StartOutlook(&pid);
+    RECT composeRect = { 400, 300, 900, 800 };
+    HWND compose = FakeCreateWindow(pid, 2, NULL, composeRect);
+    FakeShowWindow(compose, TRUE);
+
+    FakeSendMessage(main, WM_CLOSE, 0);
+    FakeAdvanceTicks(10);
+    FakeSendMessage(compose, WM_CLOSE, 0);
+
+    HiddenWindowInfo windows[MAX_HIDDEN_WINDOWS];
+    int count = SnapshotHiddenWindows(FakeSharedData(), windows, MAX_HIDDEN_WINDOWS);
+    CHECK(count == 2);
+    CHECK(windows[0].hwnd == main && windows[1].hwnd == compose);
+    CHECK(windows[1].originalRect.left == composeRect.left);
+
+    // Restore only the compose window
+    RestoreWindow(&windows[1]);
+    ReleaseWindow(FakeSharedData(), compose);
+    count = SnapshotHiddenWindows(FakeSharedData(), windows, MAX_HIDDEN_WINDOWS);
+    CHECK(count == 1 && windows[0].hwnd == main);
+    CHECK(FakeGetWindow(compose)->rect.left == composeRect.left);
+    CHECK(FakeGetWindow(main)->rect.left == -32000);
+
+    // Outlook exits: its remaining entries go
+    ReleaseProcessWindows(FakeSharedData(), pid);
+    CHECK(SnapshotHiddenWindows(FakeSharedData(), windows, MAX_HIDDEN_WINDOWS) == 0);
+}
+
+// Test: with the table full, closing falls through instead of losing the window
+static void TestTableFull() {
+    FakeReset();
+    DWORD pid = FakeCreateProcess(L"olk.exe", TRUE);
+    HWND hwnds[MAX_HIDDEN_WINDOWS + 1];
+    for (int i = 0; i <= MAX_HIDDEN_WINDOWS; i++) {
+        hwnds[i] = FakeCreateWindow(pid, 1, NULL, MAIN_RECT);
+        FakeShowWindow(hwnds[i], TRUE);
+        FakeSendMessage(hwnds[i], WM_CLOSE, 0);
+    }
+    for (int i = 0; i < MAX_HIDDEN_WINDOWS; i++) {
+        CHECK(OsIsWindow(hwnds[i]));
+    }
+    CHECK(!OsIsWindow(hwnds[MAX_HIDDEN_WINDOWS]));
+}
+
+// Test: tracker learns about Outlook and its new UI threads from window creation
+static void TestTracker() {
+    FakeReset();
+    OutlookTracker tracker = {};
+    DWORD other = FakeCreateProcess(L"C:\\Windows\\explorer.exe", FALSE);
+    HWND otherWindow = FakeCreateWindow(other, 7, NULL, MAIN_RECT);
+    CHECK(TrackerOnWindowCreated(&tracker, otherWindow, 7) == TRACKER_NONE);
+    CHECK(tracker.processId == 0);
+
+    DWORD pid = FakeCreateProcess(L"C:\\Apps\\olk.exe", FALSE);
+    HWND main = FakeCreateWindow(pid, 1, NULL, MAIN_RECT);
+    FakeCreateWindow(pid, 2, NULL, MAIN_RECT);
+    CHECK(TrackerOnWindowCreated(&tracker, main, 1) == TRACKER_STARTED);
+    CHECK(tracker.processId == pid);
+    CHECK(tracker.uiThreadCount == 2);
+
+    HWND popout = FakeCreateWindow(pid, 3, NULL, MAIN_RECT);
+    CHECK(TrackerOnWindowCreated(&tracker, popout, 3) == TRACKER_THREADS_CHANGED);
+    CHECK(TrackerOnWindowCreated(&tracker, popout, 3) == TRACKER_NONE);
+    CHECK(tracker.uiThreadCount == 3);
+
+    TrackerStop(&tracker);
+    CHECK(tracker.processId == 0 && tracker.uiThreadCount == 0);
+    CHECK(OsFindProcessId(L"OLK.EXE") == pid);
+}
+
+// Test: dead threads are pruned when the thread table fills up
+static void TestTrackerPrunesDeadThreads() {
+    FakeReset();
+    OutlookTracker tracker = {};
+    DWORD pid = FakeCreateProcess(L"olk.exe", FALSE);
+    TrackerStart(&tracker, pid);
+    for (DWORD tid = 1; tid <= MAX_UI_THREADS; tid++) {
+        TrackerOnWindowCreated(&tracker, NULL, tid);
+    }
+    CHECK(tracker.uiThreadCount == MAX_UI_THREADS);
+    FakeExitThread(5);
+    CHECK(TrackerOnWindowCreated(&tracker, NULL, 1000) == TRACKER_THREADS_CHANGED);
+    CHECK(tracker.uiThreadCount == MAX_UI_THREADS);
+}
+
+// Test: threads of target processes the DLL cannot load into (32-bit under a
+// 64-bit tray) are counted but never handed to the hook
+static void TestTrackerSkipsOtherBitness() {
+    FakeReset();
+    RuleTable rules = {};
+    wcscpy(rules.rules[rules.count++].image, L"olk.exe");
+    wcscpy(rules.rules[rules.count++].image, L"lob32.exe");
+    wcscpy(rules.rules[rules.count++].image, L"lob64.exe");
+    BuildRuleTable(&rules);
+    DWORD lob32 = FakeCreateProcess(L"C:\\Apps\\lob32.exe", FALSE);
+    DWORD lob64 = FakeCreateProcess(L"C:\\Apps\\lob64.exe", FALSE);
+    FakeGetProcess(lob32)->otherBitness = TRUE;
+    FakeCreateWindow(lob32, 10, NULL, MAIN_RECT);
+    FakeCreateWindow(lob64, 20, NULL, MAIN_RECT);
+
+    OutlookTracker tracker = {};
+    TrackerSetRules(&tracker, &rules);
+    CHECK(tracker.appThreadCount == 1 && tracker.appThreads[0] == 20);
+    CHECK(tracker.skippedThreadCount == 1 && tracker.skippedThreads[0] == 10);
+    HWND dialog = FakeCreateWindow(lob32, 11, NULL, MAIN_RECT);
+    CHECK(TrackerOnWindowCreated(&tracker, dialog, 11) == TRACKER_NONE);
+    CHECK(tracker.appThreadCount == 1 && tracker.skippedThreadCount == 2);
+
+    // A 32-bit Outlook is tracked, but none of its threads are hooked
+    DWORD outlook = FakeCreateProcess(L"C:\\Apps\\olk.exe", FALSE);
+    FakeGetProcess(outlook)->otherBitness = TRUE;
+    HWND main = FakeCreateWindow(outlook, 1, NULL, MAIN_RECT);
+    CHECK(TrackerOnWindowCreated(&tracker, main, 1) == TRACKER_STARTED);
+    CHECK(tracker.processId == outlook && tracker.uiThreadCount == 0);
+    CHECK(TrackerOnWindowCreated(&tracker, FakeCreateWindow(outlook, 2, NULL, MAIN_RECT), 2) == TRACKER_NONE);
+    CHECK(tracker.uiThreadCount == 0 && tracker.skippedThreadCount == 4);
+    TrackerStop(&tracker);
+    CHECK(!tracker.outlookOtherBitness);
+}
+
+// Test: concurrent writers and readers never observe a torn entry
+// Writers fill every field of an entry from one value; readers check they agree
+static void TestSeqlockStress() {
+    static SharedData data;
+    data = SharedData();
+    const int writerCount = 4;
+    const int iterations = 200000;
+    std::atomic<bool> stop(false);
+    std::atomic<int> torn(0);
+    std::atomic<long> snapshots(0);
+
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writerCount; w++) {
+        threads.emplace_back([&, w]() {
+            for (int i = 1; i <= iterations; i++) {
+                // Two windows per writer, plus one window all writers fight over
+                HWND hwnd = (HWND)(UINT_PTR)(i % 3 == 0 ? 0x9990 : 0x1000 * (w + 1) + (i & 1));
+                WindowEntry* pEntry = LockWindowEntry(&data, hwnd, TRUE);
+                if (!pEntry) continue;
+                if (i % 5 == 0) {
+                    ReleaseWindowEntry(&data, pEntry);
+                    continue;
+                }
+                LONG v = w * iterations + i;
+                pEntry->originalRect.left = v;
+                pEntry->originalRect.top = v;
+                pEntry->originalRect.right = v;
+                pEntry->originalRect.bottom = v;
+                pEntry->originalExStyle = v;
+                pEntry->processId = (DWORD)v;
+                pEntry->hiddenTick = (ULONGLONG)v;
+                pEntry->flags |= ENTRY_HIDDEN;
+                EndEntryWrite(&data, pEntry);
+            }
+        });
+    }
+    // The window all writers fight over, written through the bare seqlock
+    threads.emplace_back([&]() {
+        for (int i = 1; i <= iterations; i++) {
+            WindowEntry* pEntry = &data.windows[MAX_HIDDEN_WINDOWS - 1];
+            BeginEntryWrite(&data, pEntry);
+            LONG v = -i;
+            pEntry->originalRect.left = v;
+            pEntry->originalRect.top = v;
+            pEntry->originalRect.right = v;
+            pEntry->originalRect.bottom = v;
+            pEntry->originalExStyle = v;
+            EndEntryWrite(&data, pEntry);
+        }
+    });
+    threads.emplace_back([&]() {
+        while (!stop) {
+            WindowEntry entry;
+            ReadWindowEntry(&data, &data.windows[MAX_HIDDEN_WINDOWS - 1], &entry);
+            LONG v = entry.originalRect.left;
+            if (entry.originalRect.top != v || entry.originalRect.right != v ||
+                entry.originalRect.bottom != v || entry.originalExStyle != v) {
+                torn++;
+            }
+        }
+    });
+    const int writerThreads = writerCount + 1;
+    for (int r = 0; r < 2; r++) {
+        threads.emplace_back([&]() {
+            HiddenWindowInfo windows[MAX_HIDDEN_WINDOWS];
+            while (!stop) {
+                int count = SnapshotHiddenWindows(&data, windows, MAX_HIDDEN_WINDOWS);
+                for (int i = 0; i < count; i++) {
+                    LONG v = windows[i].originalRect.left;
+                    if (windows[i].originalRect.top != v || windows[i].originalRect.right != v ||
+                        windows[i].originalRect.bottom != v || windows[i].originalExStyle != v ||
+                        windows[i].processId != (DWORD)v || windows[i].hiddenTick != (ULONGLONG)v) {
+                        torn++;
+                    }
+                    // A window appears at most once
+                    for (int j = 0; j < i; j++) {
+                        if (windows[j].hwnd == windows[i].hwnd) torn++;
+                    }
+                }
+                snapshots++;
+            }
+        });
+    }
+    for (int w = 0; w < writerThreads; w++) {
+        threads[w].join();
+    }
+    stop = true;
+    for (size_t t = writerThreads; t < threads.size(); t++) {
+        threads[t].join();
+    }
+
+    CHECK(torn == 0);
+    CHECK(snapshots > 0);
+    for (int i = 0; i < MAX_HIDDEN_WINDOWS; i++) {
+        CHECK(!(data.windows[i].sequence & 1));
+    }
+}
+
+// Test: a writer killed while holding an entry does not stall readers and
+// writers for good; one whose process still runs is waited for
+static void TestSeqlockDeadWriter() {
+    FakeReset();
+    SharedData* pData = FakeSharedData();
+    LogReader reader;
+    LogReaderStart(&pData->log, &reader);
+    HiddenWindowInfo windows[MAX_HIDDEN_WINDOWS];
+
+    // Outlook hides a window, then dies inside its next write of the entry
+    DWORD outlook;
+    HWND hwnd = StartOutlook(&outlook);
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    CHECK(SnapshotHiddenWindows(pData, windows, MAX_HIDDEN_WINDOWS) == 1);
+    WindowEntry* pEntry = LockWindowEntry(pData, hwnd, FALSE);
+    CHECK(pEntry != NULL);
+    pEntry->writer = outlook;
+    pEntry->writerStart = FakeGetProcess(outlook)->startTime;
+    FakeExitProcess(outlook);
+
+    // The tray's next snapshot frees the entry instead of spinning forever
+    CHECK(SnapshotHiddenWindows(pData, windows, MAX_HIDDEN_WINDOWS) == 0);
+    CHECK(!(pEntry->sequence & 1) && pEntry->hwnd == NULL);
+    LogRecord records[LOG_RING_SIZE];
+    int count = LogDrain(&pData->log, &reader, records, LOG_RING_SIZE);
+    int abandoned = 0;
+    for (int i = 0; i < count; i++) {
+        if (records[i].event == LOG_ENTRY_ABANDONED) {
+            abandoned++;
+            CHECK(records[i].args[0] == (UINT_PTR)hwnd && records[i].args[1] == outlook);
+        }
+    }
+    CHECK(abandoned == 1);
+
+    // A writer does the same, and a reused process ID does not keep the entry held
+    DWORD other = FakeCreateProcess(L"C:\\Windows\\notepad.exe", FALSE);
+    pEntry = LockWindowEntry(pData, (HWND)0x5550, TRUE);
+    pEntry->writer = other;
+    pEntry->writerStart = FakeGetProcess(other)->startTime - 1;
+    CHECK(LockWindowEntry(pData, (HWND)0x5550, FALSE) == NULL);
+    CHECK(LockWindowEntry(pData, (HWND)0x5551, TRUE) != NULL);
+
+    // A live writer is waited for, however long it holds the entry
+    WindowEntry* pHeld = LockWindowEntry(pData, (HWND)0x5552, TRUE);
+    pHeld->writer = other;
+    pHeld->writerStart = FakeGetProcess(other)->startTime;
+    std::atomic<bool> done(false);
+    std::thread waiter([&]() {
+        WindowEntry entry;
+        ReadWindowEntry(pData, pHeld, &entry);
+        done = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(!done);
+    EndEntryWrite(pData, pHeld);
+    waiter.join();
+    CHECK(done && pHeld->hwnd == (HWND)0x5552);
+}
+
+// The table as a process killed inside its first window call of a hide leaves it
+static WindowEntry g_tableAtKill[MAX_HIDDEN_WINDOWS];
+
+static void KeepTableAtKill(HWND hwnd) {
+    for (int i = 0; i < MAX_HIDDEN_WINDOWS; i++) {
+        ReadWindowEntry(FakeSharedData(), &FakeSharedData()->windows[i], &g_tableAtKill[i]);
+    }
+}
+
+// Test: a process killed between claiming a slot and publishing the hidden
+// window does not keep the slot once the tray sees the process exit
+static void TestKilledWhileHiding() {
+    FakeReset();
+    SharedData* pData = FakeSharedData();
+    HiddenWindowInfo windows[MAX_HIDDEN_WINDOWS];
+
+    // An earlier Outlook used the slot, so its process ID is left in it
+    DWORD earlier;
+    HWND earlierHwnd = StartOutlook(&earlier);
+    FakeSendMessage(earlierHwnd, WM_CLOSE, 0);
+    CHECK(ReleaseWindow(pData, earlierHwnd));
+
+    DWORD outlook = FakeCreateProcess(L"C:\\Program Files\\WindowsApps\\olk.exe", TRUE);
+    HWND hwnd = FakeCreateWindow(outlook, 2, NULL, MAIN_RECT);
+    FakeShowWindow(hwnd, TRUE);
+    FakeOnNextWindowStyle(KeepTableAtKill);
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    for (int i = 0; i < MAX_HIDDEN_WINDOWS; i++) {
+        pData->windows[i] = g_tableAtKill[i];
+    }
+    FakeExitProcess(outlook);
+
+    // Claimed but not hidden: snapshots skip it, so only the exit can free it
+    CHECK(SnapshotHiddenWindows(pData, windows, MAX_HIDDEN_WINDOWS) == 0);
+    CHECK(pData->windows[0].hwnd == hwnd);
+    ReleaseProcessWindows(pData, outlook);
+    CHECK(pData->windows[0].hwnd == NULL);
+}
+
+// Test: hook counters per process, histogram buckets, and totals that
+// survive a process unloading the DLL
+static void TestHookStats() {
+    CHECK(HookTimeBucket(0) == 0);
+    CHECK(HookTimeBucket(1) == 1);
+    CHECK(HookTimeBucket(3) == 2);
+    CHECK(HookTimeBucket(4) == 3);
+    CHECK(HookTimeBucket(-5) == 0);
+    CHECK(HookTimeBucket(1LL << 40) == HOOK_HISTOGRAM_BUCKETS - 1);
+
+    FakeReset();
+    SharedData* pData = FakeSharedData();
+    DWORD notepad = FakeCreateProcess(L"C:\\Windows\\notepad.exe", TRUE);
+    DWORD unhooked = FakeCreateProcess(L"C:\\Windows\\calc.exe", FALSE);
+    DWORD pid;
+    FakeSetCounterStep(3);
+    HWND hwnd = StartOutlook(&pid);
+    HWND other = FakeCreateWindow(notepad, 9, NULL, MAIN_RECT);
+    FakeShowWindow(other, TRUE);
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    FakeSendMessage(FakeCreateWindow(unhooked, 10, NULL, MAIN_RECT), WM_CLOSE, 0);
+
+    HookStats total;
+    CHECK(AggregateHookStats(pData, &total) == 2);
+    const HookStats* pOutlook = FakeGetProcess(pid)->hookState.stats;
+    CHECK(pOutlook->processId == (LONG)pid);
+    CHECK(pOutlook->messagesSeen == 2);         // WM_SHOWWINDOW, WM_CLOSE
+    CHECK(pOutlook->outlookMessages == 2);
+    CHECK(pOutlook->histogram[2] == 2);         // 3 ticks each
+    CHECK(pOutlook->hookTicks == 6);
+    CHECK(pOutlook->subclassInstalls == 1);
+    CHECK(pOutlook->hides == 1);
+    CHECK(total.messagesSeen == 3);             // Notepad's message counted, not timed
+    CHECK(total.outlookMessages == 2);
+
+    // Outlook exits: its counters move to the retired totals
+    FakeExitProcess(pid);
+    CHECK(AggregateHookStats(pData, &total) == 1);
+    CHECK(total.messagesSeen == 3);
+    CHECK(total.hides == 1);
+    CHECK(total.histogram[2] == 2);
+
+    wchar_t text[1024];
+    FormatHookStats(&total, 1, 0, OsQueryPerformanceFrequency(), text, 1024);
+    CHECK(wcsstr(text, L"Hides: 1") != NULL);
+    CHECK(wcsstr(text, L"Mean Outlook-path time: 300.0 ns") != NULL);
+    CHECK(wcsstr(text, L"200 - 400 ns: 2") != NULL);
+
+    // A tiny buffer is truncated, never overrun
+    wchar_t tiny[16];
+    FormatHookStats(&total, 1, 0, OsQueryPerformanceFrequency(), tiny, 16);
+    CHECK(wcslen(tiny) < 16);
+
+    // Killed processes never retire their slots. Once the table is full, a new
+    // process takes over one whose owner is gone or whose ID was reused, and
+    // what the dead owner counted stays in the totals
+    const HookStats* pNotepad = FakeGetProcess(notepad)->hookState.stats;
+    for (int i = 0; i < MAX_STATS_SLOTS; i++) {
+        HookStats* pStats = &pData->stats[i];
+        if (pStats->processId == 0) {
+            pStats->processId = (LONG)notepad;          // Notepad's ID, an earlier process's start
+            pStats->processStart = FakeGetProcess(notepad)->startTime - 1;
+            pStats->messagesSeen = 1;
+        }
+    }
+    pData->stats[MAX_STATS_SLOTS - 1].processId = 0x7FF0;     // Gone
+    CHECK(AggregateHookStats(pData, &total) == MAX_STATS_SLOTS);
+    ULONGLONG seenBefore = total.messagesSeen;
+    DWORD late = FakeCreateProcess(L"C:\\Windows\\write.exe", TRUE);
+    const HookStats* pLate = FakeGetProcess(late)->hookState.stats;
+    CHECK(pLate != pNotepad && pLate->processId == (LONG)late && pLate->messagesSeen == 0);
+    CHECK(pLate->processStart == FakeGetProcess(late)->startTime);
+    CHECK(pData->uncountedProcesses == 0);
+    CHECK(AggregateHookStats(pData, &total) == MAX_STATS_SLOTS && total.messagesSeen == seenBefore);
+    int reclaimed = 1;
+    while (FakeGetProcess(FakeCreateProcess(L"C:\\Windows\\write.exe", TRUE))->hookState.stats->processId != 0) {
+        reclaimed++;
+    }
+    CHECK(reclaimed == MAX_STATS_SLOTS - 1);        // Every slot but live Notepad's own
+    CHECK(pNotepad->processId == (LONG)notepad && pData->uncountedProcesses == 1);
+}
+
+// Test: the hook tells the tray about every table change, once per change,
+// and the tray model only reports a change when what it shows differs
+static void TestTrayNotifications() {
+    FakeReset();
+    SharedData* pData = FakeSharedData();
+    DWORD pid;
+    HWND hwnd = StartOutlook(&pid);
+
+    // No tray registered: nothing is posted
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    CHECK(FakeNotificationCount(TRAY_NOTIFY_WINDOW_HIDDEN) == 0);
+    ReleaseWindow(pData, hwnd);
+
+    pData->trayWindow = (HWND)0x9990;
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    FakeSendMessage(hwnd, WM_CLOSE, 0);         // Already hidden: no change, no post
+    CHECK(FakeNotificationCount(TRAY_NOTIFY_WINDOW_HIDDEN) == 1);
+
+    TrayModel model = {};
+    HiddenWindowInfo windows[MAX_HIDDEN_WINDOWS];
+    int count = SnapshotHiddenWindows(pData, windows, MAX_HIDDEN_WINDOWS);
+    CHECK(TrayModelUpdate(&model, TRUE, windows, count));
+    CHECK(!TrayModelUpdate(&model, TRUE, windows, count));
+    wchar_t tip[128];
+    FormatTrayTooltip(&model, tip, 128);
+    CHECK(wcscmp(tip, L"Outlook to Tray - 1 window hidden") == 0);
+
+    CHECK(ReleaseWindow(pData, hwnd));
+    CHECK(FakeNotificationCount(TRAY_NOTIFY_WINDOW_RESTORED) == 1);
+    count = SnapshotHiddenWindows(pData, windows, MAX_HIDDEN_WINDOWS);
+    CHECK(TrayModelUpdate(&model, TRUE, windows, count));
+    FormatTrayTooltip(&model, tip, 128);
+    CHECK(wcscmp(tip, L"Outlook to Tray - Outlook open") == 0);
+
+    // Destroyed while hidden
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    FakeDestroyWindow(hwnd);
+    CHECK(FakeNotificationCount(TRAY_NOTIFY_WINDOW_DESTROYED) == 1);
+    CHECK(SnapshotHiddenWindows(pData, windows, MAX_HIDDEN_WINDOWS) == 0);
+    CHECK(TrayModelUpdate(&model, FALSE, windows, 0));
+    FormatTrayTooltip(&model, tip, 128);
+    CHECK(wcscmp(tip, L"Outlook to Tray - Outlook not running") == 0);
+}
+
+// Test: the tray's restore request is handled by the subclass procedure,
+// which restores in one update, acknowledges and records the latency
+static void TestInProcessRestore() {
+    FakeReset();
+    SharedData* pData = FakeSharedData();
+    pData->trayWindow = (HWND)0x9990;
+    DWORD pid;
+    HWND hwnd = StartOutlook(&pid);
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    CHECK(pWindow && pWindow->rect.left == -32000);
+    if (!pWindow) return;
+
+    UINT restoreMessage = OsRegisterMessage(RESTORE_WINDOW_MESSAGE);
+    CHECK(FakeGetProcess(pid)->hookState.restoreMessage == restoreMessage);
+    FakeSetCounterStep(50000);                  // 5 ms per counter read
+    LONGLONG clickTicks = OsQueryPerformanceCounter();
+    FakeSendMessage(hwnd, restoreMessage, 0, (LPARAM)clickTicks);
+    CHECK(pWindow->rect.left == MAIN_RECT.left && pWindow->rect.top == MAIN_RECT.top);
+    CHECK(pWindow->exStyle == WS_EX_APPWINDOW);
+    CHECK(pWindow->visible && pWindow->foreground);
+    CHECK(FakeNotificationCount(TRAY_NOTIFY_WINDOW_RESTORED) == 1);
+
+    HiddenWindowInfo windows[MAX_HIDDEN_WINDOWS];
+    CHECK(SnapshotHiddenWindows(pData, windows, MAX_HIDDEN_WINDOWS) == 0);
+    const HookStats* pStats = FakeGetProcess(pid)->hookState.stats;
+    CHECK(pStats->restores == 1);
+    CHECK(pStats->inProcessRestore.count == 1);
+    CHECK(pStats->inProcessRestore.maxTicks == 3 * 50000);    // Hook timing reads the counter twice first
+
+    // A second (stale) request for a window that is no longer hidden does nothing
+    FakeSendMessage(hwnd, restoreMessage, 0, (LPARAM)clickTicks);
+    CHECK(FakeNotificationCount(TRAY_NOTIFY_WINDOW_RESTORED) == 1);
+    CHECK(pStats->restores == 1);
+
+    wchar_t text[256];
+    FormatRestoreTiming(L"In-process", &pStats->inProcessRestore, OsQueryPerformanceFrequency(),
+                        text, 256);
+    CHECK(wcscmp(text, L"In-process: 1, mean 15.00 ms, max 15.00 ms\n") == 0);
+}
+
+// Test: a restarted tray takes back the windows the previous one left hidden,
+// with the saved placement where there is a record, and the hook subclasses
+// them again on the restore request
+static void TestRecoverHiddenWindows() {
+    FakeReset();
+    SharedData* pData = FakeSharedData();
+    DWORD pid;
+    HWND hwnd = StartOutlook(&pid);
+    const RECT POPUP_RECT = { 200, 150, 900, 750 };
+    HWND popup = FakeCreateWindow(pid, 2, NULL, POPUP_RECT);
+    FakeShowWindow(popup, TRUE);
+    HWND minimized = FakeCreateWindow(pid, 1, NULL, RECT{ -32000, -32000, -31840, -31970 });
+    FakeShowWindow(minimized, TRUE);
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    pData->settings.hideMode = HIDE_CLOAK;
+    FakeAdvanceTicks(10);
+    FakeSendMessage(popup, WM_CLOSE, 0);
+
+    // Only the main window had been saved when the tray went away
+    HiddenWindowInfo windows[MAX_HIDDEN_WINDOWS];
+    CHECK(SnapshotHiddenWindows(pData, windows, MAX_HIDDEN_WINDOWS) == 2);
+    HiddenWindowFile file = {};
+    SaveHiddenWindows(windows, 1, &file);
+    CHECK(file.count == 1 && file.records[0].hwnd == (DWORD)(UINT_PTR)hwnd);
+
+    // The table and the hook went with it
+    ReleaseProcessWindows(pData, pid);
+    FakeReloadHook(pid);
+    CHECK(SnapshotHiddenWindows(pData, windows, MAX_HIDDEN_WINDOWS) == 0);
+
+    DWORD threads[MAX_UI_THREADS];
+    int threadCount = OsFindUiThreads(pid, threads, MAX_UI_THREADS);
+    CHECK(AdoptHiddenWindows(pData, pid, RULE_OUTLOOK, threads, threadCount, &file) == 2);
+    CHECK(AdoptHiddenWindows(pData, pid, RULE_OUTLOOK, threads, threadCount, &file) == 0);
+    CHECK(SnapshotHiddenWindows(pData, windows, MAX_HIDDEN_WINDOWS) == 2);
+    for (int i = 0; i < 2; i++) {
+        CHECK(windows[i].processId == pid && windows[i].rule == RULE_OUTLOOK);
+        CHECK(windows[i].cloaked == (windows[i].hwnd == popup));
+    }
+
+    // Restore requests reach the hook, which subclasses the windows first
+    UINT restoreMessage = OsRegisterMessage(RESTORE_WINDOW_MESSAGE);
+    FakeSendMessage(hwnd, restoreMessage, 0, 0);
+    FakeSendMessage(popup, restoreMessage, 0, 0);
+    FakeWindow* pMain = FakeGetWindow(hwnd);
+    FakeWindow* pPopup = FakeGetWindow(popup);
+    CHECK(pMain->subclassed && pMain->visible && !(pMain->exStyle & WS_EX_TOOLWINDOW));
+    CHECK(pMain->rect.left == MAIN_RECT.left && pMain->rect.top == MAIN_RECT.top);
+    CHECK(pMain->exStyle == WS_EX_APPWINDOW);
+    CHECK(pPopup->subclassed && !pPopup->cloaked && pPopup->rect.left == POPUP_RECT.left);
+    CHECK((pPopup->exStyle & WS_EX_APPWINDOW) && !(pPopup->exStyle & WS_EX_TOOLWINDOW));
+    CHECK(SnapshotHiddenWindows(pData, windows, MAX_HIDDEN_WINDOWS) == 0);
+
+    // Without a record a parked window comes back near the corner, its size kept
+    pData->settings.hideMode = HIDE_OFFSCREEN;
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    ReleaseProcessWindows(pData, pid);
+    CHECK(AdoptHiddenWindows(pData, pid, RULE_OUTLOOK, threads, threadCount, NULL) == 1);
+    CHECK(SnapshotHiddenWindows(pData, windows, MAX_HIDDEN_WINDOWS) == 1);
+    CHECK(windows[0].hwnd == hwnd && windows[0].originalRect.left == ADOPTED_WINDOW_POS);
+    CHECK(windows[0].originalRect.right - windows[0].originalRect.left == MAIN_RECT.right - MAIN_RECT.left);
+    CHECK(FakeGetWindow(minimized)->rect.left == -32000);
+}
+
+// Test: hovering over the tray icon pre-warms at most once a second and holds
+// for a while; the first paint after the restore is timed cold or pre-warmed
+static void TestHoverPrewarm() {
+    PrewarmState prewarm = {};
+    CHECK(!PrewarmHolding(&prewarm, 1000));
+    CHECK(PrewarmOnHover(&prewarm, 1000));
+    CHECK(!PrewarmOnHover(&prewarm, 1000 + PREWARM_INTERVAL_MS - 1));
+    CHECK(PrewarmOnHover(&prewarm, 1000 + PREWARM_INTERVAL_MS));
+    CHECK(prewarm.prewarms == 2);
+    CHECK(PrewarmHolding(&prewarm, 1000 + PREWARM_INTERVAL_MS + PREWARM_HOLD_MS - 1));
+    CHECK(!PrewarmHolding(&prewarm, 1000 + PREWARM_INTERVAL_MS + PREWARM_HOLD_MS));
+    CHECK(PrewarmOnRestore(&prewarm, 3000));
+    CHECK(!PrewarmOnRestore(&prewarm, 3000));      // The restore ended it
+    CHECK(PrewarmOnHover(&prewarm, 3001));
+    CHECK(!PrewarmOnRestore(&prewarm, 3001 + PREWARM_HOLD_MS));
+    CHECK(prewarm.prewarms == 3 && prewarm.used == 1);
+
+    FakeReset();
+    SharedData* pData = FakeSharedData();
+    DWORD pid;
+    HWND hwnd = StartOutlook(&pid);
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    HiddenWindowInfo windows[MAX_HIDDEN_WINDOWS];
+    int count = SnapshotHiddenWindows(pData, windows, MAX_HIDDEN_WINDOWS);
+    TrayModel model = {};
+    TrayModelUpdate(&model, TRUE, windows, count);
+    CHECK(RepaintHiddenWindows(&model) == 1);
+    CHECK(FakeGetWindow(hwnd)->repaints == 1);
+
+    // Pre-warmed restore: only the first paint after it counts
+    UINT restoreMessage = OsRegisterMessage(RESTORE_WINDOW_MESSAGE);
+    const HookStats* pStats = FakeGetProcess(pid)->hookState.stats;
+    FakeSetCounterStep(10000);
+    FakeSendMessage(hwnd, restoreMessage, TRUE, (LPARAM)OsQueryPerformanceCounter());
+    FakeSendMessage(hwnd, WM_PAINT, 0);
+    FakeSendMessage(hwnd, WM_PAINT, 0);
+    CHECK(pStats->firstPaint[1].count == 1 && pStats->firstPaint[1].maxTicks > 0);
+    CHECK(pStats->firstPaint[0].count == 0);
+
+    // Cold restore
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    FakeSendMessage(hwnd, restoreMessage, FALSE, (LPARAM)OsQueryPerformanceCounter());
+    FakeSendMessage(hwnd, WM_PAINT, 0);
+    CHECK(pStats->firstPaint[0].count == 1 && pStats->firstPaint[1].count == 1);
+
+    // Recovered windows are restored without a click time: nothing to time
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    FakeSendMessage(hwnd, restoreMessage, FALSE, 0);
+    FakeSendMessage(hwnd, WM_PAINT, 0);
+    CHECK(pStats->firstPaint[0].count == 1);
+}
+
+// Test: unread count from window titles, badge labels and the icon rate limit
+static void TestUnreadBadge() {
+    CHECK(ParseUnreadCount(L"Inbox (3) - Jane Doe - Outlook") == 3);
+    CHECK(ParseUnreadCount(L"(12) Inbox - Outlook") == 12);
+    CHECK(ParseUnreadCount(L"Inbox - Outlook") == -1);
+    CHECK(ParseUnreadCount(L"Re: budget (draft) - Outlook") == -1);
+    CHECK(ParseUnreadCount(L"Inbox () - Outlook") == -1);
+
+    UnreadTracker tracker = {};
+    HWND main = (HWND)0x100, compose = (HWND)0x200;
+    CHECK(UnreadOnTitleChange(&tracker, main, L"Inbox (3) - Outlook"));
+    CHECK(!UnreadOnTitleChange(&tracker, main, L"Inbox (3) - Outlook"));
+    CHECK(!UnreadOnTitleChange(&tracker, compose, L"Untitled - Message"));   // Not the source
+    CHECK(tracker.count == 3);
+    CHECK(UnreadOnTitleChange(&tracker, main, L"Inbox - Outlook"));
+    CHECK(tracker.count == 0);
+
+    TrayModel model = {};
+    model.outlookRunning = TRUE;
+    CHECK(TrayModelSetUnread(&model, 4));
+    CHECK(!TrayModelSetUnread(&model, 4));
+    wchar_t tip[128];
+    FormatTrayTooltip(&model, tip, 128);
+    CHECK(wcscmp(tip, L"Outlook to Tray - Outlook open (4 unread)") == 0);
+    model.hiddenCount = 2;
+    FormatTrayTooltip(&model, tip, 128);
+    CHECK(wcscmp(tip, L"Outlook to Tray - 2 windows hidden (4 unread)") == 0);
+
+    wchar_t label[8];
+    CHECK(BadgeIndex(0) == 0);
+    CHECK(BadgeIndex(7) == 7);
+    CHECK(BadgeIndex(250) == MAX_BADGE_NUMBER + 1);
+    FormatBadgeLabel(BadgeIndex(250), label, 8);
+    CHECK(wcscmp(label, L"9+") == 0);
+
+    // First update goes out at once; a burst within the interval becomes one timer
+    TrayUpdateLimiter limiter = {};
+    ULONGLONG delay = 0;
+    CHECK(TrayUpdateRequest(&limiter, 10000, &delay) == TRAY_UPDATE_NOW);
+    CHECK(TrayUpdateRequest(&limiter, 10050, &delay) == TRAY_UPDATE_LATER);
+    CHECK(delay == TRAY_UPDATE_INTERVAL_MS - 50);
+    CHECK(TrayUpdateRequest(&limiter, 10060, &delay) == TRAY_UPDATE_PENDING);
+    TrayUpdateTimerFired(&limiter, 10000 + TRAY_UPDATE_INTERVAL_MS);
+    CHECK(TrayUpdateRequest(&limiter, 10000 + 2 * TRAY_UPDATE_INTERVAL_MS, &delay) == TRAY_UPDATE_NOW);
+}
+
+// Test: icon registration backs off while Explorer is missing and records startup time
+static void TestTrayIconStartup() {
+    TrayIconState icon = {};
+    icon.processStart = 100000000;
+    icon.windowCreated = icon.processStart + 400000;        // 40 ms
+
+    // Explorer not up yet: 250, 500, 1000 ... ms, capped
+    CHECK(TrayIconAddResult(&icon, FALSE, icon.processStart + 500000) == ICON_RETRY_FIRST_MS);
+    CHECK(TrayIconAddResult(&icon, FALSE, icon.processStart + 3000000) == 2 * ICON_RETRY_FIRST_MS);
+    for (int i = 0; i < 10; i++) {
+        TrayIconAddResult(&icon, FALSE, icon.processStart + 4000000);
+    }
+    CHECK(TrayIconAddResult(&icon, FALSE, icon.processStart + 5000000) == ICON_RETRY_MAX_MS);
+    CHECK(!icon.added && icon.iconVisible == 0);
+
+    wchar_t text[256];
+    FormatStartupTimes(&icon, text, 256);
+    CHECK(wcsstr(text, L"window after 40 ms, tray icon not added yet (13 attempt(s))") != NULL);
+
+    // Added on the 14th call, 1.5 s after the process started
+    CHECK(TrayIconAddResult(&icon, TRUE, icon.processStart + 15000000) == 0);
+    CHECK(icon.added && icon.startupAttempts == 14);
+    FormatStartupTimes(&icon, text, 256);
+    CHECK(wcsstr(text, L"tray icon after 1500 ms (14 attempt(s))") != NULL);
+
+    // Explorer restarts: the retry sequence starts over, startup figures stay
+    TrayIconLost(&icon);
+    icon.explorerRestarts++;
+    CHECK(TrayIconAddResult(&icon, FALSE, icon.processStart + 90000000) == ICON_RETRY_FIRST_MS);
+    CHECK(TrayIconAddResult(&icon, TRUE, icon.processStart + 92500000) == 0);
+    CHECK(icon.iconVisible == icon.processStart + 15000000 && icon.startupAttempts == 14);
+    FormatStartupTimes(&icon, text, 256);
+    CHECK(wcsstr(text, L"Explorer restarts: 1, icon shown") != NULL);
+}
+
+// Test: trimming covers Outlook and its WebView2 tree, and only once hidden long enough
+static void TestWorkingSetTrim() {
+    FakeReset();
+    const ULONGLONG MB = 1024 * 1024;
+    DWORD pid;
+    HWND hwnd = StartOutlook(&pid);
+    const wchar_t* webViewImage = L"C:\\Program Files (x86)\\Microsoft\\EdgeWebView\\msedgewebview2.exe";
+    DWORD browser = FakeCreateProcess(webViewImage, FALSE, pid);
+    DWORD renderer = FakeCreateProcess(webViewImage, FALSE, browser);
+    DWORD sandboxed = FakeCreateProcess(webViewImage, FALSE, browser);
+    DWORD helper = FakeCreateProcess(L"C:\\Windows\\notepad.exe", FALSE, pid);    // Not WebView2
+    DWORD teams = FakeCreateProcess(L"C:\\Apps\\ms-teams.exe", FALSE);
+    DWORD otherWebView = FakeCreateProcess(webViewImage, FALSE, teams);
+    FakeGetProcess(pid)->workingSet = 300 * MB;
+    FakeGetProcess(browser)->workingSet = 50 * MB;
+    FakeGetProcess(renderer)->workingSet = 200 * MB;
+    FakeGetProcess(sandboxed)->accessDenied = TRUE;
+    FakeGetProcess(helper)->workingSet = 40 * MB;
+    FakeGetProcess(otherWebView)->workingSet = 80 * MB;
+
+    ProcessLink links[MAX_PROCESS_LINKS];
+    DWORD ids[MAX_TREE_PROCESSES];
+    int linkCount = OsListProcesses(links, MAX_PROCESS_LINKS);
+    CHECK(CollectProcessTree(links, linkCount, pid, ids, MAX_TREE_PROCESSES) == 4);
+    CHECK(ids[0] == pid && ids[1] == browser);
+
+    TrimReport report;
+    TrimProcessTree(pid, &report);
+    CHECK(report.trimmed == 3 && report.skipped == 1);
+    CHECK(report.bytesReleased == (300 + 50 + 200) * MB - 3 * FAKE_TRIMMED_WORKING_SET);
+    CHECK(FakeGetProcess(helper)->workingSet == 40 * MB);
+    CHECK(FakeGetProcess(otherWebView)->workingSet == 80 * MB);
+
+    // Due 'delay' after the latest hide, then every 'interval'; never while nothing is hidden
+    TrimPolicy policy = { 600000, 1800000 };
+    TrayModel model = {};
+    CHECK(TrimDueTick(&policy, &model, 0) == 0);
+    CHECK(OsHasOnScreenWindow(pid));
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    CHECK(!OsHasOnScreenWindow(pid));
+    HiddenWindowInfo windows[MAX_HIDDEN_WINDOWS];
+    int count = SnapshotHiddenWindows(FakeSharedData(), windows, MAX_HIDDEN_WINDOWS);
+    TrayModelUpdate(&model, TRUE, windows, count);
+    ULONGLONG hiddenTick = model.hidden[0].hiddenTick;
+    CHECK(TrimDueTick(&policy, &model, 0) == hiddenTick + 600000);
+    CHECK(TrimDueTick(&policy, &model, hiddenTick + 600000) == hiddenTick + 2400000);
+    policy.intervalMs = 0;
+    CHECK(TrimDueTick(&policy, &model, hiddenTick + 600000) == 0);
+    policy.delayMs = 0;
+    CHECK(TrimDueTick(&policy, &model, 0) == 0);
+
+    TrimHistory history = {};
+    for (int i = 0; i < TRIM_HISTORY_SIZE + 1; i++) {
+        RecordTrim(&history, &report);
+    }
+    CHECK(history.trims == TRIM_HISTORY_SIZE + 1);
+    CHECK(history.totalBytes == (TRIM_HISTORY_SIZE + 1) * report.bytesReleased);
+    wchar_t text[1024];
+    policy = { 600000, 1800000 };
+    FormatTrimHistory(&policy, &history, text, 1024);
+    CHECK(wcsstr(text, L"after 600 s hidden, then every 1800 s\n") != NULL);
+    CHECK(wcsstr(text, L"  547.0 MB from 3 process(es), 1 not accessible\n") != NULL);
+}
+
+// Test: hiding puts the Outlook tree in efficiency mode, picks up new WebView2
+// processes, undoes only what it changed, and measures CPU time while hidden
+static void TestHiddenEfficiencyMode() {
+    FakeReset();
+    const ULONGLONG SECOND = 10000000;      // 100 ns units
+    DWORD pid;
+    StartOutlook(&pid);
+    const wchar_t* webViewImage = L"C:\\Program Files (x86)\\Microsoft\\EdgeWebView\\msedgewebview2.exe";
+    DWORD browser = FakeCreateProcess(webViewImage, FALSE, pid);
+    DWORD renderer = FakeCreateProcess(webViewImage, FALSE, browser);
+    FakeGetProcess(pid)->cpuTime = 100 * SECOND;
+    FakeGetProcess(browser)->cpuTime = 20 * SECOND;
+    FakeGetProcess(browser)->gpuTime = 30 * SECOND;
+    FakeGetProcess(renderer)->belowNormal = TRUE;      // WebView2's own choice
+
+    ThrottleState state = {};
+    HiddenCpu efficient = {}, normal = {};
+    ThrottleStart(&state, pid, TRUE, 1000);
+    CHECK(state.count == 3);
+    CHECK(FakeGetProcess(pid)->efficient && FakeGetProcess(pid)->belowNormal);
+    CHECK(FakeGetProcess(renderer)->efficient);
+
+    // The renderer is read, then exits; a new one starts
+    FakeGetProcess(renderer)->cpuTime = SECOND / 2;
+    ThrottleRescan(&state, pid);
+    FakeExitProcess(renderer);
+    DWORD newRenderer = FakeCreateProcess(webViewImage, FALSE, browser);
+    FakeGetProcess(newRenderer)->cpuTime = 2 * SECOND;
+    ThrottleRescan(&state, pid);
+    CHECK(state.count == 3);
+    CHECK(FakeGetProcess(newRenderer)->efficient);
+
+    // The running period as of the last rescan, without reading the counters again
+    HiddenCpu sofar = {};
+    FakeGetProcess(pid)->cpuTime += 50 * SECOND;
+    ThrottleTotal(&state, 1000 + 30000, &sofar);
+    CHECK(sofar.periods == 1 && sofar.hiddenMs == 30000);
+    CHECK(sofar.cpuTime == 2 * SECOND + SECOND / 2);
+    FakeGetProcess(pid)->cpuTime -= 50 * SECOND;
+
+    FakeGetProcess(pid)->cpuTime += 5 * SECOND;
+    FakeGetProcess(browser)->cpuTime += SECOND;
+    FakeGetProcess(browser)->gpuTime += 3 * SECOND;
+
+    // A restore lifts the mode at once from a copy; the period is still open
+    ThrottledProcess lowered[MAX_TREE_PROCESSES];
+    for (int i = 0; i < state.count; i++) lowered[i] = state.processes[i];
+    ThrottleLift(lowered, state.count);
+    CHECK(!FakeGetProcess(pid)->efficient && !FakeGetProcess(pid)->belowNormal);
+    CHECK(!FakeGetProcess(newRenderer)->efficient && !FakeGetProcess(newRenderer)->belowNormal);
+    CHECK(state.active);
+    ThrottleStop(&state, 1000 + 600000, &efficient);
+    CHECK(!state.active);
+    CHECK(!FakeGetProcess(pid)->efficient && !FakeGetProcess(pid)->belowNormal);
+    CHECK(!FakeGetProcess(newRenderer)->efficient && !FakeGetProcess(newRenderer)->belowNormal);
+    CHECK(efficient.periods == 1 && efficient.hiddenMs == 600000);
+    CHECK(efficient.cpuTime == 5 * SECOND + SECOND + 2 * SECOND + SECOND / 2);
+    CHECK(efficient.gpuTime == 3 * SECOND);
+
+    // Without the mode: measured, nothing changed
+    FakeGetProcess(browser)->belowNormal = FALSE;
+    ThrottleStart(&state, pid, FALSE, 700000);
+    CHECK(!FakeGetProcess(pid)->efficient && !FakeGetProcess(pid)->belowNormal);
+    FakeGetProcess(pid)->cpuTime += 6 * SECOND;
+    ThrottleStop(&state, 700000 + 60000, &normal);
+    CHECK(normal.cpuTime == 6 * SECOND);
+
+    wchar_t text[256];
+    FormatHiddenCpu(L"Efficient", &efficient, text, 256);
+    CHECK(wcscmp(text, L"Efficient: 8.5 s CPU, 3.0 s GPU over 10.0 min hidden (1.42% of one core), 1 period(s)\n") == 0);
+    FormatHiddenCpu(L"Normal", &normal, text, 256);
+    CHECK(wcscmp(text, L"Normal: 6.0 s CPU, 0.0 s GPU over 1.0 min hidden (10.00% of one core), 1 period(s)\n") == 0);
+    HiddenCpu none = {};
+    FormatHiddenCpu(L"Cloaked", &none, text, 256);
+    CHECK(wcscmp(text, L"Cloaked: none yet\n") == 0);
+}
+
+// Test: in cloak mode the window is cloaked in place, counts as off screen,
+// and the in-process restore uncloaks it and times it separately
+static void TestCloakedHide() {
+    FakeReset();
+    SharedData* pData = FakeSharedData();
+    pData->settings.hideMode = HIDE_CLOAK;
+    DWORD pid;
+    HWND hwnd = StartOutlook(&pid);
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    FakeWindow* pWindow = FakeGetWindow(hwnd);
+    CHECK(pWindow && pWindow->cloaked && pWindow->rect.left == MAIN_RECT.left);
+    if (!pWindow) return;
+    CHECK(!(pWindow->exStyle & WS_EX_APPWINDOW));
+    CHECK(!OsHasOnScreenWindow(pid));
+
+    HiddenWindowInfo windows[MAX_HIDDEN_WINDOWS];
+    CHECK(SnapshotHiddenWindows(pData, windows, MAX_HIDDEN_WINDOWS) == 1);
+    CHECK(windows[0].cloaked);
+
+    // The mode applies to the next hide; this window comes back uncloaked where it was
+    pData->settings.hideMode = HIDE_OFFSCREEN;
+    UINT restoreMessage = OsRegisterMessage(RESTORE_WINDOW_MESSAGE);
+    FakeSetCounterStep(1000);
+    FakeSendMessage(hwnd, restoreMessage, 0, (LPARAM)OsQueryPerformanceCounter());
+    CHECK(!pWindow->cloaked && pWindow->visible && pWindow->foreground);
+    CHECK(pWindow->rect.left == MAIN_RECT.left && pWindow->exStyle == WS_EX_APPWINDOW);
+    const HookStats* pStats = FakeGetProcess(pid)->hookState.stats;
+    CHECK(pStats->cloakedRestore.count == 1 && pStats->inProcessRestore.count == 0);
+
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    CHECK(!pWindow->cloaked && pWindow->rect.left == -32000);
+    CHECK(SnapshotHiddenWindows(pData, windows, MAX_HIDDEN_WINDOWS) == 1);
+    CHECK(!windows[0].cloaked);
+
+    // DWM only cloaks a process's own windows
+    CHECK(!OsCloakWindow(hwnd, TRUE));
+}
+
+// Test: settings layer file < user < policy, bad values fall through, and the
+// hook picks up the published target and hide mode
+static void TestSettings() {
+    FakeReset();
+    TraySettings settings;
+    LoadSettings(&settings, L"C:\\Tools\\OutlookToTray.ini");
+    CHECK(settings.values[SETTING_TRIM_DELAY] == DEFAULT_TRIM_DELAY_SECONDS);
+    CHECK(settings.sources[SETTING_TRIM_DELAY] == SOURCE_DEFAULT);
+    CHECK(wcscmp(settings.targetImage, L"olk.exe") == 0 && !settings.autoStart);
+
+    FakeSetTextFile(L"C:\\Tools\\OutlookToTray.ini",
+                    L"; Outlook to Tray\r\n[General]\r\n"
+                    L"  TrimDelaySeconds = 120 \r\n"
+                    L"TrimIntervalSeconds=soon\r\n"
+                    L"hidemode=1\r\n"
+                    L"TargetProcess=C:\\Apps\\Mail.exe\r\n"
+                    L"EfficiencyMode=0");
+    FakeSetRegistryDword(HIVE_CURRENT_USER, SETTINGS_KEY, L"TrimDelaySeconds", 300);
+    FakeSetRegistryDword(HIVE_CURRENT_USER, SETTINGS_KEY, L"HideMode", 7);     // Out of range
+    FakeSetRegistryDword(HIVE_LOCAL_MACHINE, SETTINGS_POLICY_KEY, L"EfficiencyMode", 1);
+    FakeSetRegistryString(HIVE_CURRENT_USER, AUTOSTART_KEY, AUTOSTART_VALUE, L"C:\\Tools\\OutlookToTray.exe");
+    LoadSettings(&settings, L"C:\\Tools\\OutlookToTray.ini");
+    CHECK(settings.values[SETTING_TRIM_DELAY] == 300 && settings.sources[SETTING_TRIM_DELAY] == SOURCE_USER);
+    CHECK(settings.values[SETTING_TRIM_INTERVAL] == DEFAULT_TRIM_INTERVAL_SECONDS);
+    CHECK(settings.values[SETTING_HIDE_MODE] == HIDE_CLOAK && settings.sources[SETTING_HIDE_MODE] == SOURCE_FILE);
+    CHECK(settings.values[SETTING_EFFICIENCY_MODE] == 1 && SettingLocked(&settings, SETTING_EFFICIENCY_MODE));
+    CHECK(!SettingLocked(&settings, SETTING_HIDE_MODE));
+    CHECK(wcscmp(settings.targetImage, L"Mail.exe") == 0 && settings.targetSource == SOURCE_FILE);
+    CHECK(settings.autoStart);
+
+    wchar_t text[512];
+    FormatSettings(&settings, text, 512);
+    CHECK(wcsstr(text, L"TrimDelaySeconds = 300 (user)") != NULL);
+    CHECK(wcsstr(text, L"EfficiencyMode = 1 (policy)") != NULL);
+    CHECK(wcsstr(text, L"TargetProcess = Mail.exe (config file)") != NULL);
+
+    // Published through the mapping: processes started afterwards use the new target
+    HookSettings hookSettings;
+    GetHookSettings(&settings, &hookSettings);
+    PublishHookSettings(FakeSharedData(), &hookSettings);
+    CHECK(FakeSharedData()->settings.hideMode == HIDE_CLOAK);
+    DWORD mail = FakeCreateProcess(L"C:\\Apps\\mail.exe", TRUE);
+    DWORD outlook = FakeCreateProcess(L"C:\\Program Files\\WindowsApps\\olk.exe", TRUE);
+    CHECK(FakeGetProcess(mail)->hookState.isTargetProcess);
+    CHECK(!FakeGetProcess(outlook)->hookState.isTargetProcess);
+    CHECK(IsOutlookPid(mail, settings.targetImage) && !IsOutlookPid(outlook, settings.targetImage));
+    HWND hwnd = FakeCreateWindow(mail, 1, NULL, MAIN_RECT);
+    FakeShowWindow(hwnd, TRUE);
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    CHECK(FakeGetWindow(hwnd)->cloaked);
+}
+
+// Test: the rule table matches each process in one lookup, other apps hide
+// by their own rule and class filter, and the tracker follows their threads
+static void TestTargetRules() {
+    FakeReset();
+    static const wchar_t* const images[MAX_TARGET_RULES] = {
+        L"olk.exe", L"ms-teams.exe", L"a.exe", L"b.exe", L"c.exe", L"d.exe", L"e.exe", L"OLK.exe"
+    };
+    RuleTable table = {};
+    for (int i = 0; i < MAX_TARGET_RULES; i++) {
+        wcscpy(table.rules[table.count++].image, images[i]);
+    }
+    BuildRuleTable(&table);
+    CHECK(table.count == MAX_TARGET_RULES - 1);     // The repeated olk.exe is dropped
+    for (int i = 0; i < table.count; i++) {
+        CHECK(MatchRule(&table, images[i]) == i);
+    }
+    CHECK(MatchRule(&table, L"C:\\Apps\\MS-Teams.exe") == 1);
+    CHECK(MatchRule(&table, L"explorer.exe") == -1 && MatchRule(&table, L"f.exe") == -1);
+
+    FakeSetTextFile(L"C:\\Tools\\OutlookToTray.ini",
+                    L"TeamsToTray=1\r\n"
+                    L"[App: Notes ]\r\nProcess=C:\\Apps\\notes.exe\r\nWindowClass=NotesMain\r\nHideMode=1\r\n"
+                    L"[App:Broken]\r\nWindowClass=NoProcess\r\n"
+                    L"[General]\r\nTrimDelaySeconds=60");
+    TraySettings settings;
+    LoadSettings(&settings, L"C:\\Tools\\OutlookToTray.ini");
+    CHECK(settings.values[SETTING_TRIM_DELAY] == 60 && settings.appCount == 2);
+    HookSettings hookSettings;
+    GetHookSettings(&settings, &hookSettings);
+    CHECK(hookSettings.rules.count == 3);
+    CHECK(wcscmp(hookSettings.rules.rules[2].name, L"Notes") == 0);
+    PublishHookSettings(FakeSharedData(), &hookSettings);
+
+    DWORD outlook;
+    HWND outlookWindow = StartOutlook(&outlook);
+    DWORD teams = FakeCreateProcess(L"C:\\Apps\\ms-teams.exe", TRUE);
+    DWORD notes = FakeCreateProcess(L"C:\\Apps\\notes.exe", TRUE);
+    DWORD explorer = FakeCreateProcess(L"C:\\Windows\\explorer.exe", TRUE);
+    CHECK(FakeGetProcess(teams)->hookState.rule == 1 && FakeGetProcess(notes)->hookState.rule == 2);
+    CHECK(!FakeGetProcess(explorer)->hookState.isTargetProcess);
+
+    HWND teamsWindow = FakeCreateWindow(teams, 20, NULL, MAIN_RECT);
+    HWND notesWindow = FakeCreateWindow(notes, 30, NULL, MAIN_RECT);
+    HWND notesTool = FakeCreateWindow(notes, 30, NULL, MAIN_RECT);
+    wcscpy(FakeGetWindow(notesWindow)->className, L"NotesMain");
+    wcscpy(FakeGetWindow(notesTool)->className, L"NotesPalette");
+    HWND windows[] = { teamsWindow, notesWindow, notesTool, outlookWindow };
+    for (HWND hwnd : windows) {
+        FakeShowWindow(hwnd, TRUE);
+        FakeSendMessage(hwnd, WM_CLOSE, 0);
+    }
+    CHECK(!OsIsWindow(notesTool));                  // Not of the rule's class: closes
+    CHECK(FakeGetWindow(notesWindow)->cloaked);     // The rule's own hide mode
+    CHECK(!FakeGetWindow(teamsWindow)->cloaked && !FakeGetWindow(outlookWindow)->cloaked);
+
+    HiddenWindowInfo hidden[MAX_HIDDEN_WINDOWS];
+    TrayModel model = {};
+    TrayModelUpdate(&model, TRUE, hidden, SnapshotHiddenWindows(FakeSharedData(), hidden, MAX_HIDDEN_WINDOWS));
+    CHECK(model.hiddenCount == 3);
+    CHECK(NewestHiddenWindow(&model, 1)->hwnd == teamsWindow);
+    CHECK(NewestHiddenWindow(&model, RULE_OUTLOOK)->hwnd == outlookWindow);
+    CHECK(NewestHiddenWindow(&model, 3) == NULL);
+
+    // Trimming and throttling only look at Outlook's windows
+    TrimPolicy policy = { 1000, 0 };
+    CHECK(TrimDueTick(&policy, &model, 0) == NewestHiddenWindow(&model, RULE_OUTLOOK)->hiddenTick + 1000);
+    RestoreWindow(NewestHiddenWindow(&model, RULE_OUTLOOK));
+    ReleaseWindow(FakeSharedData(), outlookWindow);
+    TrayModelUpdate(&model, TRUE, hidden, SnapshotHiddenWindows(FakeSharedData(), hidden, MAX_HIDDEN_WINDOWS));
+    CHECK(model.hiddenCount == 2 && TrimDueTick(&policy, &model, 0) == 0);
+
+    // The tracker hooks running apps' threads, then new ones as they appear
+    OutlookTracker tracker = {};
+    CHECK(TrackerSetRules(&tracker, &hookSettings.rules) == TRACKER_THREADS_CHANGED);
+    CHECK(tracker.appThreadCount == 2);             // Teams thread 20, Notes thread 30
+    TrackerStart(&tracker, outlook);
+    HWND teamsChat = FakeCreateWindow(teams, 21, NULL, MAIN_RECT);
+    CHECK(TrackerOnWindowCreated(&tracker, teamsChat, 21) == TRACKER_THREADS_CHANGED);
+    CHECK(TrackerOnWindowCreated(&tracker, FakeCreateWindow(explorer, 40, NULL, MAIN_RECT), 40) == TRACKER_NONE);
+    CHECK(TrackerOnWindowCreated(&tracker, FakeCreateWindow(outlook, 2, NULL, MAIN_RECT), 2) ==
+          TRACKER_THREADS_CHANGED);
+    CHECK(tracker.appThreadCount == 3 && tracker.uiThreadCount == 2);
+}
+
+// Test: log records from the hook and the tray, a reader that falls behind,
+// a writer that died mid-record, the text form and compiled-out levels
+static void TestLog() {
+    FakeReset();
+    LogRing* pRing = &FakeSharedData()->log;
+    LogReader reader;
+    LogReaderStart(pRing, &reader);
+    LogRecord records[LOG_RING_SIZE];
+
+    // The hook logs from inside Outlook; the tray logs from its own process
+    DWORD outlook;
+    HWND hwnd = StartOutlook(&outlook);
+    FakeShowWindow(hwnd, TRUE);
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    LOG_INFO(pRing, LOG_OUTLOOK_TRIMMED, 3, 4096, 1);
+    int count = LogDrain(pRing, &reader, records, LOG_RING_SIZE);
+    CHECK(count == 3);
+    CHECK(records[0].event == LOG_HOOK_ATTACHED && records[0].processId == outlook);
+    CHECK(records[1].event == LOG_WINDOW_HIDDEN && records[1].args[0] == (UINT_PTR)hwnd);
+    CHECK(records[2].processId == 0 && records[2].args[1] == 4096);
+    CHECK(LogDrain(pRing, &reader, records, LOG_RING_SIZE) == 0);
+
+    wchar_t text[256];
+    FormatLogRecord(&records[2], text, 256);
+    CHECK(wcscmp(text, L"2026-01-01 00:00:01.000Z INFO  0/1 OutlookTrimmed processes=3 bytes=4096 skipped=1\r\n") == 0);
+    CHECK(FormatLogRecord(&records[2], text, 16) == 15 && wcslen(text) == 15);
+
+    // Lapped: only the newest LOG_RING_SIZE records are left
+    for (int i = 0; i < LOG_RING_SIZE + 10; i++) {
+        LOG_INFO(pRing, LOG_ICON_ADDED, i);
+    }
+    count = LogDrain(pRing, &reader, records, LOG_RING_SIZE);
+    CHECK(count == LOG_RING_SIZE && reader.lost == 10);
+    CHECK(records[0].args[0] == 10 && records[count - 1].args[0] == LOG_RING_SIZE + 9);
+
+    // A slot still being written holds the reader up until newer records
+    // show its writer is gone
+    LONG ticket = pRing->head;
+    LOG_INFO(pRing, LOG_ICON_ADDED, 1);
+    pRing->records[ticket & (LOG_RING_SIZE - 1)].sequence = 0;
+    LOG_INFO(pRing, LOG_ICON_ADDED, 2);
+    CHECK(LogDrain(pRing, &reader, records, LOG_RING_SIZE) == 0);
+    for (int i = 0; i < LOG_RING_SIZE / 2; i++) {
+        LOG_INFO(pRing, LOG_ICON_ADDED, 3);
+    }
+    count = LogDrain(pRing, &reader, records, LOG_RING_SIZE);
+    CHECK(count == LOG_RING_SIZE / 2 + 1 && records[0].args[0] == 2 && reader.lost == 11);
+
+    // Below the compiled level nothing runs, not even the arguments
+    int evaluated = 0;
+    LOG_DEBUG(pRing, LOG_WINDOW_SUBCLASSED, ++evaluated);
+    CHECK(evaluated == 0 && LogDrain(pRing, &reader, records, LOG_RING_SIZE) == 0);
+    LogWrite(NULL, LOG_LEVEL_ERROR, LOG_TABLE_FULL);
+
+    // Writers on several threads never lose or tear a record the reader keeps up with
+    static LogRing ring;
+    ring = LogRing();
+    LogReaderStart(&ring, &reader);
+    const int writerCount = 4;
+    const int iterations = 100000;
+    std::atomic<int> done(0);
+    std::vector<std::thread> writers;
+    for (int w = 0; w < writerCount; w++) {
+        writers.emplace_back([&, w]() {
+            for (int i = 0; i < iterations; i++) {
+                LogWrite(&ring, LOG_LEVEL_INFO, LOG_ICON_ADDED, w, i, w ^ i);
+            }
+            done++;
+        });
+    }
+    int torn = 0;
+    ULONGLONG seen = 0;
+    int last[writerCount] = { -1, -1, -1, -1 };
+    for (;;) {
+        bool finished = done == writerCount;
+        count = LogDrain(&ring, &reader, records, LOG_RING_SIZE);
+        for (int i = 0; i < count; i++) {
+            int w = (int)records[i].args[0];
+            int n = (int)records[i].args[1];
+            if (w >= writerCount || records[i].args[2] != (ULONGLONG)(w ^ n) || n <= last[w]) {
+                torn++;
+                continue;
+            }
+            last[w] = n;
+        }
+        seen += count;
+        if (finished && count == 0) break;
+    }
+    for (std::thread& writer : writers) {
+        writer.join();
+    }
+    CHECK(torn == 0);
+    CHECK(seen + reader.lost == (ULONGLONG)writerCount * iterations);
+}
+
+// Test: a message capture records every hooked message with the hook's
+// decision, stays within its size, stops, and summarizes by process and message
+static void TestMessageTrace() {
+    FakeReset();
+    const UINT WM_TIMER_TEST = 0x0113;
+    DWORD outlook;
+    HWND outlookWindow = StartOutlook(&outlook);
+    DWORD explorer = FakeCreateProcess(L"C:\\Windows\\explorer.exe", TRUE);
+    HWND explorerWindow = FakeCreateWindow(explorer, 10, NULL, MAIN_RECT);
+    FakeSetCounterStep(3);
+
+    const DWORD capacity = 64;
+    HANDLE hMapping;
+    TraceHeader* pTrace = StartTrace(FakeSharedData(), L"C:\\Temp\\trace.ott", capacity, &hMapping);
+    CHECK(pTrace && IsTraceHeader(pTrace, TraceFileSize(capacity)));
+    FakeSendMessage(outlookWindow, WM_TIMER_TEST, 0);
+    FakeSendMessage(outlookWindow, WM_CLOSE, 0);
+    FakeSendMessage(outlookWindow, WM_CLOSE, 0);
+    FakeSendMessage(explorerWindow, WM_TIMER_TEST, 0);
+    const TraceRecord* pRecords = TraceRecords(pTrace);
+    CHECK(pTrace->next == 4 && pTrace->processCount == 2);
+    CHECK(TraceRecordDecision(&pRecords[0]) == HOOK_IGNORED && TraceRecordProcess(&pRecords[0]) == 0);
+    CHECK(pTrace->processes[0].processId == outlook);
+    CHECK(TraceRecordDecision(&pRecords[1]) == HOOK_SUBCLASSED && pRecords[1].message == WM_CLOSE);
+    CHECK(pRecords[1].hwnd == (DWORD)(UINT_PTR)outlookWindow && pRecords[1].cost == 3);
+    CHECK(TraceRecordTime(&pRecords[1]) > TraceRecordTime(&pRecords[0]));
+    CHECK(TraceRecordDecision(&pRecords[2]) == HOOK_CHECKED);
+    CHECK(TraceRecordDecision(&pRecords[3]) == HOOK_OTHER_PROCESS && pRecords[3].cost == 0);
+    CHECK(TraceRecordProcess(&pRecords[3]) == 1 && wcscmp(pTrace->processes[1].image, L"explorer.exe") == 0);
+
+    // Calls with nCode < 0 go straight on: not counted, not captured
+    ULONGLONG seen = FakeGetProcess(explorer)->hookState.stats->messagesSeen;
+    HookDispatch(&FakeGetProcess(explorer)->hookState, -1, explorerWindow, WM_TIMER_TEST, 0);
+    CHECK(pTrace->next == 4 && FakeGetProcess(explorer)->hookState.stats->messagesSeen == seen);
+
+    // Bounded: a full capture records nothing more
+    for (int i = 0; i < 100; i++) {
+        FakeSendMessage(explorerWindow, WM_TIMER_TEST, 0);
+    }
+    CHECK(pTrace->next == (LONG)capacity);
+
+    static TraceSummary summary;
+    CHECK(SummarizeTrace(pTrace, TraceFileSize(capacity), &summary));
+    CHECK(summary.records == capacity && summary.full && summary.incomplete == 0);
+    CHECK(summary.processCount == 2 && summary.messages[WM_TIMER_TEST].messages == capacity - 2);
+    CHECK(summary.decisions[HOOK_OTHER_PROCESS].messages == capacity - 3);
+    CHECK(summary.decisions[HOOK_SUBCLASSED].cost == 3);
+    static wchar_t text[16384];
+    FormatTraceSummary(&summary, text, 16384);
+    CHECK(wcsstr(text, L"explorer.exe") && wcsstr(text, L"olk.exe") && wcsstr(text, L"WM_CLOSE"));
+
+    // A record left unfinished is counted apart; other files are refused
+    TraceRecords(pTrace)[5].stamp = 0;
+    SummarizeTrace(pTrace, TraceFileSize(capacity), &summary);
+    CHECK(summary.records == capacity - 1 && summary.incomplete == 1);
+    CHECK(!SummarizeTrace(FakeSharedData(), sizeof(SharedData), &summary));
+
+    // Stopped: the hook stops writing, then joins the next capture
+    StopTrace(FakeSharedData(), pTrace, hMapping);
+    FakeSendMessage(explorerWindow, WM_TIMER_TEST, 0);
+    CHECK(FakeGetProcess(explorer)->hookState.trace == NULL);
+    TraceHeader* pNext = StartTrace(FakeSharedData(), L"C:\\Temp\\trace2.ott", capacity, &hMapping);
+    FakeSendMessage(explorerWindow, WM_TIMER_TEST, 0);
+    CHECK(pNext && pNext != pTrace && pNext->next == 1 && pNext->processCount == 1);
+    StopTrace(FakeSharedData(), pNext, hMapping);
+
+    // Switched without seeing the stop: other threads may still write to the old
+    // view, so it is retired and unmapped at the next switch, or at unload
+    HookState* pHook = &FakeGetProcess(explorer)->hookState;
+    int unmapped = FakeUnmappedViewCount();
+    TraceHeader* pThird = StartTrace(FakeSharedData(), L"C:\\Temp\\trace3.ott", capacity, &hMapping);
+    FakeSendMessage(explorerWindow, WM_TIMER_TEST, 0);
+    CHECK(pHook->trace == pThird && pHook->retiredView == pNext);
+    CHECK(FakeUnmappedViewCount() == unmapped);
+    StopTrace(FakeSharedData(), pThird, hMapping);
+    TraceHeader* pFourth = StartTrace(FakeSharedData(), L"C:\\Temp\\trace4.ott", capacity, &hMapping);
+    FakeSendMessage(explorerWindow, WM_TIMER_TEST, 0);
+    CHECK(pHook->trace == pFourth && pHook->retiredView == pThird);
+    CHECK(FakeUnmappedViewCount() == unmapped + 2);     // The tray's view of the third, the second
+    StopTrace(FakeSharedData(), pFourth, hMapping);
+    FakeReloadHook(explorer);
+    CHECK(FakeUnmappedViewCount() == unmapped + 5);     // The tray's, then the hook's two
+    CHECK(pHook->traceView == NULL && pHook->retiredView == NULL);
+}
+
+// Test: the work queue hands items over in order, refuses them when full and
+// survives a producer and a consumer racing; messages over a frame count as stalls
+static void TestUiThreadWork() {
+    static WorkQueue queue;
+    queue = WorkQueue();
+    WorkItem item = {};
+    for (int i = 0; i < WORK_QUEUE_SIZE; i++) {
+        item.value = i;
+        CHECK(WorkQueuePush(&queue, &item));
+    }
+    CHECK(!WorkQueuePush(&queue, &item));
+    WorkItem popped;
+    CHECK(WorkQueuePop(&queue, &popped) && popped.value == 0);
+    item.value = WORK_QUEUE_SIZE;
+    CHECK(WorkQueuePush(&queue, &item));           // Wraps around
+    for (int i = 1; i <= WORK_QUEUE_SIZE; i++) {
+        CHECK(WorkQueuePop(&queue, &popped) && popped.value == (DWORD)i);
+    }
+    CHECK(!WorkQueuePop(&queue, &popped));
+
+    // One thread pushes 100000 numbered items, another takes them in order
+    const DWORD ITEMS = 100000;
+    std::atomic<bool> inOrder(true);
+    std::thread worker([&]() {
+        WorkItem next;
+        for (DWORD expected = 0; expected < ITEMS; ) {
+            if (WorkQueuePop(&queue, &next)) {
+                if (next.value != expected || next.id != ~expected) inOrder = false;
+                expected++;
+            }
+        }
+    });
+    for (DWORD i = 0; i < ITEMS; ) {
+        item.value = i;
+        item.id = ~i;
+        if (WorkQueuePush(&queue, &item)) i++;
+    }
+    worker.join();
+    CHECK(inOrder);
+    CHECK(!WorkQueuePop(&queue, &popped));
+
+    // 10 MHz counter: 16 ms is 160000 ticks, and only longer counts
+    StallStats stalls = {};
+    LONGLONG frequency = 10000000;
+    CHECK(!RecordDispatch(&stalls, 0x0113, 1000, frequency));
+    CHECK(!RecordDispatch(&stalls, 0x0111, 160000, frequency));
+    CHECK(RecordDispatch(&stalls, 0x0401, 250000, frequency));
+    CHECK(!RecordDispatch(&stalls, 0x0113, 2000, frequency));
+    CHECK(stalls.dispatched == 4 && stalls.stalls == 1 && stalls.maxMessage == 0x0401);
+    wchar_t text[256];
+    FormatStallStats(&stalls, frequency, text, 256);
+    CHECK(wcscmp(text, L"UI thread: 4 message(s), 1 over 16 ms, longest 25.00 ms (message 0x0401)\n") == 0);
+}
+
+// Test: named objects are session-local, and the hook only opens the table
+// the tray created, never one of another build
+static void TestSessionObjects() {
+    FakeReset();
+    CHECK(wcsncmp(SHARED_DATA_NAME, L"Local\\", 6) == 0);
+    wchar_t name[64];
+    TraceMappingName(1, name, 64);
+    CHECK(wcscmp(name, L"Local\\OutlookToTrayTrace.1") == 0);
+
+    // No tray in the session: nothing to open, and nothing is created
+    HANDLE hMapping;
+    CHECK(OpenSharedData(L"Local\\OutlookToTrayOther", &hMapping) == NULL && hMapping == NULL);
+    CHECK(OsOpenSharedMemory(L"Local\\OutlookToTrayOther", &hMapping) == NULL);
+    CHECK(OpenSharedData(SHARED_DATA_NAME, &hMapping) == FakeSharedData());
+
+    // A table left by another build is refused on both sides
+    FakeSharedData()->version = SHARED_DATA_VERSION + 1;
+    CHECK(OpenSharedData(SHARED_DATA_NAME, &hMapping) == NULL && hMapping == NULL);
+    CHECK(MapSharedData(SHARED_DATA_NAME, &hMapping) == NULL);
+    FakeSharedData()->version = SHARED_DATA_VERSION;
+
+    // Lean mode only when asked for
+    TraySettings settings;
+    LoadSettings(&settings, L"C:\\Tools\\OutlookToTray.ini");
+    CHECK(settings.values[SETTING_LEAN_MODE] == 0);
+    FakeSetRegistryDword(HIVE_LOCAL_MACHINE, SETTINGS_POLICY_KEY, L"LeanMode", 1);
+    LoadSettings(&settings, L"C:\\Tools\\OutlookToTray.ini");
+    CHECK(settings.values[SETTING_LEAN_MODE] == 1 && SettingLocked(&settings, SETTING_LEAN_MODE));
+}
+
+// Test: the footprint adds each process to its session's row, in session order,
+// and sizes per session over the sessions running a tray
+static void TestFootprint() {
+    static FootprintReport report;
+    report = FootprintReport();
+    report.interval = 10 * 10000000ULL;         // 10 s
+    FootprintSample tray = {};
+    tray.tray = TRUE;
+    tray.sessionId = 3;
+    tray.threads = 5;
+    tray.privateBytes = 2048 * 1024;
+    tray.cpuTime = 100000;                      // 10 ms
+    AddFootprintSample(&report, &tray);
+    tray.sessionId = 1;
+    tray.threads = 1;
+    tray.privateBytes = 1024 * 1024;
+    tray.cpuTime = 0;
+    AddFootprintSample(&report, &tray);
+    FootprintSample hooked = {};
+    hooked.sessionId = 3;
+    AddFootprintSample(&report, &hooked);
+    AddFootprintSample(&report, &hooked);
+    hooked.sessionId = 1;
+    AddFootprintSample(&report, &hooked);
+    CHECK(report.sessionCount == 2 && report.sessions[0].sessionId == 1 && report.sessions[1].sessionId == 3);
+    CHECK(report.sessions[1].trays == 1 && report.sessions[1].hooked == 2);
+    CHECK(report.sessions[1].threads == 5 && report.sessions[1].privateBytes == 2048 * 1024);
+
+    static wchar_t text[4096];
+    FormatFootprint(&report, text, 4096);
+    CHECK(wcsstr(text, L"Host: 2 tray(s) in 2 session(s), 3 hooked process(es), 3072 KB private, "
+                       L"0.100% of one core over 10.0 s\n") != NULL);
+    CHECK(wcsstr(text, L"Per session: 1536 KB private, 3.0 thread(s), 1.5 hooked process(es), "
+                       L"0.050% of one core\n") != NULL);
+
+    // Sessions beyond the table are only counted
+    for (DWORD id = 100; report.sessionCount < MAX_FOOTPRINT_SESSIONS; id++) {
+        hooked.sessionId = id;
+        AddFootprintSample(&report, &hooked);
+    }
+    hooked.sessionId = 2;
+    AddFootprintSample(&report, &hooked);
+    CHECK(report.droppedSessions == 1 && report.sessions[1].sessionId == 3);
+}
+
+// Test: control commands are parsed against the rules, hide only asks the app's
+// shown windows to close (the hook hides them), and the replies' text
+static void TestControlCommands() {
+    FakeReset();
+    wchar_t name[64];
+    ControlPipeName(3, name, 64);
+    CHECK(wcscmp(name, L"\\\\.\\pipe\\OutlookToTray.Control.3") == 0);
+
+    RuleTable rules;
+    DefaultRuleTable(&rules);
+    ControlCommand command;
+    wchar_t error[CONTROL_MAX_REPLY] = L"";
+    CHECK(ParseControlCommand(L"status", &rules, &command, error, CONTROL_MAX_REPLY));
+    CHECK(command.verb == CONTROL_STATUS && command.rule == -1);
+    CHECK(ParseControlCommand(L" Hide  outlook \r\n", &rules, &command, error, CONTROL_MAX_REPLY));
+    CHECK(command.verb == CONTROL_HIDE && command.rule == RULE_OUTLOOK);
+    CHECK(ParseControlCommand(L"restore OLK.exe", &rules, &command, error, CONTROL_MAX_REPLY));
+    CHECK(command.verb == CONTROL_RESTORE && command.rule == RULE_OUTLOOK);
+    CHECK(!ParseControlCommand(L"status x", &rules, &command, error, CONTROL_MAX_REPLY));
+    CHECK(wcscmp(error, L"error status takes no app") == 0);
+    CHECK(!ParseControlCommand(L"bogus", &rules, &command, error, CONTROL_MAX_REPLY));
+    CHECK(wcsncmp(error, L"error unknown command 'bogus'", 29) == 0);
+    CHECK(!ParseControlCommand(L"hide notes", &rules, &command, error, CONTROL_MAX_REPLY));
+    CHECK(wcscmp(error, L"error unknown app 'notes'") == 0);
+    RuleTable empty = {};
+    CHECK(ParseControlCommand(L"hide olk.exe", &empty, &command, error, CONTROL_MAX_REPLY));
+    CHECK(command.rule == RULE_OUTLOOK);
+
+    DWORD pid;
+    HWND main = StartOutlook(&pid);
+    HWND dialog = FakeCreateWindow(pid, 1, main, MAIN_RECT);
+    FakeShowWindow(dialog, TRUE);
+    HWND second = FakeCreateWindow(pid, 1, NULL, MAIN_RECT);
+    FakeShowWindow(second, TRUE);
+    FakeSendMessage(second, WM_CLOSE, 0);       // Already hidden
+    DWORD threads[] = { 1 };
+    CHECK(RequestHideWindows(&rules, 1, threads, 1) == 0);         // Another app's rule
+    CHECK(RequestHideWindows(&rules, -1, threads, 1) == 1);
+    HiddenWindowInfo hidden[MAX_HIDDEN_WINDOWS];
+    CHECK(SnapshotHiddenWindows(FakeSharedData(), hidden, MAX_HIDDEN_WINDOWS) == 2);
+    CHECK(OsIsWindow(main) && OsIsWindow(dialog));
+    CHECK(RequestHideWindows(&rules, RULE_OUTLOOK, threads, 1) == 0);
+
+    // The request is no close: without the hook, or with no entry left, the window stays
+    DWORD unhooked = FakeCreateProcess(L"C:\\Program Files\\WindowsApps\\olk.exe", FALSE);
+    HWND plain = FakeCreateWindow(unhooked, 2, NULL, MAIN_RECT);
+    FakeShowWindow(plain, TRUE);
+    DWORD plainThreads[] = { 2 };
+    CHECK(RequestHideWindows(&rules, RULE_OUTLOOK, plainThreads, 1) == 1);
+    CHECK(OsIsWindow(plain) && FakeGetWindow(plain)->rect.left == MAIN_RECT.left);
+    HWND third = FakeCreateWindow(pid, 1, NULL, MAIN_RECT);
+    FakeShowWindow(third, TRUE);
+    for (int i = 0; i < MAX_HIDDEN_WINDOWS - 2; i++) {
+        EndEntryWrite(FakeSharedData(), LockWindowEntry(FakeSharedData(), (HWND)(UINT_PTR)(0x7000 + i), TRUE));
+    }
+    CHECK(RequestHideWindows(&rules, RULE_OUTLOOK, threads, 1) == 1);
+    CHECK(OsIsWindow(third) && FakeGetWindow(third)->rect.left == MAIN_RECT.left);
+    CHECK(!(FakeGetWindow(third)->exStyle & WS_EX_TOOLWINDOW));
+
+    ControlStatus status = {};
+    status.outlookRunning = TRUE;
+    status.outlookPid = pid;
+    status.unreadCount = 4;
+    status.hiddenCount = 2;
+    status.hiddenByRule[RULE_OUTLOOK] = 2;
+    status.targetedHook = TRUE;
+    wchar_t reply[CONTROL_MAX_REPLY];
+    wchar_t expected[CONTROL_MAX_REPLY];
+    swprintf(expected, CONTROL_MAX_REPLY, L"ok outlook=running pid=%lu unread=4 hidden=2 hidden.Outlook=2 "
+             L"hook=targeted lean=0", (unsigned long)pid);
+    CHECK(FormatControlStatus(&status, &rules, reply, CONTROL_MAX_REPLY) == (int)wcslen(expected));
+    CHECK(wcscmp(reply, expected) == 0);
+
+    ControlStats stats = {};
+    stats.processes = 2;
+    stats.hooks.hides = 5;
+    stats.stalls = 1;
+    stats.maxStallUs = 250000;
+    stats.monitorWakeups = 7;
+    stats.logWakeups = 3;
+    FormatControlStats(&stats, reply, CONTROL_MAX_REPLY);
+    CHECK(wcscmp(reply, L"ok processes=2 messages=0 handled=0 subclassed=0 hides=5 restores=0 stalls=1 "
+                        L"maxstallus=250000 logwritten=0 loglost=0 wakeups=7 logwakeups=3") == 0);
+
+    // A reply that does not fit keeps its start, terminated
+    CHECK(FormatControlStats(&stats, reply, 16) == 15);
+    CHECK(wcscmp(reply, L"ok processes=2 ") == 0);
+}
+
+// Test: the hotkey setting as text, what a press does, and key-press-to-done timing
+static void TestHotkeyToggle() {
+    FakeReset();
+    DWORD hotkey = 0;
+    CHECK(ParseHotkey(L"Ctrl+Alt+O", &hotkey) && hotkey == ((HOTKEY_CONTROL | HOTKEY_ALT) << 8 | 'O'));
+    CHECK(ParseHotkey(L" win + shift + f12 ", &hotkey) && hotkey == ((HOTKEY_WIN | HOTKEY_SHIFT) << 8 | 0x7B));
+    CHECK(!ParseHotkey(L"O", &hotkey));                 // No modifier
+    CHECK(!ParseHotkey(L"Ctrl+Alt", &hotkey) && !ParseHotkey(L"Ctrl+O+P", &hotkey));
+    CHECK(!ParseHotkey(L"Ctrl+F25", &hotkey) && !ParseHotkey(L"Hyper+O", &hotkey));
+    wchar_t text[MAX_HOTKEY_TEXT];
+    FormatHotkey((HOTKEY_ALT | HOTKEY_CONTROL) << 8 | '7', text, MAX_HOTKEY_TEXT);
+    CHECK(wcscmp(text, L"Ctrl+Alt+7") == 0);
+    FormatHotkey(HOTKEY_WIN << 8 | 0x70, text, MAX_HOTKEY_TEXT);
+    CHECK(wcscmp(text, L"Win+F1") == 0);
+
+    FakeSetTextFile(L"C:\\Tools\\OutlookToTray.ini", L"Hotkey = Ctrl+Shift+O\r\n");
+    TraySettings settings;
+    LoadSettings(&settings, L"C:\\Tools\\OutlookToTray.ini");
+    CHECK(settings.values[SETTING_HOTKEY] == ((HOTKEY_CONTROL | HOTKEY_SHIFT) << 8 | 'O'));
+    CHECK(settings.sources[SETTING_HOTKEY] == SOURCE_FILE);
+
+    // As a number it still needs a modifier and a key
+    FakeSetRegistryDword(HIVE_CURRENT_USER, SETTINGS_KEY, L"Hotkey", 79);
+    LoadSettings(&settings, L"C:\\Tools\\OutlookToTray.ini");
+    CHECK(settings.sources[SETTING_HOTKEY] == SOURCE_FILE);
+    FakeSetRegistryDword(HIVE_CURRENT_USER, SETTINGS_KEY, L"Hotkey", HOTKEY_CONTROL << 8);
+    LoadSettings(&settings, L"C:\\Tools\\OutlookToTray.ini");
+    CHECK(settings.sources[SETTING_HOTKEY] == SOURCE_FILE);
+    FakeSetRegistryDword(HIVE_CURRENT_USER, SETTINGS_KEY, L"Hotkey", HOTKEY_WIN << 8 | 'O');
+    LoadSettings(&settings, L"C:\\Tools\\OutlookToTray.ini");
+    CHECK(settings.values[SETTING_HOTKEY] == (HOTKEY_WIN << 8 | 'O') && settings.sources[SETTING_HOTKEY] == SOURCE_USER);
+
+    DWORD pid;
+    HWND hwnd = StartOutlook(&pid);
+    TrayModel model = {};
+    CHECK(ChooseHotkeyAction(&model, 0, 0) == HOTKEY_OPEN);
+    CHECK(ChooseHotkeyAction(&model, pid, pid) == HOTKEY_HIDE);
+    CHECK(ChooseHotkeyAction(&model, pid, pid + 1) == HOTKEY_OPEN);     // Behind another app
+    FakeSendMessage(hwnd, WM_CLOSE, 0);
+    HiddenWindowInfo hidden[MAX_HIDDEN_WINDOWS];
+    TrayModelUpdate(&model, TRUE, hidden, SnapshotHiddenWindows(FakeSharedData(), hidden, MAX_HIDDEN_WINDOWS));
+    CHECK(ChooseHotkeyAction(&model, pid, pid + 1) == HOTKEY_RESTORE);
+
+    // Done at the last notification; within the budget or not
+    const LONGLONG frequency = 1000000;
+    HotkeyToggle toggle = {};
+    HotkeyStart(&toggle, HOTKEY_HIDE, 2, 1000);
+    CHECK(HotkeyOnNotify(&toggle, TRAY_NOTIFY_WINDOW_RESTORED, 2000, frequency) == -1);
+    CHECK(HotkeyOnNotify(&toggle, TRAY_NOTIFY_WINDOW_HIDDEN, 3000, frequency) == -1);
+    CHECK(HotkeyOnNotify(&toggle, TRAY_NOTIFY_WINDOW_HIDDEN, 21000, frequency) == 20000);
+    CHECK(toggle.action == HOTKEY_NONE && toggle.timing[0].count == 1 && toggle.overBudget == 0);
+    CHECK(HotkeyOnNotify(&toggle, TRAY_NOTIFY_WINDOW_HIDDEN, 22000, frequency) == -1);
+
+    HotkeyStart(&toggle, HOTKEY_RESTORE, 1, 100000);
+    HotkeyStart(&toggle, HOTKEY_RESTORE, 1, 200000);     // Gives up the first
+    CHECK(HotkeyOnNotify(&toggle, TRAY_NOTIFY_WINDOW_RESTORED, 290000, frequency) == 90000);
+    CHECK(toggle.presses == 3 && toggle.unfinished == 1 && toggle.overBudget == 1);
+    CHECK(toggle.timing[1].count == 1 && toggle.timing[1].maxTicks == 90000);
+    HotkeyStart(&toggle, HOTKEY_OPEN, 0, 300000);
+    CHECK(toggle.action == HOTKEY_NONE && toggle.presses == 4 && toggle.unfinished == 1);
+
+    static wchar_t report[1024];
+    FormatHotkeyStats(&toggle, frequency, report, 1024);
+    CHECK(wcsstr(report, L"Hotkey presses: 4, 1 over 50 ms, 1 unfinished\n") != NULL);
+    CHECK(wcsstr(report, L"Hotkey restores (key to visible): 1, mean 90.00 ms, max 90.00 ms\n") != NULL);
+}
+
+// Test: the automatic hide's settings, idle check timing, and how long each hide lasted
+static void TestAutoHide() {
+    FakeReset();
+    FakeSetTextFile(L"C:\\Tools\\OutlookToTray.ini", L"AutoHideIdleMinutes=15\r\nAutoHideOnLock=1\r\n");
+    TraySettings settings;
+    LoadSettings(&settings, L"C:\\Tools\\OutlookToTray.ini");
+    CHECK(settings.values[SETTING_AUTOHIDE_IDLE] == 15 && settings.values[SETTING_AUTOHIDE_LOCK] == 1);
+    FakeSetTextFile(L"C:\\Tools\\OutlookToTray.ini", L"AutoHideIdleMinutes=2000\r\n");    // Over a day
+    LoadSettings(&settings, L"C:\\Tools\\OutlookToTray.ini");
+    CHECK(settings.values[SETTING_AUTOHIDE_IDLE] == 0 && settings.values[SETTING_AUTOHIDE_LOCK] == 0);
+
+    // The rest of the threshold, then a whole one once it has passed
+    CHECK(AutoHideIdleDue(0, 5000) == 0);
+    CHECK(AutoHideIdleDue(60000, 15000) == 45000);
+    CHECK(AutoHideIdleDue(60000, 59900) == AUTOHIDE_MIN_CHECK_MS);
+    CHECK(AutoHideIdleDue(60000, 600000) == 60000);
+
+    AutoHideState state = {};
+    CHECK(AutoHideOnNotify(&state, TRAY_NOTIFY_WINDOW_RESTORED, 1000) == -1);     // None in effect
+    AutoHideStart(&state, AUTOHIDE_IDLE);
+    CHECK(state.reason == AUTOHIDE_NONE);       // Nothing hidden yet: a new request is not blocked
+    CHECK(AutoHideOnNotify(&state, TRAY_NOTIFY_WINDOW_HIDDEN, 1000) == -1);
+    CHECK(AutoHideOnNotify(&state, TRAY_NOTIFY_WINDOW_HIDDEN, 2000) == -1);
+    CHECK(AutoHideOnNotify(&state, TRAY_NOTIFY_WINDOW_RESTORED, 1801000) == 1800000);
+    CHECK(state.reason == AUTOHIDE_NONE && state.ended == 1);
+    AutoHideStart(&state, AUTOHIDE_LOCKED);
+    CHECK(AutoHideOnNotify(&state, TRAY_NOTIFY_WINDOW_RESTORED, 1900000) == -1);  // Back before any hide
+    CHECK(state.requested == AUTOHIDE_NONE && state.hides[AUTOHIDE_LOCKED] == 0);
+    AutoHideStart(&state, AUTOHIDE_LOCKED);
+    AutoHideOnNotify(&state, TRAY_NOTIFY_WINDOW_HIDDEN, 2000000);
+    CHECK(AutoHideOnNotify(&state, TRAY_NOTIFY_OUTLOOK_EXITED, 2600000) == 600000);
+    AutoHideStart(&state, AUTOHIDE_DISPLAY_OFF);
+    AutoHideOnNotify(&state, TRAY_NOTIFY_WINDOW_HIDDEN, 3000000);
+
+    // The hide goes out as a request only the hook acts on: an Outlook without it stays open
+    DWORD unhooked = FakeCreateProcess(L"C:\\Program Files\\WindowsApps\\olk.exe", FALSE);
+    HWND plain = FakeCreateWindow(unhooked, 2, NULL, MAIN_RECT);
+    FakeShowWindow(plain, TRUE);
+    RuleTable rules;
+    DefaultRuleTable(&rules);
+    DWORD threads[] = { 2 };
+    CHECK(RequestHideWindows(&rules, RULE_OUTLOOK, threads, 1) == 1);
+    CHECK(OsIsWindow(plain) && OsIsWindowVisible(plain) && FakeNotificationCount(TRAY_NOTIFY_WINDOW_HIDDEN) == 0);
+    CHECK(state.hides[AUTOHIDE_IDLE] == 1 && state.hides[AUTOHIDE_LOCKED] == 1 && state.longestMs == 1800000);
+
+    static wchar_t report[512];
+    FormatAutoHideStats(&state, 3120000, report, 512);
+    CHECK(wcscmp(report, L"Automatic hides: 1 idle, 1 locked, 1 display off; 2 over, 40.0 min hidden in total, "
+                         L"longest 30.0 min\n  Hidden automatically for 2.0 min now\n") == 0);
+}
+
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+static const TestCase TESTS[] = {
+    { "ProcessVerdict", TestProcessVerdict },
+    { "CloseOtherProcess", TestCloseOtherProcess },
+    { "ShowCloseRestore", TestShowCloseRestore },
+    { "OwnedAndInvisibleWindows", TestOwnedAndInvisibleWindows },
+    { "DestroyWhileHidden", TestDestroyWhileHidden },
+    { "HandleReuse", TestHandleReuse },
+    { "MultipleWindows", TestMultipleWindows },
+    { "TableFull", TestTableFull },
+    { "Tracker", TestTracker },
+    { "TrackerPrunesDeadThreads", TestTrackerPrunesDeadThreads },
+    { "TrackerSkipsOtherBitness", TestTrackerSkipsOtherBitness },
+    { "SeqlockStress", TestSeqlockStress },
+    { "SeqlockDeadWriter", TestSeqlockDeadWriter },
+    { "KilledWhileHiding", TestKilledWhileHiding },
+    { "HookStats", TestHookStats },
+    { "TrayNotifications", TestTrayNotifications },
+    { "InProcessRestore", TestInProcessRestore },
+    { "RecoverHiddenWindows", TestRecoverHiddenWindows },
+    { "HoverPrewarm", TestHoverPrewarm },
+    { "UnreadBadge", TestUnreadBadge },
+    { "TrayIconStartup", TestTrayIconStartup },
+    { "WorkingSetTrim", TestWorkingSetTrim },
+    { "HiddenEfficiencyMode", TestHiddenEfficiencyMode },
+    { "CloakedHide", TestCloakedHide },
+    { "Settings", TestSettings },
+    { "TargetRules", TestTargetRules },
+    { "Log", TestLog },
+    { "MessageTrace", TestMessageTrace },
+    { "UiThreadWork", TestUiThreadWork },
+    { "SessionObjects", TestSessionObjects },
+    { "Footprint", TestFootprint },
+    { "ControlCommands", TestControlCommands },
+    { "HotkeyToggle", TestHotkeyToggle },
+    { "AutoHide", TestAutoHide },
+};
+
+int main() {
+    for (const TestCase& test : TESTS) {
+        int before = g_failures;
+        test.run();
+        printf("%s %s\n", g_failures == before ? "PASS" : "FAIL", test.name);
+    }
+    printf("%d failure(s)\n", g_failures);
+    return g_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,42 @@
+/*
+ * Outlook to Tray - Trace Tool
+ * Summarizes a message capture made with "Capture Message Trace":
+ *   OutlookToTray.TraceTool <file.ott>
+ * Builds on Windows and on the test host alike
+ */
+
+#include "../OutlookToTray.Core/TraceSummary.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static TraceSummary g_summary;
+static wchar_t g_text[64 * 1024];
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <trace file>\n", argv[0]);
+        return 2;
+    }
+
+    FILE* file = fopen(argv[1], "rb");
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", argv[1]);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    void* pFile = size > 0 ? malloc((size_t)size) : NULL;
+    bool read = pFile && fread(pFile, 1, (size_t)size, file) == (size_t)size;
+    fclose(file);
+
+    if (!read || !SummarizeTrace(pFile, (size_t)size, &g_summary)) {
+        fprintf(stderr, "%s is not an Outlook to Tray trace\n", argv[1]);
+        free(pFile);
+        return 1;
+    }
+    FormatTraceSummary(&g_summary, g_text, sizeof(g_text) / sizeof(g_text[0]));
+    printf("%ls", g_text);
+    free(pFile);
+    return 0;
+}
@@ -8,7 +8,7 @@ set OUTDIR=bin
 if not exist %OUTDIR% mkdir %OUTDIR%
 
 echo Building DLL...
-g++ -std=c++17 -Wall -O2 -DUNICODE -D_UNICODE -shared -static-libgcc -static-libstdc++ -o %OUTDIR%\OutlookToTray.dll OutlookToTray.Dll\OutlookToTray.Dll.cpp -lpsapi -lcomctl32
+g++ -std=c++17 -Wall -O2 -DUNICODE -D_UNICODE -fno-exceptions -fno-rtti -shared -static-libgcc -nostdlib++ -o %OUTDIR%\OutlookToTray.dll OutlookToTray.Dll\OutlookToTray.Dll.cpp OutlookToTray.Core\HookCore.cpp OutlookToTray.Core\HookStats.cpp OutlookToTray.Core\Log.cpp OutlookToTray.Core\SharedState.cpp OutlookToTray.Core\Targets.cpp OutlookToTray.Core\Trace.cpp OutlookToTray.Core\OsWin32.cpp -lcomctl32 -ldwmapi
 if errorlevel 1 (
     echo DLL build failed!
     pause
@@ -16,7 +16,7 @@ if errorlevel 1 (
 )
 
 echo Building EXE resources...
-windres OutlookToTray.Exe\OutlookToTray.rc -o %OUTDIR%\resources.o
+windres --include-dir=OutlookToTray.Exe OutlookToTray.Exe\OutlookToTray.rc -o %OUTDIR%\resources.o
 if errorlevel 1 (
     echo Resource compile failed!
     pause
@@ -24,7 +24,7 @@ if errorlevel 1 (
 )
 
 echo Building EXE...
-g++ -std=c++17 -Wall -O2 -DUNICODE -D_UNICODE -mwindows -static-libgcc -static-libstdc++ -o %OUTDIR%\OutlookToTray.exe OutlookToTray.Exe\OutlookToTray.Exe.cpp %OUTDIR%\resources.o -lshell32 -lpsapi
+g++ -std=c++17 -Wall -O2 -DUNICODE -D_UNICODE -mwindows -static-libgcc -static-libstdc++ -o %OUTDIR%\OutlookToTray.exe OutlookToTray.Exe\OutlookToTray.Exe.cpp OutlookToTray.Core\TrayCore.cpp OutlookToTray.Core\Control.cpp OutlookToTray.Core\Log.cpp OutlookToTray.Core\Settings.cpp OutlookToTray.Core\SharedState.cpp OutlookToTray.Core\Targets.cpp OutlookToTray.Core\OsWin32.cpp %OUTDIR%\resources.o -lshell32 -lgdi32 -lole32 -ldwmapi -lwtsapi32
 if errorlevel 1 (
     echo EXE build failed!
     pause
@@ -33,6 +33,41 @@ if errorlevel 1 (
 
 del %OUTDIR%\resources.o 2>nul
 
+echo Building trace tool...
+g++ -std=c++17 -Wall -O2 -DUNICODE -D_UNICODE -static-libgcc -static-libstdc++ -o %OUTDIR%\OutlookToTray.TraceTool.exe OutlookToTray.TraceTool\TraceTool.cpp OutlookToTray.Core\TraceSummary.cpp
+if errorlevel 1 (
+    echo Trace tool build failed!
+    pause
+    exit /b 1
+)
+
+echo Building footprint tool...
+g++ -std=c++17 -Wall -O2 -DUNICODE -D_UNICODE -static-libgcc -static-libstdc++ -o %OUTDIR%\OutlookToTray.Footprint.exe OutlookToTray.Footprint\Footprint.cpp OutlookToTray.Core\Footprint.cpp
+if errorlevel 1 (
+    echo Footprint tool build failed!
+    pause
+    exit /b 1
+)
+
+echo Building control client...
+g++ -std=c++17 -Wall -O2 -DUNICODE -D_UNICODE -static-libgcc -static-libstdc++ -o %OUTDIR%\OutlookToTray.Ctl.exe OutlookToTray.Ctl\Ctl.cpp
+if errorlevel 1 (
+    echo Control client build failed!
+    pause
+    exit /b 1
+)
+
+echo Building latency probe...
+g++ -std=c++17 -Wall -O2 -DUNICODE -D_UNICODE -static-libgcc -static-libstdc++ -o %OUTDIR%\OutlookToTray.LatencyProbe.exe OutlookToTray.LatencyProbe\LatencyProbe.cpp
+if errorlevel 1 (
+    echo Latency probe build failed!
+    pause
+    exit /b 1
+)
+if exist C:\msys64\mingw32\bin\g++.exe (
+    C:\msys64\mingw32\bin\g++.exe -std=c++17 -Wall -O2 -DUNICODE -D_UNICODE -static-libgcc -static-libstdc++ -o %OUTDIR%\OutlookToTray.LatencyProbe32.exe OutlookToTray.LatencyProbe\LatencyProbe.cpp
+)
+
 echo.
 echo Build successful!
 echo Output: %OUTDIR%\OutlookToTray.exe and %OUTDIR%\OutlookToTray.dll